@@ -0,0 +1,200 @@
+#include "stdafx.h"
+#include "AtomicDensities.h"
+
+#include "UnrestrictedHartreeFock.h"
+
+#include <fstream>
+
+
+namespace HartreeFock {
+
+	AtomicDensities::AtomicDensities()
+		: modified(false)
+	{
+	}
+
+
+	Eigen::MatrixXd AtomicDensities::GetDensity(const Systems::AtomWithShells& atom)
+	{
+		const Key key = GetKey(atom);
+
+		{
+			std::lock_guard<std::mutex> lock(densitiesMutex);
+
+			const auto it = densities.find(key);
+			if (it != densities.end()) return it->second;
+		}
+
+		// not computed while locked, it's an SCF computation and other threads might need other atoms meanwhile
+		// if two threads compute the same atom, the results are the same anyway
+		Eigen::MatrixXd density = Compute(atom);
+
+		std::lock_guard<std::mutex> lock(densitiesMutex);
+
+		densities[key] = density;
+		modified = true;
+
+		return density;
+	}
+
+
+	void AtomicDensities::GetGuess(const Systems::Molecule& molecule, Eigen::MatrixXd& density)
+	{
+		const Eigen::Index size = static_cast<Eigen::Index>(molecule.CountNumberOfContractedGaussians());
+		density.setZero(size, size);
+
+		// the basis functions are numbered atom by atom, see Molecule::SetIDs
+		Eigen::Index offset = 0;
+		unsigned int atomsElectrons = 0;
+
+		for (const auto& atom : molecule.atoms)
+		{
+			const Eigen::MatrixXd atomDensity = GetDensity(atom);
+			const Eigen::Index atomSize = atomDensity.rows();
+
+			density.block(offset, offset, atomSize, atomSize) = atomDensity;
+
+			offset += atomSize;
+			atomsElectrons += atom.Z;
+		}
+
+		const unsigned int nrElectrons = molecule.alphaElectrons + molecule.betaElectrons;
+		if (nrElectrons && atomsElectrons && nrElectrons != atomsElectrons)
+			density *= static_cast<double>(nrElectrons) / atomsElectrons;
+	}
+
+
+	bool AtomicDensities::Load(const std::string& fileName)
+	{
+		std::ifstream file(fileName);
+
+		if (!file) return false;
+
+		std::map<Key, Eigen::MatrixXd> loaded;
+
+		unsigned int Z;
+		size_t nrParams;
+		Eigen::Index size;
+
+		while (file >> Z >> nrParams >> size)
+		{
+			Key key;
+			key.first = Z;
+			key.second.resize(nrParams);
+
+			for (auto& param : key.second)
+				if (!(file >> param)) return false;
+
+			Eigen::MatrixXd density(size, size);
+			for (Eigen::Index i = 0; i < size; ++i)
+				for (Eigen::Index j = 0; j < size; ++j)
+					if (!(file >> density(i, j))) return false;
+
+			loaded[key] = density;
+		}
+
+		std::lock_guard<std::mutex> lock(densitiesMutex);
+
+		// the ones computed already are kept
+		for (auto& entry : loaded)
+			densities.insert(entry);
+
+		modified = false;
+
+		return true;
+	}
+
+
+	bool AtomicDensities::Save(const std::string& fileName)
+	{
+		std::ofstream file(fileName);
+
+		if (!file) return false;
+
+		file.precision(17);
+
+		std::lock_guard<std::mutex> lock(densitiesMutex);
+
+		for (const auto& entry : densities)
+		{
+			const Key& key = entry.first;
+			const Eigen::MatrixXd& density = entry.second;
+
+			file << key.first << " " << key.second.size() << " " << density.rows() << std::endl;
+
+			for (const double param : key.second)
+				file << param << " ";
+			file << std::endl;
+
+			for (Eigen::Index i = 0; i < density.rows(); ++i)
+			{
+				for (Eigen::Index j = 0; j < density.cols(); ++j)
+					file << density(i, j) << " ";
+				file << std::endl;
+			}
+		}
+
+		modified = false;
+
+		return static_cast<bool>(file);
+	}
+
+
+	bool AtomicDensities::IsModified()
+	{
+		std::lock_guard<std::mutex> lock(densitiesMutex);
+
+		return modified;
+	}
+
+
+	AtomicDensities::Key AtomicDensities::GetKey(const Systems::AtomWithShells& atom)
+	{
+		Key key;
+		key.first = atom.Z;
+
+		for (const auto& shell : atom.shells)
+			for (const auto& orbital : shell.basisFunctions)
+			{
+				key.second.push_back(orbital.angularMomentum.l);
+				key.second.push_back(orbital.angularMomentum.m);
+				key.second.push_back(orbital.angularMomentum.n);
+				key.second.push_back(static_cast<double>(orbital.gaussianOrbitals.size()));
+
+				for (const auto& gaussian : orbital.gaussianOrbitals)
+				{
+					key.second.push_back(gaussian.alpha);
+					key.second.push_back(gaussian.coefficient);
+				}
+			}
+
+		return key;
+	}
+
+
+	Eigen::MatrixXd AtomicDensities::Compute(const Systems::AtomWithShells& atom)
+	{
+		Systems::Molecule atomMolecule;
+		atomMolecule.atoms.push_back(atom);
+		atomMolecule.alphaElectrons = (atom.Z + 1) / 2;
+		atomMolecule.betaElectrons = atom.Z / 2;
+		atomMolecule.Init();
+
+		// the open shell atoms need the unrestricted method, the closed shell ones get the same result from it
+		UnrestrictedHartreeFock algorithm;
+
+		algorithm.alpha = 0.5;
+		algorithm.initGuess = 0;
+		algorithm.normalIterAfterDIIS = 0;
+		algorithm.diis.useEDIIS = true;
+		algorithm.secondOrderSCF = 2;
+
+		algorithm.Init(&atomMolecule);
+		algorithm.Calculate();
+
+		TRACE("Atomic density for Z = %d, energy: %f, iterations: %d\n", atom.Z, algorithm.GetTotalEnergy(), algorithm.nrIterations);
+
+		return algorithm.DensityMatrixPlus + algorithm.DensityMatrixMinus;
+	}
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Eigen\eigen>
+
+#include "Molecule.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace HartreeFock {
+
+	// the converged densities of the isolated atoms, for the superposition of atomic densities (SAD) initial guess
+	// the molecule density is started from the block diagonal matrix with the densities of its atoms, which is much closer to the solution than the core Hamiltonian guess
+	// each is computed once for an element in a basis, with the unrestricted method, then kept in memory and optionally saved in a file, too
+	// the basis is identified by the atom shells, so the same element in different bases gets different entries
+	// it can be used from several threads at once
+	class AtomicDensities
+	{
+	public:
+		AtomicDensities();
+
+		// the total density of the atom in its own basis, computed if it's not in the cache yet
+		Eigen::MatrixXd GetDensity(const Systems::AtomWithShells& atom);
+
+		// the block diagonal density for the molecule, in the order of its basis functions
+		// for an ion it's scaled to the number of electrons of the molecule
+		void GetGuess(const Systems::Molecule& molecule, Eigen::MatrixXd& density);
+
+		// the file has for each entry Z, the number of basis parameters and the number of basis functions on a line
+		// then the basis parameters on a line, then the density matrix, a line for each row
+		bool Load(const std::string& fileName);
+		bool Save(const std::string& fileName);
+
+		// true if there are densities computed since the last load or save
+		bool IsModified();
+
+	protected:
+		// Z and for each basis function its angular momentum and its gaussians exponents and coefficients
+		typedef std::pair<unsigned int, std::vector<double>> Key;
+
+		static Key GetKey(const Systems::AtomWithShells& atom);
+		static Eigen::MatrixXd Compute(const Systems::AtomWithShells& atom);
+
+		std::map<Key, Eigen::MatrixXd> densities;
+		std::mutex densitiesMutex;
+		bool modified;
+	};
+
+}
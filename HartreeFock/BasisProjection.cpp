@@ -0,0 +1,147 @@
+#include "stdafx.h"
+#include "BasisProjection.h"
+
+#include "RestrictedHartreeFock.h"
+#include "UnrestrictedHartreeFock.h"
+#include "AtomicDensities.h"
+#include "QuantumMatrix.h"
+
+#include <memory>
+
+
+namespace HartreeFock {
+
+	bool BasisProjection::ChangeBasis(const Systems::Molecule& molecule, const Chemistry::Basis& basis, Systems::Molecule& result)
+	{
+		result.atoms.clear();
+
+		for (const auto& atom : molecule.atoms)
+		{
+			const auto basisAtom = std::find_if(basis.atoms.begin(), basis.atoms.end(), [&atom](const Systems::AtomWithShells& a) { return a.Z == atom.Z; });
+			if (basisAtom == basis.atoms.end()) return false;
+
+			result.atoms.push_back(*basisAtom);
+			result.atoms.back().position = atom.position;
+		}
+
+		result.alphaElectrons = molecule.alphaElectrons;
+		result.betaElectrons = molecule.betaElectrons;
+		result.Init();
+
+		return true;
+	}
+
+
+	void BasisProjection::CalculateOverlaps(const Systems::Molecule& molecule, const Systems::Molecule& otherMolecule, Eigen::MatrixXd& overlap, Eigen::MatrixXd& mixedOverlap)
+	{
+		// the atoms of both in a single molecule, its overlap matrix has all the needed blocks
+		Systems::Molecule combined;
+		combined.atoms = molecule.atoms;
+		combined.atoms.insert(combined.atoms.end(), otherMolecule.atoms.begin(), otherMolecule.atoms.end());
+		combined.Init();
+
+		GaussianIntegrals::IntegralsRepository repository(&combined);
+		const Matrices::OverlapMatrix overlapMatrix(&repository);
+
+		const Eigen::Index size = molecule.CountNumberOfContractedGaussians();
+		const Eigen::Index otherSize = otherMolecule.CountNumberOfContractedGaussians();
+
+		overlap = overlapMatrix.matrix.topLeftCorner(size, size);
+		mixedOverlap = overlapMatrix.matrix.topRightCorner(size, otherSize);
+	}
+
+
+	Eigen::MatrixXd BasisProjection::ProjectDensity(const Eigen::MatrixXd& overlap, const Eigen::MatrixXd& mixedOverlap, const Eigen::MatrixXd& C, const std::vector<bool>& occupied, double occupation)
+	{
+		Eigen::Index nrOccupied = 0;
+		for (Eigen::Index level = 0; level < static_cast<Eigen::Index>(occupied.size()) && level < C.cols(); ++level)
+			if (occupied[level]) ++nrOccupied;
+
+		Eigen::MatrixXd occupiedC(C.rows(), nrOccupied);
+		for (Eigen::Index level = 0, col = 0; col < nrOccupied; ++level)
+			if (occupied[level]) occupiedC.col(col++) = C.col(level);
+
+		// the least squares fit of the small basis orbitals in the target basis
+		Eigen::MatrixXd projected = overlap.ldlt().solve(mixedOverlap * occupiedC);
+
+		// they are not orthonormal anymore, Lowdin orthonormalization keeps them as close as possible to the projected ones
+		const Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(projected.transpose() * overlap * projected);
+		projected = projected * solver.operatorInverseSqrt();
+
+		return occupation * projected * projected.transpose();
+	}
+
+
+	int BasisProjection::SetGuess(HartreeFockAlgorithm& algorithm, const Systems::Molecule& molecule, const Chemistry::Basis& smallBasis, AtomicDensities* atomicDensities)
+	{
+		Systems::Molecule smallMolecule;
+		if (!ChangeBasis(molecule, smallBasis, smallMolecule)) return -1;
+
+		RestrictedHartreeFock* restricted = dynamic_cast<RestrictedHartreeFock*>(&algorithm);
+		UnrestrictedHartreeFock* unrestricted = dynamic_cast<UnrestrictedHartreeFock*>(&algorithm);
+
+		std::unique_ptr<HartreeFockAlgorithm> smallAlgorithm;
+		if (restricted) smallAlgorithm = std::make_unique<RestrictedHartreeFock>();
+		else if (unrestricted)
+		{
+			std::unique_ptr<UnrestrictedHartreeFock> alg = std::make_unique<UnrestrictedHartreeFock>();
+			alg->addAsymmetry = unrestricted->addAsymmetry;
+			alg->asymmetry = unrestricted->asymmetry;
+			alg->jointDIIS = unrestricted->jointDIIS;
+			smallAlgorithm = std::move(alg);
+		}
+		else return -1;
+
+		smallAlgorithm->alpha = algorithm.alpha;
+		smallAlgorithm->initGuess = algorithm.initGuess;
+		smallAlgorithm->UseDIIS = algorithm.UseDIIS;
+		smallAlgorithm->maxDIISiterations = algorithm.maxDIISiterations;
+		smallAlgorithm->diisStagnationIterations = algorithm.diisStagnationIterations;
+		smallAlgorithm->secondOrderSCF = algorithm.secondOrderSCF;
+		smallAlgorithm->stabilityCheck = algorithm.stabilityCheck;
+		smallAlgorithm->diis.maxSize = algorithm.diis.maxSize;
+		smallAlgorithm->diis.useEDIIS = algorithm.diis.useEDIIS;
+		smallAlgorithm->fullFockBuildInterval = algorithm.fullFockBuildInterval;
+		smallAlgorithm->integralsRepository.schwarzThreshold = algorithm.integralsRepository.schwarzThreshold;
+		smallAlgorithm->integralsRepository.primitivePairThreshold = algorithm.integralsRepository.primitivePairThreshold;
+		smallAlgorithm->integralsRepository.integralDirect = algorithm.integralsRepository.integralDirect;
+		smallAlgorithm->integralsRepository.nrThreads = algorithm.integralsRepository.nrThreads;
+		smallAlgorithm->integralsRepository.useLotsOfMemory = algorithm.integralsRepository.useLotsOfMemory;
+		smallAlgorithm->integralsRepository.supermatrixMemoryLimit = algorithm.integralsRepository.supermatrixMemoryLimit;
+
+		// it's only a guess, the DIIS result is good enough
+		smallAlgorithm->normalIterAfterDIIS = 0;
+
+		if (atomicDensities)
+		{
+			smallAlgorithm->initialDensities.resize(1);
+			atomicDensities->GetGuess(smallMolecule, smallAlgorithm->initialDensities[0]);
+		}
+
+		smallAlgorithm->Init(&smallMolecule);
+		smallAlgorithm->Calculate();
+
+		Eigen::MatrixXd overlap;
+		Eigen::MatrixXd mixedOverlap;
+		CalculateOverlaps(molecule, smallMolecule, overlap, mixedOverlap);
+
+		algorithm.initialDensities.clear();
+
+		if (restricted)
+		{
+			const RestrictedHartreeFock* smallRestricted = static_cast<const RestrictedHartreeFock*>(smallAlgorithm.get());
+			algorithm.initialDensities.emplace_back(ProjectDensity(overlap, mixedOverlap, smallRestricted->C, smallRestricted->occupied, 2.));
+		}
+		else
+		{
+			const UnrestrictedHartreeFock* smallUnrestricted = static_cast<const UnrestrictedHartreeFock*>(smallAlgorithm.get());
+			algorithm.initialDensities.emplace_back(ProjectDensity(overlap, mixedOverlap, smallUnrestricted->Cplus, smallUnrestricted->occupiedPlus, 1.));
+			algorithm.initialDensities.emplace_back(ProjectDensity(overlap, mixedOverlap, smallUnrestricted->Cminus, smallUnrestricted->occupiedMinus, 1.));
+		}
+
+		TRACE("Small basis guess energy: %f, Fock matrix builds: %d\n", smallAlgorithm->GetTotalEnergy(), smallAlgorithm->nrFockBuilds);
+
+		return smallAlgorithm->nrFockBuilds;
+	}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <Eigen\eigen>
+
+#include "Molecule.h"
+#include "Basis.h"
+
+#include <vector>
+
+namespace HartreeFock {
+
+	class HartreeFockAlgorithm;
+	class AtomicDensities;
+
+	// the initial guess from a calculation in a smaller basis: the molecule is converged there first, where the Fock matrix builds are cheap
+	// then the occupied orbitals are projected into the target basis with the mixed basis overlap, C = S^-1 * Sts * Csmall
+	// and orthonormalized with the target basis overlap, the initial densities are computed from them
+	class BasisProjection
+	{
+	public:
+		// the molecule with the same atoms and electrons, but with the shells from the basis, returns false if the basis does not have all the elements
+		static bool ChangeBasis(const Systems::Molecule& molecule, const Chemistry::Basis& basis, Systems::Molecule& result);
+
+		// for two molecules with the same atoms in different bases, the overlap matrix of the first one and the overlap between the two bases, the rows for the first one
+		static void CalculateOverlaps(const Systems::Molecule& molecule, const Systems::Molecule& otherMolecule, Eigen::MatrixXd& overlap, Eigen::MatrixXd& mixedOverlap);
+
+		// the density from the occupied orbitals of C, projected and orthonormalized
+		static Eigen::MatrixXd ProjectDensity(const Eigen::MatrixXd& overlap, const Eigen::MatrixXd& mixedOverlap, const Eigen::MatrixXd& C, const std::vector<bool>& occupied, double occupation);
+
+		// converges the molecule in the small basis with an algorithm of the same kind and with the same settings
+		// then sets the projected densities as the initial ones of the algorithm, before its Init
+		// the small basis calculation starts from the superposition of atomic densities, if they are passed
+		// returns the number of Fock matrix builds done in the small basis, -1 if the guess could not be made
+		static int SetGuess(HartreeFockAlgorithm& algorithm, const Systems::Molecule& molecule, const Chemistry::Basis& smallBasis, AtomicDensities* atomicDensities = nullptr);
+	};
+
+}
@@ -4,10 +4,103 @@
 #include "MathUtils.h"
 #include "BoysFunction.h"
 
+#include <limits>
+
 namespace GaussianIntegrals {
 
 
+	BoysFunctions::Table::Table()
+	{
+		const int rowSize = maxTableOrder + taylorTerms;
+		const int nrPoints = asymptoticLimit * gridPointsPerUnit + 2;
+
+		values.resize(static_cast<size_t>(rowSize) * nrPoints);
+
+		for (int point = 0; point < nrPoints; ++point)
+		{
+			const double T = static_cast<double>(point) / gridPointsPerUnit;
+			double* row = values.data() + static_cast<size_t>(point) * rowSize;
+
+			// the reference cannot be used here, for high orders and small T it divides by an underflowed power of T
+			// so the highest order is computed with the series F_m(T) = exp(-T) * sum_k (2T)^k / ((2m+1)(2m+3)...(2m+2k+1))
+			// which converges for any T, it just needs more terms for bigger T, but it's done only once
+			const int m = rowSize - 1;
+
+			double term = 1. / (2. * m + 1.);
+			double sum = term;
+			for (int k = 1; term > std::numeric_limits<double>::epsilon() * sum; ++k)
+			{
+				term *= 2. * T / (2. * m + 2. * k + 1.);
+				sum += term;
+			}
+
+			const double expT = exp(-T);
+			row[m] = expT * sum;
+
+			for (int i = m - 1; i >= 0; --i)
+				row[i] = (2. * T * row[i + 1ULL] + expT) / (2. * i + 1.);
+		}
+	}
+
+
+	const BoysFunctions::Table& BoysFunctions::GetTable()
+	{
+		// generated once, on first use, the initialization is thread safe
+		static const Table table;
+
+		return table;
+	}
+
+
 	void BoysFunctions::GenerateBoysFunctions(int maxM, double T)
+	{
+		if (maxM > maxTableOrder)
+		{
+			GenerateBoysFunctionsReference(maxM, T);
+			return;
+		}
+
+		functions.resize(maxM + 1ULL);
+
+		if (T >= asymptoticLimit)
+		{
+			// F0 = sqrt(pi / T) / 2 * erf(sqrt(T)), but the erf is 1 to double precision here
+			// the upward recursion is stable for T this big
+			const double expT = exp(-T);
+			const double twoT = 2. * T;
+
+			functions[0] = 0.5 * sqrt(M_PI / T);
+
+			for (int m = 0; m < maxM; ++m)
+				functions[m + 1ULL] = ((2. * m + 1.) * functions[m] - expT) / twoT;
+
+			return;
+		}
+
+		// Taylor expansion for the highest order around the closest grid point, dF_m/dT = -F_m+1
+		const int point = static_cast<int>(T * gridPointsPerUnit + 0.5);
+		const double delta = static_cast<double>(point) / gridPointsPerUnit - T;
+
+		const double* values = GetTable().values.data() + static_cast<size_t>(point) * (maxTableOrder + taylorTerms) + maxM;
+
+		double term = 1;
+		double result = values[0];
+		for (int k = 1; k < taylorTerms; ++k)
+		{
+			term *= delta / k;
+			result += term * values[k];
+		}
+
+		functions[maxM] = result;
+
+		// the rest with the downward recursion
+		const double expT = exp(-T);
+		for (int m = maxM - 1; m >= 0; --m)
+			functions[m] = (2. * T * functions[m + 1ULL] + expT) / (2. * m + 1.);
+	}
+
+
+	void BoysFunctions::GenerateBoysFunctionsReference(int maxM, double T)
 	{
 		functions.resize(maxM + 1ULL);
 
@@ -25,4 +118,4 @@ namespace GaussianIntegrals {
 	}
 
 
-}
\ No newline at end of file
+}
@@ -9,7 +9,36 @@ namespace GaussianIntegrals {
 	public:
 		std::vector<double> functions;
 
+		// computes the functions for all orders from 0 to maxM
+		// uses the tabulated values with a Taylor expansion around the closest grid point, and the asymptotic formula for big T
 		void GenerateBoysFunctions(int maxM, double T);
+
+		// the slow way: the highest order with the incomplete gamma function, then the downward recursion
+		// it's used to check the table
+		void GenerateBoysFunctionsReference(int maxM, double T);
+
+		// the highest order that can be obtained from the table, above it the reference is used
+		static const int maxTableOrder = 32;
+
+	protected:
+		static const int taylorTerms = 7;
+
+		// the grid step is chosen small enough for the Taylor expansion with the above number of terms to be exact to double precision
+		static const int gridPointsPerUnit = 20;
+
+		// above this the asymptotic formula with upward recursion is used
+		static const int asymptoticLimit = 36;
+
+		class Table
+		{
+		public:
+			Table();
+
+			// values for orders 0 to maxTableOrder + taylorTerms - 1, for each grid point
+			std::vector<double> values;
+		};
+
+		static const Table& GetTable();
 	};
 
 }
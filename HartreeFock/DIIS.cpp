@@ -0,0 +1,264 @@
+#include "stdafx.h"
+#include "DIIS.h"
+
+
+namespace HartreeFock {
+
+	DIIS::DIIS(unsigned int maxSize, unsigned int minSize, double maxConditionNumber)
+		: maxSize(maxSize ? maxSize : 1), minSize(minSize), maxConditionNumber(maxConditionNumber), useEDIIS(false), ediisErrorThreshold(1E-1), diisErrorThreshold(1E-4),
+		nrChannels(1), size(0), next(0), errorEstimate(0)
+	{
+		Clear();
+	}
+
+
+	void DIIS::Clear(unsigned int channels)
+	{
+		if (!maxSize) maxSize = 1;
+
+		nrChannels = channels ? channels : 1;
+		size = 0;
+		next = 0;
+		errorEstimate = 0;
+
+		// the matrices already allocated are kept, they are overwritten by the new entries
+		fockMatrices.resize(static_cast<size_t>(maxSize) * nrChannels);
+		errorMatrices.resize(static_cast<size_t>(maxSize) * nrChannels);
+		densityMatrices.resize(useEDIIS ? static_cast<size_t>(maxSize) * nrChannels : 0);
+
+		B.setZero(maxSize, maxSize);
+		densityFockProducts.setZero(maxSize, maxSize);
+		energies.setZero(maxSize);
+	}
+
+
+	bool DIIS::Step(Eigen::MatrixXd* const fock[], const Eigen::MatrixXd* const error[], const Eigen::MatrixXd* const density[], double energy)
+	{
+		const bool energyBased = useEDIIS && density;
+
+		// the size was changed since the last call
+		if (fockMatrices.size() != static_cast<size_t>(maxSize) * nrChannels || (energyBased && densityMatrices.size() != fockMatrices.size()))
+			Clear(nrChannels);
+
+		// if the buffer is full the new entry replaces the oldest one
+		const unsigned int slot = next;
+		for (unsigned int channel = 0; channel < nrChannels; ++channel)
+		{
+			fockMatrices[slot * nrChannels + channel] = *fock[channel];
+			errorMatrices[slot * nrChannels + channel] = *error[channel];
+			if (energyBased) densityMatrices[slot * nrChannels + channel] = *density[channel];
+		}
+		energies(slot) = energy;
+
+		next = (next + 1) % maxSize;
+		if (size < maxSize) ++size;
+
+		// only the row of the new entry changes, for EDIIS the column, too
+		for (unsigned int entry = 0; entry < size; ++entry)
+		{
+			const unsigned int otherSlot = GetSlot(entry);
+
+			double product = 0;
+			for (unsigned int channel = 0; channel < nrChannels; ++channel)
+				product += errorMatrices[slot * nrChannels + channel].cwiseProduct(errorMatrices[otherSlot * nrChannels + channel]).sum();
+
+			B(slot, otherSlot) = B(otherSlot, slot) = product;
+
+			if (energyBased)
+			{
+				double densityFock = 0;
+				double fockDensity = 0;
+				for (unsigned int channel = 0; channel < nrChannels; ++channel)
+				{
+					densityFock += densityMatrices[slot * nrChannels + channel].cwiseProduct(fockMatrices[otherSlot * nrChannels + channel]).sum();
+					fockDensity += densityMatrices[otherSlot * nrChannels + channel].cwiseProduct(fockMatrices[slot * nrChannels + channel]).sum();
+				}
+
+				densityFockProducts(slot, otherSlot) = densityFock;
+				densityFockProducts(otherSlot, slot) = fockDensity;
+			}
+		}
+
+		const double newError = sqrt(B(slot, slot));
+
+		errorEstimate = B(slot, slot);
+		if (size > 1)
+		{
+			const unsigned int previousSlot = GetSlot(size - 2);
+			errorEstimate += B(previousSlot, previousSlot);
+		}
+		errorEstimate = sqrt(errorEstimate);
+
+		// a subspace set smaller than the minimum is still used, when full
+		const bool enoughForDIIS = size >= min(minSize, maxSize);
+
+		if (energyBased && newError > diisErrorThreshold && size > 1)
+		{
+			SolveEDIIS();
+
+			// blended with the DIIS coefficients as the error gets smaller, if there are enough entries for DIIS
+			if (newError < ediisErrorThreshold && enoughForDIIS && Solve())
+			{
+				const double ediisWeight = newError / ediisErrorThreshold;
+				weights = ediisWeight * ediisWeights + (1. - ediisWeight) * weights;
+			}
+			else weights = ediisWeights;
+		}
+		else if (!enoughForDIIS || !Solve()) return false;
+
+		for (unsigned int channel = 0; channel < nrChannels; ++channel)
+		{
+			Eigen::MatrixXd& F = *fock[channel];
+
+			F.setZero();
+			for (unsigned int entry = 0; entry < size; ++entry)
+				if (weights(entry)) F += weights(entry) * fockMatrices[GetSlot(entry) * nrChannels + channel];
+		}
+
+		return true;
+	}
+
+
+	bool DIIS::Solve()
+	{
+		for (unsigned int nrEntries = size; nrEntries >= max(min(minSize, maxSize), 1U); --nrEntries)
+		{
+			const unsigned int first = size - nrEntries;
+
+			// scaled with the biggest error, close to convergence they get very small and the bordering would dominate the system
+			double scale = 0;
+			for (unsigned int i = 0; i < nrEntries; ++i)
+			{
+				const unsigned int slot = GetSlot(first + i);
+				scale = max(scale, B(slot, slot));
+			}
+
+			// no error at all, nothing to improve
+			if (scale <= 0) return false;
+
+			A.resize(nrEntries + 1, nrEntries + 1);
+			for (unsigned int i = 0; i < nrEntries; ++i)
+			{
+				const unsigned int slot1 = GetSlot(first + i);
+
+				for (unsigned int j = 0; j < nrEntries; ++j)
+					A(i, j) = B(slot1, GetSlot(first + j)) / scale;
+
+				A(nrEntries, i) = A(i, nrEntries) = 1;
+			}
+			A(nrEntries, nrEntries) = 0;
+
+			rhs.setZero(nrEntries + 1);
+			rhs(nrEntries) = 1;
+
+			qr.compute(A);
+
+			// the ratio of the pivots estimates the condition number
+			const double maxPivot = abs(qr.matrixQR()(0, 0));
+			const double minPivot = abs(qr.matrixQR()(nrEntries, nrEntries));
+
+			if (minPivot * maxConditionNumber > maxPivot)
+			{
+				coefficients = qr.solve(rhs);
+
+				// the dropped entries get 0
+				weights.setZero(size);
+				weights.tail(nrEntries) = coefficients.head(nrEntries);
+
+				return true;
+			}
+
+			if (nrEntries == 1) break;
+		}
+
+		return false;
+	}
+
+
+	void DIIS::SolveEDIIS()
+	{
+		// the energy of the combined density is sum c(i) * E(i) - 1/4 * sum c(i) * c(j) * Tr((D(i) - D(j)) * (F(i) - F(j)))
+		// it is minimized over the simplex c(i) >= 0, sum c(i) = 1, by checking the stationary points on all its faces
+		// it's a quadratic form but not necessarily convex, so the minimum can be on any face
+		// the number of faces grows exponentially, so only the newest entries are used
+		const unsigned int nrEntries = min(size, 10U);
+		const unsigned int first = size - nrEntries;
+
+		// the energies are shifted by the lowest one, the constant does not change the solution since the coefficients sum up to 1
+		double minEnergy = energies(GetSlot(first));
+		for (unsigned int i = 1; i < nrEntries; ++i)
+			minEnergy = min(minEnergy, energies(GetSlot(first + i)));
+
+		// the energy is e * c - 1/2 * c * Q * c
+		Eigen::VectorXd e(nrEntries);
+		Eigen::MatrixXd Q(nrEntries, nrEntries);
+		for (unsigned int i = 0; i < nrEntries; ++i)
+		{
+			const unsigned int slot1 = GetSlot(first + i);
+			e(i) = energies(slot1) - minEnergy;
+
+			for (unsigned int j = 0; j < nrEntries; ++j)
+			{
+				const unsigned int slot2 = GetSlot(first + j);
+				Q(i, j) = 0.5 * (densityFockProducts(slot1, slot1) + densityFockProducts(slot2, slot2) - densityFockProducts(slot1, slot2) - densityFockProducts(slot2, slot1));
+			}
+		}
+
+		// the vertices first, the lowest energy entry alone
+		Eigen::VectorXd best = Eigen::VectorXd::Zero(nrEntries);
+		Eigen::Index bestEntry;
+		double bestEnergy = e.minCoeff(&bestEntry);
+		best(bestEntry) = 1;
+
+		Eigen::VectorXd c(nrEntries);
+		std::vector<unsigned int> face;
+		face.reserve(nrEntries);
+
+		for (unsigned int mask = 1; mask < (1U << nrEntries); ++mask)
+		{
+			face.clear();
+			for (unsigned int i = 0; i < nrEntries; ++i)
+				if (mask & (1U << i)) face.push_back(i);
+
+			const unsigned int faceSize = static_cast<unsigned int>(face.size());
+			if (faceSize < 2) continue;
+
+			// Q * c + lambda = e, with sum of c = 1
+			Eigen::MatrixXd M(faceSize + 1, faceSize + 1);
+			Eigen::VectorXd faceRhs(faceSize + 1);
+			for (unsigned int i = 0; i < faceSize; ++i)
+			{
+				for (unsigned int j = 0; j < faceSize; ++j)
+					M(i, j) = Q(face[i], face[j]);
+
+				M(i, faceSize) = M(faceSize, i) = 1;
+				faceRhs(i) = e(face[i]);
+			}
+			M(faceSize, faceSize) = 0;
+			faceRhs(faceSize) = 1;
+
+			const Eigen::FullPivLU<Eigen::MatrixXd> lu(M);
+			if (!lu.isInvertible()) continue;
+
+			const Eigen::VectorXd solution = lu.solve(faceRhs);
+
+			// must be inside the face
+			if (solution.head(faceSize).minCoeff() <= 0) continue;
+
+			c.setZero();
+			for (unsigned int i = 0; i < faceSize; ++i)
+				c(face[i]) = solution(i);
+
+			const double faceEnergy = e.dot(c) - 0.5 * c.dot(Q * c);
+			if (faceEnergy < bestEnergy)
+			{
+				bestEnergy = faceEnergy;
+				best = c;
+			}
+		}
+
+		ediisWeights.setZero(size);
+		ediisWeights.tail(nrEntries) = best;
+	}
+
+}
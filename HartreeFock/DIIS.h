@@ -0,0 +1,94 @@
+#pragma once
+
+#include <Eigen\eigen>
+
+#include <vector>
+
+namespace HartreeFock {
+
+	// Pulay's direct inversion in the iterative subspace
+	// the new Fock matrix is the linear combination of the previous ones that minimizes the norm of the combined errors, with the coefficients summing up to 1
+	// the history is a ring buffer, adding an entry computes only its row of the errors inner products matrix
+	// the Fock matrices of several channels (alpha and beta for the unrestricted method) can be extrapolated together, with the same coefficients
+	// in that case the errors inner products of the channels are added together
+	//
+	// far from convergence the commutator errors say little about where the minimum is and DIIS can wander off or oscillate
+	// optionally the energy based EDIIS (Kudin, Scuseria, Cances) is used there instead: the Hartree-Fock energy of the combined density
+	// is exactly quadratic in the coefficients, it's minimized with the coefficients constrained to be positive, so it's an interpolation
+	// as the error gets smaller the coefficients are blended from the EDIIS ones towards the DIIS ones (Garza, Scuseria)
+	class DIIS
+	{
+	public:
+		DIIS(unsigned int maxSize = 6, unsigned int minSize = 5, double maxConditionNumber = 1E14);
+
+		// clears the history, the number of channels can be changed only along with it
+		void Clear(unsigned int channels = 1);
+
+		// adds the Fock matrices and their errors to the history, one of each for every channel
+		// if there are enough entries, replaces the Fock matrices with the extrapolated ones and returns true
+		// for EDIIS the densities the Fock matrices were built from and the electronic energy for them are needed, too
+		// the channels densities and Fock matrices must be such that the energy is 1/2 * sum over channels of Tr(D * (h + F))
+		bool Step(Eigen::MatrixXd* const fock[], const Eigen::MatrixXd* const error[], const Eigen::MatrixXd* const density[] = nullptr, double energy = 0);
+
+		// the norm of the errors of the last two entries
+		double GetErrorEstimate() const { return errorEstimate; }
+
+		unsigned int GetSize() const { return size; }
+
+		// the number of entries kept
+		unsigned int maxSize;
+
+		// the extrapolation is done only if there are at least that many entries
+		unsigned int minSize;
+
+		// if the linear system is conditioned worse than this, the oldest entries are dropped until it gets better or there are not enough of them left
+		double maxConditionNumber;
+
+		// use EDIIS while the norm of the newest error is above diisErrorThreshold, only EDIIS above ediisErrorThreshold, blended in between
+		bool useEDIIS;
+		double ediisErrorThreshold;
+		double diisErrorThreshold;
+
+	protected:
+		// the slot in the ring buffer of an entry, 0 is the oldest one
+		unsigned int GetSlot(unsigned int entry) const
+		{
+			return (next + maxSize - size + entry) % maxSize;
+		}
+
+		// the DIIS coefficients into weights, for all the entries
+		bool Solve();
+
+		// the EDIIS coefficients into ediisWeights, for all the entries
+		void SolveEDIIS();
+
+		unsigned int nrChannels;
+		unsigned int size;
+		unsigned int next;
+
+		// the matrices for the slot s and channel c are at s * nrChannels + c
+		std::vector<Eigen::MatrixXd> fockMatrices;
+		std::vector<Eigen::MatrixXd> errorMatrices;
+
+		// the errors inner products, indexed by slots
+		Eigen::MatrixXd B;
+
+		// for EDIIS, the densities, Tr(D * F) for all the pairs of entries (not symmetric) and the energies, indexed by slots
+		std::vector<Eigen::MatrixXd> densityMatrices;
+		Eigen::MatrixXd densityFockProducts;
+		Eigen::VectorXd energies;
+
+		// the linear system in the chronological order, bordered for the constraint on the coefficients sum
+		Eigen::MatrixXd A;
+		Eigen::VectorXd rhs;
+		Eigen::VectorXd coefficients;
+		Eigen::ColPivHouseholderQR<Eigen::MatrixXd> qr;
+
+		// the coefficients of all the entries in the chronological order, zero for the ones not used
+		Eigen::VectorXd weights;
+		Eigen::VectorXd ediisWeights;
+
+		double errorEstimate;
+	};
+
+}
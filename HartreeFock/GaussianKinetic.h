@@ -36,6 +36,10 @@ namespace GaussianIntegrals {
 		~GaussianKinetic();
 
 		void Reset(double alpha1, double alpha2, const Orbitals::QuantumNumbers::QuantumNumbers& maxQN1, const Orbitals::QuantumNumbers::QuantumNumbers& maxQN2);
+		void Reset(const PrimitivePair& primitivePair, const Orbitals::QuantumNumbers::QuantumNumbers& maxQN1, const Orbitals::QuantumNumbers::QuantumNumbers& maxQN2)
+		{
+			Reset(primitivePair.alpha1, primitivePair.alpha2, maxQN1, maxQN2);
+		}
 
 		double operator()(const Orbitals::QuantumNumbers::QuantumNumbers& QN1, const Orbitals::QuantumNumbers::QuantumNumbers& QN2) const { return getKinetic(QN1, QN2); }
 		double getKinetic(const Orbitals::QuantumNumbers::QuantumNumbers& QN1, const Orbitals::QuantumNumbers::QuantumNumbers& QN2) const;
@@ -19,7 +19,7 @@ namespace GaussianIntegrals {
 	}
 
 
-	void GaussianMoment::Reset(double alpha1, double alpha2, const Vector3D<double>& center1, const Vector3D<double>& center2, const Vector3D<double>& center3, const Orbitals::QuantumNumbers::QuantumNumbers& maxQN1, const Orbitals::QuantumNumbers::QuantumNumbers& maxQN2)
+	void GaussianMoment::AllocateMatrices(const Orbitals::QuantumNumbers::QuantumNumbers& maxQN1, const Orbitals::QuantumNumbers::QuantumNumbers& maxQN2)
 	{
 		matrixX = Eigen::MatrixXd::Zero(3ULL + maxQN1.l + maxQN2.l, maxQN2.l + 2ULL);
 		matrixY = Eigen::MatrixXd::Zero(3ULL + maxQN1.m + maxQN2.m, maxQN2.m + 2ULL);
@@ -28,13 +28,32 @@ namespace GaussianIntegrals {
 		matrixX1 = Eigen::MatrixXd::Zero(2ULL + maxQN1.l + maxQN2.l, maxQN2.l + 2ULL);
 		matrixY1 = Eigen::MatrixXd::Zero(2ULL + maxQN1.m + maxQN2.m, maxQN2.m + 2ULL);
 		matrixZ1 = Eigen::MatrixXd::Zero(2ULL + maxQN1.n + maxQN2.n, maxQN2.n + 2ULL);
+	}
+
+	void GaussianMoment::Reset(double alpha1, double alpha2, const Vector3D<double>& center1, const Vector3D<double>& center2, const Vector3D<double>& center3, const Orbitals::QuantumNumbers::QuantumNumbers& maxQN1, const Orbitals::QuantumNumbers::QuantumNumbers& maxQN2)
+	{
+		AllocateMatrices(maxQN1, maxQN2);
+
+		const double alpha = alpha1 + alpha2;
+		const Vector3D<double> productCenter = (alpha1 * center1 + alpha2 * center2) / alpha;
 
-		CalculateMoment(matrixX, matrixX1, alpha1, alpha2, center1.X, center2.X, center3.X, maxQN1.l, maxQN2.l);
-		CalculateMoment(matrixY, matrixY1, alpha1, alpha2, center1.Y, center2.Y, center3.Y, maxQN1.m, maxQN2.m);
-		CalculateMoment(matrixZ, matrixZ1, alpha1, alpha2, center1.Z, center2.Z, center3.Z, maxQN1.n, maxQN2.n);
+		CalculateMoment(matrixX, matrixX1, alpha, productCenter.X, center1.X, center2.X, center3.X, maxQN1.l, maxQN2.l);
+		CalculateMoment(matrixY, matrixY1, alpha, productCenter.Y, center1.Y, center2.Y, center3.Y, maxQN1.m, maxQN2.m);
+		CalculateMoment(matrixZ, matrixZ1, alpha, productCenter.Z, center1.Z, center2.Z, center3.Z, maxQN1.n, maxQN2.n);
 
 		const Vector3D<double> dif = center1 - center2;
-		factor = exp(-alpha1 * alpha2 / (alpha1 + alpha2) * dif * dif) * pow(M_PI / (alpha1 + alpha2), 3. / 2.);
+		factor = exp(-alpha1 * alpha2 / alpha * dif * dif) * pow(M_PI / alpha, 3. / 2.);
+	}
+
+	void GaussianMoment::Reset(const ShellPair& shellPair, const PrimitivePair& primitivePair, const Orbitals::QuantumNumbers::QuantumNumbers& maxQN1, const Orbitals::QuantumNumbers::QuantumNumbers& maxQN2)
+	{
+		AllocateMatrices(maxQN1, maxQN2);
+
+		CalculateMoment(matrixX, matrixX1, primitivePair.alpha, primitivePair.P.X, shellPair.center1.X, shellPair.center2.X, 0, maxQN1.l, maxQN2.l);
+		CalculateMoment(matrixY, matrixY1, primitivePair.alpha, primitivePair.P.Y, shellPair.center1.Y, shellPair.center2.Y, 0, maxQN1.m, maxQN2.m);
+		CalculateMoment(matrixZ, matrixZ1, primitivePair.alpha, primitivePair.P.Z, shellPair.center1.Z, shellPair.center2.Z, 0, maxQN1.n, maxQN2.n);
+
+		factor = primitivePair.overlapFactor;
 	}
 
 	double GaussianMoment::getMoment(const Orbitals::QuantumNumbers::QuantumNumbers& QN1, const Orbitals::QuantumNumbers::QuantumNumbers& QN2, bool momentX, bool momentY, bool momentZ) const
@@ -47,10 +66,8 @@ namespace GaussianIntegrals {
 		return factor * matrixX(QN1.l, QN2.l) * matrixY(QN1.m, QN2.m) * matrixZ(QN1.n, QN2.n); // or getMoment(QN1, QN2, false, false, false) but this is slightly faster
 	}
 
-	void GaussianMoment::CalculateMoment(Eigen::MatrixXd& matrix, Eigen::MatrixXd& matrix1, double alpha1, double alpha2, double center1, double center2, double center3, unsigned int maxQN1, unsigned int maxQN2)
+	void GaussianMoment::CalculateMoment(Eigen::MatrixXd& matrix, Eigen::MatrixXd& matrix1, double alpha, double productCenter, double center1, double center2, double center3, unsigned int maxQN1, unsigned int maxQN2)
 	{
-		const double alpha = alpha1 + alpha2;
-		const double productCenter = (alpha1 * center1 + alpha2 * center2) / alpha;
 		const double dif = center1 - center2;
 		const double dif1 = center1 - center3;
 		const double difCenter = productCenter - center1;
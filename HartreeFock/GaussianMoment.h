@@ -4,6 +4,7 @@
 
 #include "QuantumNumbers.h"
 #include "GaussianIntegral.h"
+#include "ShellPairs.h"
 
 namespace GaussianIntegrals {
 
@@ -49,6 +50,9 @@ namespace GaussianIntegrals {
 
         void Reset(double alpha1, double alpha2, const Vector3D<double>& center1, const Vector3D<double>& center2, const Vector3D<double>& center3, const Orbitals::QuantumNumbers::QuantumNumbers& maxQN1, const Orbitals::QuantumNumbers::QuantumNumbers& maxQN2);
 
+        // the same as above but with the primitive pair quantities already computed, the moment is relative to the origin
+        void Reset(const ShellPair& shellPair, const PrimitivePair& primitivePair, const Orbitals::QuantumNumbers::QuantumNumbers& maxQN1, const Orbitals::QuantumNumbers::QuantumNumbers& maxQN2);
+
         double getMomentX(const Orbitals::QuantumNumbers::QuantumNumbers& QN1, const Orbitals::QuantumNumbers::QuantumNumbers& QN2) const
         {
             return getMoment(QN1, QN2, true, false, false);
@@ -69,7 +73,8 @@ namespace GaussianIntegrals {
         double getOverlap(const Orbitals::QuantumNumbers::QuantumNumbers& QN1, const Orbitals::QuantumNumbers::QuantumNumbers& QN2) const;
 
     protected:
-        void CalculateMoment(Eigen::MatrixXd& matrix, Eigen::MatrixXd& matrix1, double alpha1, double alpha2, double center1, double center2, double center3, unsigned int maxQN1, unsigned int maxQN2);
+        void AllocateMatrices(const Orbitals::QuantumNumbers::QuantumNumbers& maxQN1, const Orbitals::QuantumNumbers::QuantumNumbers& maxQN2);
+        void CalculateMoment(Eigen::MatrixXd& matrix, Eigen::MatrixXd& matrix1, double alpha, double productCenter, double center1, double center2, double center3, unsigned int maxQN1, unsigned int maxQN2);
 
     };
 
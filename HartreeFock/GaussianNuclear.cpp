@@ -17,13 +17,14 @@ namespace GaussianIntegrals {
 	{
 	}
 
-	void GaussianNuclear::Reset(IntegralsRepository* repository, double alpha1, double alpha2, const Vector3D<double>& nucleus, const Vector3D<double>& center1, const Vector3D<double>& center2, unsigned int maxL1, unsigned int maxL2, bool calculateHorizontal)
+	void GaussianNuclear::Reset(IntegralsRepository* repository, const ShellPair& shellPair, const PrimitivePair& primitivePair, const Vector3D<double>& nucleus, bool calculateHorizontal)
 	{
-		const double alpha = alpha1 + alpha2;
-		const Vector3D<double> Rp = (alpha1 * center1 + alpha2 * center2) / alpha;
+		const double alpha = primitivePair.alpha;
+		const Vector3D<double>& Rp = primitivePair.P;
 		const Vector3D<double> difN = nucleus - Rp;		
-		const Vector3D<double> dif = center1 - center2; 
 
+		const unsigned int maxL1 = shellPair.maxL1;
+		const unsigned int maxL2 = shellPair.maxL2;
 		const unsigned int maxL = maxL1 + maxL2;
 		const unsigned int size = maxL + 1;
 
@@ -32,15 +33,15 @@ namespace GaussianIntegrals {
 		
 		Orbitals::QuantumNumbers::QuantumNumbers maxQN(0, 0 , maxL);
 
-		const double factor = 2. * M_PI / alpha * exp(-alpha1 * alpha2 / alpha * dif * dif);
+		const double factor = primitivePair.nuclearFactor;
 		matrixCalc = Eigen::MatrixXd::Zero(maxQN.GetTotalCanonicalIndex() + 1ULL, size);
 
 		for (unsigned int i = 0; i < size; ++i)	
 			matrixCalc(0, i) = factor * boys.functions[i];
 
-		VerticalRecursion(alpha, Rp, center1, difN, maxL);
+		VerticalRecursion(alpha, Rp, shellPair.center1, difN, maxL);
 		
-		if (calculateHorizontal) HorizontalRecursion(dif, maxL1, maxL2);
+		if (calculateHorizontal) HorizontalRecursion(shellPair.AB, maxL1, maxL2);
 		else matrixCalc = matrixCalc.block(0, 0, matrixCalc.rows(), 1).eval();
 	}
 
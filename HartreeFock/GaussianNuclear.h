@@ -4,6 +4,7 @@
 
 #include "GaussianIntegral.h"
 #include "QuantumNumbers.h"
+#include "ShellPairs.h"
 
 
 namespace GaussianIntegrals {
@@ -29,7 +30,8 @@ namespace GaussianIntegrals {
 		GaussianNuclear();
 		~GaussianNuclear();
 
-		void Reset(IntegralsRepository* repository, double alpha1, double alpha2, const Vector3D<double>& nucleus, const Vector3D<double>& center1, const Vector3D<double>& center2, unsigned int maxL1, unsigned int maxL2, bool calculateHorizontal = true);
+		// computes for all the angular momenta up to the max ones of the shells in the pair
+		void Reset(IntegralsRepository* repository, const ShellPair& shellPair, const PrimitivePair& primitivePair, const Vector3D<double>& nucleus, bool calculateHorizontal = true);
 
 		double operator()(const Orbitals::QuantumNumbers::QuantumNumbers& QN1, const Orbitals::QuantumNumbers::QuantumNumbers& QN2) const { return getNuclear(QN1, QN2); }
 		double getNuclear(const Orbitals::QuantumNumbers::QuantumNumbers& QN1, const Orbitals::QuantumNumbers::QuantumNumbers& QN2) const;	
@@ -40,6 +40,14 @@ namespace Orbitals {
 			sqrt(GaussianIntegrals::MathUtils::DoubleFactorial(2 * angularMomentum.l - 1) * GaussianIntegrals::MathUtils::DoubleFactorial(2 * angularMomentum.m - 1) * GaussianIntegrals::MathUtils::DoubleFactorial(2 * angularMomentum.n - 1));
 	}
 
+	double GaussianOrbital::getNormalizationRatio(const QuantumNumbers::QuantumNumbers& QN)
+	{
+		const long int L = static_cast<long int>(QN.AngularMomentum());
+
+		return sqrt(GaussianIntegrals::MathUtils::DoubleFactorial(2 * L - 1) / 
+			(GaussianIntegrals::MathUtils::DoubleFactorial(2 * static_cast<long int>(QN.l) - 1) * GaussianIntegrals::MathUtils::DoubleFactorial(2 * static_cast<long int>(QN.m) - 1) * GaussianIntegrals::MathUtils::DoubleFactorial(2 * static_cast<long int>(QN.n) - 1)));
+	}
+
 	double GaussianOrbital::operator()(const Vector3D<double>& r) const
 	{
 		const Vector3D<double> R = r - center;
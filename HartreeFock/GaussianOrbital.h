@@ -24,6 +24,10 @@ namespace Orbitals {
 
 		Vector3D<double> ProductCenter(const GaussianOrbital& other) const;
 
+		// the ratio between the normalization factor for these quantum numbers and the one for (L, 0, 0) with the same exponent
+		// it does not depend on the exponent, so it can be used to pass from one component of a shell to another after contraction
+		static double getNormalizationRatio(const QuantumNumbers::QuantumNumbers& QN);
+
 	protected:
 		double getNormalizationFactor() const;
 
@@ -3,10 +3,16 @@
 
 #include "IntegralsRepository.h"
 
+#include <algorithm>
+
 namespace GaussianIntegrals {
 
+	static const double twoPiToFiveHalves = 2. * pow(M_PI, 5. / 2.);
 
 	GaussianTwoElectrons::GaussianTwoElectrons()
+		: allocations(0), primitiveQuartets(0), 
+		m_L1(0), m_L2(0), m_L3(0), m_L4(0), maxL(0), verticalRows(0), transferColumns(0), indexL1(0), indexL3(0), rows12(0), columns34(0), limit2(0), limit4(0),
+		nrOrbitals1(0), nrOrbitals2(0), nrOrbitals3(0), nrOrbitals4(0)
 	{
 	}
 
@@ -15,97 +21,131 @@ namespace GaussianIntegrals {
 	{
 	}
 
-	double GaussianTwoElectrons::getValue(const Orbitals::QuantumNumbers::QuantumNumbers& QN1, const Orbitals::QuantumNumbers::QuantumNumbers& QN2, const Orbitals::QuantumNumbers::QuantumNumbers& QN3, const Orbitals::QuantumNumbers::QuantumNumbers& QN4)
+
+	void GaussianTwoElectrons::BeginContraction(unsigned int L1, unsigned int L2, unsigned int L3, unsigned int L4)
 	{
-		return tensor4Calc(QN1.GetCanonicalIndex(), QN2.GetCanonicalIndex(), QN3.GetCanonicalIndex(), QN4.GetCanonicalIndex());
-	}
+		assert(L1 >= L2);
+		assert(L3 >= L4);
+		assert(L1 + L2 >= L3 + L4);
+
+		m_L1 = L1;
+		m_L2 = L2;
+		m_L3 = L3;
+		m_L4 = L4;
+
+		const unsigned int maxL12 = L1 + L2;
+		const unsigned int maxL34 = L3 + L4;
+
+		maxL = maxL12 + maxL34;
+
+		verticalRows = Orbitals::QuantumNumbers::QuantumNumbers(0, 0, maxL).GetTotalCanonicalIndex() + 1;
+		transferColumns = Orbitals::QuantumNumbers::QuantumNumbers(0, 0, maxL34).GetTotalCanonicalIndex() + 1;
+
+		indexL1 = Orbitals::QuantumNumbers::QuantumNumbers(L1, 0, 0).GetTotalCanonicalIndex();
+		indexL3 = Orbitals::QuantumNumbers::QuantumNumbers(L3, 0, 0).GetTotalCanonicalIndex();
+
+		rows12 = Orbitals::QuantumNumbers::QuantumNumbers(0, 0, maxL12).GetTotalCanonicalIndex() - indexL1 + 1;
+		columns34 = transferColumns - indexL3;
+
+		limit2 = Orbitals::QuantumNumbers::QuantumNumbers(0, 0, L2).GetTotalCanonicalIndex() + 1;
+		limit4 = Orbitals::QuantumNumbers::QuantumNumbers(0, 0, L4).GetTotalCanonicalIndex() + 1;
+
+		nrOrbitals1 = Orbitals::QuantumNumbers::QuantumNumbers::NumOrbitals(L1);
+		nrOrbitals2 = Orbitals::QuantumNumbers::QuantumNumbers::NumOrbitals(L2);
+		nrOrbitals3 = Orbitals::QuantumNumbers::QuantumNumbers::NumOrbitals(L3);
+		nrOrbitals4 = Orbitals::QuantumNumbers::QuantumNumbers::NumOrbitals(L4);
+
+		EnsureSize(vertical, static_cast<size_t>(verticalRows) * (maxL + 1ULL));
+		EnsureSize(transfer, static_cast<size_t>(verticalRows) * transferColumns);
+		EnsureSize(horizontal1, static_cast<size_t>(rows12) * limit2 * columns34);
+		EnsureSize(horizontal2, static_cast<size_t>(nrOrbitals1) * nrOrbitals2 * columns34 * limit4);
+		EnsureSize(result, static_cast<size_t>(nrOrbitals1) * nrOrbitals2 * nrOrbitals3 * nrOrbitals4);
 
+		// the contraction is accumulated in here
+		std::fill(horizontal1.begin(), horizontal1.begin() + static_cast<size_t>(rows12) * limit2 * columns34, 0.);
+	}
 
 
-	void GaussianTwoElectrons::Reset(IntegralsRepository* repository, double alpha1, double alpha2, double alpha3, double alpha4, 
-		const Vector3D<double>& center1, const Vector3D<double>& center2, const Vector3D<double>& center3, const Vector3D<double>& center4, 
-		unsigned int maxL1, unsigned int maxL2, unsigned int maxL3, unsigned int maxL4)
+	void GaussianTwoElectrons::AddPrimitives(IntegralsRepository* repository, double contractionFactor, const ShellPair& shellPair12, const PrimitivePair& pair12, const ShellPair& shellPair34, const PrimitivePair& pair34)
 	{
-		const double alpha12 = alpha1 + alpha2;
-		const double alpha34 = alpha3 + alpha4;
+		++primitiveQuartets;
+
+		const double alpha12 = pair12.alpha;
+		const double alpha34 = pair34.alpha;
 		const double alphaProd = alpha12 * alpha34;
 		const double alphaSum = alpha12 + alpha34;
 		const double alpha = alphaProd / alphaSum;
 
-		const unsigned int maxL12 = maxL1 + maxL2;
-		const unsigned int maxL34 = maxL3 + maxL4;
-
-
-		const unsigned int maxL = maxL12 + maxL34;
 		const unsigned int size = maxL + 1;
 
-		const Orbitals::QuantumNumbers::QuantumNumbers maxQN(0, 0, maxL);
-		const unsigned int maxIndex = maxQN.GetTotalCanonicalIndex();
-
-		const Vector3D<double> R12 = center1 - center2;
-		const Vector3D<double> R34 = center3 - center4;
-
-		const Vector3D<double> Rp = (alpha1 * center1 + alpha2 * center2) / alpha12;
-		const Vector3D<double> Rq = (alpha3 * center3 + alpha4 * center4) / alpha34;
+		const Vector3D<double>& Rp = pair12.P;
+		const Vector3D<double>& Rq = pair34.P;
 		const Vector3D<double> Rpq = Rp - Rq;
 
 		// auxiliary integrals
 
-		const double exponent = -alpha1 * alpha2 / alpha12 * (R12 * R12) - alpha3 * alpha4 / alpha34 * (R34 * R34);
-		const double factor = 2. * pow(M_PI, 5. / 2.) / (alphaProd * sqrt(alphaSum)) * exp(exponent);
+		const double factor = twoPiToFiveHalves / (alphaProd * sqrt(alphaSum)) * pair12.K * pair34.K;
 		const double T = alpha * (Rpq * Rpq);
 
-		matrixCalc = Eigen::MatrixXd::Zero(maxIndex + 1ULL, size);
-
 		const BoysFunctions& boys = repository->getBoysFunctions(maxL, T);
 
 		for (unsigned int i = 0; i < size; ++i)
-			matrixCalc(0, i) = factor * boys.functions[i];
+			vertical[i] = factor * boys.functions[i];
 
-	    // at this point the first row of matrixCalc contains the Boys functions from m = 0 up to m = L1 + L2 + L3 + L4
+		// at this point the first row of the vertical buffer contains the Boys functions from m = 0 up to m = L1 + L2 + L3 + L4
+		// there is no need to zero the rest, the vertical recursion only reads values it already computed
 
-	    // *********************************************************
+		// *********************************************************
 
-		VerticalRecursion(alpha, alpha12, Rp - center1, -alpha / alpha12 * Rpq, maxL);
+		VerticalRecursion(alpha, alpha12, Rp - shellPair12.center1, -alpha / alpha12 * Rpq);
 
-		// after the above call (apart from m != 0 intermediary results), matrixCalc contains on the 0 column the integrals from (s, s | s, s) to (L1 + L2 + L3 + L4, s | s, s)
+		// after the above call (apart from m != 0 intermediary results), the m = 0 column contains the integrals from (s, s | s, s) to (L1 + L2 + L3 + L4, s | s, s)
 
 		// ************************************************************
 
-		const Orbitals::QuantumNumbers::QuantumNumbers maxQN12(0, 0, maxL12);
-		const unsigned int maxIndex12 = maxQN12.GetTotalCanonicalIndex();
-
-		const Orbitals::QuantumNumbers::QuantumNumbers maxQN34(0, 0, maxL34);
-		const unsigned int maxIndex34 = maxQN34.GetTotalCanonicalIndex();
-
-		const unsigned int indexL1 = Orbitals::QuantumNumbers::QuantumNumbers(maxL1, 0, 0).GetTotalCanonicalIndex();
-		const unsigned int indexL3 = Orbitals::QuantumNumbers::QuantumNumbers(maxL3, 0, 0).GetTotalCanonicalIndex();
-
-
-		// to start the electron transfer, start with the above calculated 0 column, but enlarge the matrixCalc to hold all 'transferred' integrals in columns
+		// to start the electron transfer, start with the above calculated m = 0 column, the transfer buffer holds all 'transferred' integrals in columns
 		// transfer from (L1 + L2 + L3 + L4, s | s, s) -> (L1 + L2, s | L3 + L4, s)
-		// so it needs as many lines as before and maxIndex34 columns to be able to hold all results, including the intermediary ones
 
-		Eigen::MatrixXd electronTransfer = Eigen::MatrixXd::Zero(maxIndex + 1ULL, maxIndex34 + 1ULL);
-		electronTransfer.col(0) = matrixCalc.col(0);  // copy the 0 column into the new matrixCalc
-		matrixCalc = electronTransfer;
+		for (unsigned int i = 0; i < verticalRows; ++i)
+		{
+			double* row = &transfer[static_cast<size_t>(i) * transferColumns];
 
-		const Vector3D<double> Delta = -(alpha2 * R12 + alpha4 * R34) / alpha34;
+			row[0] = vertical[static_cast<size_t>(i) * size];
+			std::fill(row + 1, row + transferColumns, 0.);
+		}
+
+		const Vector3D<double> Delta = -(pair12.alpha2 * shellPair12.AB + pair34.alpha2 * shellPair34.AB) / alpha34;
 
 		// ***************************************************************************************************************************
 
-		ElectronTransfer(alpha12, alpha34, Delta, maxL, maxL34);
+		ElectronTransfer(alpha12, alpha34, Delta);
 
-		// at this point the matrix holds 0 -> L1 + L2 + L3 + L4 rows (the canonical index) and 0 -> L3 + L4 (the canonical index, not this value) columns
+		// at this point the buffer holds 0 -> L1 + L2 + L3 + L4 rows (the canonical index) and 0 -> L3 + L4 (the canonical index, not this value) columns
 		// not all of them are valid values, see the electron transfer calculation for details
 
 		// **************************************************************************************************************************
 
-		// need to hold only L1 -> L1 + L2 range of rows and L3 -> L3 + L4 range of columns
-		matrixCalc = matrixCalc.block(indexL1, indexL3, maxIndex12 - indexL1 + 1ULL, maxIndex34 - indexL3 + 1ULL).eval();
+		// only L1 -> L1 + L2 range of rows and L3 -> L3 + L4 range of columns is needed, contract it directly into the work tensor for the first horizontal recursion
+
+		for (unsigned int i = 0; i < rows12; ++i)
+		{
+			const double* src = &transfer[static_cast<size_t>(indexL1 + i) * transferColumns + indexL3];
+			double* dst = &horizontal1[static_cast<size_t>(i) * limit2 * columns34];
+
+			for (unsigned int k = 0; k < columns34; ++k)
+				dst[k] += contractionFactor * src[k];
+		}
+	}
+
+
+	void GaussianTwoElectrons::EndContraction(const Vector3D<double>& dif12, const Vector3D<double>& dif34)
+	{
+		HorizontalRecursion1(dif12);
+		HorizontalRecursion2(dif34);
 	}
 
-	void GaussianTwoElectrons::VerticalRecursion(double alpha, double alpha12, const Vector3D<double>& Rpa, const Vector3D<double>& Rwp, unsigned int maxL)
+
+	void GaussianTwoElectrons::VerticalRecursion(double alpha, double alpha12, const Vector3D<double>& Rpa, const Vector3D<double>& Rwp)
 	{
 		double RpaScalar, RwpScalar;
 		double N;
@@ -119,36 +159,43 @@ namespace GaussianIntegrals {
 
 			const bool addPrevPrev = GetPrevAndPrevPrevAndScalarsForVerticalRecursion(currentQN, Rpa, Rwp, prevQN, prevPrevQN, RpaScalar, RwpScalar, N);
 
-			const unsigned int curIndex = currentQN.GetTotalCanonicalIndex();
-			const unsigned int prevIndex = prevQN.GetTotalCanonicalIndex();
+			double* cur = &vertical[static_cast<size_t>(currentQN.GetTotalCanonicalIndex()) * size];
+			const double* prev = &vertical[static_cast<size_t>(prevQN.GetTotalCanonicalIndex()) * size];
+			const unsigned int mLimit = size - currentQN;
 
-			for (unsigned int m = 0; m < size - currentQN; ++m)
-			{
-				// ********************************************************************************************************************************
-				// The Vertical Recurrence Relation
+			// ********************************************************************************************************************************
+			// The Vertical Recurrence Relation
 
-				matrixCalc(curIndex, m) = RpaScalar * matrixCalc(prevIndex, m) + RwpScalar * matrixCalc(prevIndex, m + 1ULL);
+			for (unsigned int m = 0; m < mLimit; ++m)
+				cur[m] = RpaScalar * prev[m] + RwpScalar * prev[m + 1ULL];
 
-				if (addPrevPrev)
-				{
-					const unsigned int prevPrevIndex = prevPrevQN.GetTotalCanonicalIndex();
-					matrixCalc(curIndex, m) += N / (2. * alpha12) * (matrixCalc(prevPrevIndex, m) - alpha / alpha12 * matrixCalc(prevPrevIndex, m + 1ULL));
-				}
+			if (addPrevPrev)
+			{
+				const double* prevPrev = &vertical[static_cast<size_t>(prevPrevQN.GetTotalCanonicalIndex()) * size];
+				const double N2alpha = N / (2. * alpha12);
+				const double alphaRatio = alpha / alpha12;
 
-				// ********************************************************************************************************************************
+				for (unsigned int m = 0; m < mLimit; ++m)
+					cur[m] += N2alpha * (prevPrev[m] - alphaRatio * prevPrev[m + 1ULL]);
 			}
+
+			// ********************************************************************************************************************************
 		}
 	}
 
 
 
-	void GaussianTwoElectrons::ElectronTransfer(double alpha12, double alpha34, const Vector3D<double>& delta, unsigned int maxL, unsigned int maxL34)
+	void GaussianTwoElectrons::ElectronTransfer(double alpha12, double alpha34, const Vector3D<double>& delta)
 	{
 		unsigned int maxIndex;
 		double deltaScalar;
 		double Nx = 0;
 		double Ny = 0; // assignment is just to keep the compiler happy
 
+		const unsigned int maxL34 = m_L3 + m_L4;
+		const double alphaRatio = alpha12 / alpha34;
+		const double inv2alpha34 = 1. / (2. * alpha34);
+
 		for (auto currentQN2 = Orbitals::QuantumNumbers::QuantumNumbers(1, 0, 0); currentQN2 <= maxL34; ++currentQN2) // for each 'column' starting from 1
 		{
 			const unsigned int curL1 = currentQN2;
@@ -165,9 +212,12 @@ namespace GaussianIntegrals {
 			assert(curL1 <= maxL - curL1);
 			assert(maxL - curL1 > 0);
 
-			for (auto currentQN1 = Orbitals::QuantumNumbers::QuantumNumbers(curL1 - 1, 0, 0); currentQN1 <= maxL - curL1; ++currentQN1)
+			// the rows go down by one for each column, from L1 for the L3 + L4 one, for example for (d, d | d, d) the d rows of the last column are needed
+			const unsigned int startL1 = (m_L1 + curL1 > maxL34) ? m_L1 + curL1 - maxL34 : 0;
+
+			for (auto currentQN1 = Orbitals::QuantumNumbers::QuantumNumbers(startL1, 0, 0); currentQN1 <= maxL - curL1; ++currentQN1)
 			{
-				unsigned int curIndexQN1 = currentQN1.GetTotalCanonicalIndex();
+				const size_t curRow = static_cast<size_t>(currentQN1.GetTotalCanonicalIndex()) * transferColumns;
 
 				auto nextQN1 = currentQN1;
 				auto prevQN1 = currentQN1;
@@ -184,13 +234,15 @@ namespace GaussianIntegrals {
 				// ********************************************************************************************************************************
 				// Electron Transfer Relation
 
-				matrixCalc(curIndexQN1, curIndexQN2) = deltaScalar * matrixCalc(curIndexQN1, prevIndexQN2) - alpha12 / alpha34 * matrixCalc(nextQN1.GetTotalCanonicalIndex(), prevIndexQN2);
+				double value = deltaScalar * transfer[curRow + prevIndexQN2] - alphaRatio * transfer[static_cast<size_t>(nextQN1.GetTotalCanonicalIndex()) * transferColumns + prevIndexQN2];
 
 				if (addPrev)
-					matrixCalc(curIndexQN1, curIndexQN2) += Nx / (2. * alpha34) * matrixCalc(prevQN1.GetTotalCanonicalIndex(), prevIndexQN2);
+					value += Nx * inv2alpha34 * transfer[static_cast<size_t>(prevQN1.GetTotalCanonicalIndex()) * transferColumns + prevIndexQN2];
 
 				if (addPrevPrev)
-					matrixCalc(curIndexQN1, curIndexQN2) += Ny / (2. * alpha34) * matrixCalc(curIndexQN1, prevPrevIndexQN2);
+					value += Ny * inv2alpha34 * transfer[curRow + prevPrevIndexQN2];
+
+				transfer[curRow + curIndexQN2] = value;
 
 				// ********************************************************************************************************************************					
 			}
@@ -201,39 +253,22 @@ namespace GaussianIntegrals {
 
 
 
-	void GaussianTwoElectrons::HorizontalRecursion1(const Vector3D<double>& dif, unsigned int L1, unsigned int L2, unsigned int L3, unsigned int L4)
+	void GaussianTwoElectrons::HorizontalRecursion1(const Vector3D<double>& dif)
 	{
-		// some values needed later
-		const unsigned int ind2Limit = Orbitals::QuantumNumbers::QuantumNumbers(0, 0, L2).GetTotalCanonicalIndex() + 1;
-		const unsigned int ind3Limit = static_cast<unsigned int>(matrixCalc.cols());
-
-		const Orbitals::QuantumNumbers::QuantumNumbers QN1Start(L1, 0, 0);
-		const unsigned int QN1Base = QN1Start.GetTotalCanonicalIndex();
-
-		unsigned int L12 = L1 + L2;
-
-		// assertions to check the correctness of some bounds
-		assert(matrixCalc.rows() == (int)(Orbitals::QuantumNumbers::QuantumNumbers(0, 0, L12).GetTotalCanonicalIndex() - Orbitals::QuantumNumbers::QuantumNumbers(L1, 0, 0).GetTotalCanonicalIndex() + 1));
-		assert(ind3Limit == Orbitals::QuantumNumbers::QuantumNumbers(0, 0, L3 + L4).GetTotalCanonicalIndex() - Orbitals::QuantumNumbers::QuantumNumbers(L3, 0, 0).GetTotalCanonicalIndex() + 1);
-
-		// copy the results from the vertical recurrence and electron transfer into a work tensor
-
-		// this holds in the beginning in the first index the L1 -> L1 + L2 range, on the second it holds only s, that is, only the 0 index is filled (but space is reserved to be able to hold all L2 values)
+		// the work tensor holds in the beginning in the first index the L1 -> L1 + L2 range, on the second it holds only s, that is, only the 0 index is filled (but space is reserved to be able to hold all L2 values)
 		// on the third index it has the L3 -> L3 + L4 range
 		// the later range is not touched, the formula is simply applied on all index values and nothing more, see the 'for' for the ind3 index
 		// the second is filled with computation results, as a consequence the first range will decrease to L1 only, the '+ L2' is moved into the second index
 
 		// the formula does this: (L1 + L2, s | L3 + L4, s) -> (L1, L2 | L3 + L4, s)
 
-		Tensors::TensorOrder3<double> workTensor(static_cast<unsigned int>(matrixCalc.rows()), ind2Limit, ind3Limit);
+		const Orbitals::QuantumNumbers::QuantumNumbers QN1Start(m_L1, 0, 0);
+		const unsigned int QN1Base = indexL1;
 
-		// copy the values from matrixCalc
-		for (int i = 0; i < matrixCalc.rows(); ++i)
-			for (int j = 0; j < matrixCalc.cols(); ++j)
-				workTensor(i, 0, j) = matrixCalc(i, j);
+		const unsigned int L2 = m_L2;
+		unsigned int L12 = m_L1 + m_L2;
 
-		// clean up the matrixCalc since it's not needed anymore
-		matrixCalc.resize(0, 0);
+		const size_t stride1 = static_cast<size_t>(limit2) * columns34;
 
 		// the real work - the value for 's' is already in there, here 's' is incremented until reaches L2
 		for (auto QN2 = Orbitals::QuantumNumbers::QuantumNumbers(1, 0, 0); QN2 <= L2; IncrementQNandDecrementLimitIfNeeded(QN2, L12))    // for each 'column' starting from 1
@@ -246,81 +281,60 @@ namespace GaussianIntegrals {
 
 				const double difScalar = GetNextAndPrevQNAndScalarDiffForHorizontalRecursion(QN1, QN2, dif, nextQN1, prevQN2);
 
-				const unsigned int curIndex1 = QN1.GetTotalCanonicalIndex() - QN1Base;
-				const unsigned int nextIndex1 = nextQN1.GetTotalCanonicalIndex() - QN1Base;
+				const size_t curIndex1 = QN1.GetTotalCanonicalIndex() - QN1Base;
+				const size_t nextIndex1 = nextQN1.GetTotalCanonicalIndex() - QN1Base;
+
+				const size_t curIndex2 = QN2.GetTotalCanonicalIndex();
+				const size_t prevIndex2 = prevQN2.GetTotalCanonicalIndex();
 
-				const unsigned int curIndex2 = QN2.GetTotalCanonicalIndex();
-				const unsigned int prevIndex2 = prevQN2.GetTotalCanonicalIndex();
+				double* cur = &horizontal1[curIndex1 * stride1 + curIndex2 * columns34];
+				const double* next = &horizontal1[nextIndex1 * stride1 + prevIndex2 * columns34];
+				const double* prev = &horizontal1[curIndex1 * stride1 + prevIndex2 * columns34];
 
 				// ***********************************************************************************************************
 				// Horizontal Recurrence Relation 1
 
-				for (unsigned int ind3 = 0; ind3 < ind3Limit; ++ind3)
-					workTensor(curIndex1, curIndex2, ind3) = workTensor(nextIndex1, prevIndex2, ind3) + difScalar * workTensor(curIndex1, prevIndex2, ind3);
+				for (unsigned int ind3 = 0; ind3 < columns34; ++ind3)
+					cur[ind3] = next[ind3] + difScalar * prev[ind3];
 
 				// ********************************************************************************************************************************				
 			}
 		}
 
-		Orbitals::QuantumNumbers::QuantumNumbers QN1(L1, 0, 0);
-		Orbitals::QuantumNumbers::QuantumNumbers QN2(L2, 0, 0);
-		const unsigned int QN2Base = QN2.GetTotalCanonicalIndex();
-
-
-		// now copy the values from workTensor into tensor3Calc
+		// now copy the values into the work tensor for the second horizontal recursion
 		// only L2 values are needed, not the whole 0 -> L2 range from the second index
 		// also from the first index only the L1 values are needed, the rest of the values up to L1 + L2 are ignored
-		tensor3Calc = Tensors::TensorOrder3<double>(QN1.NumOrbitals(), QN2.NumOrbitals(), workTensor.GetDim(2));
+		// in the beginning only s values on the last position
+
+		const size_t QN2Base = Orbitals::QuantumNumbers::QuantumNumbers(m_L2, 0, 0).GetTotalCanonicalIndex();
+
+		for (size_t i = 0; i < nrOrbitals1; ++i)
+			for (size_t j = 0; j < nrOrbitals2; ++j)
+			{
+				const double* src = &horizontal1[i * stride1 + (QN2Base + j) * columns34];
+				double* dst = &horizontal2[(i * nrOrbitals2 + j) * columns34 * limit4];
 
-		for (unsigned int i = 0; i < tensor3Calc.GetDim(0); ++i)
-			for (unsigned int j = 0; j < tensor3Calc.GetDim(1); ++j)
-				for (unsigned int k = 0; k < tensor3Calc.GetDim(2); ++k)
-					tensor3Calc(i, j, k) = workTensor(i, QN2Base + j, k);
+				for (unsigned int k = 0; k < columns34; ++k)
+					dst[k * limit4] = src[k];
+			}
 	}
 
 
 	// this is very similar with the above, it just transforms (L1, L2 | L3 + L4, s) -> (L1, L2 | L3, L4)
 
-	void GaussianTwoElectrons::HorizontalRecursion2(const Vector3D<double>& dif, unsigned int L1, unsigned int L2, unsigned int L3, unsigned int L4)
+	void GaussianTwoElectrons::HorizontalRecursion2(const Vector3D<double>& dif)
 	{
-		// some values that are needed later
-		const Orbitals::QuantumNumbers::QuantumNumbers QN1lim(0, 0, L1);
-		const Orbitals::QuantumNumbers::QuantumNumbers QN2lim(0, 0, L2);
-		const Orbitals::QuantumNumbers::QuantumNumbers QN3lim(0, 0, L3);
-		const Orbitals::QuantumNumbers::QuantumNumbers QN4lim(0, 0, L4);
-
-		const unsigned int limit1 = QN1lim.NumOrbitals();
-		const unsigned int limit2 = QN2lim.NumOrbitals();
-		const unsigned int limit3 = static_cast<unsigned int>(tensor3Calc.GetDim(2));
-		const unsigned int limit4 = QN4lim.GetTotalCanonicalIndex() + 1;
+		const unsigned int limit12 = nrOrbitals1 * nrOrbitals2;
 
-		unsigned int L34 = L3 + L4;
+		const unsigned int L4 = m_L4;
+		unsigned int L34 = m_L3 + m_L4;
 
-		const Orbitals::QuantumNumbers::QuantumNumbers QN3Start(L3, 0, 0);
-		const unsigned int QN3Base = QN3Start.GetTotalCanonicalIndex();
+		const Orbitals::QuantumNumbers::QuantumNumbers QN3Start(m_L3, 0, 0);
+		const unsigned int QN3Base = indexL3;
 
-		const Orbitals::QuantumNumbers::QuantumNumbers QN4Start(L4, 0, 0);
-		const unsigned int QN4Base = QN4Start.GetTotalCanonicalIndex();
-
-		// assertions to check that some things are correct
-
-		assert(limit1 == tensor3Calc.GetDim(0));
-		assert(limit2 == tensor3Calc.GetDim(1));
-		assert(limit3 == Orbitals::QuantumNumbers::QuantumNumbers(0, 0, L3 + L4).GetTotalCanonicalIndex() - QN3Base + 1);
-
-		// copy the results from the vertical recurrence and electron transfer and the first horizontal recursion into a work tensor
-		// now an order 4 tensor is needed, to hold all values
-
-		Tensors::TensorOrder4<double> workTensor(limit1, limit2, limit3, limit4);
-
-		for (unsigned int i = 0; i < limit1; ++i)
-			for (unsigned int j = 0; j < limit2; ++j)
-				for (unsigned int k = 0; k < limit3; ++k)
-					workTensor(i, j, k, 0) = tensor3Calc(i, j, k); // in the beginning only s values on the last position
-
-		// don't need the previous results anymore 
-		tensor3Calc.Clear();
+		const unsigned int QN4Base = Orbitals::QuantumNumbers::QuantumNumbers(L4, 0, 0).GetTotalCanonicalIndex();
 
+		const size_t stride12 = static_cast<size_t>(columns34) * limit4;
 
 		// here is the work
 
@@ -334,18 +348,19 @@ namespace GaussianIntegrals {
 
 				const double difScalar = GetNextAndPrevQNAndScalarDiffForHorizontalRecursion(QN3, QN4, dif, nextQN3, prevQN4);
 
-				const unsigned int curIndex3 = QN3.GetTotalCanonicalIndex() - QN3Base;
-				const unsigned int nextIndex3 = nextQN3.GetTotalCanonicalIndex() - QN3Base;
-
-				const unsigned int curIndex4 = QN4.GetTotalCanonicalIndex();
-				const unsigned int prevIndex4 = prevQN4.GetTotalCanonicalIndex();
+				const size_t cur = static_cast<size_t>(QN3.GetTotalCanonicalIndex() - QN3Base) * limit4 + QN4.GetTotalCanonicalIndex();
+				const size_t next = static_cast<size_t>(nextQN3.GetTotalCanonicalIndex() - QN3Base) * limit4 + prevQN4.GetTotalCanonicalIndex();
+				const size_t prev = static_cast<size_t>(QN3.GetTotalCanonicalIndex() - QN3Base) * limit4 + prevQN4.GetTotalCanonicalIndex();
 
 				// ***********************************************************************************************************
 				// Horizontal Recurrence Relation 2
 
-				for (unsigned int i = 0; i < limit1; ++i)
-					for (unsigned int j = 0; j < limit2; ++j)
-						workTensor(i, j, curIndex3, curIndex4) = workTensor(i, j, nextIndex3, prevIndex4) + difScalar * workTensor(i, j, curIndex3, prevIndex4);
+				for (size_t ij = 0; ij < limit12; ++ij)
+				{
+					double* work = &horizontal2[ij * stride12];
+
+					work[cur] = work[next] + difScalar * work[prev];
+				}
 
 				// ********************************************************************************************************************************
 			}			
@@ -354,16 +369,68 @@ namespace GaussianIntegrals {
 
 		// copy the result from the work tensor
 		// the first indices were not touched, the third range decreased from L3 -> L3 + L4 to L3 only
-		// the fourth is now restricted to L4 only, although in the workTensor it started from 0 up to L4
+		// the fourth is now restricted to L4 only, although in the work tensor it started from 0 up to L4
+
+		double* res = result.data();
+		for (size_t ij = 0; ij < limit12; ++ij)
+			for (size_t k = 0; k < nrOrbitals3; ++k)
+			{
+				const double* work = &horizontal2[ij * stride12 + k * limit4 + QN4Base];
+
+				for (unsigned int l = 0; l < nrOrbitals4; ++l)
+					*res++ = work[l];
+			}
+	}
+
+
+	// ratios between the normalization factors of the components and the one of (L, 0, 0), in canonical order
+	// they are computed only once, the table is shared by all threads (the initialization of a function static is thread safe)
+
+	static const unsigned int maxNormalizationL = 12;
+
+	static const double* GetNormalizationRatios(unsigned int L)
+	{
+		static const std::vector<std::vector<double>> ratios = []()
+		{
+			std::vector<std::vector<double>> table(maxNormalizationL + 1ULL);
+
+			for (unsigned int L = 0; L <= maxNormalizationL; ++L)
+				for (Orbitals::QuantumNumbers::QuantumNumbers QN(L, 0, 0); QN <= L; ++QN)
+					table[L].push_back(Orbitals::GaussianOrbital::getNormalizationRatio(QN));
+
+			return table;
+		}();
 
-		tensor4Calc = Tensors::TensorOrder4<double>(limit1, limit2, QN3lim.NumOrbitals(), QN4lim.NumOrbitals());
+		assert(L <= maxNormalizationL);
 
-		for (unsigned int i = 0; i < tensor4Calc.GetDim(0); ++i)
-			for (unsigned int j = 0; j < tensor4Calc.GetDim(1); ++j)
-				for (unsigned int k = 0; k < tensor4Calc.GetDim(2); ++k)
-					for (unsigned int l = 0; l < tensor4Calc.GetDim(3); ++l)
-						tensor4Calc(i, j, k, l) = workTensor(i, j, k, QN4Base + l);
+		return ratios[L].data();
 	}
 
+	void GaussianTwoElectrons::AdjustNormalization()
+	{
+		// nothing to adjust for s and p, the ratios are all 1
+		if (m_L1 < 2 && m_L2 < 2 && m_L3 < 2 && m_L4 < 2) return;
+
+		const double* ratios1 = GetNormalizationRatios(m_L1);
+		const double* ratios2 = GetNormalizationRatios(m_L2);
+		const double* ratios3 = GetNormalizationRatios(m_L3);
+		const double* ratios4 = GetNormalizationRatios(m_L4);
+
+		double* res = result.data();
+
+		for (unsigned int i = 0; i < nrOrbitals1; ++i)
+			for (unsigned int j = 0; j < nrOrbitals2; ++j)
+			{
+				const double ratio12 = ratios1[i] * ratios2[j];
+
+				for (unsigned int k = 0; k < nrOrbitals3; ++k)
+				{
+					const double ratio123 = ratio12 * ratios3[k];
+
+					for (unsigned int l = 0; l < nrOrbitals4; ++l)
+						*res++ *= ratio123 * ratios4[l];
+				}
+			}
+	}
 
-}
\ No newline at end of file
+}
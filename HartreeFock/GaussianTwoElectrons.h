@@ -3,9 +3,9 @@
 #include <Eigen\eigen>
 
 #include "GaussianIntegral.h"
+#include "ShellPairs.h"
 
-#include "TensorOrder3.h"
-#include "TensorOrder4.h"
+#include <vector>
 
 namespace GaussianIntegrals {
 
@@ -17,25 +17,89 @@ namespace GaussianIntegrals {
 
 	class IntegralsRepository;
 
+	// computes the contracted integrals for a shell quartet, for all the components
+	// it's meant to be reused: the work buffers only grow, so after the first shell quartets for each angular momentum class
+	// there are no more heap allocations, neither per primitive quartet nor per shell quartet
+	// use it like this: BeginContraction, AddPrimitives for each primitive quartet, EndContraction, then get the values
+
 	class GaussianTwoElectrons : public GaussianIntegral
 	{
 	public:
-		Eigen::MatrixXd matrixCalc;
-		Tensors::TensorOrder3<double> tensor3Calc;
-		Tensors::TensorOrder4<double> tensor4Calc;
-
 		GaussianTwoElectrons();
 		~GaussianTwoElectrons();
 
-		double getValue(const Orbitals::QuantumNumbers::QuantumNumbers& QN1, const Orbitals::QuantumNumbers::QuantumNumbers& QN2, const Orbitals::QuantumNumbers::QuantumNumbers& QN3, const Orbitals::QuantumNumbers::QuantumNumbers& QN4);
+		double getValue(const Orbitals::QuantumNumbers::QuantumNumbers& QN1, const Orbitals::QuantumNumbers::QuantumNumbers& QN2, const Orbitals::QuantumNumbers::QuantumNumbers& QN3, const Orbitals::QuantumNumbers::QuantumNumbers& QN4) const
+		{
+			return operator()(QN1.GetCanonicalIndex(), QN2.GetCanonicalIndex(), QN3.GetCanonicalIndex(), QN4.GetCanonicalIndex());
+		}
+
+		// the indices are the canonical indices of the components
+		inline double operator()(unsigned int index1, unsigned int index2, unsigned int index3, unsigned int index4) const
+		{
+			return result[((index1 * static_cast<size_t>(nrOrbitals2) + index2) * nrOrbitals3 + index3) * nrOrbitals4 + index4];
+		}
+
+		// the angular momenta must be in the order required by the algorithm: L1 >= L2, L3 >= L4, L1 + L2 >= L3 + L4
+		void BeginContraction(unsigned int L1, unsigned int L2, unsigned int L3, unsigned int L4);
+
+		// vertical recursion and electron transfer for a primitive quartet, the result is multiplied by factor and added to the contraction
+		void AddPrimitives(IntegralsRepository* repository, double factor, const ShellPair& shellPair12, const PrimitivePair& pair12, const ShellPair& shellPair34, const PrimitivePair& pair34);
 
-		void Reset(IntegralsRepository* repository, double alpha1, double alpha2, double alpha3, double alpha4, 
-			const Vector3D<double>& center1, const Vector3D<double>& center2, const Vector3D<double>& center3, const Vector3D<double>& center4, 			
-			unsigned int maxL1, unsigned int maxL2, unsigned int maxL3, unsigned int maxL4);
+		// the horizontal recursions, on the contracted values
+		void EndContraction(const Vector3D<double>& dif12, const Vector3D<double>& dif34);
+
+		// if the contraction was done with the normalization factors of the (L, 0, 0) components, this fixes the values for all the components
+		void AdjustNormalization();
+
+		// statistics: how many times a work buffer had to grow, and for how many primitive quartets they were used
+		unsigned long long int allocations;
+		unsigned long long int primitiveQuartets;
 
 	protected:
-		void VerticalRecursion(double alpha, double alpha12, const Vector3D<double>& Rpa, const Vector3D<double>& Rwp, unsigned int maxL);
-		void ElectronTransfer(double alpha12, double alpha34, const Vector3D<double>& delta, unsigned int maxL, unsigned int maxL2);
+		void VerticalRecursion(double alpha, double alpha12, const Vector3D<double>& Rpa, const Vector3D<double>& Rwp);
+		void ElectronTransfer(double alpha12, double alpha34, const Vector3D<double>& delta);
+
+		void HorizontalRecursion1(const Vector3D<double>& dif);
+		void HorizontalRecursion2(const Vector3D<double>& dif);
+
+		// grows the buffer if needed, counting the allocations
+		inline void EnsureSize(std::vector<double>& buffer, size_t size)
+		{
+			if (buffer.size() >= size) return;
+
+			if (buffer.capacity() < size) ++allocations;
+			buffer.resize(size);
+		}
+
+		unsigned int m_L1;
+		unsigned int m_L2;
+		unsigned int m_L3;
+		unsigned int m_L4;
+
+		// sizes for the current angular momentum class, set in BeginContraction
+
+		unsigned int maxL; // L1 + L2 + L3 + L4
+		unsigned int verticalRows; // total canonical index for maxL + 1
+		unsigned int transferColumns; // total canonical index for L3 + L4 + 1
+		unsigned int indexL1; // total canonical index of (L1, 0, 0)
+		unsigned int indexL3; // total canonical index of (L3, 0, 0)
+		unsigned int rows12; // the L1 -> L1 + L2 range
+		unsigned int columns34; // the L3 -> L3 + L4 range
+		unsigned int limit2; // total canonical index for L2 + 1
+		unsigned int limit4; // total canonical index for L4 + 1
+
+		unsigned int nrOrbitals1;
+		unsigned int nrOrbitals2;
+		unsigned int nrOrbitals3;
+		unsigned int nrOrbitals4;
+
+		// the work buffers
+
+		std::vector<double> vertical; // verticalRows x (maxL + 1), the vertical recursion, the second index is m
+		std::vector<double> transfer; // verticalRows x transferColumns, the electron transfer
+		std::vector<double> horizontal1; // rows12 x limit2 x columns34, the contraction accumulates into [i, 0, k], then the first horizontal recursion is done in place
+		std::vector<double> horizontal2; // nrOrbitals1 x nrOrbitals2 x columns34 x limit4, the second horizontal recursion
+		std::vector<double> result; // nrOrbitals1 x nrOrbitals2 x nrOrbitals3 x nrOrbitals4
 
 		inline static bool DecrementPrevAndPrevPrevAndSetN(unsigned int& prev, unsigned int& prevPrev, double& N)
 		{
@@ -95,11 +159,6 @@ namespace GaussianIntegrals {
 			return addPrevPrev;
 		}
 	public:
-		void HorizontalRecursion1(const Vector3D<double>& dif, unsigned int L1, unsigned int L2, unsigned int L3, unsigned int L4);
-
-		void HorizontalRecursion2(const Vector3D<double>& dif, unsigned int L1, unsigned int L2, unsigned int L3, unsigned int L4);
-
-		
 		inline static bool GetPrevAndPrevPrevAndScalarsForVerticalRecursion(const Orbitals::QuantumNumbers::QuantumNumbers& currentQN, const Vector3D<double>& Rpa, const Vector3D<double>& Rwp, Orbitals::QuantumNumbers::QuantumNumbers& prevQN, Orbitals::QuantumNumbers::QuantumNumbers& prevPrevQN, double& RpaScalar, double& RwpScalar, double& N)
 		{
 			prevPrevQN = prevQN = currentQN;
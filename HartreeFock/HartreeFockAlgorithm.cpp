@@ -3,12 +3,14 @@
 
 #include "Constants.h"
 
+#include <algorithm>
+
 
 namespace HartreeFock {
 
 	HartreeFockAlgorithm::HartreeFockAlgorithm(int iterations)
-		: totalEnergy(std::numeric_limits<double>::infinity()), mp2Energy(0), nuclearRepulsionEnergy(0), numberOfOrbitals(0),  maxIterations(iterations), inited(false), alpha(0.75), initGuess(0.75), terminate(false), converged(false),
-		HOMOEnergy(0), lastErrorEst(0), UseDIIS(true), maxDIISiterations(1000), normalIterAfterDIIS(500)
+		: totalEnergy(std::numeric_limits<double>::infinity()), mp2Energy(0), nuclearRepulsionEnergy(0), numberOfOrbitals(0),  maxIterations(iterations), inited(false), fockBuildsSinceFull(0), lastFockBuildIncremental(false), previousFockBuildIncremental(false), onlyFullFockBuilds(false), densityGuess(false), polishing(false), checkStartCurvature(0), alpha(0.75), initGuess(0.75), precomputedIntegrals(nullptr), terminate(false), converged(false),
+		HOMOEnergy(0), lastErrorEst(0), UseDIIS(true), maxDIISiterations(1000), normalIterAfterDIIS(500), polishingStableIterations(5), diisStagnationIterations(50), secondOrderSCF(0), trustRadius(0.5), maxTrustRadius(1.), maxMicroIterations(20), stabilityCheck(false), stabilityGuessCurvature(0), softestCurvature(0), nrFockBuilds(0), nrIterations(0), nrPolishingIterations(0), diisStagnated(false), fullFockBuildInterval(10)
 	{
 	}
 
@@ -21,6 +23,12 @@ namespace HartreeFock {
 	void HartreeFockAlgorithm::Init(Systems::Molecule* molecule)
 	{
 		converged = false;
+		fockBuildsSinceFull = 0;
+		lastFockBuildIncremental = false;
+		previousFockBuildIncremental = false;
+		onlyFullFockBuilds = false;
+		nrIterations = 0;
+		diis.Clear();
 		integralsRepository.Reset(molecule);
 
 		overlapMatrix.SetRepository(&integralsRepository);
@@ -37,11 +45,20 @@ namespace HartreeFock {
 
 		h = kineticMatrix.matrix + nuclearMatrix.matrix;
 
+		densityGuess = !initialDensities.empty();
+		for (const auto& density : initialDensities)
+			if (density.rows() != h.rows() || density.cols() != h.cols()) densityGuess = false;
+
 		nuclearRepulsionEnergy = molecule->NuclearRepulsionEnergy();
 
 		numberOfOrbitals = molecule->CountNumberOfContractedGaussians();
 
-		integralsRepository.CalculateElectronElectronIntegrals();
+		if (precomputedIntegrals && !integralsRepository.integralDirect && precomputedIntegrals->HasElectronElectronIntegrals())
+			precomputedIntegrals->TransferElectronElectronIntegrals(integralsRepository);
+		else
+			integralsRepository.CalculateElectronElectronIntegrals();
+		precomputedIntegrals = nullptr;
+
 		integralsRepository.ClearAllMaps();
 
 		Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(overlapMatrix.matrix);
@@ -106,16 +123,45 @@ namespace HartreeFock {
 		double curEnergy = 0;
 		double prevEnergy = std::numeric_limits<double>::infinity();
 
+		nrIterations = 0;
+		nrPolishingIterations = 0;
+		nrFockBuilds = 0;
+		diisStagnated = false;
+
+		softRotations.clear();
+		softestCurvature = 0;
+		checkStartRotations.clear();
+		checkStartRotations.swap(stabilityGuess);
+		checkStartCurvature = stabilityGuessCurvature;
+		stabilityGuessCurvature = 0;
+
 		if (!inited) return prevEnergy;
 
+		if (1 == secondOrderSCF)
+		{
+			// a step only for the orbitals of the initial guess, then only the second order steps
+			Step(0);
+			++nrIterations;
+
+			int iter = 1;
+			converged = SecondOrderSolve(iter);
+
+			return GetTotalEnergy();
+		}
+
+		// the best DIIS error so far and when it was reached, for detecting the stagnation
+		double bestErrorEst = std::numeric_limits<double>::infinity();
+		int bestErrorIter = 0;
+
 		int iter = 0;
 		for (; iter < maxIterations; ++iter)
 		{
 			const double rmsD = Step(iter);
+			++nrIterations;
 
 			curEnergy = GetTotalEnergy();
 
-			if (abs(prevEnergy - curEnergy) <= (UseDIIS ? energyConvergenceDIIS : energyConvergence) && rmsD < rmsDConvergence && lastErrorEst < diisConvergence) {
+			if (Converged(curEnergy - prevEnergy, UseDIIS ? energyConvergenceDIIS : energyConvergence, rmsD, true)) {
 				converged = true;
 				break;
 			}
@@ -123,55 +169,189 @@ namespace HartreeFock {
 			if (terminate) return curEnergy;
 
 			prevEnergy = curEnergy;
+
+			// DIIS can get stuck oscillating around a point it cannot improve on, with the error not getting any smaller
+			// then the damped iterations are better, switch to them
+			if (UseDIIS && diisStagnationIterations > 0 && lastErrorEst > 0)
+			{
+				if (lastErrorEst < 0.9 * bestErrorEst)
+				{
+					bestErrorEst = lastErrorEst;
+					bestErrorIter = iter;
+				}
+				else if (iter - bestErrorIter >= diisStagnationIterations)
+				{
+					diisStagnated = true;
+					++iter;
+					break;
+				}
+			}
 		}
 
+		// set if the polishing leaves the point DIIS converged to, DIIS would only go back there
+		bool leftDIISPoint = false;
+
 		// did it converge with DIIS?
 		if (UseDIIS && iter < maxDIISiterations && converged && normalIterAfterDIIS)
 		{
 			UseDIIS = false;
+			polishing = true;
+
+			// continue without DIIS, sometimes DIIS gets stuck in a bad position close to the minimum
+			// the commutator error is computed even if it's not used for extrapolation
+			// a saddle point meets the convergence criteria, too, the damped steps leave it with the error growing geometrically from there
+			// so once the criteria are met, the steps go on for polishingStableIterations more and stop only if the error did not grow meanwhile
+			int convergedStep = -1;
+			double convergedError = 0;
+			bool polished = false;
 
-			// do a loop without checking the convergence, sometimes DIIS gets stuck in a bad position close to the minimum
 			for (int i = 0; i < normalIterAfterDIIS; ++i)
 			{
-				Step(iter + i);
+				const double rmsD = Step(iter);
+				++iter;
+				++nrIterations;
+				++nrPolishingIterations;
 
 				curEnergy = GetTotalEnergy();
-				if (terminate)
+				if (terminate) break;
+
+				if (Converged(curEnergy - prevEnergy, energyConvergence, rmsD, true))
 				{
-					UseDIIS = true; // restore it back
-					return curEnergy;
+					if (convergedStep < 0 || i - convergedStep >= polishingStableIterations)
+					{
+						if (convergedStep >= 0 && lastErrorEst <= 2. * convergedError)
+						{
+							polished = true;
+							break;
+						}
+
+						// first met, or still met but with the error growing, then check again later
+						convergedStep = i;
+						convergedError = lastErrorEst;
+					}
 				}
+				else if (lastErrorEst >= diisConvergence)
+					convergedStep = -1;
+
 				prevEnergy = curEnergy;
 			}
 
-			iter += normalIterAfterDIIS;
+			polishing = false;
+
+			// the result must not have the screening errors accumulated by incremental Fock matrix builds
+			if (!terminate && lastFockBuildIncremental)
+			{
+				onlyFullFockBuilds = true;
+				Step(iter);
+				++iter;
+				++nrIterations;
+				++nrPolishingIterations;
+
+				curEnergy = GetTotalEnergy();
+			}
 
 			UseDIIS = true; // restore it back
+
+			// it left the point DIIS converged to but did not settle in the allowed steps, the damped iterations below go on until it does
+			if (!polished && !terminate)
+			{
+				leftDIISPoint = true;
+				converged = false;
+			}
+		}
+
+		// a stalled DIIS is finished with the second order solver instead of the damped iterations, if selected
+		bool stabilityChecked = false;
+		if (diisStagnated && 2 == secondOrderSCF && !terminate)
+		{
+			converged = SecondOrderSolve(iter);
+			curEnergy = GetTotalEnergy();
+			stabilityChecked = true;
 		}
 
 		// now continue with normal iteration with convergence checking
-		if (!converged)
+		if (!converged && !terminate)
 		{
+			// after a stagnation or after leaving the DIIS solution, DIIS is not used anymore, not only after maxDIISiterations
+			const bool useDIIS = UseDIIS;
+			if (diisStagnated || leftDIISPoint) UseDIIS = false;
+
 			for (; iter < maxIterations; ++iter)
 			{
 				const double rmsD = Step(iter);
+				++nrIterations;
 
 				curEnergy = GetTotalEnergy();
 
-				if (abs(prevEnergy - curEnergy) <= energyConvergence && rmsD < rmsDConvergence) {
+				if (Converged(curEnergy - prevEnergy, energyConvergence, rmsD, false)) {
 					converged = true;
-					return curEnergy;
+					break;
 				}
 
-				if (terminate) return curEnergy;
+				if (terminate) break;
 
 				prevEnergy = curEnergy;
 			}
+
+			UseDIIS = useDIIS;
+		}
+
+		// DIIS can converge to a saddle point, for example with the wrong orbitals occupied, and the polishing stops there, too, it's converged already
+		// the second order solver checks the orbital Hessian and goes downhill from there, for a stable point it only costs the Hessian products
+		// for a point started from a neighbour that is far from an instability the check is skipped, the next point has to do it
+		if (converged && stabilityCheck && !stabilityChecked && !terminate)
+		{
+			if (!checkStartRotations.empty() && checkStartCurvature > 0.2)
+				softRotations = checkStartRotations;
+			else
+			{
+				converged = SecondOrderSolve(iter);
+				curEnergy = GetTotalEnergy();
+			}
 		}
 
 		return curEnergy;
 	}
 
+	bool HartreeFockAlgorithm::FullFockBuild()
+	{
+		previousFockBuildIncremental = lastFockBuildIncremental;
+
+		if (onlyFullFockBuilds || fullFockBuildInterval <= 1 || 0 == fockBuildsSinceFull % fullFockBuildInterval)
+		{
+			fockBuildsSinceFull = 1;
+			lastFockBuildIncremental = false;
+
+			return true;
+		}
+
+		++fockBuildsSinceFull;
+		lastFockBuildIncremental = true;
+
+		return false;
+	}
+
+	bool HartreeFockAlgorithm::Converged(double energyChange, double energyLimit, double rmsD, bool checkError)
+	{
+		if (lastFockBuildIncremental)
+		{
+			// the density and the error do not get below the noise of the incremental builds, which goes with the screening threshold
+			const double noise = 100. * integralsRepository.schwarzThreshold;
+
+			if (rmsD < max(rmsDConvergence, noise) && (!checkError || lastErrorEst < max(diisConvergence, noise)))
+				onlyFullFockBuilds = true;
+
+			return false;
+		}
+
+		if (rmsD >= rmsDConvergence || (checkError && lastErrorEst >= diisConvergence)) return false;
+
+		// the previous energy has the drift of the incremental builds, the next step compares two full builds
+		if (previousFockBuildIncremental) return false;
+
+		return abs(energyChange) <= energyLimit;
+	}
+
 	double HartreeFockAlgorithm::DiffDensityMatrices(const Eigen::MatrixXd& oldP, const Eigen::MatrixXd& newP)
 	{
 		double res = 0.0;
@@ -191,6 +371,563 @@ namespace HartreeFock {
 	}
 
 
+	void HartreeFockAlgorithm::SolveFockEquation(StepWorkspace& workspace, Eigen::VectorXd& eigenvals, Eigen::MatrixXd& C) const
+	{
+		// see RestrictedHartreeFock::Step for the details, the products are split so they don't need temporaries
+		workspace.VtFockMatrix.noalias() = Vt * workspace.FockMatrix;
+		workspace.FockTransformed.noalias() = workspace.VtFockMatrix * V; // orthogonalize
+
+		if (workspace.FockTransformed.rows() > 1)
+		{
+			workspace.eigenSolver.compute(workspace.FockTransformed);
+
+			eigenvals = workspace.eigenSolver.eigenvalues();
+			C.noalias() = V * workspace.eigenSolver.eigenvectors(); // transform back the eigenvectors into the original non-orthogonalized AO basis
+		}
+		else
+		{
+			eigenvals.resize(1);
+			eigenvals(0) = workspace.FockTransformed(0, 0);
+			C = V;
+		}
+	}
+
+
+	void HartreeFockAlgorithm::CalculateDensityMatrix(StepWorkspace& workspace, const Eigen::MatrixXd& C, const std::vector<bool>& occupied, double occupation)
+	{
+		const Eigen::Index nrOccupied = std::count(occupied.begin(), occupied.end(), true);
+
+		workspace.occupiedC.resize(C.rows(), nrOccupied);
+
+		Eigen::Index column = 0;
+		for (unsigned int level = 0; level < occupied.size(); ++level)
+			if (occupied[level]) workspace.occupiedC.col(column++) = C.col(level);
+
+		if (nrOccupied)
+			workspace.newDensityMatrix.noalias() = occupation * workspace.occupiedC * workspace.occupiedC.transpose();
+		else
+			workspace.newDensityMatrix.setZero(C.rows(), C.rows());
+	}
+
+
+	void HartreeFockAlgorithm::CalculateDIISErrorMatrix(StepWorkspace& workspace, const Eigen::MatrixXd& FockMatrix, const Eigen::MatrixXd& DensityMatrix) const
+	{
+		// F * D * S is the transpose of S * D * F, the matrices being symmetric
+		workspace.VtFockMatrix.noalias() = DensityMatrix * FockMatrix;
+		workspace.densityFockProduct.noalias() = overlapMatrix.matrix * workspace.VtFockMatrix;
+		workspace.errorMatrix = workspace.densityFockProduct - workspace.densityFockProduct.transpose();
+
+		// Vt * error * V, reusing the buffers
+		workspace.VtFockMatrix.noalias() = Vt * workspace.errorMatrix;
+		workspace.errorMatrix.noalias() = workspace.VtFockMatrix * V;
+	}
+
+
+	bool HartreeFockAlgorithm::SecondOrderSolve(int& iter)
+	{
+		// the energy is a function of the orbital rotations, C(kappa) = C * exp(K), with kappa in the virtual-occupied block of K and -kappa^T in the occupied-virtual one
+		// for each channel the gradient is dE/dkappa(a, i) = 2 * occupation * F(a, i), with the Fock matrix in the molecular orbitals basis
+		// the Hessian product with a rotation p is 2 * occupation * (Fvv * p - p * Foo + Cv^T * G(dD) * Co), where G is the electron-electron part of the Fock matrix
+		// for the density change dD = occupation * (Cv * p * Co^T + Co * p^T * Cv^T), so each product is a Fock matrix build, from the stored integrals or the direct ones
+		// the Newton step is solved with preconditioned conjugate gradient, truncated at the trust region boundary or on negative curvature (Steihaug)
+		// the trust radius is adjusted by comparing the energy change with the one predicted by the quadratic model
+
+		std::vector<SpinChannel> spinChannels;
+		GetSpinChannels(spinChannels);
+
+		const size_t nrChannels = spinChannels.size();
+		const Eigen::Index nrLevels = h.rows();
+
+		struct RotationChannel
+		{
+			// the occupied levels first, then the virtual ones, the orbitals and the Fock matrix below are in this order
+			std::vector<Eigen::Index> levels;
+			Eigen::Index nrOccupied;
+			Eigen::Index nrVirtual;
+
+			// where the rotation parameters of the channel start in the vectors with all of them
+			Eigen::Index offset;
+
+			Eigen::MatrixXd C;
+			Eigen::MatrixXd MOFock;
+			Eigen::MatrixXd trialC;
+			Eigen::MatrixXd trialMOFock;
+		};
+
+		std::vector<RotationChannel> channels(nrChannels);
+		Eigen::Index nrParameters = 0;
+
+		for (size_t ch = 0; ch < nrChannels; ++ch)
+		{
+			RotationChannel& channel = channels[ch];
+			const std::vector<bool>& occupied = *spinChannels[ch].occupied;
+
+			for (Eigen::Index level = 0; level < nrLevels; ++level)
+				if (level < static_cast<Eigen::Index>(occupied.size()) && occupied[level]) channel.levels.push_back(level);
+
+			channel.nrOccupied = static_cast<Eigen::Index>(channel.levels.size());
+			channel.nrVirtual = nrLevels - channel.nrOccupied;
+
+			for (Eigen::Index level = 0; level < nrLevels; ++level)
+				if (level >= static_cast<Eigen::Index>(occupied.size()) || !occupied[level]) channel.levels.push_back(level);
+
+			channel.offset = nrParameters;
+			nrParameters += channel.nrVirtual * channel.nrOccupied;
+
+			const Eigen::MatrixXd& C = *spinChannels[ch].C;
+			channel.C.resize(nrLevels, nrLevels);
+			for (Eigen::Index k = 0; k < nrLevels; ++k)
+				channel.C.col(k) = C.col(channel.levels[k]);
+		}
+
+		// the rotation parameters of a channel in a vector with all of them, as the virtual x occupied matrix
+		auto rotation = [](Eigen::VectorXd& v, const RotationChannel& channel)
+		{
+			return Eigen::Map<Eigen::MatrixXd>(v.data() + channel.offset, channel.nrVirtual, channel.nrOccupied);
+		};
+		auto constRotation = [](const Eigen::VectorXd& v, const RotationChannel& channel)
+		{
+			return Eigen::Map<const Eigen::MatrixXd>(v.data() + channel.offset, channel.nrVirtual, channel.nrOccupied);
+		};
+
+		// the density matrices of the current or the trial orbitals
+		auto setDensities = [&](bool trial)
+		{
+			for (size_t ch = 0; ch < nrChannels; ++ch)
+			{
+				const RotationChannel& channel = channels[ch];
+				const auto Co = (trial ? channel.trialC : channel.C).leftCols(channel.nrOccupied);
+
+				spinChannels[ch].DensityMatrix->noalias() = spinChannels[ch].occupation * Co * Co.transpose();
+			}
+		};
+
+		std::vector<Eigen::MatrixXd> fockMatrices;
+		std::vector<Eigen::MatrixXd> deltaDensities(nrChannels);
+		std::vector<Eigen::MatrixXd> response;
+
+		// the Fock matrices for the density matrices that are set, in the molecular orbitals basis, and the gradient, returns the energy
+		auto evaluate = [&](bool trial, Eigen::VectorXd& gradient)
+		{
+			CalculateFockMatrices(fockMatrices);
+			++nrFockBuilds;
+
+			gradient.resize(nrParameters);
+			for (size_t ch = 0; ch < nrChannels; ++ch)
+			{
+				RotationChannel& channel = channels[ch];
+				const Eigen::MatrixXd& C = trial ? channel.trialC : channel.C;
+				Eigen::MatrixXd& MOFock = trial ? channel.trialMOFock : channel.MOFock;
+
+				MOFock.noalias() = C.transpose() * fockMatrices[ch] * C;
+				rotation(gradient, channel) = 2. * spinChannels[ch].occupation * MOFock.bottomLeftCorner(channel.nrVirtual, channel.nrOccupied);
+			}
+
+			return GetTotalEnergy();
+		};
+
+		// the Hessian product, for the current orbitals
+		auto hessianProduct = [&](const Eigen::VectorXd& v, Eigen::VectorXd& result)
+		{
+			// G is linear in the density, the density change is built for the normalized v, otherwise for small ones the integral screening would matter
+			const double norm = v.norm();
+			const double scale = norm > 0 ? 1. / norm : 0;
+
+			for (size_t ch = 0; ch < nrChannels; ++ch)
+			{
+				const RotationChannel& channel = channels[ch];
+				const auto Co = channel.C.leftCols(channel.nrOccupied);
+				const auto Cv = channel.C.rightCols(channel.nrVirtual);
+
+				const Eigen::MatrixXd half = scale * spinChannels[ch].occupation * Cv * constRotation(v, channel) * Co.transpose();
+				deltaDensities[ch] = half + half.transpose();
+			}
+
+			CalculateResponseFockMatrices(deltaDensities, response);
+			++nrFockBuilds;
+
+			result.resize(nrParameters);
+			for (size_t ch = 0; ch < nrChannels; ++ch)
+			{
+				const RotationChannel& channel = channels[ch];
+				const auto Co = channel.C.leftCols(channel.nrOccupied);
+				const auto Cv = channel.C.rightCols(channel.nrVirtual);
+				const auto p = constRotation(v, channel);
+
+				rotation(result, channel) = 2. * spinChannels[ch].occupation * (channel.MOFock.bottomRightCorner(channel.nrVirtual, channel.nrVirtual) * p - p * channel.MOFock.topLeftCorner(channel.nrOccupied, channel.nrOccupied)
+					+ norm * (Cv.transpose() * response[ch] * Co));
+			}
+		};
+
+		Eigen::VectorXd gradient;
+		Eigen::VectorXd trialGradient;
+		Eigen::VectorXd hessianDiagonal(nrParameters);
+		Eigen::VectorXd preconditioner;
+		Eigen::VectorXd x, r, z, p, Hp, Hx;
+		Eigen::MatrixXd K, R;
+
+		// the lowest eigenvalue of the Hessian, with the block Davidson method, for the stability of a converged point
+		// the Hessian is block diagonal in the symmetry of the rotations and the diagonal preconditioner keeps the search in the blocks of the start vectors
+		// so it starts from several ones: the rotations with the lowest diagonal elements, or the softest rotations of a stable neighbouring point
+		// the Rayleigh quotient is an upper bound for the lowest eigenvalue, so the search stops as soon as it's negative, with the direction and its Hessian product
+		// if the search does not get there in maxMicroIterations products, the point is taken as stable
+		std::vector<Eigen::VectorXd> subspace;
+		std::vector<Eigen::VectorXd> subspaceProducts;
+		std::vector<Eigen::VectorXd> startVectors;
+		Eigen::VectorXd negativeDirection, negativeProduct;
+		Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> subspaceSolver;
+
+		auto addToSubspace = [&](Eigen::VectorXd t) -> bool
+		{
+			// twice, for the rounding errors
+			for (int pass = 0; pass < 2; ++pass)
+				for (const auto& v : subspace)
+					t -= v.dot(t) * v;
+
+			const double norm = t.norm();
+			if (norm < 1E-8) return false;
+
+			subspace.push_back(t / norm);
+			subspaceProducts.emplace_back();
+			hessianProduct(subspace.back(), subspaceProducts.back());
+
+			return true;
+		};
+
+		auto findNegativeCurvature = [&]() -> bool
+		{
+			subspace.clear();
+			subspaceProducts.clear();
+
+			for (const auto& v : startVectors)
+				if (static_cast<int>(subspace.size()) < maxMicroIterations) addToSubspace(v);
+
+			while (!subspace.empty() && !terminate)
+			{
+				const Eigen::Index size = static_cast<Eigen::Index>(subspace.size());
+				Eigen::MatrixXd subspaceHessian(size, size);
+				for (Eigen::Index i = 0; i < size; ++i)
+					for (Eigen::Index j = 0; j <= i; ++j)
+						subspaceHessian(i, j) = subspaceHessian(j, i) = 0.5 * (subspace[i].dot(subspaceProducts[j]) + subspace[j].dot(subspaceProducts[i]));
+
+				subspaceSolver.compute(subspaceHessian);
+				const double lowest = subspaceSolver.eigenvalues()(0);
+
+				negativeDirection.setZero(nrParameters);
+				negativeProduct.setZero(nrParameters);
+				for (Eigen::Index i = 0; i < size; ++i)
+				{
+					negativeDirection += subspaceSolver.eigenvectors()(i, 0) * subspace[i];
+					negativeProduct += subspaceSolver.eigenvectors()(i, 0) * subspaceProducts[i];
+				}
+
+				if (lowest < -1E-4) return true;
+
+				// a positive eigenvalue, once the residual is small compared with it
+				// or small enough to rule out one below the threshold, for the zero eigenvalues of a solution that breaks a continuous symmetry
+				const Eigen::VectorXd residual = negativeProduct - lowest * negativeDirection;
+				if (residual.norm() < std::max(0.1 * lowest, 1E-4) || static_cast<int>(subspace.size()) >= maxMicroIterations) break;
+
+				// the Davidson correction, with the diagonal as the approximation of the Hessian
+				Eigen::VectorXd t(nrParameters);
+				for (Eigen::Index k = 0; k < nrParameters; ++k)
+				{
+					const double denominator = hessianDiagonal(k) - lowest;
+					t(k) = residual(k) / (std::abs(denominator) > 0.01 ? denominator : 0.01);
+				}
+
+				if (!addToSubspace(t)) break;
+			}
+
+			return false;
+		};
+
+		// the start vectors for the stability check, from the softest rotations of the neighbouring point if they are set, only for the first check
+		// otherwise, or if they do not fit the current orbitals, the rotations with the lowest diagonal elements
+		auto setStartVectors = [&](bool useGuess)
+		{
+			startVectors.clear();
+
+			const Eigen::MatrixXd& S = overlapMatrix.matrix;
+			if (useGuess)
+				for (const auto& guess : checkStartRotations)
+				{
+					bool fits = guess.size() == nrChannels;
+					for (size_t ch = 0; fits && ch < nrChannels; ++ch)
+						fits = guess[ch].rows() == nrLevels && guess[ch].cols() == nrLevels;
+
+					if (!fits)
+					{
+						startVectors.clear();
+						break;
+					}
+
+					Eigen::VectorXd v(nrParameters);
+					for (size_t ch = 0; ch < nrChannels; ++ch)
+					{
+						const RotationChannel& channel = channels[ch];
+
+						// the rotation in the AO basis does not depend on the phases and the order of the orbitals, Cv^T * S * X * S * Co gives it back in the current ones
+						rotation(v, channel) = channel.C.rightCols(channel.nrVirtual).transpose() * S * guess[ch] * S * channel.C.leftCols(channel.nrOccupied);
+					}
+
+					startVectors.emplace_back(std::move(v));
+				}
+
+			// the lowest diagonal one, in any case
+			const Eigen::Index nrLowest = min(nrParameters, static_cast<Eigen::Index>(startVectors.empty() ? 8 : 1));
+
+			std::vector<Eigen::Index> indices(nrParameters);
+			for (Eigen::Index k = 0; k < nrParameters; ++k) indices[k] = k;
+			std::partial_sort(indices.begin(), indices.begin() + nrLowest, indices.end(), [&](Eigen::Index i, Eigen::Index j) { return hessianDiagonal(i) < hessianDiagonal(j); });
+
+			for (Eigen::Index k = 0; k < nrLowest; ++k)
+				startVectors.emplace_back(Eigen::VectorXd::Unit(nrParameters, indices[k]));
+		};
+
+		// after a passed check, the lowest Ritz vectors in the AO basis, for the check of the next point of a scan
+		auto saveSoftRotations = [&]()
+		{
+			softRotations.clear();
+			softestCurvature = subspace.empty() ? 0 : subspaceSolver.eigenvalues()(0);
+
+			const Eigen::Index nrSaved = min(static_cast<Eigen::Index>(subspace.size()), static_cast<Eigen::Index>(2));
+			for (Eigen::Index k = 0; k < nrSaved; ++k)
+			{
+				Eigen::VectorXd v = Eigen::VectorXd::Zero(nrParameters);
+				for (size_t i = 0; i < subspace.size(); ++i)
+					v += subspaceSolver.eigenvectors()(i, k) * subspace[i];
+
+				std::vector<Eigen::MatrixXd> rotationAO(nrChannels);
+				for (size_t ch = 0; ch < nrChannels; ++ch)
+				{
+					const RotationChannel& channel = channels[ch];
+					rotationAO[ch] = channel.C.rightCols(channel.nrVirtual) * constRotation(v, channel) * channel.C.leftCols(channel.nrOccupied).transpose();
+				}
+
+				softRotations.emplace_back(std::move(rotationAO));
+			}
+		};
+
+		setDensities(false);
+		double energy = evaluate(false, gradient);
+		double radius = trustRadius;
+
+		bool res = false;
+
+		// a saddle point found is remembered while a step along it is rejected, a limited number of searches for them
+		bool negativeCurvature = false;
+		int stabilityChecks = 0;
+
+		for (; iter < maxIterations; ++iter)
+		{
+			// the Hessian diagonal without the electron-electron part, 2 * occupation * (F(a, a) - F(i, i)), kept positive for the preconditioner
+			for (size_t ch = 0; ch < nrChannels; ++ch)
+			{
+				const RotationChannel& channel = channels[ch];
+				auto diagonal = rotation(hessianDiagonal, channel);
+
+				for (Eigen::Index i = 0; i < channel.nrOccupied; ++i)
+					for (Eigen::Index a = 0; a < channel.nrVirtual; ++a)
+						diagonal(a, i) = 2. * spinChannels[ch].occupation * (channel.MOFock(channel.nrOccupied + a, channel.nrOccupied + a) - channel.MOFock(i, i));
+			}
+			preconditioner = hessianDiagonal.cwiseMax(0.1);
+
+			const double gradientNorm = gradient.norm();
+
+			// the same as the norm of the DIIS commutator error
+			lastErrorEst = gradientNorm / sqrt(2.);
+			const bool gradientConverged = lastErrorEst < diisConvergence;
+
+			if (gradientConverged && !negativeCurvature)
+			{
+				if (!stabilityCheck || stabilityChecks >= 10 || terminate)
+				{
+					res = true;
+					break;
+				}
+
+				setStartVectors(0 == stabilityChecks);
+				++stabilityChecks;
+				negativeCurvature = findNegativeCurvature();
+
+				if (!negativeCurvature)
+				{
+					saveSoftRotations();
+					res = true;
+					break;
+				}
+
+				TRACE("Saddle point, the Hessian has a negative eigenvalue, energy: %f\n", energy);
+			}
+
+			if (terminate) break;
+
+			if (gradientConverged)
+			{
+				// the step along the negative curvature direction, downhill, to the trust region boundary
+				const double direction = gradient.dot(negativeDirection) > 0 ? -radius : radius;
+
+				x = direction * negativeDirection;
+				Hx = direction * negativeProduct;
+			}
+			else
+			{
+				// the conjugate gradient is stopped early while the gradient is big, more exactly as it gets smaller
+				const double tolerance = min(0.5, sqrt(gradientNorm)) * gradientNorm;
+
+				x.setZero(nrParameters);
+				Hx.setZero(nrParameters);
+				r = gradient;
+				z = r.cwiseQuotient(preconditioner);
+				p = -z;
+				double rz = r.dot(z);
+
+				for (int micro = 0; micro < maxMicroIterations; ++micro)
+				{
+					hessianProduct(p, Hp);
+
+					const double curvature = p.dot(Hp);
+					const double step = curvature > 0 ? rz / curvature : 0;
+
+					if (curvature <= 0 || (x + step * p).norm() >= radius)
+					{
+						// along p up to the trust region boundary
+						const double pp = p.squaredNorm();
+						const double xp = x.dot(p);
+						const double tau = (sqrt(max(xp * xp + pp * (radius * radius - x.squaredNorm()), 0.)) - xp) / pp;
+
+						x += tau * p;
+						Hx += tau * Hp;
+						break;
+					}
+
+					x += step * p;
+					Hx += step * Hp;
+					r += step * Hp;
+
+					if (r.norm() < tolerance) break;
+
+					z = r.cwiseQuotient(preconditioner);
+					const double rzNew = r.dot(z);
+					p = -z + (rzNew / rz) * p;
+					rz = rzNew;
+				}
+			}
+
+			const double predicted = gradient.dot(x) + 0.5 * x.dot(Hx);
+			const double stepNorm = x.norm();
+
+			for (size_t ch = 0; ch < nrChannels; ++ch)
+			{
+				RotationChannel& channel = channels[ch];
+				const auto kappa = constRotation(x, channel);
+
+				K.setZero(nrLevels, nrLevels);
+				K.bottomLeftCorner(channel.nrVirtual, channel.nrOccupied) = kappa;
+				K.topRightCorner(channel.nrOccupied, channel.nrVirtual) = -kappa.transpose();
+
+				RotationMatrix(K, R);
+				channel.trialC.noalias() = channel.C * R;
+			}
+
+			setDensities(true);
+			const double trialEnergy = evaluate(true, trialGradient);
+			++nrIterations;
+
+			TRACE("Second order step: %d Energy: %f Gradient: %g\n", iter, trialEnergy, gradientNorm);
+
+			// close to convergence the energy changes are at the rounding errors level, the quadratic model is good there anyway
+			const bool noise = abs(predicted) < 1E-10;
+			const double ratio = predicted < 0 ? (trialEnergy - energy) / predicted : 0;
+
+			if (!noise)
+			{
+				if (ratio < 0.25) radius = 0.25 * stepNorm;
+				else if (ratio > 0.75 && stepNorm > 0.99 * radius) radius = min(2. * radius, maxTrustRadius);
+			}
+
+			if (noise || ratio > 0.01)
+			{
+				for (RotationChannel& channel : channels)
+				{
+					channel.C.swap(channel.trialC);
+					channel.MOFock.swap(channel.trialMOFock);
+				}
+				gradient.swap(trialGradient);
+				energy = trialEnergy;
+				negativeCurvature = false;
+			}
+			else
+			{
+				// rejected, back to the current orbitals
+				setDensities(false);
+				totalEnergy = energy;
+			}
+		}
+
+		// the semicanonical orbitals, with the Fock matrix diagonalized in the occupied and in the virtual spaces, which does not change the densities
+		Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver;
+		HOMOEnergy = -std::numeric_limits<double>::infinity();
+
+		for (size_t ch = 0; ch < nrChannels; ++ch)
+		{
+			const RotationChannel& channel = channels[ch];
+			Eigen::MatrixXd& C = *spinChannels[ch].C;
+			Eigen::VectorXd& eigenvals = *spinChannels[ch].eigenvals;
+
+			C.resize(nrLevels, nrLevels);
+			eigenvals.resize(nrLevels);
+
+			for (int space = 0; space < 2; ++space)
+			{
+				const Eigen::Index first = space ? channel.nrOccupied : 0;
+				const Eigen::Index size = space ? channel.nrVirtual : channel.nrOccupied;
+				if (!size) continue;
+
+				solver.compute(channel.MOFock.block(first, first, size, size));
+				const Eigen::MatrixXd rotated = channel.C.middleCols(first, size) * solver.eigenvectors();
+
+				for (Eigen::Index k = 0; k < size; ++k)
+				{
+					C.col(channel.levels[first + k]) = rotated.col(k);
+					eigenvals(channel.levels[first + k]) = solver.eigenvalues()(k);
+				}
+			}
+
+			HOMOEnergy = max(HOMOEnergy, channel.nrOccupied ? eigenvals(channel.levels[channel.nrOccupied - 1]) : 0);
+		}
+
+		return res;
+	}
+
+
+	void HartreeFockAlgorithm::RotationMatrix(const Eigen::MatrixXd& K, Eigen::MatrixXd& R)
+	{
+		// scaled down until the norm is below 1/4, where the series converges fast, the result is squared back
+		int squarings = 0;
+		double scale = 1;
+		const double norm = K.norm();
+		while (norm * scale > 0.25)
+		{
+			scale *= 0.5;
+			++squarings;
+		}
+
+		R = Eigen::MatrixXd::Identity(K.rows(), K.cols());
+		Eigen::MatrixXd term = R;
+
+		for (int k = 1; k <= 12; ++k)
+		{
+			term = term * K * (scale / k);
+			R += term;
+		}
+
+		for (int i = 0; i < squarings; ++i)
+			R = R * R;
+	}
+
+
 	void HartreeFockAlgorithm::NormalizeC(Eigen::MatrixXd& C, const std::vector<bool>& occupied)
 	{
 		assert(occupied.size() <= C.cols());
@@ -211,6 +948,34 @@ namespace HartreeFock {
 	}
 
 
+	void HartreeFockAlgorithm::GetOccupiedOrbitals(std::vector<Eigen::MatrixXd>& orbitals, std::vector<double>& occupations)
+	{
+		std::vector<SpinChannel> channels;
+		GetSpinChannels(channels);
+
+		orbitals.resize(channels.size());
+		occupations.resize(channels.size());
+
+		for (size_t i = 0; i < channels.size(); ++i)
+		{
+			const Eigen::MatrixXd& C = *channels[i].C;
+			const std::vector<bool>& occupied = *channels[i].occupied;
+
+			const Eigen::Index nrLevels = min(C.cols(), static_cast<Eigen::Index>(occupied.size()));
+
+			Eigen::Index nrOccupied = 0;
+			for (Eigen::Index level = 0; level < nrLevels; ++level)
+				if (occupied[level]) ++nrOccupied;
+
+			orbitals[i].resize(C.rows(), nrOccupied);
+			for (Eigen::Index level = 0, col = 0; level < nrLevels; ++level)
+				if (occupied[level]) orbitals[i].col(col++) = C.col(level);
+
+			occupations[i] = channels[i].occupation;
+		}
+	}
+
+
 	Vector3D<double> HartreeFockAlgorithm::GetNuclearMoment() const
 	{
 		Vector3D<double> moment;
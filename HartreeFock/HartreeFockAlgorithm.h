@@ -9,6 +9,8 @@
 
 #include "BoysFunction.h"
 
+#include "DIIS.h"
+
 
 #include <atomic>
 
@@ -41,6 +43,89 @@ namespace HartreeFock {
 
 		bool inited;
 
+		// the number of Fock matrix builds since the last full one, including it, 0 forces a full build
+		int fockBuildsSinceFull;
+		bool lastFockBuildIncremental;
+		bool previousFockBuildIncremental;
+
+		// set when a step with an incremental build meets the convergence criteria, all the following builds are full ones
+		bool onlyFullFockBuilds;
+
+		// tells if the next integral direct Fock matrix build should be a full one or an incremental one, counts the incremental ones
+		bool FullFockBuild();
+
+		// the convergence test of a step, for the energy change since the previous step
+		// the incremental Fock matrix builds accumulate the screening and the rounding errors, the energy drifts by more than energyConvergence between them and across a full build
+		// so the energy change counts only between two full builds, an incremental step that gets close to the other criteria switches to full builds and returns false
+		bool Converged(double energyChange, double energyLimit, double rmsD, bool checkError);
+
+		// set by Init if the initial densities can be used, then the first step builds the Fock matrices from them
+		bool densityGuess;
+
+		// set while polishing the DIIS result, the steps compute the commutator error for the convergence check without extrapolating
+		bool polishing;
+
+		// the matrices a step works with for one spin, kept between the steps so that once they have the right size the iterations do not allocate
+		struct StepWorkspace
+		{
+			Eigen::MatrixXd FockMatrix;
+			Eigen::MatrixXd FockTransformed;
+			Eigen::MatrixXd VtFockMatrix;
+			Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigenSolver;
+			Eigen::MatrixXd occupiedC;
+			Eigen::MatrixXd newDensityMatrix;
+
+			// for the DIIS error
+			Eigen::MatrixXd densityFockProduct;
+			Eigen::MatrixXd errorMatrix;
+		};
+
+		// the same for the electron-electron part of the Fock matrices
+		std::vector<const Eigen::MatrixXd*> coulombDensities;
+		std::vector<const Eigen::MatrixXd*> exchangeDensities;
+		std::vector<Eigen::MatrixXd> coulomb;
+		std::vector<Eigen::MatrixXd> exchange;
+
+		// diagonalizes the Fock matrix from the workspace in the orthogonalized basis and transforms the eigenvectors back into the AO basis
+		void SolveFockEquation(StepWorkspace& workspace, Eigen::VectorXd& eigenvals, Eigen::MatrixXd& C) const;
+
+		// the new density matrix, occupation * sum over the occupied levels of C(i, level) * C(j, level), as a single matrix product on the occupied columns of C
+		static void CalculateDensityMatrix(StepWorkspace& workspace, const Eigen::MatrixXd& C, const std::vector<bool>& occupied, double occupation);
+
+		// the DIIS error into the workspace, the density matrix should commute with the Fock matrix: S * D * F - F * D * S
+		// it's transformed into the orthonormal basis, where the errors of different steps compare without the overlap in the way
+		void CalculateDIISErrorMatrix(StepWorkspace& workspace, const Eigen::MatrixXd& FockMatrix, const Eigen::MatrixXd& DensityMatrix) const;
+
+		// the second order solver works with the spin channels, one for the restricted method with the total density, two for the unrestricted one
+		struct SpinChannel
+		{
+			Eigen::MatrixXd* C;
+			Eigen::VectorXd* eigenvals;
+			Eigen::MatrixXd* DensityMatrix;
+			const std::vector<bool>* occupied;
+			double occupation;
+		};
+
+		virtual void GetSpinChannels(std::vector<SpinChannel>& channels) = 0;
+
+		// full builds of the Fock matrices of the channels for their current density matrices, sets the total energy for them
+		virtual void CalculateFockMatrices(std::vector<Eigen::MatrixXd>& fockMatrices) = 0;
+
+		// the electron-electron parts of the Fock matrices for changes of the density matrices of the channels, for the orbital Hessian products
+		virtual void CalculateResponseFockMatrices(const std::vector<Eigen::MatrixXd>& deltaDensities, std::vector<Eigen::MatrixXd>& response) = 0;
+
+		// the trust region Newton iterations on the orbital rotations, starting from the current orbitals, counting the steps in iter
+		// returns true if the orbital gradient got below the convergence limit
+		// with stabilityCheck set, a converged point is accepted only if the orbital Hessian has no negative eigenvalue, otherwise the iterations go downhill along it
+		bool SecondOrderSolve(int& iter);
+
+		// the stabilityGuess taken over by Calculate, for its first stability check
+		std::vector<std::vector<Eigen::MatrixXd>> checkStartRotations;
+		double checkStartCurvature;
+
+		// the rotation matrix exp(K) for the antisymmetric K, with scaling and squaring of the Taylor series
+		static void RotationMatrix(const Eigen::MatrixXd& K, Eigen::MatrixXd& R);
+
 	public:
 		GaussianIntegrals::IntegralsRepository integralsRepository;
 
@@ -48,6 +133,14 @@ namespace HartreeFock {
 
 		double initGuess;
 
+		// if set before Init, the first step builds the Fock matrices from these densities instead of using initGuess
+		// either the total density, split equally between the spins by the unrestricted method, or the alpha and the beta ones
+		std::vector<Eigen::MatrixXd> initialDensities;
+
+		// if set before Init, the electron-electron integrals are taken from it instead of being computed, for example when they were computed on another thread
+		// it must be for the same molecule at the same geometry and it's not used in the integral direct mode, Init sets it back to null
+		GaussianIntegrals::IntegralsRepository* precomputedIntegrals;
+
 		std::atomic_bool terminate;
 
 		bool converged;
@@ -59,8 +152,61 @@ namespace HartreeFock {
 		bool UseDIIS;
 		int maxDIISiterations;
 
+		// after DIIS converges, at most that many steps without it, stopping when the convergence criteria are met and the error is stable
+		// if they are not met at the end, the result is not considered converged and the damped iterations continue up to maxIterations
 		int normalIterAfterDIIS;
 
+		// the steps the convergence criteria must hold after DIIS without the error getting more than twice larger, otherwise it's leaving a saddle point
+		int polishingStableIterations;
+
+		// if the DIIS error does not get 10% better for that many steps, DIIS is abandoned for the damped iterations, 0 disables it
+		int diisStagnationIterations;
+
+		// the extrapolator, the subspace size and the conditioning limit can be set before Calculate
+		DIIS diis;
+
+		// 0 - the Step loop with DIIS, 1 - the second order solver instead, from the initial guess orbitals, 2 - the second order solver as a finisher when DIIS stagnates
+		// each second order step costs a few Fock builds for the Hessian products, so 1 pays off only where DIIS needs hundreds of steps
+		// in 6-31++G** the oxygen molecule takes 175 Fock builds instead of 323, but water 61 instead of 28, see Test::TestSecondOrder
+		int secondOrderSCF;
+
+		// the second order solver: the trust radius it starts with and the limit for it, for the norm of the orbital rotation parameters
+		double trustRadius;
+		double maxTrustRadius;
+
+		// the limit for the conjugate gradient iterations solving for a second order step, each one is a Fock matrix build
+		int maxMicroIterations;
+
+		// the converged solution is checked with the lowest eigenvalue of the orbital Hessian, DIIS and the damped steps can stop on a saddle point
+		// if it's negative the second order solver goes downhill along its eigenvector, whatever secondOrderSCF is
+		// for a stable point it costs about 10 Fock builds, in 6-31++G** water takes 41 instead of 30, the oxygen molecule 290 instead of 278
+		bool stabilityCheck;
+
+		// if set before Calculate, the first stability check starts from these rotations instead of the ones with the lowest Hessian diagonal elements
+		// for a scan they are the softRotations of the previous point, set by the warm start, so the check is short, Calculate takes them over
+		// with the lowest eigenvalue that came with them, if it's far enough from zero the check is skipped, the next point does it
+		std::vector<std::vector<Eigen::MatrixXd>> stabilityGuess;
+		double stabilityGuessCurvature;
+
+		// the lowest Hessian eigenvectors from the last passed stability check, as the rotation generators in the AO basis for each spin channel, Cv * kappa * Co^T
+		// and the lowest eigenvalue, 0 if the check was skipped, the rotations are passed on then, empty if there was no check
+		std::vector<std::vector<Eigen::MatrixXd>> softRotations;
+		double softestCurvature;
+
+		// the number of Fock matrix builds done by the last Calculate, including the ones for the orbital Hessian products of the second order solver
+		int nrFockBuilds;
+
+		// the number of steps done by the last Calculate, the ones after the DIIS convergence and if DIIS was abandoned
+		int nrIterations;
+		int nrPolishingIterations;
+		bool diisStagnated;
+
+		// integral direct mode only: the Fock matrix is built from the change of the density since the previous build, G(D) = G(Dold) + G(D - Dold)
+		// the density change gets small close to convergence, so the density weighted screening skips most of the quartets
+		// the screening errors accumulate, so a full build is done each that many builds, 0 or 1 means always full builds
+		// once a step meets the convergence criteria the builds are full ones until the end of Calculate, the convergence is confirmed on them
+		int fullFockBuildInterval;
+
 		HartreeFockAlgorithm(int iterations = 3000);
 		virtual ~HartreeFockAlgorithm();
 		
@@ -88,6 +234,15 @@ namespace HartreeFock {
 
 		virtual Vector3D<double> GetMoment() const = 0;
 
+		// the occupied orbitals of each spin channel as columns, with their occupation, after Calculate
+		// one channel with occupation 2 for the restricted method, alpha and beta with occupation 1 for the unrestricted one
+		void GetOccupiedOrbitals(std::vector<Eigen::MatrixXd>& orbitals, std::vector<double>& occupations);
+
+		const Eigen::MatrixXd& GetOverlapMatrix() const
+		{
+			return overlapMatrix.matrix;
+		}
+
 	protected:
 		static double DiffDensityMatrices(const Eigen::MatrixXd& oldP, const Eigen::MatrixXd& newP);
 		void NormalizeC(Eigen::MatrixXd& C, const std::vector<bool>& occupied);
@@ -126,6 +126,9 @@ BOOL CHartreeFockDoc::OnNewDocument()
 	basis6_311plusplusGstar.Load("6-311++g_st_.0.nw");
 	basis6_311plusplusGstarstar.Load("6-311++g_st__st_.0.nw");
 
+	// the atomic densities computed by the previous runs, if any
+	atomicDensities.Load("atomicdensities.txt");
+
 
 #ifdef _DEBUG
 	//	Tests tests;
@@ -137,6 +140,24 @@ BOOL CHartreeFockDoc::OnNewDocument()
 	//Test test;
 	//test.TestWater("c:\\tests\\h2o.txt", "c:\\tests\\sh2o.dat", "c:\\tests\\th2o.dat", "c:\\tests\\vh2o.dat", "c:\\tests\\erih2o.dat", true);
 	//test.TestMethane("c:\\tests\\ch4.txt", "c:\\tests\\sch4.dat", "c:\\tests\\tch4.dat", "c:\\tests\\vch4.dat", "c:\\tests\\erich4.dat", true);
+	// the same, with the primitive pairs screening, STO3G is compact so the threshold must be big to skip something
+	//test.TestWater("c:\\tests\\h2o_screened.txt", "c:\\tests\\sh2o.dat", "c:\\tests\\th2o.dat", "c:\\tests\\vh2o.dat", "c:\\tests\\erih2o.dat", true, 1E-6);
+	//test.TestMethane("c:\\tests\\ch4_screened.txt", "c:\\tests\\sch4.dat", "c:\\tests\\tch4.dat", "c:\\tests\\vch4.dat", "c:\\tests\\erich4.dat", true, 1E-6);
+	//Test::TestBoysFunctions("c:\\tests\\boys.txt");
+	//Test test631("6-31++g_st__st_.1.nw");
+	//test631.TestIntegralDirect("c:\\tests\\direct.txt");
+	//test631.TestFockBuild("c:\\tests\\fockbuild.txt");
+	//test631.TestStepAllocations("c:\\tests\\stepallocations.txt");
+	//test631.TestDIIS("c:\\tests\\diis.txt");
+	//test631.TestEDIIS("c:\\tests\\ediis.txt");
+	//test631.TestSecondOrder("c:\\tests\\secondorder.txt");
+	//test631.TestSAD("c:\\tests\\sad.txt");
+	//test631.TestBasisProjection("c:\\tests\\projection.txt");
+	//test631.TestWarmStart("c:\\tests\\warmstart.txt");
+	//test631.TestScanScheduler("c:\\tests\\scanscheduler.txt");
+	//test631.TestIntegralsReuse("c:\\tests\\integralsreuse.txt");
+	//test631.TestIntegralsPipeline("c:\\tests\\integralspipeline.txt");
+	//test631.TestAdaptiveScan("c:\\tests\\adaptivescan.txt");
 
 	// Example for H2O and He (now with some other basis, too):
 
@@ -373,21 +394,14 @@ void CHartreeFockDoc::StartThreads()
 
 	runningThreads = nrThreads;
 
+	// the points are tasks pulled by the threads, together with the two atoms, instead of splitting the range in equal intervals
+	// the adaptive scan refines the curve that is displayed, the results are in eV
 	const double step = (options.XMaxBondLength - options.XMinBondLength) / options.numberOfPoints;
-	const double interval = (options.XMaxBondLength - options.XMinBondLength) / nrThreads;
+	scanScheduler.Init(options.XMinBondLength, step, options.numberOfPoints + 1, nrThreads, options.adaptiveScan ? options.adaptiveTolerance * Hartree : 0, options.useSplines, 1 == options.DisplayHOMOEnergy);
 
-	double start = options.XMinBondLength;
 	for (unsigned int i = 0; i < nrThreads; ++i)
 	{
-		threadsList.emplace_back(std::make_unique<HartreeFockThread>(options, this, start, start + interval + (i == nrThreads - 1 ? step : 0), step));
-
-		if (0 == i)
-			threadsList.back()->computeFirstAtom = true;
-
-		if (nrThreads - 1 == i)
-			threadsList.back()->computeSecondAtom = true;
-
-		start += interval;
+		threadsList.emplace_back(std::make_unique<HartreeFockThread>(options, this, &scanScheduler, i));
 
 		threadsList.back()->Start();
 	}
@@ -400,39 +414,47 @@ void CHartreeFockDoc::StopThreads(bool cancel)
 {
 	for (auto& thrd : threadsList) thrd->Terminate();
 
+	// the threads waiting for the next round of an adaptive scan
+	scanScheduler.Cancel();
 
 	results.clear();
+	iterations.clear();
 
 	convergenceProblem = false;
 
 
 	atomsEnergy = 0;
 
-	// now join them then get the data out of them
+	// now join them then get the data out of the scheduler, in the bond length order
 	for (auto& thrd : threadsList)
 	{
 		thrd->join();
 
-		if (!cancel)
-		{
-			if (thrd->computeFirstAtom)
-			{
-
-				if (options.twoAtom1) atomsEnergy += thrd->firstAtomEnergy * 2;
-				else atomsEnergy += thrd->firstAtomEnergy;
-			}
+		if (!thrd->Converged()) convergenceProblem = true;
+	}
 
-			if (thrd->computeSecondAtom)
-				atomsEnergy += thrd->secondAtomEnergy;
+	if (!cancel)
+	{
+		scanScheduler.GetResults(results, iterations);
 
-			results.insert(results.end(), thrd->results.begin(), thrd->results.end());
-		}
+		if (options.twoAtom1) atomsEnergy += scanScheduler.GetFirstAtomEnergy() * 2;
+		else atomsEnergy += scanScheduler.GetFirstAtomEnergy();
 
-		if (!thrd->Converged()) convergenceProblem = true;
+		atomsEnergy += scanScheduler.GetSecondAtomEnergy();
 	}
 
 	threadsList.clear();
 
+	if (atomicDensities.IsModified()) atomicDensities.Save("atomicdensities.txt");
+
+	int totalIterations = 0;
+	for (const auto& point : iterations)
+	{
+		TRACE("Bond length: %f Iterations: %d Polishing: %d\n", std::get<0>(point), std::get<1>(point), std::get<2>(point));
+		totalIterations += std::get<1>(point);
+	}
+	TRACE("Total iterations: %d\n", totalIterations);
+
 	SetChartData();
 
 	if (cancel) SetTitle(L"Canceled");
@@ -445,6 +467,25 @@ void CHartreeFockDoc::StopThreads(bool cancel)
 	}
 }
 
+void CHartreeFockDoc::UpdateResults()
+{
+	// the binding energy cannot be shown before the atoms are done
+	if (2 == options.DisplayHOMOEnergy)
+	{
+		if (!scanScheduler.AtomsDone()) return;
+
+		atomsEnergy = scanScheduler.GetFirstAtomEnergy() * (options.twoAtom1 ? 2 : 1) + scanScheduler.GetSecondAtomEnergy();
+	}
+
+	const size_t nrResults = results.size();
+	if (scanScheduler.GetResults(results, iterations) == nrResults) return;
+
+	SetChartData();
+
+	CHartreeFockView* view = GetView();
+	if (view) view->Invalidate();
+}
+
 CHartreeFockView* CHartreeFockDoc::GetView()
 {
 	POSITION pos = GetFirstViewPosition();
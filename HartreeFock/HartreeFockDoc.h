@@ -6,6 +6,7 @@
 #pragma once
 
 #include "Basis.h"
+#include "AtomicDensities.h"
 
 #include "Chart.h"
 
@@ -54,6 +55,9 @@ public:
 	Chemistry::Basis basis6_311plusplusGstar;
 	Chemistry::Basis basis6_311plusplusGstarstar;
 
+	// for the superposition of atomic densities initial guess, shared by the threads
+	HartreeFock::AtomicDensities atomicDensities;
+
 	Chart m_Chart;
 
 	std::atomic_int runningThreads;
@@ -62,7 +66,11 @@ public:
 
 	std::list<std::unique_ptr<HartreeFockThread>> threadsList;
 
+	// the scan points and the atoms, pulled by the threads, with the results
+	ScanScheduler scanScheduler;
+
 	std::vector<std::tuple<double, double, double>> results;
+	std::vector<std::tuple<double, int, int>> iterations; // the SCF iterations for each bond length, all and after the DIIS convergence
 	bool convergenceProblem;
 
 	double atomsEnergy;
@@ -102,6 +110,9 @@ public:
 	bool isFinished();
 	void StartThreads();
 	void StopThreads(bool cancel = false);
+
+	// while the threads run, gets the results done so far in the bond length order and updates the chart if there are new ones
+	void UpdateResults();
 	CHartreeFockView* GetView();
 	afx_msg void OnUpdateComputationStart(CCmdUI *pCmdUI);
 	void SetChartBoundsAndTicks();
@@ -4,6 +4,7 @@
 
 #include "RestrictedHartreeFock.h"
 #include "UnrestrictedHartreeFock.h"
+#include "BasisProjection.h"
 
 #include "HartreeFockThread.h"
 #include "HartreeFockDoc.h"
@@ -11,28 +12,14 @@
 
 #include "Constants.h"
 
-HartreeFockThread::HartreeFockThread(const Options& options, CHartreeFockDoc* doc, const double start, const double end, const double step)
-	: m_Doc(doc), m_start(start), m_end(end), m_step(step), terminate(false), converged(true),
-	computeFirstAtom(false), computeSecondAtom(false), firstAtomEnergy(0), secondAtomEnergy(0)
-{
-	if (options.restricted && options.alphaElectrons == options.betaElectrons) {
-		algorithm = new HartreeFock::RestrictedHartreeFock(options.iterations);
-	}
-	else {
-		HartreeFock::UnrestrictedHartreeFock *alg = new HartreeFock::UnrestrictedHartreeFock(options.iterations);
-		alg->addAsymmetry = options.addAsymmetry;
-		alg->asymmetry = options.asymmetry;
-		algorithm = alg;
-	}
+#include <thread>
 
-	algorithm->alpha = options.alpha;
-	algorithm->initGuess = options.initialGuess;
-
-	algorithm->integralsRepository.useLotsOfMemory = options.useLotsOfMemory;
+HartreeFockThread::HartreeFockThread(const Options& options, CHartreeFockDoc* doc, ScanScheduler* scheduler, unsigned int index)
+	: terminate(false), m_Doc(doc), atomAlgorithm(nullptr), m_scheduler(scheduler), m_index(index), converged(true), opt(options)
+{
+	algorithm = CreateAlgorithm(options.restricted && options.alphaElectrons == options.betaElectrons);
 
-	algorithm->maxDIISiterations = options.maxDIISiterations;
-	algorithm->UseDIIS = options.useDIIS;
-	algorithm->normalIterAfterDIIS = options.normalIterAfterDIIS;
+	warmStart.extrapolation = max(options.warmStart - 1, 0);
 
 	CT2CA psz1(options.m_atom1);
 	std::string str1(psz1);
@@ -46,51 +33,7 @@ HartreeFockThread::HartreeFockThread(const Options& options, CHartreeFockDoc* do
 
 	// construct the molecule
 
-	Chemistry::Basis* basisPtr = nullptr;
-
-	if (0 == options.basis)
-		basisPtr = &doc->basisSTO3G;
-	else if (1 == options.basis)
-		basisPtr = &doc->basisSTO6G;
-	else if (2 == options.basis)
-		basisPtr = &doc->basis3_21G;
-	else if (3 == options.basis)
-		basisPtr = &doc->basis6_21G;
-	else if (4 == options.basis)
-		basisPtr = &doc->basis6_31G;
-	else if (5 == options.basis)
-		basisPtr = &doc->basis6_31Gstar;
-	else if (6 == options.basis)
-		basisPtr = &doc->basis6_31plusGstarstar;
-	else if (7 == options.basis)
-		basisPtr = &doc->basis6_31plusG;
-	else if (8 == options.basis)
-		basisPtr = &doc->basis6_31plusGstar;
-	else if (9 == options.basis)
-		basisPtr = &doc->basis6_31plusplusG;
-	else if (10 == options.basis)
-		basisPtr = &doc->basis6_31plusplusGstar;
-	else if (11 == options.basis)
-		basisPtr = &doc->basis6_31plusplusGstarstar;
-	else if (12 == options.basis)
-		basisPtr = &doc->basis6_311G;
-	else if (13 == options.basis)
-		basisPtr = &doc->basis6_311Gstar;
-	else if (14 == options.basis)
-		basisPtr = &doc->basis6_311Gstarstar;
-	else if (15 == options.basis)
-		basisPtr = &doc->basis6_311plusG;
-	else if (16 == options.basis)
-		basisPtr = &doc->basis6_311plusGstar;
-	else if (17 == options.basis)
-		basisPtr = &doc->basis6_311plusGstarstar;
-	else if (18 == options.basis)
-		basisPtr = &doc->basis6_311plusplusG;
-	else if (19 == options.basis)
-		basisPtr = &doc->basis6_311plusplusGstar;
-	else if (20 == options.basis)
-		basisPtr = &doc->basis6_311plusplusGstarstar;
-
+	const Chemistry::Basis* basisPtr = GetBasis(doc, options.basis);
 
 	if (basisPtr)
 	{
@@ -110,7 +53,6 @@ HartreeFockThread::HartreeFockThread(const Options& options, CHartreeFockDoc* do
 	molecule.betaElectrons = options.betaElectrons;
 
 	molecule.SetIDs();
-	opt = options;
 }
 
 
@@ -123,102 +65,326 @@ HartreeFockThread::~HartreeFockThread()
 
 void HartreeFockThread::Calculate()
 {
-	for (double pos = m_start; pos < m_end; pos += m_step)
+	if (UsePipeline(opt))
+		CalculatePipelined();
+	else
 	{
-		const double dist = pos / Bohr;
+		ScanScheduler::Task lastPoint = { ScanScheduler::TaskType::Point, 0, 0, 0 };
 
-		// adjust the molecule coordinates
-		if (molecule.atoms.size() <= 2)
+		ScanScheduler::Task task;
+		while (!terminate && m_scheduler->GetTask(m_index, task))
 		{
-			molecule.atoms[0].position.X = -dist / 2.;
-			molecule.atoms[0].SetCenterForShells();
-			molecule.atoms[1].position.X = dist / 2.;
-			molecule.atoms[1].SetCenterForShells();
+			if (ScanScheduler::TaskType::Point == task.type) SetGeometry(molecule, task.position);
+
+			RunTask(task, molecule, nullptr, lastPoint);
 		}
-		else
-		{
-			molecule.atoms[0].position.X = dist * cos(angle / 2.);
-			molecule.atoms[0].position.Y = dist * sin(angle / 2.);
+	}
 
-			molecule.atoms[2].position.X = molecule.atoms[0].position.X;
-			molecule.atoms[2].position.Y = -molecule.atoms[0].position.Y;
+	--m_Doc->runningThreads;
+}
 
-			molecule.atoms[0].SetCenterForShells();
-			molecule.atoms[2].SetCenterForShells();
-		}
 
+// the integrals for the next points are computed on a second thread while the SCF of the current point runs on this one
+void HartreeFockThread::CalculatePipelined()
+{
+	pipeline.Start(molecule, algorithm->integralsRepository, GetPipelineThreads(opt), opt.pipelineDepth,
+		[this](ScanScheduler::Task& task) -> bool { return m_scheduler->GetTask(m_index, task); },
+		[this](Systems::Molecule& mol, double position) { SetGeometry(mol, position); });
+
+	if (terminate) pipeline.Stop();
 
-		algorithm->Init(&molecule);
+	ScanScheduler::Task lastPoint = { ScanScheduler::TaskType::Point, 0, 0, 0 };
 
-		double result = algorithm->Calculate();
-		if (opt.computePostHF) result += algorithm->CalculateMp2Energy();
+	while (!terminate)
+	{
+		auto item = pipeline.Pop();
+		if (!item) break;
 
-		if (!algorithm->converged) converged = false;
+		RunTask(item->task, item->molecule, &item->integrals, lastPoint);
 
-		results.emplace_back(std::make_tuple(pos, result * Hartree, algorithm->HOMOEnergy * Hartree));
-		if (terminate) break;
+		// the algorithm points into the molecule of the last point, the previous one can go
+		if (ScanScheduler::TaskType::Point == item->task.type) currentItem = std::move(item);
 	}
 
-	ComputeAtoms();
+	pipeline.Join();
+}
 
 
-	--m_Doc->runningThreads;
+void HartreeFockThread::RunTask(const ScanScheduler::Task& task, Systems::Molecule& mol, GaussianIntegrals::IntegralsRepository* integrals, ScanScheduler::Task& lastPoint)
+{
+	if (ScanScheduler::TaskType::Point == task.type)
+	{
+		// the warm start needs the previous point to be a neighbour, a point stolen from another block starts from the density guess
+		// going through a block backwards is fine, the points are still equally spaced, and so are the ones of an adaptive scan round, if the intervals were the same
+		if (!task.Follows(lastPoint)) warmStart.Clear();
+
+		ComputePoint(task, mol, integrals);
+		lastPoint = task;
+	}
+	else
+	{
+		const double energy = ComputeAtom(ScanScheduler::TaskType::FirstAtom == task.type ? atom1 : atom2);
+		if (!terminate) m_scheduler->SetAtomResult(task.type, energy);
+	}
 }
 
 
-void HartreeFockThread::Terminate()
+void HartreeFockThread::SetGeometry(Systems::Molecule& mol, double position) const
 {
-	algorithm->terminate = true;
-	terminate = true;
+	const double dist = position / Bohr;
+
+	// adjust the molecule coordinates
+	if (mol.atoms.size() <= 2)
+	{
+		mol.atoms[0].position.X = -dist / 2.;
+		mol.atoms[0].SetCenterForShells();
+		mol.atoms[1].position.X = dist / 2.;
+		mol.atoms[1].SetCenterForShells();
+	}
+	else
+	{
+		mol.atoms[0].position.X = dist * cos(angle / 2.);
+		mol.atoms[0].position.Y = dist * sin(angle / 2.);
+
+		mol.atoms[2].position.X = mol.atoms[0].position.X;
+		mol.atoms[2].position.Y = -mol.atoms[0].position.Y;
+
+		mol.atoms[0].SetCenterForShells();
+		mol.atoms[2].SetCenterForShells();
+	}
 }
 
 
-bool HartreeFockThread::Converged() const
+void HartreeFockThread::ComputePoint(const ScanScheduler::Task& task, Systems::Molecule& mol, GaussianIntegrals::IntegralsRepository* integrals)
 {
-	return converged;
+	// the first point, or the one after a point that did not converge, starts from the density guess
+	if (!opt.warmStart || !warmStart.SetGuess(*algorithm, mol))
+		SetDensityGuess(*algorithm, mol);
+
+	algorithm->precomputedIntegrals = integrals;
+	algorithm->Init(&mol);
+
+	double result = algorithm->Calculate();
+	if (opt.computePostHF) result += algorithm->CalculateMp2Energy();
+
+	if (terminate) return;
+
+	if (!algorithm->converged) converged = false;
+
+	if (opt.warmStart)
+	{
+		if (algorithm->converged) warmStart.Add(*algorithm);
+		else warmStart.Clear();
+	}
+
+	m_scheduler->SetPointResult(task.point, result * Hartree, algorithm->HOMOEnergy * Hartree, algorithm->nrIterations, algorithm->nrPolishingIterations);
 }
 
 
-void HartreeFockThread::ComputeAtoms()
+bool HartreeFockThread::UsePipeline(const Options& options)
 {
-	if (!terminate && computeFirstAtom) firstAtomEnergy = ComputeAtom(atom1);
-	if (!terminate && computeSecondAtom) secondAtomEnergy = ComputeAtom(atom2);
+	// in the integral direct mode there is nothing to compute ahead
+	return options.pipelineDepth > 0 && !options.integralDirect;
 }
 
 
-double HartreeFockThread::ComputeAtom(const Systems::AtomWithShells& atom)
+unsigned int HartreeFockThread::GetThreadsShare(const Options& options)
 {
-	delete algorithm;
+	if (options.nrIntegralsThreads > 0) return options.nrIntegralsThreads;
+
+	// each of the bond length range threads gets its share of the cores
+	const unsigned int cores = std::thread::hardware_concurrency();
+	const unsigned int scanThreads = options.nrThreads > 0 ? options.nrThreads : 1;
+
+	return max(1U, cores / scanThreads);
+}
+
+
+unsigned int HartreeFockThread::GetIntegralsThreads(const Options& options)
+{
+	const unsigned int threads = GetThreadsShare(options);
+
+	// the pipeline computes the integrals of the next points meanwhile, with the rest of the share
+	return UsePipeline(options) ? max(1U, threads - threads / 2) : threads;
+}
 
+
+unsigned int HartreeFockThread::GetPipelineThreads(const Options& options)
+{
+	return max(1U, GetThreadsShare(options) / 2);
+}
+
+
+unsigned int HartreeFockThread::GetSupermatrixMemoryLimit(const Options& options)
+{
+	// the limit is the budget for all the bond length range threads, each one gets its share
+	// with the pipeline a thread has depth + 2 integral sets at once, each can have a supermatrix: the ones waiting, the one computed and the one of the SCF
+	const unsigned int scanThreads = options.nrThreads > 0 ? options.nrThreads : 1;
+	const unsigned int sets = UsePipeline(options) ? options.pipelineDepth + 2 : 1;
+
+	return static_cast<unsigned int>(max(options.supermatrixMemoryLimit, 0)) / (scanThreads * sets);
+}
+
+
+const Chemistry::Basis* HartreeFockThread::GetBasis(CHartreeFockDoc* doc, int basis)
+{
+	if (0 == basis)
+		return &doc->basisSTO3G;
+	if (1 == basis)
+		return &doc->basisSTO6G;
+	if (2 == basis)
+		return &doc->basis3_21G;
+	if (3 == basis)
+		return &doc->basis6_21G;
+	if (4 == basis)
+		return &doc->basis6_31G;
+	if (5 == basis)
+		return &doc->basis6_31Gstar;
+	if (6 == basis)
+		return &doc->basis6_31plusGstarstar;
+	if (7 == basis)
+		return &doc->basis6_31plusG;
+	if (8 == basis)
+		return &doc->basis6_31plusGstar;
+	if (9 == basis)
+		return &doc->basis6_31plusplusG;
+	if (10 == basis)
+		return &doc->basis6_31plusplusGstar;
+	if (11 == basis)
+		return &doc->basis6_31plusplusGstarstar;
+	if (12 == basis)
+		return &doc->basis6_311G;
+	if (13 == basis)
+		return &doc->basis6_311Gstar;
+	if (14 == basis)
+		return &doc->basis6_311Gstarstar;
+	if (15 == basis)
+		return &doc->basis6_311plusG;
+	if (16 == basis)
+		return &doc->basis6_311plusGstar;
+	if (17 == basis)
+		return &doc->basis6_311plusGstarstar;
+	if (18 == basis)
+		return &doc->basis6_311plusplusG;
+	if (19 == basis)
+		return &doc->basis6_311plusplusGstar;
+	if (20 == basis)
+		return &doc->basis6_311plusplusGstarstar;
+
+	return nullptr;
+}
+
+
+void HartreeFockThread::SetDensityGuess(HartreeFock::HartreeFockAlgorithm& alg, const Systems::Molecule& mol, bool allowProjection)
+{
+	alg.initialDensities.clear();
+
+	if (0 == opt.densityGuess) return;
+
+	if (2 == opt.densityGuess && allowProjection && opt.projectionBasis != opt.basis)
+	{
+		// the small basis SCF is redone for each geometry, it's cheap compared with the one in the target basis
+		const Chemistry::Basis* smallBasis = GetBasis(m_Doc, opt.projectionBasis);
+		if (smallBasis && HartreeFock::BasisProjection::SetGuess(alg, mol, *smallBasis, &m_Doc->atomicDensities) >= 0)
+			return;
+	}
+
+	// the atomic densities do not depend on the geometry, but once computed they are only copied from the cache
+	// also the fallback if the projection basis does not have all the atoms
+	alg.initialDensities.resize(1);
+	m_Doc->atomicDensities.GetGuess(mol, alg.initialDensities[0]);
+}
+
+
+void HartreeFockThread::Terminate()
+{
+	terminate = true;
+
+	pipeline.Stop();
+
+	std::lock_guard<std::mutex> lock(algorithmMutex);
+
+	algorithm->terminate = true;
+	if (atomAlgorithm) atomAlgorithm->terminate = true;
+}
+
+
+bool HartreeFockThread::Converged() const
+{
+	return converged;
+}
+
+
+double HartreeFockThread::ComputeAtom(const Systems::AtomWithShells& atom)
+{
 	Systems::Molecule atomM;
 	atomM.atoms.push_back(atom);
 	atomM.alphaElectrons = static_cast<int>(atom.Z / 2);
 	atomM.betaElectrons = atom.Z - atomM.alphaElectrons;
 	atomM.Init();
 
-	if (opt.restricted && atom.Z % 2 == 0)
-		algorithm = new HartreeFock::RestrictedHartreeFock(opt.iterations);
-	else {
-		HartreeFock::UnrestrictedHartreeFock *alg = new HartreeFock::UnrestrictedHartreeFock(opt.iterations);
-		alg->addAsymmetry = opt.addAsymmetry;
-		alg->asymmetry = opt.asymmetry;
-		algorithm = alg;
+	// a separate algorithm, the one for the scan points keeps its state for the warm start
+	{
+		std::lock_guard<std::mutex> lock(algorithmMutex);
+		atomAlgorithm = CreateAlgorithm(opt.restricted && atom.Z % 2 == 0);
 	}
 
-	algorithm->alpha = opt.alpha;
-	algorithm->initGuess = opt.initialGuess;
-	algorithm->integralsRepository.useLotsOfMemory = opt.useLotsOfMemory;
+	// for an isolated atom the atomic density is already the best guess, there is nothing to project
+	SetDensityGuess(*atomAlgorithm, atomM, false);
 
-	algorithm->maxDIISiterations = opt.maxDIISiterations;
-	algorithm->UseDIIS = opt.useDIIS;
-	algorithm->normalIterAfterDIIS = opt.normalIterAfterDIIS;
+	atomAlgorithm->Init(&atomM);
 
-	algorithm->Init(&atomM);
+	double result = atomAlgorithm->Calculate();
+	if (opt.computePostHF) result += atomAlgorithm->CalculateMp2Energy();
 
-	double result = algorithm->Calculate();
-	if (opt.computePostHF) result += algorithm->CalculateMp2Energy();
+	if (converged) converged = atomAlgorithm->converged;
 
-	if (converged) converged = algorithm->converged;
+	{
+		std::lock_guard<std::mutex> lock(algorithmMutex);
+		delete atomAlgorithm;
+		atomAlgorithm = nullptr;
+	}
 
 	return result * Hartree;
 }
+
+
+HartreeFock::HartreeFockAlgorithm* HartreeFockThread::CreateAlgorithm(bool restricted) const
+{
+	HartreeFock::HartreeFockAlgorithm* alg;
+
+	if (restricted) {
+		alg = new HartreeFock::RestrictedHartreeFock(opt.iterations);
+	}
+	else {
+		HartreeFock::UnrestrictedHartreeFock *ualg = new HartreeFock::UnrestrictedHartreeFock(opt.iterations);
+		ualg->addAsymmetry = opt.addAsymmetry;
+		ualg->asymmetry = opt.asymmetry;
+		ualg->jointDIIS = opt.jointDIIS;
+		alg = ualg;
+	}
+
+	alg->alpha = opt.alpha;
+	alg->initGuess = opt.initialGuess;
+
+	alg->integralsRepository.useLotsOfMemory = opt.useLotsOfMemory;
+	alg->integralsRepository.supermatrixMemoryLimit = GetSupermatrixMemoryLimit(opt);
+	alg->integralsRepository.schwarzThreshold = opt.schwarzThreshold;
+	alg->integralsRepository.primitivePairThreshold = opt.primitivePairThreshold;
+	alg->integralsRepository.integralDirect = opt.integralDirect;
+	alg->integralsRepository.nrThreads = GetIntegralsThreads(opt);
+	// the scan points are the same molecule, from one to the next only the integrals with centres on atoms that moved relative to each other change
+	alg->integralsRepository.reuseElectronElectronIntegrals = true;
+
+	alg->maxDIISiterations = opt.maxDIISiterations;
+	alg->UseDIIS = opt.useDIIS;
+	alg->normalIterAfterDIIS = opt.normalIterAfterDIIS;
+	alg->diisStagnationIterations = opt.diisStagnationIterations;
+	alg->secondOrderSCF = opt.secondOrderSCF;
+	alg->stabilityCheck = opt.stabilityCheck;
+	alg->diis.maxSize = max(opt.diisSubspaceSize, 1);
+	alg->diis.useEDIIS = opt.useEDIIS;
+	alg->fullFockBuildInterval = opt.fullFockBuildInterval;
+
+	return alg;
+}
@@ -2,11 +2,16 @@
 #include "ComputationThread.h"
 
 #include "Options.h"
+#include "ScanScheduler.h"
+#include "IntegralsPipeline.h"
 
 
 #include "Molecule.h"
+#include "WarmStart.h"
 
 #include <atomic>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 namespace HartreeFock {
@@ -23,11 +28,21 @@ protected:
 	HartreeFock::HartreeFockAlgorithm *algorithm;
 	CHartreeFockDoc* m_Doc;
 
-	Systems::Molecule molecule;
+	// the one for the atom task that is running, if any, guarded by the mutex so that Terminate can reach it
+	HartreeFock::HartreeFockAlgorithm *atomAlgorithm;
+	std::mutex algorithmMutex;
+
+	// the scan tasks are pulled from it, the results are stored in it
+	ScanScheduler* m_scheduler;
+	unsigned int m_index;
 
-	double m_start;
-	double m_end;
-	double m_step;
+	// computes the integrals for the next points while the SCF of the current one runs
+	IntegralsPipeline pipeline;
+
+	// the algorithm points into its molecule, so it's kept until the next point
+	std::unique_ptr<IntegralsPipeline::Item> currentItem;
+
+	Systems::Molecule molecule;
 
 	double angle;
 
@@ -35,23 +50,34 @@ protected:
 
 	Systems::AtomWithShells atom1, atom2;
 	Options opt;
+
+	// the orbitals of the previous scan points, for the initial guess of the next one
+	HartreeFock::WarmStart warmStart;
 public:
-	HartreeFockThread(const Options& options, CHartreeFockDoc* doc, const double start, const double end, const double step);
+	HartreeFockThread(const Options& options, CHartreeFockDoc* doc, ScanScheduler* scheduler, unsigned int index);
 	virtual ~HartreeFockThread();
 
-	std::vector<std::tuple<double, double, double>> results;
-
 	virtual void Calculate();
 	void Terminate();
 	bool Converged() const;
-
-	bool computeFirstAtom;
-	bool computeSecondAtom;
-
-	double firstAtomEnergy;
-	double secondAtomEnergy;
 private:
-	void ComputeAtoms();
+	void CalculatePipelined();
+
+	void RunTask(const ScanScheduler::Task& task, Systems::Molecule& mol, GaussianIntegrals::IntegralsRepository* integrals, ScanScheduler::Task& lastPoint);
+	void SetGeometry(Systems::Molecule& mol, double position) const;
+	void ComputePoint(const ScanScheduler::Task& task, Systems::Molecule& mol, GaussianIntegrals::IntegralsRepository* integrals);
 	double ComputeAtom(const Systems::AtomWithShells& atom);
-};
+	void SetDensityGuess(HartreeFock::HartreeFockAlgorithm& alg, const Systems::Molecule& mol, bool allowProjection = true);
+
+	HartreeFock::HartreeFockAlgorithm* CreateAlgorithm(bool restricted) const;
+
+	static const Chemistry::Basis* GetBasis(CHartreeFockDoc* doc, int basis);
+
+	static bool UsePipeline(const Options& options);
 
+	// the cores for the integrals and the Fock matrices of a bond length range thread, split between the SCF and the pipeline if it's used
+	static unsigned int GetThreadsShare(const Options& options);
+	static unsigned int GetIntegralsThreads(const Options& options);
+	static unsigned int GetPipelineThreads(const Options& options);
+	static unsigned int GetSupermatrixMemoryLimit(const Options& options);
+};
\ No newline at end of file
@@ -152,6 +152,7 @@ void CHartreeFockView::OnTimer(UINT_PTR nIDEvent)
 		EndWaitCursor();
 		Invalidate();
 	}
+	else pDoc->UpdateResults();
 }
 
 
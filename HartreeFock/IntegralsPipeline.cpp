@@ -0,0 +1,117 @@
+#include "stdafx.h"
+#include "IntegralsPipeline.h"
+
+
+IntegralsPipeline::IntegralsPipeline()
+	: m_depth(1), done(true), stopped(false)
+{
+}
+
+
+IntegralsPipeline::~IntegralsPipeline()
+{
+	Stop();
+	Join();
+}
+
+
+void IntegralsPipeline::Start(const Systems::Molecule& molecule, const GaussianIntegrals::IntegralsRepository& settings, unsigned int nrThreads, unsigned int depth, const std::function<bool(ScanScheduler::Task&)>& getTask, const std::function<void(Systems::Molecule&, double)>& setGeometry)
+{
+	Join();
+
+	m_molecule = molecule;
+	m_depth = max(depth, 1U);
+	m_getTask = getTask;
+	m_setGeometry = setGeometry;
+
+	repository.Reset();
+	repository.useLotsOfMemory = settings.useLotsOfMemory;
+	repository.supermatrixMemoryLimit = settings.supermatrixMemoryLimit;
+	repository.schwarzThreshold = settings.schwarzThreshold;
+	repository.primitivePairThreshold = settings.primitivePairThreshold;
+	repository.nrThreads = max(nrThreads, 1U);
+	repository.reuseElectronElectronIntegrals = true;
+
+	items.clear();
+	done = false;
+	stopped = false;
+
+	thread = std::thread(&IntegralsPipeline::Produce, this);
+}
+
+
+std::unique_ptr<IntegralsPipeline::Item> IntegralsPipeline::Pop()
+{
+	std::unique_ptr<Item> item;
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		condition.wait(lock, [this] { return stopped || done || !items.empty(); });
+
+		if (stopped || items.empty()) return item;
+
+		item = std::move(items.front());
+		items.pop_front();
+	}
+
+	// there is room for the next one
+	condition.notify_all();
+
+	return item;
+}
+
+
+void IntegralsPipeline::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopped = true;
+	}
+
+	condition.notify_all();
+}
+
+
+void IntegralsPipeline::Join()
+{
+	if (thread.joinable()) thread.join();
+}
+
+
+void IntegralsPipeline::Produce()
+{
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this] { return stopped || items.size() < m_depth; });
+
+			if (stopped) break;
+		}
+
+		auto item = std::make_unique<Item>();
+		if (!m_getTask(item->task)) break;
+
+		if (ScanScheduler::TaskType::Point == item->task.type)
+		{
+			m_setGeometry(m_molecule, item->task.position);
+			item->molecule = m_molecule;
+
+			repository.Reset(&m_molecule);
+			repository.CalculateElectronElectronIntegrals();
+			repository.TransferElectronElectronIntegrals(item->integrals);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			items.push_back(std::move(item));
+		}
+		condition.notify_all();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		done = true;
+	}
+	condition.notify_all();
+}
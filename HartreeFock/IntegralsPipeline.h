@@ -0,0 +1,63 @@
+#pragma once
+
+#include "IntegralsRepository.h"
+#include "Molecule.h"
+#include "ScanScheduler.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// computes the electron-electron integrals for the next scan points on its own thread, while the caller does the SCF for the current one
+// the tasks are taken one at a time, only when there is room in the queue for their integrals, so the memory stays bounded
+// and until then the tasks can still be stolen by the other scan threads
+// the integrals of the previous point are kept, only the shell quartets on atoms that moved relative to each other are computed again
+// the atom tasks pass through without integrals, so the tasks come out in the order they were taken
+class IntegralsPipeline
+{
+public:
+	struct Item
+	{
+		ScanScheduler::Task task;
+		Systems::Molecule molecule; // at the geometry of the task
+		GaussianIntegrals::IntegralsRepository integrals; // to be passed as the precomputed integrals of the algorithm
+	};
+
+	IntegralsPipeline();
+	~IntegralsPipeline();
+
+	// the repository settings (memory use, screening) are copied from the passed one, the supermatrix memory limit applies to each item
+	// the integrals are computed on nrThreads threads, they run together with the ones of the caller, so it should be the pipeline share of the cores
+	// getTask returns false when there are no more tasks, setGeometry moves the atoms of the molecule copy for the task position
+	// depth is the number of items computed ahead, the memory is for depth + 1 integral sets besides the ones used by the caller
+	void Start(const Systems::Molecule& molecule, const GaussianIntegrals::IntegralsRepository& settings, unsigned int nrThreads, unsigned int depth, const std::function<bool(ScanScheduler::Task&)>& getTask, const std::function<void(Systems::Molecule&, double)>& setGeometry);
+
+	// blocks until the next item is ready, returns null if there are no more tasks or the pipeline was stopped
+	std::unique_ptr<Item> Pop();
+
+	// it can be called from another thread, the integrals that are being computed are finished first
+	void Stop();
+
+	// waits for the thread to finish
+	void Join();
+
+protected:
+	void Produce();
+
+	Systems::Molecule m_molecule;
+	GaussianIntegrals::IntegralsRepository repository;
+	unsigned int m_depth;
+	std::function<bool(ScanScheduler::Task&)> m_getTask;
+	std::function<void(Systems::Molecule&, double)> m_setGeometry;
+
+	std::thread thread;
+
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::deque<std::unique_ptr<Item>> items;
+	bool done;
+	bool stopped;
+};
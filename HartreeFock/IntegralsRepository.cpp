@@ -3,6 +3,10 @@
 #include "QuantumNumbers.h"
 
 #include "BoysFunctions.h"
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <memory>
 
 #include <psapi.h>
 
@@ -10,8 +14,9 @@ namespace GaussianIntegrals {
 
 
 	IntegralsRepository::IntegralsRepository(Systems::Molecule *molecule)
-		: m_Molecule(molecule), useLotsOfMemory(true)
+		: m_Molecule(molecule), useLotsOfMemory(true), supermatrixMemoryLimit(512), schwarzThreshold(0), primitivePairThreshold(0), nrThreads(1), integralDirect(false), reuseElectronElectronIntegrals(false), electronElectronShellQuartets(0), electronElectronShellQuartetsSkipped(0), electronElectronShellQuartetsReused(0), electronElectronPrimitiveQuartets(0), electronElectronAllocations(0), previousSchwarzThreshold(0), previousPrimitivePairThreshold(0)
 	{
+		if (m_Molecule) shellPairs.Build(*m_Molecule, primitivePairThreshold);
 	}
 
 
@@ -19,14 +24,44 @@ namespace GaussianIntegrals {
 	{
 	}
 
+	WorkStealingPool& IntegralsRepository::GetPool()
+	{
+		if (!pool || pool->GetNrThreads() != max(nrThreads, 1U))
+			pool = std::make_unique<WorkStealingPool>(nrThreads);
+
+		return *pool;
+	}
+
+
 	void IntegralsRepository::Reset(Systems::Molecule* molecule)
 	{
 		ClearAllMaps();
 
-		std::valarray<double> emptyV;
-		electronElectronIntegrals.swap(emptyV);
+		// the next CalculateElectronElectronIntegrals checks if they can be used
+		if (!reuseElectronElectronIntegrals)
+		{
+			std::valarray<double> emptyV;
+			electronElectronIntegrals.swap(emptyV);
+
+			previousShells.clear();
+			previousShellPairBounds.clear();
+		}
+		supermatrix.resize(0, 0);
+
+		// the integral direct data points into the old molecule
+		electronElectronShells.clear();
+		electronElectronShellPairBounds.clear();
+		fockWorkers.clear();
 
 		m_Molecule = molecule;
+
+		if (m_Molecule)
+		{
+			shellPairs.Build(*m_Molecule, primitivePairThreshold);
+
+			TRACE("Primitive pairs: %llu, skipped by screening: %llu\n", shellPairs.nrPrimitivePairsTotal, shellPairs.nrPrimitivePairsSkipped);
+		}
+		else shellPairs.Clear();
 	}
 
 
@@ -34,7 +69,7 @@ namespace GaussianIntegrals {
 	// OVERLAP integrals
 	//************************************************************************************************************************************************************
 
-	double IntegralsRepository::getOverlap(const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2, bool extendForKinetic)
+	double IntegralsRepository::getOverlap(const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2, const ShellPair& shellPair, const PrimitivePair& primitivePair, bool extendForKinetic)
 	{
 		assert(m_Molecule);
 		
@@ -54,28 +89,9 @@ namespace GaussianIntegrals {
 
 
 
-		Orbitals::QuantumNumbers::QuantumNumbers maxQN1(0, 0, 0), maxQN2(0, 0, 0);
-
-		// now find out the maximum quantum numbers
-
-		Systems::AtomWithShells *a1 = nullptr;
-		Systems::AtomWithShells *a2 = nullptr;
-
-		for (auto &atom : m_Molecule->atoms)
-		{
-			if (atom.position == gaussian1.center) a1 = &atom;
-			if (atom.position == gaussian2.center) a2 = &atom;
-
-			if (a1 && a2) break;
-		}
-
-		assert(a1);
-		assert(a2);
-
-		// now find the max quantum numbers
+		// the max quantum numbers come from the shells, all the components share the primitives
 
-		if (a1) a1->GetMaxQN(gaussian1.alpha, maxQN1);
-		if (a2) a2->GetMaxQN(gaussian2.alpha, maxQN2);
+		Orbitals::QuantumNumbers::QuantumNumbers maxQN1(shellPair.maxL1, shellPair.maxL1, shellPair.maxL1), maxQN2(shellPair.maxL2, shellPair.maxL2, shellPair.maxL2);
 
 		if (extendForKinetic)
 		{
@@ -91,7 +107,7 @@ namespace GaussianIntegrals {
 
 		// calculate the integrals and that's about it
 
-		result.first->second.Reset(gaussian1.alpha, gaussian2.alpha, gaussian1.center, gaussian2.center, maxQN1, maxQN2);
+		result.first->second.Reset(shellPair, primitivePair, maxQN1, maxQN2);
 
 		return result.first->second.getOverlap(gaussian1.angularMomentum, gaussian2.angularMomentum);
 	}
@@ -100,10 +116,17 @@ namespace GaussianIntegrals {
 	double IntegralsRepository::getOverlap(const Orbitals::ContractedGaussianOrbital& orbital1, const Orbitals::ContractedGaussianOrbital& orbital2, bool extendForKinetic)
 	{
 		double res = 0;
-		
-		for (auto &gaussian1 : orbital1.gaussianOrbitals)
-			for (auto &gaussian2 : orbital2.gaussianOrbitals)
-				res += gaussian1.normalizationFactor * gaussian2.normalizationFactor * gaussian1.coefficient * gaussian2.coefficient * getOverlap(gaussian1, gaussian2, extendForKinetic);
+
+		const ShellPair& shellPair = shellPairs(orbital1.shellID, orbital2.shellID);
+
+		// only the primitive pairs that survived the screening
+		for (const PrimitivePair* primitivePair = shellPairs.begin(shellPair); primitivePair != shellPairs.end(shellPair); ++primitivePair)
+		{
+			const Orbitals::GaussianOrbital& gaussian1 = orbital1.gaussianOrbitals[primitivePair->primitive1];
+			const Orbitals::GaussianOrbital& gaussian2 = orbital2.gaussianOrbitals[primitivePair->primitive2];
+
+			res += gaussian1.normalizationFactor * gaussian2.normalizationFactor * gaussian1.coefficient * gaussian2.coefficient * getOverlap(gaussian1, gaussian2, shellPair, *primitivePair, extendForKinetic);
+		}
 
 		return res;
 	}
@@ -115,7 +138,7 @@ namespace GaussianIntegrals {
 	//************************************************************************************************************************************************************
 
 
-	double IntegralsRepository::getMoment(const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2, bool momentX, bool momentY, bool momentZ)
+	double IntegralsRepository::getMoment(const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2, const ShellPair& shellPair, const PrimitivePair& primitivePair, bool momentX, bool momentY, bool momentZ)
 	{
 		assert(m_Molecule);
 
@@ -131,32 +154,13 @@ namespace GaussianIntegrals {
 
 
 
-		Orbitals::QuantumNumbers::QuantumNumbers maxQN1(0, 0, 0), maxQN2(0, 0, 0);
-
-		// now find out the maximum quantum numbers
-
-		Systems::AtomWithShells* a1 = nullptr;
-		Systems::AtomWithShells* a2 = nullptr;
-
-		for (auto& atom : m_Molecule->atoms)
-		{
-			if (atom.position == gaussian1.center) a1 = &atom;
-			if (atom.position == gaussian2.center) a2 = &atom;
-
-			if (a1 && a2) break;
-		}
+		// the max quantum numbers come from the shells, all the components share the primitives
 
-		assert(a1);
-		assert(a2);
-
-		// now find the max quantum numbers
-
-		if (a1) a1->GetMaxQN(gaussian1.alpha, maxQN1);
-		if (a2) a2->GetMaxQN(gaussian2.alpha, maxQN2);
+		Orbitals::QuantumNumbers::QuantumNumbers maxQN1(shellPair.maxL1, shellPair.maxL1, shellPair.maxL1), maxQN2(shellPair.maxL2, shellPair.maxL2, shellPair.maxL2);
 
 		// calculate the integrals and that's about it
 
-		result.first->second.Reset(gaussian1.alpha, gaussian2.alpha, gaussian1.center, gaussian2.center, maxQN1, maxQN2);
+		result.first->second.Reset(shellPair, primitivePair, maxQN1, maxQN2);
 
 		return result.first->second.getMoment(gaussian1.angularMomentum, gaussian2.angularMomentum, momentX, momentY, momentZ);
 	}
@@ -166,9 +170,16 @@ namespace GaussianIntegrals {
 	{
 		double res = 0;
 
-		for (auto& gaussian1 : orbital1.gaussianOrbitals)
-			for (auto& gaussian2 : orbital2.gaussianOrbitals)
-				res += gaussian1.normalizationFactor * gaussian2.normalizationFactor * gaussian1.coefficient * gaussian2.coefficient * getMoment(gaussian1, gaussian2, momentX, momentY, momentZ);
+		const ShellPair& shellPair = shellPairs(orbital1.shellID, orbital2.shellID);
+
+		// only the primitive pairs that survived the screening
+		for (const PrimitivePair* primitivePair = shellPairs.begin(shellPair); primitivePair != shellPairs.end(shellPair); ++primitivePair)
+		{
+			const Orbitals::GaussianOrbital& gaussian1 = orbital1.gaussianOrbitals[primitivePair->primitive1];
+			const Orbitals::GaussianOrbital& gaussian2 = orbital2.gaussianOrbitals[primitivePair->primitive2];
+
+			res += gaussian1.normalizationFactor * gaussian2.normalizationFactor * gaussian1.coefficient * gaussian2.coefficient * getMoment(gaussian1, gaussian2, shellPair, *primitivePair, momentX, momentY, momentZ);
+		}
 
 		return res;
 	}
@@ -183,14 +194,21 @@ namespace GaussianIntegrals {
 	{
 		double res = 0;
 
-		for (auto &gaussian1 : orbital1.gaussianOrbitals)
-			for (auto &gaussian2 : orbital2.gaussianOrbitals)
-				res += gaussian1.normalizationFactor * gaussian2.normalizationFactor * gaussian1.coefficient * gaussian2.coefficient * getKinetic(gaussian1, gaussian2);
+		const ShellPair& shellPair = shellPairs(orbital1.shellID, orbital2.shellID);
+
+		// only the primitive pairs that survived the screening
+		for (const PrimitivePair* primitivePair = shellPairs.begin(shellPair); primitivePair != shellPairs.end(shellPair); ++primitivePair)
+		{
+			const Orbitals::GaussianOrbital& gaussian1 = orbital1.gaussianOrbitals[primitivePair->primitive1];
+			const Orbitals::GaussianOrbital& gaussian2 = orbital2.gaussianOrbitals[primitivePair->primitive2];
+
+			res += gaussian1.normalizationFactor * gaussian2.normalizationFactor * gaussian1.coefficient * gaussian2.coefficient * getKinetic(gaussian1, gaussian2, shellPair, *primitivePair);
+		}
 
 		return res;
 	}
 
-	double IntegralsRepository::getKinetic(const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2)
+	double IntegralsRepository::getKinetic(const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2, const ShellPair& shellPair, const PrimitivePair& primitivePair)
 	{
 		assert(m_Molecule);
 
@@ -208,32 +226,13 @@ namespace GaussianIntegrals {
 		GaussianKinetic kinetic(&gaussian1, &gaussian2, &oit->second);
 		auto result = kineticIntegralsMap.insert(std::make_pair(params, kinetic));
 
-		Orbitals::QuantumNumbers::QuantumNumbers maxQN1(0, 0, 0), maxQN2(0, 0, 0);
-
-		// now find out the maximum quantum numbers
-
-		Systems::AtomWithShells *a1 = nullptr;
-		Systems::AtomWithShells *a2 = nullptr;
-
-		for (auto &atom : m_Molecule->atoms)
-		{
-			if (atom.position == gaussian1.center) a1 = &atom;
-			if (atom.position == gaussian2.center) a2 = &atom;
-
-			if (a1 && a2) break;
-		}
-
-		assert(a1);
-		assert(a2);
+		// the max quantum numbers come from the shells, all the components share the primitives
 
-		// now find the max quantum numbers
-
-		if (a1) a1->GetMaxQN(gaussian1.alpha, maxQN1);
-		if (a2) a2->GetMaxQN(gaussian2.alpha, maxQN2);
+		Orbitals::QuantumNumbers::QuantumNumbers maxQN1(shellPair.maxL1, shellPair.maxL1, shellPair.maxL1), maxQN2(shellPair.maxL2, shellPair.maxL2, shellPair.maxL2);
 
 		// calculate the integrals and that's about it
 
-		result.first->second.Reset(gaussian1.alpha, gaussian2.alpha, maxQN1, maxQN2);
+		result.first->second.Reset(primitivePair, maxQN1, maxQN2);
 
 		return result.first->second.getKinetic(gaussian1.angularMomentum, gaussian2.angularMomentum);
 	}
@@ -254,34 +253,34 @@ namespace GaussianIntegrals {
 		auto it = nuclearIntegralsContractedMap.find(params);
 		if (nuclearIntegralsContractedMap.end() != it) return it->second.getNuclear(orbital1->angularMomentum, orbital2->angularMomentum);
 		
-		const auto center1 = orbital1->getCenter();
-		const auto center2 = orbital2->getCenter();
-
 		Orbitals::QuantumNumbers::QuantumNumbers maxQN(0, 0, orbital1->angularMomentum + orbital2->angularMomentum);
 	
 		GaussianNuclear horizNuclear;
 		auto result = nuclearIntegralsContractedMap.insert(std::make_pair(params, horizNuclear));
 		result.first->second.matrixCalc = Eigen::MatrixXd::Zero(maxQN.GetTotalCanonicalIndex() + 1ULL, 1);
 
+		const ShellPair& shellPair = shellPairs(orbital1->shellID, orbital2->shellID);
 		
-		for (auto &gaussian1 : orbital1->gaussianOrbitals)
-			for (auto &gaussian2 : orbital2->gaussianOrbitals)
-			{
-				const GaussianNuclear& nuclear = getNuclearVertical(nucleus, gaussian1, gaussian2);
+		for (const PrimitivePair* primitivePair = shellPairs.begin(shellPair); primitivePair != shellPairs.end(shellPair); ++primitivePair)
+		{
+			const Orbitals::GaussianOrbital& gaussian1 = orbital1->gaussianOrbitals[primitivePair->primitive1];
+			const Orbitals::GaussianOrbital& gaussian2 = orbital2->gaussianOrbitals[primitivePair->primitive2];
+
+			const GaussianNuclear& nuclear = getNuclearVertical(nucleus, gaussian1, gaussian2, shellPair, *primitivePair);
 
-				double factor = gaussian1.normalizationFactor * gaussian2.normalizationFactor * gaussian1.coefficient * gaussian2.coefficient;
+			const double factor = gaussian1.normalizationFactor * gaussian2.normalizationFactor * gaussian1.coefficient * gaussian2.coefficient;
 
-				for (int row = 0; row < result.first->second.matrixCalc.rows(); ++row)
-					result.first->second.matrixCalc(row, 0) += factor * nuclear.matrixCalc(row, 0);
-			}			
+			for (int row = 0; row < result.first->second.matrixCalc.rows(); ++row)
+				result.first->second.matrixCalc(row, 0) += factor * nuclear.matrixCalc(row, 0);
+		}			
 
-		result.first->second.HorizontalRecursion(center1-center2, orbital1->angularMomentum, orbital2->angularMomentum);
+		result.first->second.HorizontalRecursion(shellPair.AB, orbital1->angularMomentum, orbital2->angularMomentum);
 
 		return result.first->second.getNuclear(orbital1->angularMomentum, orbital2->angularMomentum);
 	}
 
 
-	const GaussianNuclear& IntegralsRepository::getNuclearVertical(const Systems::Atom& nucleus, const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2)
+	const GaussianNuclear& IntegralsRepository::getNuclearVertical(const Systems::Atom& nucleus, const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2, const ShellPair& shellPair, const PrimitivePair& primitivePair)
 	{
 		assert(m_Molecule);
 
@@ -293,30 +292,9 @@ namespace GaussianIntegrals {
 		GaussianNuclear nuclear;
 		auto result = nuclearVerticalIntegralsMap.insert(std::make_pair(params, nuclear));
 
-		// now find out the maximum quantum numbers
-
-		Systems::AtomWithShells *a1 = nullptr;
-		Systems::AtomWithShells *a2 = nullptr;
-
-		for (auto &atom : m_Molecule->atoms)
-		{
-			if (atom.position == gaussian1.center) a1 = &atom;
-			if (atom.position == gaussian2.center) a2 = &atom;
-
-			if (a1 && a2) break;
-		}
-
-		assert(a1);
-		assert(a2);
+		// calculate the integrals and that's about it, the max angular momenta are taken from the shell pair
 
-		// now find the max quantum numbers
-
-		const unsigned int maxL1 = a1 ? a1->GetMaxAngularMomentum(gaussian1.alpha) : 0;
-		const unsigned int maxL2 = a2 ? a2->GetMaxAngularMomentum(gaussian2.alpha) : 0;
-
-		// calculate the integrals and that's about it
-
-		result.first->second.Reset(this, gaussian1.alpha, gaussian2.alpha, nucleus.position, gaussian1.center, gaussian2.center, maxL1, maxL2, false);
+		result.first->second.Reset(this, shellPair, primitivePair, nucleus.position, false);
 
 		return result.first->second;
 	}
@@ -329,206 +307,237 @@ namespace GaussianIntegrals {
 	
 	const BoysFunctions& IntegralsRepository::getBoysFunctions(unsigned int L, double T)
 	{
-		auto it = boysFunctions.find(T);		
-		if (boysFunctions.end() != it) return it->second;
-
-		BoysFunctions boys;
-		auto result = boysFunctions.insert(std::make_pair(T, boys));
-
-		unsigned int maxL = L + 1;
+		// caching them by T is useless, it's almost never the same, but they are cheap to get from the table
+		boysFunctions.GenerateBoysFunctions(L, T);
 
-		Systems::Molecule *molecule = getMolecule();	
-		if (molecule) maxL = 4 * molecule->GetMaxAngularMomentum() + 1;
-
-		result.first->second.GenerateBoysFunctions(maxL, T);
-
-		return result.first->second;
+		return boysFunctions;
 	}	
 
-	template<class Orb> void IntegralsRepository::SwapOrbitals(Orb **orb1, Orb **orb2, Orb **orb3, Orb **orb4)
+	void IntegralsRepository::SwapShells(const Orbitals::ContractedGaussianOrbital* orbitals[4], unsigned int order[4])
 	{
-		assert(orb1);
-		assert(orb2);
-		assert(orb3);
-		assert(orb4);
-
-		assert(*orb1);
-		assert(*orb2);
-		assert(*orb3);
-		assert(*orb4);
+		assert(orbitals[0]);
+		assert(orbitals[1]);
+		assert(orbitals[2]);
+		assert(orbitals[3]);
 
 		// the calculation algorithm requires a certain order of angular momenta
 		// the L1 >= L2, L3 >= L4 and L1 + L2 >= L3 + L4 are needed by the algorithm
 		// this also ensures that symmetry is used to speed it up
-		
-		if ((*orb1)->angularMomentum < (*orb2)->angularMomentum || ((*orb1)->angularMomentum == (*orb2)->angularMomentum && (*orb1)->ID < (*orb2)->ID)) std::swap(*orb1, *orb2);
-		if ((*orb3)->angularMomentum < (*orb4)->angularMomentum || ((*orb3)->angularMomentum == (*orb4)->angularMomentum && (*orb3)->ID < (*orb4)->ID)) std::swap(*orb3, *orb4);
+		// the ties are broken by the shell IDs, not the orbital IDs, so all the components of a shell quartet end up in the same block
+		// 'order' tracks the original position of the orbitals
 
-		if ((*orb1)->angularMomentum + (*orb2)->angularMomentum < (*orb3)->angularMomentum + (*orb4)->angularMomentum ||
-			((*orb1)->angularMomentum + (*orb2)->angularMomentum == (*orb3)->angularMomentum + (*orb4)->angularMomentum &&
-			((*orb1)->ID < (*orb3)->ID || ((*orb1)->ID == (*orb3)->ID && (*orb2)->ID < (*orb4)->ID))))
+		const auto less = [](const Orbitals::ContractedGaussianOrbital* orb1, const Orbitals::ContractedGaussianOrbital* orb2) -> bool
 		{
-			std::swap(*orb1, *orb3);
-			std::swap(*orb2, *orb4);
+			return orb1->angularMomentum < orb2->angularMomentum || (orb1->angularMomentum == orb2->angularMomentum && orb1->shellID < orb2->shellID);
+		};
+
+		if (less(orbitals[0], orbitals[1]))
+		{
+			std::swap(orbitals[0], orbitals[1]);
+			std::swap(order[0], order[1]);
+		}
+		if (less(orbitals[2], orbitals[3]))
+		{
+			std::swap(orbitals[2], orbitals[3]);
+			std::swap(order[2], order[3]);
+		}
+
+		const unsigned int L12 = orbitals[0]->angularMomentum + orbitals[1]->angularMomentum;
+		const unsigned int L34 = orbitals[2]->angularMomentum + orbitals[3]->angularMomentum;
+
+		if (L12 < L34 || (L12 == L34 && (less(orbitals[0], orbitals[2]) || (!less(orbitals[2], orbitals[0]) && less(orbitals[1], orbitals[3])))))
+		{
+			std::swap(orbitals[0], orbitals[2]);
+			std::swap(orbitals[1], orbitals[3]);
+			std::swap(order[0], order[2]);
+			std::swap(order[1], order[3]);
 		}
 	}
 	
 	double IntegralsRepository::getElectronElectron(const Orbitals::ContractedGaussianOrbital* orbital1, const Orbitals::ContractedGaussianOrbital* orbital2, const Orbitals::ContractedGaussianOrbital* orbital3, const Orbitals::ContractedGaussianOrbital* orbital4)
 	{
-		SwapOrbitals(&orbital1, &orbital2, &orbital3, &orbital4);
+		const Orbitals::ContractedGaussianOrbital* orbitals[4] = { orbital1, orbital2, orbital3, orbital4 };
+		unsigned int order[4] = { 0, 1, 2, 3 };
+
+		SwapShells(orbitals, order);
+
+		const std::tuple<unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int> params(orbitals[0]->shellID, orbitals[1]->shellID, orbitals[2]->shellID, orbitals[3]->shellID,
+																																				 orbitals[0]->angularMomentum, orbitals[1]->angularMomentum, orbitals[2]->angularMomentum, orbitals[3]->angularMomentum);
+		auto it = electronElectronIntegralsShellsMap.find(params);
+		if (electronElectronIntegralsShellsMap.end() == it)
+		{
+			// not calculated yet, compute the whole block, any component of the shells will do
+			it = electronElectronIntegralsShellsMap.insert(std::make_pair(params, GaussianTwoElectrons())).first;
+
+			CalculateElectronElectronShells(orbitals[0], orbitals[1], orbitals[2], orbitals[3], it->second);
+		}
 
+		return it->second.getValue(orbitals[0]->angularMomentum, orbitals[1]->angularMomentum, orbitals[2]->angularMomentum, orbitals[3]->angularMomentum);
+	}
+
+	void IntegralsRepository::CalculateElectronElectronShells(const Orbitals::ContractedGaussianOrbital* orbital1, const Orbitals::ContractedGaussianOrbital* orbital2, const Orbitals::ContractedGaussianOrbital* orbital3, const Orbitals::ContractedGaussianOrbital* orbital4, GaussianTwoElectrons& result)
+	{
 		assert(orbital1->angularMomentum >= orbital2->angularMomentum);
 		assert(orbital3->angularMomentum >= orbital4->angularMomentum);
 		assert(orbital1->angularMomentum + orbital2->angularMomentum >= orbital3->angularMomentum + orbital4->angularMomentum);
-		
-		const std::tuple<unsigned int, unsigned int, unsigned int, unsigned int> params(orbital1->ID, orbital2->ID, orbital3->ID, orbital4->ID);
-		auto it = electronElectronIntegralsContractedMap.find(params);
-		if (electronElectronIntegralsContractedMap.end() != it) return it->second.getValue(orbital1->angularMomentum, orbital2->angularMomentum, orbital3->angularMomentum, orbital4->angularMomentum);
 
 		const unsigned int L1 = orbital1->angularMomentum;
 		const unsigned int L2 = orbital2->angularMomentum;
 		const unsigned int L3 = orbital3->angularMomentum;
 		const unsigned int L4 = orbital4->angularMomentum;
 
-		const unsigned int maxL12 = L1 + L2;
-		const unsigned int maxL34 = L3 + L4;
+		result.BeginContraction(L1, L2, L3, L4);
 
-		GaussianTwoElectrons contractedTwoElectrons;
-		auto result = electronElectronIntegralsContractedMap.insert(std::make_pair(params, contractedTwoElectrons));
+		// the passed orbitals can be any components of the shells
+		// the contraction is done with the normalization of the (L, 0, 0) components, the other ones are adjusted at the end
+		const double normalizationRatio = Orbitals::GaussianOrbital::getNormalizationRatio(orbital1->angularMomentum) * Orbitals::GaussianOrbital::getNormalizationRatio(orbital2->angularMomentum) *
+											Orbitals::GaussianOrbital::getNormalizationRatio(orbital3->angularMomentum) * Orbitals::GaussianOrbital::getNormalizationRatio(orbital4->angularMomentum);
 
-		// set up a zero filled matrix for the range L1 -> L1 + L2 on columns and L3 -> L3 + L4 on rows, the same range as the result from vertical and electron transfer relations
-		result.first->second.matrixCalc = Eigen::MatrixXd::Zero(Orbitals::QuantumNumbers::QuantumNumbers(0, 0, maxL12).GetTotalCanonicalIndex() - Orbitals::QuantumNumbers::QuantumNumbers(L1, 0, 0).GetTotalCanonicalIndex() + 1ULL, Orbitals::QuantumNumbers::QuantumNumbers(0, 0, maxL34).GetTotalCanonicalIndex() - Orbitals::QuantumNumbers::QuantumNumbers(L3, 0, 0).GetTotalCanonicalIndex() + 1ULL);
+		const ShellPair& shellPair12 = shellPairs(orbital1->shellID, orbital2->shellID);
+		const ShellPair& shellPair34 = shellPairs(orbital3->shellID, orbital4->shellID);
 
-		// now contract the results from the above mentioned two relations, the horizontal relations can be applied on the contracted results
+		// now contract the results from the vertical and electron transfer relations, the horizontal relations can be applied on the contracted results
+		// only the primitive pairs that survived the screening are used
 
-		for (const auto &gaussian1 : orbital1->gaussianOrbitals)		
-			for (const auto &gaussian2 : orbital2->gaussianOrbitals)
-				for (const auto &gaussian3 : orbital3->gaussianOrbitals)
-					for (const auto &gaussian4 : orbital4->gaussianOrbitals)
-					{
-						const double factor = gaussian1.normalizationFactor * gaussian2.normalizationFactor *  gaussian3.normalizationFactor * gaussian4.normalizationFactor * 
-												gaussian1.coefficient * gaussian2.coefficient * gaussian3.coefficient * gaussian4.coefficient;
+		for (const PrimitivePair* pair12 = shellPairs.begin(shellPair12); pair12 != shellPairs.end(shellPair12); ++pair12)
+		{
+			const Orbitals::GaussianOrbital& gaussian1 = orbital1->gaussianOrbitals[pair12->primitive1];
+			const Orbitals::GaussianOrbital& gaussian2 = orbital2->gaussianOrbitals[pair12->primitive2];
 
-						bool swapped;
-						const GaussianTwoElectrons& electronsVertical = getElectronElectronVerticalAndTransfer(&gaussian1, &gaussian2, &gaussian3, &gaussian4, swapped);
+			const double factor12 = gaussian1.normalizationFactor * gaussian2.normalizationFactor * gaussian1.coefficient * gaussian2.coefficient / normalizationRatio;
 
-						if (swapped)
-						{
-							for (int i = 0; i < result.first->second.matrixCalc.rows(); ++i)
-								for (int j = 0; j < result.first->second.matrixCalc.cols(); ++j)
-									result.first->second.matrixCalc(i, j) += factor * electronsVertical.matrixCalc(j, i);
-						}
-						else
-						{
-							for (int i = 0; i < result.first->second.matrixCalc.rows(); ++i)
-								for (int j = 0; j < result.first->second.matrixCalc.cols(); ++j)
-									result.first->second.matrixCalc(i, j) += factor * electronsVertical.matrixCalc(i, j);
-						}
-					}
+			for (const PrimitivePair* pair34 = shellPairs.begin(shellPair34); pair34 != shellPairs.end(shellPair34); ++pair34)
+			{
+				const Orbitals::GaussianOrbital& gaussian3 = orbital3->gaussianOrbitals[pair34->primitive1];
+				const Orbitals::GaussianOrbital& gaussian4 = orbital4->gaussianOrbitals[pair34->primitive2];
 
-		// result.first->second.matrixCalc now holds the contraction of the results of vertical and electron transfer relations
+				const double factor = factor12 * gaussian3.normalizationFactor * gaussian4.normalizationFactor * gaussian3.coefficient * gaussian4.coefficient;
 
-		// now apply the two horizontal recurrence relations on it
+				result.AddPrimitives(this, factor, shellPair12, *pair12, shellPair34, *pair34);
+			}
+		}
 
-		result.first->second.HorizontalRecursion1(orbital1->center - orbital2->center, orbital1->angularMomentum, orbital2->angularMomentum, orbital3->angularMomentum, orbital4->angularMomentum);
-		result.first->second.HorizontalRecursion2(orbital3->center - orbital4->center, orbital1->angularMomentum, orbital2->angularMomentum, orbital3->angularMomentum, orbital4->angularMomentum);
+		// now apply the two horizontal recurrence relations on the contracted values
 
-		return result.first->second.getValue(orbital1->angularMomentum, orbital2->angularMomentum, orbital3->angularMomentum, orbital4->angularMomentum);
+		result.EndContraction(orbital1->center - orbital2->center, orbital3->center - orbital4->center);
+
+		result.AdjustNormalization();
 	}
 
 
-	const GaussianTwoElectrons& IntegralsRepository::getElectronElectronVerticalAndTransfer(const Orbitals::GaussianOrbital* orbital1, const Orbitals::GaussianOrbital* orbital2, const Orbitals::GaussianOrbital* orbital3, const Orbitals::GaussianOrbital* orbital4, bool& swapped)
+	
+
+
+
+
+
+	inline void IntegralsRepository::CalculateElectronElectronIntegrals4(unsigned int shell1, unsigned int shell2, unsigned int shell3, long long int shell12, GaussianTwoElectrons& block, std::valarray<double>& integrals)
 	{
-		// the contracted gaussians were already swapped to have the angular momentum in order
-		assert(orbital1->angularMomentum >= orbital2->angularMomentum);
-		assert(orbital3->angularMomentum >= orbital4->angularMomentum);
-		assert(orbital1->angularMomentum + orbital2->angularMomentum >= orbital3->angularMomentum + orbital4->angularMomentum);
+		for (unsigned int shell4 = 0; shell4 <= shell3; ++shell4)
+		{
+			const long long int shell34 = GetTwoIndex(shell3, shell4);
+			if (shell34 > shell12) return;
 
-		if (orbital1->angularMomentum == orbital2->angularMomentum && orbital1->ID < orbital2->ID) std::swap(orbital1, orbital2);
-		if (orbital3->angularMomentum == orbital4->angularMomentum && orbital3->ID < orbital4->ID) std::swap(orbital3, orbital4);
-
-		// the 'swapped' flag is needed to transpose the results matrix
-		// the range is (L1 -> L1 + L2, s | L3 -> L3 + L4, s)
-		// if 'swapped', it needs to be turned - by transposing - into:
-		// (L3 -> L3 + L4, s | L1 -> L1 + L2, s)
-		// since we're swapping here only if L1 + L2 == L3 + L4,
-		// the 'swapping' flag only takes care of the lower bounds
-		if (orbital1->angularMomentum + orbital2->angularMomentum == orbital3->angularMomentum + orbital4->angularMomentum &&
-		       (orbital1->ID < orbital3->ID || (orbital1->ID == orbital3->ID && orbital2->ID < orbital4->ID)))
-		{
-			std::swap(orbital1, orbital3);
-			std::swap(orbital2, orbital4);
-			swapped = true;
-		}
-		else swapped = false;
-
-		const std::tuple<unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, double, double, double, double> params(orbital1->shellID, orbital2->shellID, orbital3->shellID, orbital4->shellID,
-																																											orbital1->angularMomentum, orbital2->angularMomentum, orbital3->angularMomentum, orbital4->angularMomentum, 																																											 
-																																											orbital1->alpha, orbital2->alpha, orbital3->alpha, orbital4->alpha);
-		const auto it = electronElectronIntegralsVerticalAndTransferMap.find(params);
-		if (electronElectronIntegralsVerticalAndTransferMap.end() != it) return it->second;
-		
-		// unfortunately it's not yet calculated
-		auto result = electronElectronIntegralsVerticalAndTransferMap.insert(std::make_pair(params, GaussianTwoElectrons()));
+			++electronElectronShellQuartets;
 
-		result.first->second.Reset(this, orbital1->alpha, orbital2->alpha, orbital3->alpha, orbital4->alpha, 
-			                             orbital1->center, orbital2->center, orbital3->center, orbital4->center, 
-			                             orbital1->angularMomentum, orbital2->angularMomentum, orbital3->angularMomentum, orbital4->angularMomentum);
+			// the centres moved rigidly since the previous geometry, the stored values are still good
+			if (!electronElectronShellGroups.empty())
+			{
+				const int group = electronElectronShellGroups[shell1];
+				if (group == electronElectronShellGroups[shell2] && group == electronElectronShellGroups[shell3] && group == electronElectronShellGroups[shell4])
+				{
+					++electronElectronShellQuartetsReused;
+					continue;
+				}
+			}
 
-		return result.first->second;
-	}
+			const ElectronElectronShell* shells[4] = { &electronElectronShells[shell1], &electronElectronShells[shell2], &electronElectronShells[shell3], &electronElectronShells[shell4] };
 
+			if (schwarzThreshold > 0 && electronElectronShellPairBounds[shell12] * electronElectronShellPairBounds[shell34] < schwarzThreshold)
+			{
+				// negligible, the integrals stay zero
+				++electronElectronShellQuartetsSkipped;
 
-	
+				// the ones kept from the previous geometry might not be
+				if (!electronElectronShellGroups.empty())
+				{
+					for (unsigned int i = 0; i < shells[0]->nrOrbitals; ++i)
+						for (unsigned int j = 0; j < shells[1]->nrOrbitals; ++j)
+							for (unsigned int k = 0; k < shells[2]->nrOrbitals; ++k)
+								for (unsigned int l = 0; l < shells[3]->nrOrbitals; ++l)
+									integrals[GetElectronElectronIndex(shells[0]->startIndex + i, shells[1]->startIndex + j, shells[2]->startIndex + k, shells[3]->startIndex + l)] = 0;
+				}
 
+				continue;
+			}
 
+			const Orbitals::ContractedGaussianOrbital* orbitals[4] = { shells[0]->firstOrbital, shells[1]->firstOrbital, shells[2]->firstOrbital, shells[3]->firstOrbital };
+			unsigned int order[4] = { 0, 1, 2, 3 };
+
+			SwapShells(orbitals, order);
+			CalculateElectronElectronShells(orbitals[0], orbitals[1], orbitals[2], orbitals[3], block);
+
+			// scatter the whole block into the integrals array
+			// the component index inside a shell is the canonical index, as in the block, but the block might have the shells in a different order
+			unsigned int components[4];
+			for (components[0] = 0; components[0] < shells[0]->nrOrbitals; ++components[0])
+				for (components[1] = 0; components[1] < shells[1]->nrOrbitals; ++components[1])
+					for (components[2] = 0; components[2] < shells[2]->nrOrbitals; ++components[2])
+						for (components[3] = 0; components[3] < shells[3]->nrOrbitals; ++components[3])
+							integrals[GetElectronElectronIndex(shells[0]->startIndex + components[0], shells[1]->startIndex + components[1], shells[2]->startIndex + components[2], shells[3]->startIndex + components[3])] = 
+								block(components[order[0]], components[order[1]], components[order[2]], components[order[3]]);
+		}
+	}
 
 
 
-	inline void IntegralsRepository::CalculateElectronElectronIntegrals4(int i, int j, int k, long long int ij, const Orbitals::ContractedGaussianOrbital& orb1, const Orbitals::ContractedGaussianOrbital& orb2, const Orbitals::ContractedGaussianOrbital& orb3)
+	void IntegralsRepository::CalculateElectronElectronShellPairBounds(GaussianTwoElectrons& block)
 	{
-		int l = 0;
-		for (const auto& atom4 : m_Molecule->atoms)
-			for (const auto& shell4 : atom4.shells)
+		electronElectronShellPairBounds.resize(GetTwoIndex(electronElectronShells.size(), 0));
+
+		for (unsigned int shell1 = 0; shell1 < electronElectronShells.size(); ++shell1)
+			for (unsigned int shell2 = 0; shell2 <= shell1; ++shell2)
 			{
-				for (const auto& orb4 : shell4.basisFunctions)
+				// the pair did not change since the previous geometry
+				if (!electronElectronShellGroups.empty() && electronElectronShellGroups[shell1] == electronElectronShellGroups[shell2])
 				{
-					const long long int kl = GetTwoIndex(k, l);
-					
-					if (ij <= kl)
-						electronElectronIntegrals[GetElectronElectronIndex(i, j, k, l)] = getElectronElectron(&orb1, &orb2, &orb3, &orb4);
+					electronElectronShellPairBounds[GetTwoIndex(shell1, shell2)] = previousShellPairBounds[GetTwoIndex(shell1, shell2)];
+					continue;
+				}
 
-					if (++l > k) 
+				const ElectronElectronShell& s1 = electronElectronShells[shell1];
+				const ElectronElectronShell& s2 = electronElectronShells[shell2];
+
+				const Orbitals::ContractedGaussianOrbital* orbitals[4] = { s1.firstOrbital, s2.firstOrbital, s1.firstOrbital, s2.firstOrbital };
+				unsigned int order[4] = { 0, 1, 2, 3 };
+
+				SwapShells(orbitals, order);
+				CalculateElectronElectronShells(orbitals[0], orbitals[1], orbitals[2], orbitals[3], block);
+
+				double maxVal = 0;
+				unsigned int components[4];
+				for (components[0] = 0; components[0] < s1.nrOrbitals; ++components[0])
+					for (components[1] = 0; components[1] < s2.nrOrbitals; ++components[1])
 					{
-						if (!useLotsOfMemory) ClearElectronElectronIntermediaries(); // if this is cleared, it more than doubles the execution time, but it uses a lot less memory
+						components[2] = components[0];
+						components[3] = components[1];
 
-						return;
+						maxVal = max(maxVal, abs(block(components[order[0]], components[order[1]], components[order[2]], components[order[3]])));
 					}
-				}
 
-				if (!useLotsOfMemory) ClearElectronElectronIntermediaries(); // if this is cleared, it more than doubles the execution time, but it uses a lot less memory
+				electronElectronShellPairBounds[GetTwoIndex(shell1, shell2)] = sqrt(maxVal);
 			}
 	}
 
 
-
-	inline void IntegralsRepository::CalculateElectronElectronIntegrals23(int i, const Orbitals::ContractedGaussianOrbital& orb1)
+	// all the shell quartets having the first pair (shell1, shell2), this is the unit of work for the threads
+	// the integrals are written in the passed array, the shell pair determines the slots, so the threads write disjoint ones
+	void IntegralsRepository::CalculateElectronElectronIntegrals34(unsigned int shell1, unsigned int shell2, GaussianTwoElectrons& block, std::valarray<double>& integrals)
 	{
-		int j = 0;
-		for (const auto& atom2 : m_Molecule->atoms)
-			for (const auto& shell2 : atom2.shells)
-				for (const auto& orb2 : shell2.basisFunctions)
-				{
-					const long long int ij = GetTwoIndex(i, j);
+		const long long int shell12 = GetTwoIndex(shell1, shell2);
 
-					int k = 0;
-					for (const auto& atom3 : m_Molecule->atoms)
-						for (const auto& shell3 : atom3.shells)
-							for (const auto& orb3 : shell3.basisFunctions)
-								CalculateElectronElectronIntegrals4(i, j, k++, ij, orb1, orb2, orb3);
-
-					if (++j > i) return;
-				}
+		for (unsigned int shell3 = 0; shell3 <= shell1; ++shell3)
+			CalculateElectronElectronIntegrals4(shell1, shell2, shell3, shell12, block, integrals);
 	}
 
 
@@ -566,18 +575,162 @@ namespace GaussianIntegrals {
 
 
 
-	void IntegralsRepository::CalculateElectronElectronIntegrals()
+	void IntegralsRepository::CalculateElectronElectronIntegralsMultithreaded()
 	{
-		const int maxNr = m_Molecule->CountNumberOfContractedGaussians();
-		const long long int maxIndex = GetElectronElectronIndex(maxNr, maxNr, maxNr, maxNr);
+		// the tasks are the first shell pairs, the cost for one is estimated from the number of quartets it has
+		// and the number of primitive gaussians and components involved
+		std::vector<std::pair<unsigned int, unsigned int>> tasks;
+		std::vector<double> costs;
+
+		for (unsigned int shell1 = 0; shell1 < electronElectronShells.size(); ++shell1)
+			for (unsigned int shell2 = 0; shell2 <= shell1; ++shell2)
+			{
+				const ElectronElectronShell& s1 = electronElectronShells[shell1];
+				const ElectronElectronShell& s2 = electronElectronShells[shell2];
+
+				tasks.emplace_back(std::make_pair(shell1, shell2));
+				costs.push_back((GetTwoIndex(shell1, shell2) + 1.) * s1.firstOrbital->gaussianOrbitals.size() * s2.firstOrbital->gaussianOrbitals.size() * s1.nrOrbitals * s2.nrOrbitals);
+			}
+
+		std::vector<unsigned int> order(tasks.size());
+		for (unsigned int i = 0; i < order.size(); ++i) order[i] = i;
+		std::sort(order.begin(), order.end(), [&costs](unsigned int i1, unsigned int i2) -> bool { return costs[i1] > costs[i2]; });
+
+		// each thread has its own repository for the intermediary results and the Boys functions work space
+		std::vector<std::unique_ptr<IntegralsRepository>> workers;
+		std::vector<GaussianTwoElectrons> blocks(nrThreads);
+
+		for (unsigned int i = 0; i < nrThreads; ++i)
+		{
+			workers.emplace_back(std::make_unique<IntegralsRepository>());
+
+			workers.back()->m_Molecule = m_Molecule;
+			workers.back()->shellPairs = shellPairs;
+			workers.back()->schwarzThreshold = schwarzThreshold;
+			workers.back()->electronElectronShells = electronElectronShells;
+			workers.back()->electronElectronShellPairBounds = electronElectronShellPairBounds;
+			workers.back()->electronElectronShellGroups = electronElectronShellGroups;
+		}
 
-		electronElectronIntegrals.resize(maxIndex + 1ULL);
+		GetPool().Run(static_cast<unsigned int>(tasks.size()), [this, &tasks, &order, &workers, &blocks](unsigned int task, unsigned int thread)
+		{
+			const auto& shells = tasks[order[task]];
+
+			workers[thread]->CalculateElectronElectronIntegrals34(shells.first, shells.second, blocks[thread], electronElectronIntegrals);
+		});
+
+		for (const auto& worker : workers)
+		{
+			electronElectronShellQuartets += worker->electronElectronShellQuartets;
+			electronElectronShellQuartetsSkipped += worker->electronElectronShellQuartetsSkipped;
+			electronElectronShellQuartetsReused += worker->electronElectronShellQuartetsReused;
+		}
+
+		for (const auto& block : blocks)
+		{
+			electronElectronPrimitiveQuartets += block.primitiveQuartets;
+			electronElectronAllocations += block.allocations;
+		}
+	}
+
+
+	void IntegralsRepository::CalculateElectronElectronShellsList()
+	{
+		// split the shells by angular momentum, the integrals are computed for the whole shell quartets at once
+		electronElectronShells.clear();
+
+		unsigned int index = 0;
+		for (const auto& atom : m_Molecule->atoms)
+			for (const auto& shell : atom.shells)
+				for (const auto& orbital : shell.basisFunctions)
+				{
+					if (electronElectronShells.empty() || electronElectronShells.back().firstOrbital->shellID != orbital.shellID || electronElectronShells.back().firstOrbital->angularMomentum != orbital.angularMomentum)
+						electronElectronShells.push_back({ &orbital, index, 0 });
+
+					assert(orbital.angularMomentum.GetCanonicalIndex() == electronElectronShells.back().nrOrbitals);
+
+					++electronElectronShells.back().nrOrbitals;
+					++index;
+				}
+	}
+
+
+	void IntegralsRepository::CalculateElectronElectronIntegrals(bool forceStore)
+	{
+		const bool store = !integralDirect || forceStore;
+
+		supermatrix.resize(0, 0);
+
+		CalculateElectronElectronShellsList();
+		fockWorkers.clear();
+
+		// with the integrals of the previous geometry kept, only the quartets that changed are computed, the others are left as they are
+		if (!store || !FindElectronElectronShellGroups())
+		{
+			electronElectronShellGroups.clear();
 
-		int i = 0;
-		for (const auto& atom1 : m_Molecule->atoms)
-			for (const auto& shell1 : atom1.shells)
-				for (const auto& orb1 : shell1.basisFunctions)
-					CalculateElectronElectronIntegrals23(i++, orb1);
+			if (store)
+			{
+				const int maxNr = m_Molecule->CountNumberOfContractedGaussians();
+				const long long int maxIndex = GetElectronElectronIndex(maxNr, maxNr, maxNr, maxNr);
+
+				electronElectronIntegrals.resize(maxIndex + 1ULL);
+			}
+			else
+			{
+				// might be kept over the Reset from a previous calculation
+				std::valarray<double> emptyV;
+				electronElectronIntegrals.swap(emptyV);
+			}
+		}
+
+		GaussianTwoElectrons block;
+
+		electronElectronShellQuartets = 0;
+		electronElectronShellQuartetsSkipped = 0;
+		electronElectronShellQuartetsReused = 0;
+		electronElectronPrimitiveQuartets = 0;
+		electronElectronAllocations = 0;
+
+		// the direct mode needs the bounds for the density weighted screening
+		if (schwarzThreshold > 0 || integralDirect) CalculateElectronElectronShellPairBounds(block);
+
+		if (store)
+		{
+			if (nrThreads <= 1)
+			{
+				for (unsigned int shell1 = 0; shell1 < electronElectronShells.size(); ++shell1)
+					for (unsigned int shell2 = 0; shell2 <= shell1; ++shell2)
+						CalculateElectronElectronIntegrals34(shell1, shell2, block, electronElectronIntegrals);
+			}
+			else
+				CalculateElectronElectronIntegralsMultithreaded();
+		}
+
+		electronElectronPrimitiveQuartets += block.primitiveQuartets;
+		electronElectronAllocations += block.allocations;
+
+		TRACE("Shell quartets: %llu, skipped by Schwarz screening: %llu, reused from the previous geometry: %llu\n", electronElectronShellQuartets, electronElectronShellQuartetsSkipped, electronElectronShellQuartetsReused);
+		TRACE("Primitive quartets: %llu, work buffer allocations: %llu\n", electronElectronPrimitiveQuartets, electronElectronAllocations);
+
+		if (store && reuseElectronElectronIntegrals) SaveElectronElectronShellGeometry();
+		else
+		{
+			previousShells.clear();
+			previousShellPairBounds.clear();
+		}
+		electronElectronShellGroups.clear();
+
+		// the direct mode needs them for each Fock matrix build
+		if (!integralDirect)
+		{
+			electronElectronShells.clear();
+			electronElectronShellPairBounds.clear();
+
+			const unsigned long long int nrOrbitals = m_Molecule->CountNumberOfContractedGaussians();
+			if (useLotsOfMemory && nrOrbitals * nrOrbitals * nrOrbitals * nrOrbitals * sizeof(double) <= supermatrixMemoryLimit * 1024ULL * 1024ULL)
+				CalculateSupermatrix();
+		}
 					
 		//PrintMemoryInfo();
 
@@ -587,14 +740,513 @@ namespace GaussianIntegrals {
 	}
 
 
-}
+	void IntegralsRepository::TransferElectronElectronIntegrals(IntegralsRepository& destination)
+	{
+		if (reuseElectronElectronIntegrals) destination.electronElectronIntegrals = electronElectronIntegrals;
+		else
+		{
+			destination.electronElectronIntegrals.swap(electronElectronIntegrals);
+
+			std::valarray<double> emptyV;
+			electronElectronIntegrals.swap(emptyV);
+		}
+
+		destination.supermatrix.swap(supermatrix);
+		supermatrix.resize(0, 0);
+
+		// the destination did not compute them, it has nothing to reuse at its next geometry
+		destination.previousShells.clear();
+		destination.previousShellPairBounds.clear();
+
+		destination.electronElectronShellQuartets = electronElectronShellQuartets;
+		destination.electronElectronShellQuartetsSkipped = electronElectronShellQuartetsSkipped;
+		destination.electronElectronShellQuartetsReused = electronElectronShellQuartetsReused;
+		destination.electronElectronPrimitiveQuartets = electronElectronPrimitiveQuartets;
+		destination.electronElectronAllocations = electronElectronAllocations;
+	}
+
+
+	bool IntegralsRepository::FindElectronElectronShellGroups()
+	{
+		electronElectronShellGroups.clear();
+
+		if (!reuseElectronElectronIntegrals || previousShells.size() != electronElectronShells.size() || previousSchwarzThreshold != schwarzThreshold || previousPrimitivePairThreshold != primitivePairThreshold)
+			return false;
+
+		const int maxNr = m_Molecule->CountNumberOfContractedGaussians();
+		if (electronElectronIntegrals.size() != static_cast<size_t>(GetElectronElectronIndex(maxNr, maxNr, maxNr, maxNr) + 1)) return false;
+		if (schwarzThreshold > 0 && previousShellPairBounds.size() != static_cast<size_t>(GetTwoIndex(static_cast<long long int>(electronElectronShells.size()), 0))) return false;
+
+		std::vector<Vector3D<double>> translations;
+		std::vector<int> groups(electronElectronShells.size());
+
+		for (unsigned int shell = 0; shell < electronElectronShells.size(); ++shell)
+		{
+			const ElectronElectronShell& current = electronElectronShells[shell];
+			const ElectronElectronShellGeometry& previous = previousShells[shell];
+			const Orbitals::ContractedGaussianOrbital& orbital = *current.firstOrbital;
+
+			if (previous.startIndex != current.startIndex || previous.nrOrbitals != current.nrOrbitals || previous.shellID != orbital.shellID || previous.angularMomentum != static_cast<unsigned int>(orbital.angularMomentum) || previous.primitives.size() != orbital.gaussianOrbitals.size())
+				return false;
+
+			for (unsigned int i = 0; i < orbital.gaussianOrbitals.size(); ++i)
+				if (previous.primitives[i].first != orbital.gaussianOrbitals[i].alpha || previous.primitives[i].second != orbital.gaussianOrbitals[i].coefficient)
+					return false;
+
+			// the atoms that moved together, usually there are only a few groups
+			const Vector3D<double> translation = orbital.center - previous.center;
+
+			unsigned int group = 0;
+			for (; group < translations.size(); ++group)
+				if ((translations[group] - translation).Length() < 1E-12) break;
+
+			if (translations.size() == group) translations.push_back(translation);
+
+			groups[shell] = static_cast<int>(group);
+		}
+
+		electronElectronShellGroups.swap(groups);
+
+		return true;
+	}
+
+
+	void IntegralsRepository::SaveElectronElectronShellGeometry()
+	{
+		previousShells.clear();
+		previousShells.reserve(electronElectronShells.size());
+
+		for (const auto& shell : electronElectronShells)
+		{
+			const Orbitals::ContractedGaussianOrbital& orbital = *shell.firstOrbital;
+
+			ElectronElectronShellGeometry geometry;
+			geometry.center = orbital.center;
+			geometry.startIndex = shell.startIndex;
+			geometry.nrOrbitals = shell.nrOrbitals;
+			geometry.shellID = orbital.shellID;
+			geometry.angularMomentum = orbital.angularMomentum;
+
+			for (const auto& gaussian : orbital.gaussianOrbitals)
+				geometry.primitives.emplace_back(gaussian.alpha, gaussian.coefficient);
+
+			previousShells.emplace_back(std::move(geometry));
+		}
+
+		previousShellPairBounds = electronElectronShellPairBounds;
+		previousSchwarzThreshold = schwarzThreshold;
+		previousPrimitivePairThreshold = primitivePairThreshold;
+	}
+
+
+	// unpacks the stored integrals, the element (i + N * j, k + N * l) is (ij|kl)
+	void IntegralsRepository::CalculateSupermatrix()
+	{
+		const unsigned int nrOrbitals = m_Molecule->CountNumberOfContractedGaussians();
+		const Eigen::Index N = nrOrbitals;
+
+		supermatrix.resize(N * N, N * N);
+
+		const double* value = &electronElectronIntegrals[0];
+
+		for (unsigned int i = 0; i < nrOrbitals; ++i)
+			for (unsigned int j = 0; j <= i; ++j)
+				for (unsigned int k = 0; k <= i; ++k)
+				{
+					const unsigned int maxl = (k == i) ? j : k;
+
+					for (unsigned int l = 0; l <= maxl; ++l, ++value)
+					{
+						const Eigen::Index ij = i + N * j;
+						const Eigen::Index ji = j + N * i;
+						const Eigen::Index kl = k + N * l;
+						const Eigen::Index lk = l + N * k;
+
+						supermatrix(ij, kl) = supermatrix(ji, kl) = supermatrix(ij, lk) = supermatrix(ji, lk) = *value;
+						supermatrix(kl, ij) = supermatrix(kl, ji) = supermatrix(lk, ij) = supermatrix(lk, ji) = *value;
+					}
+				}
+	}
+
+
+	//************************************************************************************************************************************************************
+	// Coulomb and exchange matrices
+	//************************************************************************************************************************************************************
+
+	// with the densities as the columns of V (vec(D), the column major layout) J is supermatrix * V
+	// the supermatrix columns N * j to N * j + N - 1, seen as a N x N^2 matrix, have the element (i, l + N * k) equal with (il|kj)
+	// so the column j of K is that matrix times vec(D transposed)
+	// both are computed for each j, with all the densities at once, using that the supermatrix is symmetric for J
+	// J is not done as a single product for all j, the supermatrix is too big for the cache, it would be read from memory twice, once for J and once for K
+	// the densities and the results are in the work space kept in the repository, after the first build nothing is allocated
+	void IntegralsRepository::CalculateCoulombAndExchangeSupermatrix(const std::vector<const Eigen::MatrixXd*>& coulombDensities, const std::vector<const Eigen::MatrixXd*>& exchangeDensities, std::vector<Eigen::MatrixXd>& coulomb, std::vector<Eigen::MatrixXd>& exchange)
+	{
+		const Eigen::Index N = (coulombDensities.empty() ? exchangeDensities : coulombDensities).front()->rows();
+		const Eigen::Index nrCoulomb = static_cast<Eigen::Index>(coulombDensities.size());
+		const Eigen::Index nrExchange = static_cast<Eigen::Index>(exchangeDensities.size());
+
+		supermatrixCoulombDensities.resize(N * N, nrCoulomb);
+		for (Eigen::Index d = 0; d < nrCoulomb; ++d)
+			supermatrixCoulombDensities.col(d) = Eigen::Map<const Eigen::VectorXd>(coulombDensities[d]->data(), N * N);
+
+		supermatrixExchangeDensities.resize(N * N, nrExchange);
+		for (Eigen::Index d = 0; d < nrExchange; ++d)
+			Eigen::Map<Eigen::MatrixXd>(supermatrixExchangeDensities.col(d).data(), N, N) = exchangeDensities[d]->transpose();
+
+		supermatrixCoulomb.resize(N * N, nrCoulomb);
+		supermatrixExchange.resize(N, N * nrExchange);
+
+		// each task writes its own rows of vec(J) and its own columns of K, so the result does not depend on the number of threads
+		const auto task = [this, N, nrCoulomb, nrExchange](unsigned int j, unsigned int /*thread*/)
+		{
+			const auto columns = supermatrix.middleCols(N * j, N);
+
+			if (nrCoulomb)
+				supermatrixCoulomb.middleRows(N * j, N).noalias() = columns.transpose() * supermatrixCoulombDensities;
+
+			if (nrExchange)
+				supermatrixExchange.middleCols(nrExchange * j, nrExchange).noalias() = Eigen::Map<const Eigen::MatrixXd>(columns.data(), N, N * N) * supermatrixExchangeDensities;
+		};
+
+		// passed by reference, a std::function made from the lambda itself would allocate for its captures
+		GetPool().Run(static_cast<unsigned int>(N), std::ref(task));
+
+		for (Eigen::Index d = 0; d < nrCoulomb; ++d)
+			coulomb[d] = Eigen::Map<const Eigen::MatrixXd>(supermatrixCoulomb.col(d).data(), N, N);
+
+		for (Eigen::Index d = 0; d < nrExchange; ++d)
+			for (Eigen::Index j = 0; j < N; ++j)
+				exchange[d].col(j) = supermatrixExchange.col(nrExchange * j + d);
+	}
+
+
+	// all the unique shell quartets having the first pair (shell1, shell2), the integrals are contracted with the densities as soon as the block is computed
+	void IntegralsRepository::CalculateCoulombAndExchange34(unsigned int shell1, unsigned int shell2, const std::vector<const Eigen::MatrixXd*>& coulombDensities, const std::vector<const Eigen::MatrixXd*>& exchangeDensities, double threshold, GaussianTwoElectrons& block, std::vector<Eigen::MatrixXd>& coulomb, std::vector<Eigen::MatrixXd>& exchange)
+	{
+		const unsigned int nrShells = static_cast<unsigned int>(electronElectronShells.size());
+		const long long int shell12 = GetTwoIndex(shell1, shell2);
+
+		for (unsigned int shell3 = 0; shell3 <= shell1; ++shell3)
+			for (unsigned int shell4 = 0; shell4 <= shell3; ++shell4)
+			{
+				const long long int shell34 = GetTwoIndex(shell3, shell4);
+				if (shell34 > shell12) break;
+
+				++electronElectronShellQuartets;
+				if (threshold > 0)
+				{
+					// the biggest density value an integral from the quartet gets multiplied with, either in the Coulomb or in the exchange matrix
+					const double maxDensity = max(max(max(shellPairsMaxDensity[shell1 * nrShells + shell2], shellPairsMaxDensity[shell3 * nrShells + shell4]),
+						max(shellPairsMaxDensity[shell1 * nrShells + shell3], shellPairsMaxDensity[shell1 * nrShells + shell4])),
+						max(shellPairsMaxDensity[shell2 * nrShells + shell3], shellPairsMaxDensity[shell2 * nrShells + shell4]));
+
+					if (electronElectronShellPairBounds[shell12] * electronElectronShellPairBounds[shell34] * maxDensity < threshold)
+					{
+						++electronElectronShellQuartetsSkipped;
+						continue;
+					}
+				}
+
+				const ElectronElectronShell* shells[4] = { &electronElectronShells[shell1], &electronElectronShells[shell2], &electronElectronShells[shell3], &electronElectronShells[shell4] };
+				const Orbitals::ContractedGaussianOrbital* orbitals[4] = { shells[0]->firstOrbital, shells[1]->firstOrbital, shells[2]->firstOrbital, shells[3]->firstOrbital };
+				unsigned int order[4] = { 0, 1, 2, 3 };
+
+				SwapShells(orbitals, order);
+				CalculateElectronElectronShells(orbitals[0], orbitals[1], orbitals[2], orbitals[3], block);
+
+				// if the shells in a pair are the same (or the pairs are the same) the block contains the same integral more than once, only the one with i >= j, k >= l, ij >= kl is used
+				// for different shells the canonical order is given by the shells and they cannot contain duplicates
+				// the value is multiplied with the number of the distinct permutations of the indices that give the same integral
+				unsigned int components[4];
+				for (components[0] = 0; components[0] < shells[0]->nrOrbitals; ++components[0])
+				{
+					const unsigned int i = shells[0]->startIndex + components[0];
+
+					for (components[1] = 0; components[1] < shells[1]->nrOrbitals; ++components[1])
+					{
+						const unsigned int j = shells[1]->startIndex + components[1];
+						if (j > i) break;
+
+						const long long int ij = GetTwoIndex(i, j);
+
+						for (components[2] = 0; components[2] < shells[2]->nrOrbitals; ++components[2])
+						{
+							const unsigned int k = shells[2]->startIndex + components[2];
+
+							for (components[3] = 0; components[3] < shells[3]->nrOrbitals; ++components[3])
+							{
+								const unsigned int l = shells[3]->startIndex + components[3];
+								if (l > k) break;
+
+								// the orbitals order is not the same as the shells order, only the same shell pairs are checked
+								const long long int kl = GetTwoIndex(k, l);
+								if (shell12 == shell34 && kl > ij) break;
+
+								double value = block(components[order[0]], components[order[1]], components[order[2]], components[order[3]]);
+								if (i != j) value *= 2;
+								if (k != l) value *= 2;
+								if (ij != kl) value *= 2;
+
+								AddCoulombAndExchange(i, j, k, l, value, coulombDensities, exchangeDensities, coulomb, exchange);
+							}
+						}
+					}
+				}
+			}
+	}
+
 
+	void IntegralsRepository::CalculateShellPairsMaxDensity(const std::vector<const Eigen::MatrixXd*>& coulombDensities, const std::vector<const Eigen::MatrixXd*>& exchangeDensities)
+	{
+		const unsigned int nrShells = static_cast<unsigned int>(electronElectronShells.size());
+
+		shellPairsMaxDensity.assign(static_cast<size_t>(nrShells) * nrShells, 0.);
+		for (unsigned int shell1 = 0; shell1 < nrShells; ++shell1)
+			for (unsigned int shell2 = 0; shell2 < nrShells; ++shell2)
+			{
+				const ElectronElectronShell& s1 = electronElectronShells[shell1];
+				const ElectronElectronShell& s2 = electronElectronShells[shell2];
+
+				double maxDensity = 0;
+				for (const Eigen::MatrixXd* D : coulombDensities)
+					maxDensity = max(maxDensity, D->block(s1.startIndex, s2.startIndex, s1.nrOrbitals, s2.nrOrbitals).cwiseAbs().maxCoeff());
+				for (const Eigen::MatrixXd* D : exchangeDensities)
+					maxDensity = max(maxDensity, D->block(s1.startIndex, s2.startIndex, s1.nrOrbitals, s2.nrOrbitals).cwiseAbs().maxCoeff());
+
+				shellPairsMaxDensity[static_cast<size_t>(shell1) * nrShells + shell2] = maxDensity;
+			}
+	}
+
+
+	void IntegralsRepository::CalculateCoulombAndExchangeDirect(const std::vector<const Eigen::MatrixXd*>& coulombDensities, const std::vector<const Eigen::MatrixXd*>& exchangeDensities, double threshold, std::vector<Eigen::MatrixXd>& coulomb, std::vector<Eigen::MatrixXd>& exchange)
+	{
+		const unsigned int nrShells = static_cast<unsigned int>(electronElectronShells.size());
+
+		const unsigned long long int primitiveQuartets = directBlock.primitiveQuartets;
+		const unsigned long long int allocations = directBlock.allocations;
+
+		for (unsigned int shell1 = 0; shell1 < nrShells; ++shell1)
+			for (unsigned int shell2 = 0; shell2 <= shell1; ++shell2)
+				CalculateCoulombAndExchange34(shell1, shell2, coulombDensities, exchangeDensities, threshold, directBlock, coulomb, exchange);
+
+		electronElectronPrimitiveQuartets = directBlock.primitiveQuartets - primitiveQuartets;
+		electronElectronAllocations = directBlock.allocations - allocations;
+	}
+
+
+	// walks the packed integrals having the first index i once, in the order they are stored
+	// for i >= j and k >= l the index of (ij|kl) is ij * (ij + 1) / 2 + kl if ij >= kl, so with kl going from 0 to ij the index just increments
+	void IntegralsRepository::CalculateCoulombAndExchangeStored(unsigned int i, const std::vector<const Eigen::MatrixXd*>& coulombDensities, const std::vector<const Eigen::MatrixXd*>& exchangeDensities, std::vector<Eigen::MatrixXd>& coulomb, std::vector<Eigen::MatrixXd>& exchange) const
+	{
+		const double* value = &electronElectronIntegrals[GetElectronElectronIndex(i, 0, 0, 0)];
+
+		for (unsigned int j = 0; j <= i; ++j)
+		{
+			assert(value - &electronElectronIntegrals[0] == GetElectronElectronIndex(i, j, 0, 0));
+
+			const double factorij = (i == j) ? 1. : 2.;
+
+			for (unsigned int k = 0; k <= i; ++k)
+			{
+				const unsigned int maxl = (k == i) ? j : k;
+
+				for (unsigned int l = 0; l <= maxl; ++l, ++value)
+				{
+					// the ones skipped by screening are zero
+					if (0. == *value) continue;
+
+					double factor = factorij;
+					if (k != l) factor *= 2.;
+					if (k != i || l != j) factor *= 2.;
+
+					AddCoulombAndExchange(i, j, k, l, factor * *value, coulombDensities, exchangeDensities, coulomb, exchange);
+				}
+			}
+		}
+	}
+
+
+	// the tasks are the shell pairs (shell1, shell2) for the integral direct mode and the first indices i for the stored integrals
+	// they are dealt into chunks, each chunk has its own Coulomb and exchange matrices and a thread executes a whole chunk
+	// the matrices are summed in the chunks order at the end, so the result does not depend on which thread did what
+	// there are more chunks than threads so the threads that finish early can steal some
+	void IntegralsRepository::CalculateCoulombAndExchangeMultithreaded(const std::vector<const Eigen::MatrixXd*>& coulombDensities, const std::vector<const Eigen::MatrixXd*>& exchangeDensities, double threshold, std::vector<Eigen::MatrixXd>& coulomb, std::vector<Eigen::MatrixXd>& exchange)
+	{
+		const Eigen::Index nrOrbitals = (coulombDensities.empty() ? exchangeDensities : coulombDensities).front()->rows();
+
+		std::vector<std::pair<unsigned int, unsigned int>> tasks;
+		std::vector<double> costs;
+
+		if (integralDirect)
+		{
+			for (unsigned int shell1 = 0; shell1 < electronElectronShells.size(); ++shell1)
+				for (unsigned int shell2 = 0; shell2 <= shell1; ++shell2)
+				{
+					const ElectronElectronShell& s1 = electronElectronShells[shell1];
+					const ElectronElectronShell& s2 = electronElectronShells[shell2];
+
+					tasks.emplace_back(std::make_pair(shell1, shell2));
+					costs.push_back((GetTwoIndex(shell1, shell2) + 1.) * s1.firstOrbital->gaussianOrbitals.size() * s2.firstOrbital->gaussianOrbitals.size() * s1.nrOrbitals * s2.nrOrbitals);
+				}
+		}
+		else
+		{
+			for (unsigned int i = 0; i < nrOrbitals; ++i)
+			{
+				tasks.emplace_back(std::make_pair(i, 0));
+				costs.push_back(static_cast<double>(GetElectronElectronIndex(i + 1, 0, 0, 0) - GetElectronElectronIndex(i, 0, 0, 0)));
+			}
+		}
+
+		std::vector<unsigned int> order(tasks.size());
+		for (unsigned int i = 0; i < order.size(); ++i) order[i] = i;
+		std::sort(order.begin(), order.end(), [&costs](unsigned int i1, unsigned int i2) -> bool { return costs[i1] > costs[i2]; });
+
+		// the work space for the direct mode, one for each thread
+		if (integralDirect && fockWorkers.size() != nrThreads)
+		{
+			fockWorkers.clear();
+
+			for (unsigned int i = 0; i < nrThreads; ++i)
+			{
+				fockWorkers.emplace_back(std::make_unique<IntegralsRepository>());
 
+				fockWorkers.back()->m_Molecule = m_Molecule;
+				fockWorkers.back()->shellPairs = shellPairs;
+				fockWorkers.back()->electronElectronShells = electronElectronShells;
+				fockWorkers.back()->electronElectronShellPairBounds = electronElectronShellPairBounds;
+			}
+		}
 
+		for (auto& worker : fockWorkers)
+		{
+			worker->shellPairsMaxDensity = shellPairsMaxDensity;
+			worker->electronElectronShellQuartets = 0;
+			worker->electronElectronShellQuartetsSkipped = 0;
+			worker->directBlock.primitiveQuartets = 0;
+			worker->directBlock.allocations = 0;
+		}
 
+		const unsigned int nrChunks = static_cast<unsigned int>(min(static_cast<size_t>(4) * nrThreads, tasks.size()));
 
+		// the chunk matrices are allocated only if the sizes changed since the last build
+		chunksCoulomb.resize(nrChunks);
+		chunksExchange.resize(nrChunks);
 
+		const auto task = [this, &tasks, &order, &coulombDensities, &exchangeDensities, threshold, nrChunks, nrOrbitals](unsigned int chunk, unsigned int thread)
+		{
+			std::vector<Eigen::MatrixXd>& chunkCoulomb = chunksCoulomb[chunk];
+			std::vector<Eigen::MatrixXd>& chunkExchange = chunksExchange[chunk];
 
+			chunkCoulomb.resize(coulombDensities.size());
+			for (auto& J : chunkCoulomb)
+			{
+				J.resize(nrOrbitals, nrOrbitals);
+				J.setZero();
+			}
 
+			chunkExchange.resize(exchangeDensities.size());
+			for (auto& K : chunkExchange)
+			{
+				K.resize(nrOrbitals, nrOrbitals);
+				K.setZero();
+			}
 
+			// dealt round robin, the tasks are in decreasing order of cost
+			for (size_t task = chunk; task < order.size(); task += nrChunks)
+			{
+				const auto& t = tasks[order[task]];
 
+				if (integralDirect)
+				{
+					IntegralsRepository& worker = *fockWorkers[thread];
+					worker.CalculateCoulombAndExchange34(t.first, t.second, coulombDensities, exchangeDensities, threshold, worker.directBlock, chunkCoulomb, chunkExchange);
+				}
+				else
+					CalculateCoulombAndExchangeStored(t.first, coulombDensities, exchangeDensities, chunkCoulomb, chunkExchange);
+			}
+		};
+
+		// passed by reference, a std::function made from the lambda itself would allocate for its captures
+		GetPool().Run(nrChunks, std::ref(task));
+
+		for (unsigned int chunk = 0; chunk < nrChunks; ++chunk)
+		{
+			for (unsigned int d = 0; d < coulomb.size(); ++d)
+				coulomb[d] += chunksCoulomb[chunk][d];
+
+			for (unsigned int d = 0; d < exchange.size(); ++d)
+				exchange[d] += chunksExchange[chunk][d];
+		}
+
+		if (integralDirect)
+		{
+			electronElectronPrimitiveQuartets = 0;
+			electronElectronAllocations = 0;
+
+			for (const auto& worker : fockWorkers)
+			{
+				electronElectronShellQuartets += worker->electronElectronShellQuartets;
+				electronElectronShellQuartetsSkipped += worker->electronElectronShellQuartetsSkipped;
+				electronElectronPrimitiveQuartets += worker->directBlock.primitiveQuartets;
+				electronElectronAllocations += worker->directBlock.allocations;
+			}
+		}
+	}
+
+
+	void IntegralsRepository::CalculateCoulombAndExchange(const std::vector<const Eigen::MatrixXd*>& coulombDensities, const std::vector<const Eigen::MatrixXd*>& exchangeDensities, std::vector<Eigen::MatrixXd>& coulomb, std::vector<Eigen::MatrixXd>& exchange, double thresholdScale)
+	{
+		assert(!coulombDensities.empty() || !exchangeDensities.empty());
+
+		const Eigen::Index nrOrbitals = (coulombDensities.empty() ? exchangeDensities : coulombDensities).front()->rows();
+
+		coulomb.resize(coulombDensities.size());
+		for (unsigned int d = 0; d < coulomb.size(); ++d)
+			coulomb[d] = Eigen::MatrixXd::Zero(nrOrbitals, nrOrbitals);
+
+		exchange.resize(exchangeDensities.size());
+		for (unsigned int d = 0; d < exchange.size(); ++d)
+			exchange[d] = Eigen::MatrixXd::Zero(nrOrbitals, nrOrbitals);
+
+		if (HasSupermatrix())
+		{
+			CalculateCoulombAndExchangeSupermatrix(coulombDensities, exchangeDensities, coulomb, exchange);
+			return;
+		}
+
+		const double threshold = schwarzThreshold * thresholdScale;
+
+		if (integralDirect)
+		{
+			// CalculateElectronElectronIntegrals should have been called before, but just in case
+			if (electronElectronShells.empty() || electronElectronShellPairBounds.empty())
+				CalculateElectronElectronIntegrals();
+
+			// for the density weighted screening
+			CalculateShellPairsMaxDensity(coulombDensities, exchangeDensities);
+
+			electronElectronShellQuartets = 0;
+			electronElectronShellQuartetsSkipped = 0;
+		}
+
+		if (nrThreads > 1)
+			CalculateCoulombAndExchangeMultithreaded(coulombDensities, exchangeDensities, threshold, coulomb, exchange);
+		else if (integralDirect)
+			CalculateCoulombAndExchangeDirect(coulombDensities, exchangeDensities, threshold, coulomb, exchange);
+		else
+		{
+			for (unsigned int i = 0; i < nrOrbitals; ++i)
+				CalculateCoulombAndExchangeStored(i, coulombDensities, exchangeDensities, coulomb, exchange);
+		}
+
+		// each unique integral was added only in the places of some of its index permutations, weighted with the degeneracy
+		// symmetrizing and scaling gives the contributions of all of them
+		for (unsigned int d = 0; d < coulomb.size(); ++d)
+			Symmetrize(coulomb[d], 0.25);
+
+		for (unsigned int d = 0; d < exchange.size(); ++d)
+			Symmetrize(exchange[d], 0.125);
+	}
+
+}
@@ -7,10 +7,14 @@
 #include "GaussianTwoElectrons.h"
 #include "GaussianMoment.h"
 #include "BoysFunctions.h"
+#include "ShellPairs.h"
+#include "WorkStealingPool.h"
 
 #include <map>
+#include <memory>
 #include <tuple>
 #include <valarray>
+#include <vector>
 
 #include "Molecule.h"
 #include "ContractedGaussianOrbital.h"
@@ -22,7 +26,10 @@ namespace GaussianIntegrals {
 	public:
 		Systems::Molecule* m_Molecule;
 	protected:
-		std::map< double, BoysFunctions > boysFunctions;
+		BoysFunctions boysFunctions; // work space, overwritten on each getBoysFunctions call
+
+		// built when the molecule is set, the geometry must not change afterwards without a Reset
+		ShellPairs shellPairs;
 
 
 		// the momentIntegralsMap replaces this, as it also computes overlap
@@ -34,41 +41,71 @@ namespace GaussianIntegrals {
 		std::map < std::tuple<unsigned int, unsigned int, unsigned int, double, double >, GaussianNuclear > nuclearVerticalIntegralsMap;
 		std::map < std::tuple<unsigned int, unsigned int, unsigned int>, GaussianNuclear> nuclearIntegralsContractedMap;
 		
-		std::map < std::tuple<unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, double, double, double, double>, GaussianTwoElectrons> electronElectronIntegralsVerticalAndTransferMap;
-		std::map < std::tuple<unsigned int, unsigned int, unsigned int, unsigned int>, GaussianTwoElectrons> electronElectronIntegralsContractedMap;
+		// keyed by the shell IDs and the angular momenta (a shell can have more than one, as in 'SP'), holds the results for all the components of the shell quartet
+		std::map < std::tuple<unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int>, GaussianTwoElectrons> electronElectronIntegralsShellsMap;
 		std::valarray<double> electronElectronIntegrals;
 
+		// a shell restricted to a single angular momentum, for example an 'SP' shell gives two of them
+		// the contracted orbitals in it differ only by the quantum numbers, they are in canonical order and have consecutive indices
+		struct ElectronElectronShell
+		{
+			const Orbitals::ContractedGaussianOrbital* firstOrbital;
+			unsigned int startIndex;
+			unsigned int nrOrbitals;
+		};
+		std::vector<ElectronElectronShell> electronElectronShells;
+
+		// sqrt(max |(ab|ab)|) for each shell pair, indexed like the pairs in electronElectronIntegrals
+		// the Cauchy-Schwarz inequality gives |(ab|cd)| <= bound(ab) * bound(cd)
+		std::vector<double> electronElectronShellPairBounds;
+
 	public:
+		// allows keeping all the N^4 electron-electron integrals unpacked, if they fit in supermatrixMemoryLimit MB
+		// the limit is for this repository only, with several of them alive at once the caller has to split its budget
+		// then the Coulomb and exchange matrices are computed with matrix products instead of walking the unique integrals
 		bool useLotsOfMemory;
+		unsigned int supermatrixMemoryLimit;
+
+		// shell quartets with the Schwarz bound below this are not computed, they are left zero, 0 means no screening
+		double schwarzThreshold;
+
+		// primitive pairs with the overlap of the normalized s gaussians below this are dropped from all the integrals, 0 means no screening
+		// it's used when the molecule is set, by the constructor or Reset
+		double primitivePairThreshold;
+
+		// the number of threads used for computing the electron-electron integrals and for the Fock matrix builds
+		// for a given number of threads the Fock matrices are reproducible bit by bit
+		unsigned int nrThreads;
+
+		// integral direct mode: the electron-electron integrals are not stored, they are computed again for each Fock matrix and contracted with the density on the fly
+		// the memory stays O(N^2) instead of O(N^4), the price is computing the integrals on each iteration
+		// the Schwarz threshold is weighted with the density in this mode, it's compared with the contribution of the quartet to the Fock matrix
+		bool integralDirect;
+
+		// the stored electron-electron integrals are kept over a Reset, if it's for the same molecule at another geometry only the changed ones are computed again
+		// a shell quartet with all the centres moved by the same translation has the same integrals, that's the one center quartets and the ones among the atoms that don't move
+		// not used in the integral direct mode
+		bool reuseElectronElectronIntegrals;
+
+		// statistics from the last CalculateElectronElectronIntegrals call
+		unsigned long long int electronElectronShellQuartets;
+		unsigned long long int electronElectronShellQuartetsSkipped;
+		unsigned long long int electronElectronShellQuartetsReused;
+		unsigned long long int electronElectronPrimitiveQuartets;
+		unsigned long long int electronElectronAllocations; // should not grow with the number of quartets, only with the number of threads and angular momentum classes
 
 		IntegralsRepository(Systems::Molecule *molecule = nullptr);
 		~IntegralsRepository();
 
 		void Reset(Systems::Molecule* molecule = nullptr);
 
+		// the returned values are valid only until the next call
 		const BoysFunctions& getBoysFunctions(unsigned int L, double T);
 
 
 		double getOverlap(const Orbitals::ContractedGaussianOrbital& orbital1, const Orbitals::ContractedGaussianOrbital& orbital2, bool extendForKinetic = true);
-		double getOverlap(const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2, bool extendForKinetic = true);
 
 		double getMoment(const Orbitals::ContractedGaussianOrbital& orbital1, const Orbitals::ContractedGaussianOrbital& orbital2, bool momentX, bool momentY, bool momentZ);
-		double getMoment(const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2, bool momentX, bool momentY, bool momentZ);
-
-		double getMomentX(const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2)
-		{
-			return getMoment(gaussian1, gaussian2, true, false, false);
-		}
-
-		double getMomentY(const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2)
-		{
-			return getMoment(gaussian1, gaussian2, false, true, false);
-		}
-
-		double getMomentZ(const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2)
-		{
-			return getMoment(gaussian1, gaussian2, false, false, true);
-		}
 
 		double getMomentX(const Orbitals::ContractedGaussianOrbital& orbital1, const Orbitals::ContractedGaussianOrbital& orbital2)
 		{
@@ -87,18 +124,17 @@ namespace GaussianIntegrals {
 
 
 		double getKinetic(const Orbitals::ContractedGaussianOrbital& orbital1, const Orbitals::ContractedGaussianOrbital& orbital2);
-		double getKinetic(const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2);
 
 
 		double getNuclear(const Systems::Atom& atom, const Orbitals::ContractedGaussianOrbital* orbital1, const Orbitals::ContractedGaussianOrbital* orbital2);
 
 
 		double getElectronElectron(const Orbitals::ContractedGaussianOrbital* orbital1, const Orbitals::ContractedGaussianOrbital* orbital2, const Orbitals::ContractedGaussianOrbital* orbital3, const Orbitals::ContractedGaussianOrbital* orbital4);
-		const GaussianTwoElectrons& getElectronElectronVerticalAndTransfer(const Orbitals::GaussianOrbital* orbital1, const Orbitals::GaussianOrbital* orbital2, const Orbitals::GaussianOrbital* orbital3, const Orbitals::GaussianOrbital* orbital4, bool& swapped);
 
 
 
 		Systems::Molecule* getMolecule() const { return m_Molecule; }
+		const ShellPairs& getShellPairs() const { return shellPairs; }
 
 
 		void ClearMatricesMaps() 
@@ -111,30 +147,126 @@ namespace GaussianIntegrals {
 			nuclearIntegralsContractedMap.clear();
 		}
 
-		void ClearElectronElectronIntermediaries()
-		{
-			electronElectronIntegralsVerticalAndTransferMap.clear();
-		}
-
 		void ClearElectronElectronMaps()
 		{
-			ClearElectronElectronIntermediaries();
-
-			electronElectronIntegralsContractedMap.clear();
+			electronElectronIntegralsShellsMap.clear();
 		}
 
 		void ClearAllMaps()
 		{
 			ClearMatricesMaps();
 			ClearElectronElectronMaps();
-			boysFunctions.clear();
 		}
 	protected:
-		const GaussianNuclear& getNuclearVertical(const Systems::Atom& atom, const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2);
+		// the primitive integrals, the shell pair data must be the one for the shells of the gaussians
+		double getOverlap(const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2, const ShellPair& shellPair, const PrimitivePair& primitivePair, bool extendForKinetic);
+		double getMoment(const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2, const ShellPair& shellPair, const PrimitivePair& primitivePair, bool momentX, bool momentY, bool momentZ);
+		double getKinetic(const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2, const ShellPair& shellPair, const PrimitivePair& primitivePair);
+		const GaussianNuclear& getNuclearVertical(const Systems::Atom& atom, const Orbitals::GaussianOrbital& gaussian1, const Orbitals::GaussianOrbital& gaussian2, const ShellPair& shellPair, const PrimitivePair& primitivePair);
+
+		void CalculateElectronElectronShellPairBounds(GaussianTwoElectrons& block);
+		void CalculateElectronElectronShells(const Orbitals::ContractedGaussianOrbital* orbital1, const Orbitals::ContractedGaussianOrbital* orbital2, const Orbitals::ContractedGaussianOrbital* orbital3, const Orbitals::ContractedGaussianOrbital* orbital4, GaussianTwoElectrons& result);
 
-		inline void CalculateElectronElectronIntegrals23(int i, const Orbitals::ContractedGaussianOrbital& orb1);
-		inline void CalculateElectronElectronIntegrals4(int i, int j, int k, long long int ij, const Orbitals::ContractedGaussianOrbital& orb1, const Orbitals::ContractedGaussianOrbital& orb2, const Orbitals::ContractedGaussianOrbital& orb3);
+		void CalculateElectronElectronIntegralsMultithreaded();
+		void CalculateElectronElectronIntegrals34(unsigned int shell1, unsigned int shell2, GaussianTwoElectrons& block, std::valarray<double>& integrals);
+		inline void CalculateElectronElectronIntegrals4(unsigned int shell1, unsigned int shell2, unsigned int shell3, long long int shell12, GaussianTwoElectrons& block, std::valarray<double>& integrals);
+
+		void CalculateElectronElectronShellsList();
+
+		// the shells of the last stored integrals, to tell at the next geometry which of them moved together
+		struct ElectronElectronShellGeometry
+		{
+			Vector3D<double> center;
+			unsigned int startIndex;
+			unsigned int nrOrbitals;
+			unsigned int shellID;
+			unsigned int angularMomentum;
+			std::vector<std::pair<double, double>> primitives; // exponent and coefficient
+		};
+		std::vector<ElectronElectronShellGeometry> previousShells;
+		std::vector<double> previousShellPairBounds;
+		double previousSchwarzThreshold;
+		double previousPrimitivePairThreshold;
+
+		// for each shell the index of the group of shells moved by the same translation since the previous integrals, empty if there is nothing to reuse
+		// a quartet with all the shells in the same group is already in the stored integrals
+		std::vector<int> electronElectronShellGroups;
+
+		// false if the stored integrals are not for the same molecule and basis, or were computed with other thresholds
+		bool FindElectronElectronShellGroups();
+		void SaveElectronElectronShellGeometry();
+
+		// for the integral direct mode, the max abs value of the density matrices for each shell pair, indexed by shell1 * nrShells + shell2
+		std::vector<double> shellPairsMaxDensity;
+		GaussianTwoElectrons directBlock; // kept between the Fock matrix builds, the work buffers are already allocated
+
+		// the Coulomb and exchange matrices are accumulated unsymmetrized, only for the unique integrals, the caller symmetrizes them
+		void CalculateCoulombAndExchange34(unsigned int shell1, unsigned int shell2, const std::vector<const Eigen::MatrixXd*>& coulombDensities, const std::vector<const Eigen::MatrixXd*>& exchangeDensities, double threshold, GaussianTwoElectrons& block, std::vector<Eigen::MatrixXd>& coulomb, std::vector<Eigen::MatrixXd>& exchange);
+		void CalculateSupermatrix();
+		void CalculateCoulombAndExchangeSupermatrix(const std::vector<const Eigen::MatrixXd*>& coulombDensities, const std::vector<const Eigen::MatrixXd*>& exchangeDensities, std::vector<Eigen::MatrixXd>& coulomb, std::vector<Eigen::MatrixXd>& exchange);
+		void CalculateShellPairsMaxDensity(const std::vector<const Eigen::MatrixXd*>& coulombDensities, const std::vector<const Eigen::MatrixXd*>& exchangeDensities);
+		void CalculateCoulombAndExchangeDirect(const std::vector<const Eigen::MatrixXd*>& coulombDensities, const std::vector<const Eigen::MatrixXd*>& exchangeDensities, double threshold, std::vector<Eigen::MatrixXd>& coulomb, std::vector<Eigen::MatrixXd>& exchange);
+		void CalculateCoulombAndExchangeStored(unsigned int i, const std::vector<const Eigen::MatrixXd*>& coulombDensities, const std::vector<const Eigen::MatrixXd*>& exchangeDensities, std::vector<Eigen::MatrixXd>& coulomb, std::vector<Eigen::MatrixXd>& exchange) const;
+		void CalculateCoulombAndExchangeMultithreaded(const std::vector<const Eigen::MatrixXd*>& coulombDensities, const std::vector<const Eigen::MatrixXd*>& exchangeDensities, double threshold, std::vector<Eigen::MatrixXd>& coulomb, std::vector<Eigen::MatrixXd>& exchange);
+
+		// the unpacked electron-electron integrals, empty if not used
+		Eigen::MatrixXd supermatrix;
+
+		// the work space of the Fock matrix builds with the supermatrix, kept between the builds
+		// the densities as columns, vec(D) and vec(D transposed), and the products, vec(J) and the exchange columns for each density side by side
+		Eigen::MatrixXd supermatrixCoulombDensities;
+		Eigen::MatrixXd supermatrixExchangeDensities;
+		Eigen::MatrixXd supermatrixCoulomb;
+		Eigen::MatrixXd supermatrixExchange;
+
+		// the per thread work space for the multithreaded integral direct Fock matrix builds, kept between the builds
+		std::vector<std::unique_ptr<IntegralsRepository>> fockWorkers;
+
+		// the Coulomb and exchange matrices of each chunk of the multithreaded Fock matrix builds, kept between the builds and zeroed for each
+		std::vector<std::vector<Eigen::MatrixXd>> chunksCoulomb;
+		std::vector<std::vector<Eigen::MatrixXd>> chunksExchange;
+
+		// the threads for the electron-electron integrals and the Fock matrix builds, kept between them, started again only if nrThreads changes
+		std::unique_ptr<WorkStealingPool> pool;
+		WorkStealingPool& GetPool();
+
+		// adds the contributions of the unique integral (ij|kl), i >= j, k >= l, ij >= kl, the value must be already multiplied with the number of its distinct index permutations
+		// only some of the permutations are added, the matrices must be symmetrized at the end: J = (J + Jt) / 4, K = (K + Kt) / 8
+		inline static void AddCoulombAndExchange(unsigned int i, unsigned int j, unsigned int k, unsigned int l, double value, const std::vector<const Eigen::MatrixXd*>& coulombDensities, const std::vector<const Eigen::MatrixXd*>& exchangeDensities, std::vector<Eigen::MatrixXd>& coulomb, std::vector<Eigen::MatrixXd>& exchange)
+		{
+			for (unsigned int d = 0; d < coulombDensities.size(); ++d)
+			{
+				const Eigen::MatrixXd& D = *coulombDensities[d];
+				Eigen::MatrixXd& J = coulomb[d];
+
+				J(i, j) += D(k, l) * value;
+				J(k, l) += D(i, j) * value;
+			}
+
+			for (unsigned int d = 0; d < exchangeDensities.size(); ++d)
+			{
+				const Eigen::MatrixXd& D = *exchangeDensities[d];
+				Eigen::MatrixXd& K = exchange[d];
+
+				K(i, l) += D(k, j) * value;
+				K(j, l) += D(k, i) * value;
+				K(i, k) += D(l, j) * value;
+				K(j, k) += D(l, i) * value;
+			}
+		}
 	
+		// matrix = factor * (matrix + matrix transposed), in place
+		inline static void Symmetrize(Eigen::MatrixXd& matrix, double factor)
+		{
+			for (Eigen::Index j = 0; j < matrix.cols(); ++j)
+			{
+				for (Eigen::Index i = j + 1; i < matrix.rows(); ++i)
+					matrix(i, j) = matrix(j, i) = factor * (matrix(i, j) + matrix(j, i));
+
+				matrix(j, j) *= 2. * factor;
+			}
+		}
+
 		inline static long long int GetTwoIndex(long long int i, long long int j)
 		{
 			return i < j ? j * (j + 1ULL) / 2 + i : i * (i + 1ULL) / 2 + j;
@@ -148,9 +280,30 @@ namespace GaussianIntegrals {
 			return GetTwoIndex(ind12, ind34);
 		}
 
-		template<class Orb> static void SwapOrbitals(Orb **orb1, Orb **orb2, Orb **orb3, Orb **orb4);
+		static void SwapShells(const Orbitals::ContractedGaussianOrbital* orbitals[4], unsigned int order[4]);
 	public:
-		void CalculateElectronElectronIntegrals();
+		// in the integral direct mode only the data needed later by CalculateCoulombAndExchange is computed, unless forceStore is set
+		void CalculateElectronElectronIntegrals(bool forceStore = false);
+
+		// hands the stored electron-electron integrals to the other repository, to be used for the same molecule at the same geometry
+		// they are copied if kept for the reuse at the next geometry, moved otherwise, the unpacked ones are always moved
+		void TransferElectronElectronIntegrals(IntegralsRepository& destination);
+
+		bool HasElectronElectronIntegrals() const { return electronElectronIntegrals.size() != 0; }
+		bool HasSupermatrix() const { return supermatrix.size() != 0; }
+
+		// computes the Coulomb matrices J(D)ij = sum_kl Dkl (ij|kl) and the exchange ones K(D)ij = sum_kl Dkl (il|kj) for each of the passed density matrices
+		// each unique integral is used once, either from the stored ones or, in the integral direct mode, computed on the fly
+		// if the unpacked integrals are kept, they are computed with matrix products instead
+		// in the integral direct mode the Schwarz threshold is multiplied with thresholdScale, for incremental builds where the screening errors accumulate
+		void CalculateCoulombAndExchange(const std::vector<const Eigen::MatrixXd*>& densities, std::vector<Eigen::MatrixXd>& coulomb, std::vector<Eigen::MatrixXd>& exchange, double thresholdScale = 1.)
+		{
+			CalculateCoulombAndExchange(densities, densities, coulomb, exchange, thresholdScale);
+		}
+
+		// the same, but in the same pass the Coulomb matrices are computed only for the first densities and the exchange ones only for the second ones
+		// for the unrestricted method, which needs J only for the total density but K for each spin
+		void CalculateCoulombAndExchange(const std::vector<const Eigen::MatrixXd*>& coulombDensities, const std::vector<const Eigen::MatrixXd*>& exchangeDensities, std::vector<Eigen::MatrixXd>& coulomb, std::vector<Eigen::MatrixXd>& exchange, double thresholdScale = 1.);
 
 		inline double getElectronElectron(int orbital1, int orbital2, int orbital3, int orbital4) const
 		{
@@ -28,8 +28,17 @@ Options::Options()
 
 	// Computation
 	nrThreads(4),
+	nrIntegralsThreads(0),
 	useLotsOfMemory(true),
+	supermatrixMemoryLimit(512),
+	schwarzThreshold(1E-12),
+	primitivePairThreshold(1E-12),
+	integralDirect(false),
+	fullFockBuildInterval(10),
+	pipelineDepth(1),
 	numberOfPoints(80),
+	adaptiveScan(false),
+	adaptiveTolerance(1E-4),
 
 	// Charts
 	YMaxEnergy(-1700), //eV
@@ -45,6 +54,15 @@ Options::Options()
 	useDIIS(true),
 	maxDIISiterations(1000),
 	normalIterAfterDIIS(0),
+	diisSubspaceSize(6),
+	jointDIIS(true),
+	useEDIIS(true),
+	diisStagnationIterations(50),
+	secondOrderSCF(0),
+	stabilityCheck(false),
+	densityGuess(1),
+	projectionBasis(0),
+	warmStart(3),
 	computePostHF(false),
 	postHFmethod(0)
 {
@@ -80,8 +98,17 @@ void Options::Load()
 
 	// computations
 	nrThreads = theApp.GetProfileInt(L"options", L"NrThreads", 4);
+	nrIntegralsThreads = theApp.GetProfileInt(L"options", L"NrIntegralsThreads", 0);
 	useLotsOfMemory = (1 == theApp.GetProfileInt(L"options", L"UseLotsOfMemory", 1) ? true : false);
+	supermatrixMemoryLimit = theApp.GetProfileInt(L"options", L"SupermatrixMemoryLimit", 512);
+	schwarzThreshold = GetDouble(L"SchwarzThreshold", 1E-12);
+	primitivePairThreshold = GetDouble(L"PrimitivePairThreshold", 1E-12);
+	integralDirect = (1 == theApp.GetProfileInt(L"options", L"IntegralDirect", 0) ? true : false);
+	fullFockBuildInterval = theApp.GetProfileInt(L"options", L"FullFockBuildInterval", 10);
+	pipelineDepth = theApp.GetProfileInt(L"options", L"PipelineDepth", 1);
 	numberOfPoints = theApp.GetProfileInt(L"options", L"NrPoints", 80);
+	adaptiveScan = (1 == theApp.GetProfileInt(L"options", L"AdaptiveScan", 0) ? true : false);
+	adaptiveTolerance = GetDouble(L"AdaptiveTolerance", 1E-4);
 
 	// charts
 	YMaxEnergy = theApp.GetProfileInt(L"options", L"YMaxEnergy", -2000);
@@ -99,6 +126,15 @@ void Options::Load()
 	useDIIS = (1 == theApp.GetProfileInt(L"options", L"UseDIIS", 1) ? true : false);
 	maxDIISiterations = theApp.GetProfileInt(L"options", L"MaxDIISiterations", 1000);
 	normalIterAfterDIIS = theApp.GetProfileInt(L"options", L"NormalIterAfterDIIS", 0);
+	diisSubspaceSize = theApp.GetProfileInt(L"options", L"DIISSubspaceSize", 6);
+	jointDIIS = (1 == theApp.GetProfileInt(L"options", L"JointDIIS", 1) ? true : false);
+	useEDIIS = (1 == theApp.GetProfileInt(L"options", L"UseEDIIS", 1) ? true : false);
+	diisStagnationIterations = theApp.GetProfileInt(L"options", L"DIISStagnationIterations", 50);
+	secondOrderSCF = theApp.GetProfileInt(L"options", L"SecondOrderSCF", 0);
+	stabilityCheck = (1 == theApp.GetProfileInt(L"options", L"StabilityCheck", 0) ? true : false);
+	densityGuess = theApp.GetProfileInt(L"options", L"DensityGuess", 1);
+	projectionBasis = theApp.GetProfileInt(L"options", L"ProjectionBasis", 0);
+	warmStart = theApp.GetProfileInt(L"options", L"WarmStart", 3);
 	computePostHF = (1 == theApp.GetProfileInt(L"options", L"ComputePostHF", 0) ? true : false);
 	postHFmethod = theApp.GetProfileInt(L"options", L"PostHFmethod", 0);
 }
@@ -128,8 +164,17 @@ void Options::Save()
 
 	// computations
 	theApp.WriteProfileInt(L"options", L"NrThreads", nrThreads);
+	theApp.WriteProfileInt(L"options", L"NrIntegralsThreads", nrIntegralsThreads);
 	theApp.WriteProfileInt(L"options", L"UseLotsOfMemory", useLotsOfMemory ? 1 : 0);
+	theApp.WriteProfileInt(L"options", L"SupermatrixMemoryLimit", supermatrixMemoryLimit);
+	theApp.WriteProfileBinary(L"options", L"SchwarzThreshold", (LPBYTE)&schwarzThreshold, sizeof(double));
+	theApp.WriteProfileBinary(L"options", L"PrimitivePairThreshold", (LPBYTE)&primitivePairThreshold, sizeof(double));
+	theApp.WriteProfileInt(L"options", L"IntegralDirect", integralDirect ? 1 : 0);
+	theApp.WriteProfileInt(L"options", L"FullFockBuildInterval", fullFockBuildInterval);
+	theApp.WriteProfileInt(L"options", L"PipelineDepth", pipelineDepth);
 	theApp.WriteProfileInt(L"options", L"NrPoints", numberOfPoints);
+	theApp.WriteProfileInt(L"options", L"AdaptiveScan", adaptiveScan ? 1 : 0);
+	theApp.WriteProfileBinary(L"options", L"AdaptiveTolerance", (LPBYTE)&adaptiveTolerance, sizeof(double));
 
 	// charts
 	theApp.WriteProfileInt(L"options", L"YMaxEnergy", YMaxEnergy);
@@ -147,6 +192,15 @@ void Options::Save()
 	theApp.WriteProfileInt(L"options", L"UseDIIS", useDIIS ? 1 : 0);
 	theApp.WriteProfileInt(L"options", L"MaxDIISiterations", maxDIISiterations);
 	theApp.WriteProfileInt(L"options", L"NormalIterAfterDIIS", normalIterAfterDIIS);
+	theApp.WriteProfileInt(L"options", L"DIISSubspaceSize", diisSubspaceSize);
+	theApp.WriteProfileInt(L"options", L"JointDIIS", jointDIIS ? 1 : 0);
+	theApp.WriteProfileInt(L"options", L"UseEDIIS", useEDIIS ? 1 : 0);
+	theApp.WriteProfileInt(L"options", L"DIISStagnationIterations", diisStagnationIterations);
+	theApp.WriteProfileInt(L"options", L"SecondOrderSCF", secondOrderSCF);
+	theApp.WriteProfileInt(L"options", L"StabilityCheck", stabilityCheck ? 1 : 0);
+	theApp.WriteProfileInt(L"options", L"DensityGuess", densityGuess);
+	theApp.WriteProfileInt(L"options", L"ProjectionBasis", projectionBasis);
+	theApp.WriteProfileInt(L"options", L"WarmStart", warmStart);
 	theApp.WriteProfileInt(L"options", L"ComputePostHF", computePostHF ? 1 : 0);
 	theApp.WriteProfileInt(L"options", L"PostHFmethod", postHFmethod);
 }
@@ -38,8 +38,17 @@ public:
 	// Computation
 
 	int nrThreads;
+	int nrIntegralsThreads; // threads used for the electron-electron integrals and the Fock matrix builds of a single calculation, 0 means the cores are shared among the nrThreads ones
 	bool useLotsOfMemory;
+	int supermatrixMemoryLimit; // MB, with useLotsOfMemory the Fock matrices are built from the unpacked N^4 integrals if they fit, the limit is for all the scan threads together, each calculation gets its share
+	double schwarzThreshold; // electron-electron integrals with the Schwarz bound below this are skipped, 0 disables the screening
+	double primitivePairThreshold; // primitive gaussian pairs with the overlap below this are dropped from all the integrals, 0 disables the screening
+	bool integralDirect; // the electron-electron integrals are not stored but computed again on each iteration, for basis sets that do not fit in memory
+	int fullFockBuildInterval; // integral direct Fock matrices are built incrementally from the density change, with a full build each that many iterations
+	int pipelineDepth; // the integrals for up to that many next scan points are computed on a second thread during the SCF of the current one, 0 computes them in sequence, a scan thread holds pipelineDepth + 2 integral sets, the supermatrix memory is split among them and the cores between the SCF and the second thread
 	int numberOfPoints;
+	bool adaptiveScan; // the numberOfPoints grid is sampled starting coarse and refined only where the chart curve through the points is not accurate enough
+	double adaptiveTolerance; // Hartree, the estimated error of the chart curve between the points that stops the adaptive refinement
 
 	// Charts
 
@@ -61,6 +70,15 @@ public:
 	bool useDIIS;
 	int maxDIISiterations;
 	int normalIterAfterDIIS;
+	int diisSubspaceSize; // the number of Fock matrices kept for the extrapolation
+	bool jointDIIS; // unrestricted: the alpha and beta Fock matrices are extrapolated together
+	bool useEDIIS; // the energy based EDIIS for the first iterations, switching to DIIS as the error gets small
+	int diisStagnationIterations; // DIIS is abandoned for the damped iterations if its error does not improve for that many steps, 0 never
+	int secondOrderSCF; // 0 - not used, 1 - the second order (trust region Newton) solver instead of the DIIS iterations, 2 - only to finish a stagnated DIIS
+	bool stabilityCheck; // a converged solution is checked with the orbital Hessian, if it's a saddle point the second order solver continues downhill, about 10 more Fock builds for each calculation
+	int densityGuess; // 0 - the Fock matrix from initialGuess, 1 - the superposition of atomic densities, cached in atomicdensities.txt, 2 - projected from a calculation in projectionBasis
+	int projectionBasis; // the small basis for the projection guess, numbered as basis
+	int warmStart; // 0 - each scan point starts from densityGuess, 1 - from the orbitals of the previous point, 2 - extrapolated linearly from the last two points, 3 - extrapolated along the Grassmann geodesic
 
 	bool computePostHF;
 	int postHFmethod;
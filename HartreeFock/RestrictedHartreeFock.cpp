@@ -19,7 +19,13 @@ namespace HartreeFock {
 	{
 		HartreeFockAlgorithm::Init(molecule);
 
-		DensityMatrix = Eigen::MatrixXd::Zero(h.rows(), h.cols());
+		if (densityGuess)
+		{
+			DensityMatrix = initialDensities[0];
+			if (initialDensities.size() > 1) DensityMatrix += initialDensities[1];
+		}
+		else DensityMatrix = Eigen::MatrixXd::Zero(h.rows(), h.cols());
+		G.resize(0, 0);
 
 		occupied.resize(0); // just in case it was resized before
 		nrOccupiedLevels = molecule->ElectronsNumber() / 2;
@@ -34,78 +40,34 @@ namespace HartreeFock {
 
 	bool RestrictedHartreeFock::DIISStep(int iter, Eigen::MatrixXd& FockMatrix)
 	{
-		bool UsedDIIS = false;
-
 		if (UseDIIS && iter && iter < maxDIISiterations)
 		{
 			// the density matrix should commute with the Fock matrix. The difference is the error.
 			// another variant could be to subtract from the current Fock matrix the previous one to get an error estimate
-			const Eigen::MatrixXd errorMatrix = overlapMatrix.matrix * DensityMatrix * FockMatrix - FockMatrix * DensityMatrix * overlapMatrix.matrix;
-
-			// another choice: if reached the limit of kept matrices, replace the ones with the bigger error
-			errorMatrices.emplace_back(errorMatrix);
-			fockMatrices.push_back(FockMatrix);
-			if (errorMatrices.size() > 6)
-			{
-				errorMatrices.pop_front();
-				fockMatrices.pop_front();
-			}
-
-			if (errorMatrices.size() > 4)
-			{
-				// use DIIS
-				const size_t nrMatrices = errorMatrices.size();
-				Eigen::MatrixXd B = Eigen::MatrixXd::Zero(nrMatrices + 1, nrMatrices + 1);
-
-				lastErrorEst = 0;
-
-				auto errorIter1 = errorMatrices.begin();
-				for (size_t i = 0; i < nrMatrices; ++i)
-				{
-					auto errorIter2 = errorMatrices.begin();
-
-					for (size_t j = 0; j < i; ++j)
-					{
-						B(i, j) = B(j, i) = (*errorIter1).cwiseProduct(*errorIter2).sum();
-
-						++errorIter2;
-					}
-
-					B(i, i) = (*errorIter1).cwiseProduct(*errorIter1).sum();
-
-					if (i == nrMatrices - 1 || i == nrMatrices - 2) lastErrorEst += B(i, i);
+			CalculateDIISErrorMatrix(workspace, FockMatrix, DensityMatrix);
 
-					B(nrMatrices, i) = B(i, nrMatrices) = 1;
+			// the Fock matrices are extrapolated in the AO basis, the transform into the orthonormal one is linear so it's the same thing
+			Eigen::MatrixXd* const fock[] = { &FockMatrix };
+			const Eigen::MatrixXd* const error[] = { &workspace.errorMatrix };
+			const Eigen::MatrixXd* const density[] = { &DensityMatrix };
 
-					++errorIter1;
-				}
-
-				lastErrorEst = sqrt(lastErrorEst);
-
-				// Solve the system of linear equations
-
-				Eigen::VectorXd CDIIS = Eigen::VectorXd::Zero(nrMatrices + 1);
-				CDIIS(nrMatrices) = 1;
-
-				CDIIS = B.colPivHouseholderQr().solve(CDIIS);
+			// EDIIS needs the energy for the density the Fock matrix was built from
+			const double energy = diis.useEDIIS ? 0.5 * (DensityMatrix.cwiseProduct(h).sum() + DensityMatrix.cwiseProduct(FockMatrix).sum()) : 0;
 
-				// compute the new Fock matrix
+			const bool UsedDIIS = diis.Step(fock, error, density, energy);
 
-				FockMatrix = Eigen::MatrixXd::Zero(FockMatrix.rows(), FockMatrix.cols());
+			lastErrorEst = diis.GetErrorEstimate();
 
-				auto fockIter = fockMatrices.begin();
-				for (size_t i = 0; i < nrMatrices; ++i)
-				{
-					FockMatrix += CDIIS(i) * *fockIter;
-					++fockIter;
-				}
-
-				UsedDIIS = true;
-			}
+			return UsedDIIS;
+		}
+		else if (polishing && iter)
+		{
+			CalculateDIISErrorMatrix(workspace, FockMatrix, DensityMatrix);
+			lastErrorEst = workspace.errorMatrix.norm();
 		}
 		else lastErrorEst = 0;
 
-		return UsedDIIS;
+		return false;
 	}
 
 
@@ -113,8 +75,8 @@ namespace HartreeFock {
 	{
 		// *****************************************************************************************************************
 
-		// the Fock matrix
-		Eigen::MatrixXd FockMatrix;
+		// the Fock matrix, the matrices used by the step are in the workspace, reused between the iterations
+		Eigen::MatrixXd& FockMatrix = workspace.FockMatrix;
 
 		InitFockMatrix(iter, FockMatrix);
 
@@ -169,61 +131,74 @@ namespace HartreeFock {
 		// X = V * Xtransformed (just multiply the above one to the left with V)
 		// O = V * Otransformed * Vt (again, with multiplication to the left and right)
 
-		const Eigen::MatrixXd FockTransformed = Vt * FockMatrix * V; // orthogonalize
-		const Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(FockTransformed);
-		
-		eigenvals = es.eigenvalues();
-		const Eigen::MatrixXd& Cprime = es.eigenvectors();
-		
-		
-		C = V * Cprime; // transform back the eigenvectors into the original non-orthogonalized AO basis
+		// FockTransformed = Vt * FockMatrix * V, diagonalized, then C = V * Cprime
+		SolveFockEquation(workspace, eigenvals, C);
 
 		// normalize it - in some rare cases it seems to help
 		//NormalizeC(C, occupied);
 
 		//***************************************************************************************************************
 
-		// calculate the density matrix
-
-		Eigen::MatrixXd newDensityMatrix = Eigen::MatrixXd::Zero(h.rows(), h.cols());
-
-		for (int i = 0; i < h.rows(); ++i)
-			for (int j = 0; j < h.cols(); ++j)
-				for (unsigned int vec = 0; vec < occupied.size(); ++vec) // only eigenstates that are occupied 
-					if (occupied[vec]) newDensityMatrix(i, j) += 2. * C(i, vec) * C(j, vec); // 2 is for the number of electrons in the eigenstate, it's the restricted Hartree-Fock
+		// calculate the density matrix, only eigenstates that are occupied
+		// 2 is for the number of electrons in the eigenstate, it's the restricted Hartree-Fock
 
+		CalculateDensityMatrix(workspace, C, occupied, 2.);
 
 		//**************************************************************************************************************
 
-		CalculateEnergy(eigenvals, newDensityMatrix/*, FockMatrix*/);
+		// the energy, the rms for differences between new and old density matrices (it can be used to check for convergence, too)
+		// and going to the next density matrix, using mixing if alpha is set less than 1
+		// not mixed with an initial guess density, that one is not the result of a step
+		const double rmsD = UpdateDensityMatrix(!UsedDIIS && !(densityGuess && 0 == iter));
 
 		TRACE("Step: %d Energy: %f\n", iter, totalEnergy);
 
-		// calculate rms for differences between new and old density matrices, it can be used to check for convergence, too
-		const Eigen::MatrixXd rmsDensityMatricesDif = newDensityMatrix - DensityMatrix;
-		const double rmsD = sqrt(rmsDensityMatricesDif.cwiseProduct(rmsDensityMatricesDif).sum());
+		LastMOFockMatrix = workspace.FockTransformed;
+
+		return rmsD;
+	}
 
-		// ***************************************************************************************************
-		// go to the next density matrix
 
-		if (UsedDIIS)
-			DensityMatrix = newDensityMatrix;
-		else
-			DensityMatrix = alpha * newDensityMatrix + (1. - alpha) * DensityMatrix;  // use mixing if alpha is set less than 1
+	double RestrictedHartreeFock::UpdateDensityMatrix(bool mix)
+	{
+		const Eigen::MatrixXd& newDensityMatrix = workspace.newDensityMatrix;
 
-		LastMOFockMatrix = FockTransformed;
+		// see CalculateEnergy, it's the same thing
+		double energy = 0;
+		double rms = 0;
 
-		return rmsD;
+		for (int j = 0; j < h.cols(); ++j)
+			for (int i = 0; i < h.rows(); ++i)
+			{
+				const double newValue = newDensityMatrix(i, j);
+				const double oldValue = DensityMatrix(i, j);
+
+				energy += newValue * h(i, j);
+
+				const double dif = newValue - oldValue;
+				rms += dif * dif;
+
+				DensityMatrix(i, j) = mix ? alpha * newValue + (1. - alpha) * oldValue : newValue;
+			}
+
+		totalEnergy = 0.5 * energy;
+
+		for (unsigned int level = 0; level < occupied.size(); ++level)
+			if (occupied[level]) totalEnergy += eigenvals(level);
+
+		HOMOEnergy = eigenvals(nrOccupiedLevels - 1);
+
+		totalEnergy += nuclearRepulsionEnergy;
+
+		return sqrt(rms);
 	}
 
-	void RestrictedHartreeFock::InitFockMatrix(int iter, Eigen::MatrixXd& FockMatrix) const
+	void RestrictedHartreeFock::InitFockMatrix(int iter, Eigen::MatrixXd& FockMatrix)
 	{
-		// this could be made faster knowing that the matrix should be symmetric
-		// but it would be less expressive so I'll let it as it is
-		// maybe I'll improve it later
-		// anyway, the slower part is dealing with electron-electron integrals
+		// the straightforward way of computing G is G(i, j) = sum over k, l of D(k, l) * ((ij|kl) - 0.5 * (il|kj)), looping over all i, j, k, l
+		// but that uses each unique integral many times, see Test::TestFockBuild for it, compared with the one used here
 
-		if (0 == iter)
+		if (0 == iter && !densityGuess)
 		{
 			if (initGuess > 0)
 			{
@@ -237,18 +212,23 @@ namespace HartreeFock {
 		}
 		else
 		{
-			Eigen::MatrixXd G = Eigen::MatrixXd::Zero(h.rows(), h.cols());
+			// each unique electron-electron integral is used once, either from the stored ones or computed again on the fly in the integral direct mode
+			// in the direct mode the build can be incremental: G is linear in the density, so only the density change is contracted and the result is added to the previous G
+			// the stored integrals do not get cheaper for a small density change, so for them it's always a full build
+			const bool fullBuild = !integralsRepository.integralDirect || FullFockBuild() || G.rows() != h.rows();
+			if (!fullBuild) deltaDensity = DensityMatrix - GDensityMatrix;
 
-			for (int i = 0; i < numberOfOrbitals; ++i)
-				for (int j = 0; j < numberOfOrbitals; ++j)
-					for (int k = 0; k < numberOfOrbitals; ++k)
-						for (int l = 0; l < numberOfOrbitals; ++l)
-						{
-							const double coulomb = integralsRepository.getElectronElectron(i, j, k, l);
-							const double exchange = integralsRepository.getElectronElectron(i, l, k, j); // you may see it in other forms, that is, other order for indexes, but don't forget about symmetries
+			coulombDensities.assign(1, fullBuild ? &DensityMatrix : &deltaDensity);
 
-							G(i, j) += DensityMatrix(k, l) * (coulomb - 0.5 * exchange);
-						}
+			// the screening errors of the incremental builds add up until the next full one, the threshold is lowered to compensate
+			integralsRepository.CalculateCoulombAndExchange(coulombDensities, coulomb, exchange, fullBuild ? 1. : 1. / fullFockBuildInterval);
+
+			if (fullBuild) G = coulomb[0] - 0.5 * exchange[0];
+			else G += coulomb[0] - 0.5 * exchange[0];
+
+			++nrFockBuilds;
+
+			GDensityMatrix = DensityMatrix;
 
 			FockMatrix = h + G;
 		}
@@ -257,6 +237,39 @@ namespace HartreeFock {
 		FockMatrix = (FockMatrix + FockMatrix.transpose()) * 0.5;
 	}
 
+	void RestrictedHartreeFock::GetSpinChannels(std::vector<SpinChannel>& channels)
+	{
+		// a single channel with the total density, two electrons on each occupied level
+		channels.resize(1);
+		channels[0].C = &C;
+		channels[0].eigenvals = &eigenvals;
+		channels[0].DensityMatrix = &DensityMatrix;
+		channels[0].occupied = &occupied;
+		channels[0].occupation = 2.;
+	}
+
+	void RestrictedHartreeFock::CalculateFockMatrices(std::vector<Eigen::MatrixXd>& fockMatrices)
+	{
+		coulombDensities.assign(1, &DensityMatrix);
+		integralsRepository.CalculateCoulombAndExchange(coulombDensities, coulomb, exchange);
+
+		fockMatrices.resize(1);
+		fockMatrices[0] = h + coulomb[0] - 0.5 * exchange[0];
+
+		totalEnergy = 0.5 * (DensityMatrix.cwiseProduct(h).sum() + DensityMatrix.cwiseProduct(fockMatrices[0]).sum()) + nuclearRepulsionEnergy;
+
+		LastMOFockMatrix = Vt * fockMatrices[0] * V;
+	}
+
+	void RestrictedHartreeFock::CalculateResponseFockMatrices(const std::vector<Eigen::MatrixXd>& deltaDensities, std::vector<Eigen::MatrixXd>& response)
+	{
+		coulombDensities.assign(1, &deltaDensities[0]);
+		integralsRepository.CalculateCoulombAndExchange(coulombDensities, coulomb, exchange);
+
+		response.resize(1);
+		response[0] = coulomb[0] - 0.5 * exchange[0];
+	}
+
 	void RestrictedHartreeFock::CalculateEnergy(const Eigen::VectorXd& eigenvalues, const Eigen::MatrixXd& calcDensityMatrix/*, Eigen::MatrixXd& F*/)
 	{
 		// one way of calculating the energy
@@ -303,6 +316,9 @@ namespace HartreeFock {
 	{
 		mp2Energy = 0;
 
+		// the integral direct mode does not have them stored, but they are needed here
+		if (!integralsRepository.HasElectronElectronIntegrals()) integralsRepository.CalculateElectronElectronIntegrals(true);
+
 		GaussianIntegrals::MP2MolecularOrbitalsIntegralsRepository MP2repo(integralsRepository);
 
 		for (int i = 0; i < numberOfOrbitals; ++i)
@@ -1,8 +1,6 @@
 #pragma once
 #include "HartreeFockAlgorithm.h"
 
-#include <list>
-
 namespace HartreeFock {
 
 
@@ -11,11 +9,24 @@ namespace HartreeFock {
 	{
 		friend class Test;
 	protected:
-		std::list<Eigen::MatrixXd> errorMatrices;
-		std::list<Eigen::MatrixXd> fockMatrices;
+		// the electron-electron part of the Fock matrix and the density it was built with, for the incremental integral direct Fock matrix builds
+		Eigen::MatrixXd G;
+		Eigen::MatrixXd GDensityMatrix;
+		Eigen::MatrixXd deltaDensity;
+
+		StepWorkspace workspace;
 
 		void CalculateEnergy(const Eigen::VectorXd& eigenvals, const Eigen::MatrixXd& calcDensityMatrix/*, Eigen::MatrixXd& F*/);
-		void InitFockMatrix(int iter, Eigen::MatrixXd& FockMatrix) const;
+
+		// computes the energy for the new density matrix from the workspace and the rms of its difference from the current one
+		// then replaces the current one with it or mixes them, all in a single pass over the matrices, returns the rms
+		double UpdateDensityMatrix(bool mix);
+		void InitFockMatrix(int iter, Eigen::MatrixXd& FockMatrix);
+
+		// for the second order solver
+		virtual void GetSpinChannels(std::vector<SpinChannel>& channels) override;
+		virtual void CalculateFockMatrices(std::vector<Eigen::MatrixXd>& fockMatrices) override;
+		virtual void CalculateResponseFockMatrices(const std::vector<Eigen::MatrixXd>& deltaDensities, std::vector<Eigen::MatrixXd>& response) override;
 	public:
 		Eigen::MatrixXd DensityMatrix;
 
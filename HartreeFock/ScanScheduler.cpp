@@ -0,0 +1,327 @@
+#include "stdafx.h"
+#include "ScanScheduler.h"
+
+#include <cmath>
+#include <limits>
+
+
+ScanScheduler::ScanScheduler()
+	: m_start(0), m_step(0), nrPoints(0), m_tolerance(0), m_spline(true), m_HOMOEnergy(false), firstAtomEnergy(0), secondAtomEnergy(0), atomsDone(0), roundTasks(0), remaining(0), round(0), finished(false)
+{
+}
+
+
+void ScanScheduler::Init(double start, double step, unsigned int nrPoints, unsigned int nrThreads, double tolerance, bool spline, bool HOMOEnergy)
+{
+	m_start = start;
+	m_step = step;
+	this->nrPoints = nrPoints;
+
+	m_tolerance = tolerance;
+	m_spline = spline;
+	m_HOMOEnergy = HOMOEnergy;
+
+	done.assign(nrPoints, false);
+	pointResults.assign(nrPoints, std::make_tuple(0., 0., 0.));
+	pointIterations.assign(nrPoints, std::make_tuple(0., 0, 0));
+
+	firstAtomEnergy = secondAtomEnergy = 0;
+	atomsDone = 0;
+
+	roundPoints.clear();
+	roundSpacings.clear();
+
+	if (m_tolerance > 0 && nrPoints)
+	{
+		// the coarse grid, with at least 8 intervals, the stride is a power of two so the intervals can be halved down to the finest grid
+		unsigned int stride = 1;
+		while ((nrPoints - 1) / (2 * stride) >= 8) stride *= 2;
+
+		for (unsigned int point = 0; point < nrPoints; point += stride)
+		{
+			roundPoints.push_back(point);
+			roundSpacings.push_back(stride);
+		}
+
+		if (roundPoints.back() != nrPoints - 1)
+		{
+			roundSpacings.push_back(nrPoints - 1 - roundPoints.back());
+			roundPoints.push_back(nrPoints - 1);
+		}
+	}
+	else
+	{
+		for (unsigned int point = 0; point < nrPoints; ++point)
+		{
+			roundPoints.push_back(point);
+			roundSpacings.push_back(1);
+		}
+	}
+
+	round = 0;
+	finished = false;
+
+	// the atoms are the last two tasks, at the back of the last block, so the first thread that runs out of work takes them
+	pool = std::make_unique<WorkStealingPool>(nrThreads);
+	DealRound(true);
+}
+
+
+void ScanScheduler::DealRound(bool withAtoms)
+{
+	roundTasks = static_cast<unsigned int>(roundPoints.size()) + (withAtoms ? 2 : 0);
+	remaining = roundTasks;
+
+	pool->Deal(roundTasks, true);
+}
+
+
+bool ScanScheduler::GetTask(unsigned int thread, Task& task)
+{
+	if (!pool) return false;
+
+	unsigned int index;
+	for (;;)
+	{
+		// the round is read before asking for a task, if it changes meanwhile the wait below does not block
+		unsigned int currentRound;
+		{
+			std::lock_guard<std::mutex> lock(resultsMutex);
+			if (finished) return false;
+
+			currentRound = round;
+		}
+
+		if (pool->GetTask(thread, index)) break;
+
+		if (m_tolerance <= 0) return false;
+
+		// the tasks of the round are all taken, but not done, the results might need more points
+		std::unique_lock<std::mutex> lock(resultsMutex);
+		roundCondition.wait(lock, [this, currentRound] { return finished || round != currentRound; });
+	}
+
+	// the round cannot change until the result for this task is set
+	if (index < roundPoints.size())
+	{
+		task.type = TaskType::Point;
+		task.point = roundPoints[index];
+		task.position = m_start + m_step * task.point;
+		task.spacing = roundSpacings[index];
+	}
+	else
+	{
+		task.type = (index == roundPoints.size()) ? TaskType::FirstAtom : TaskType::SecondAtom;
+		task.point = 0;
+		task.position = 0;
+		task.spacing = 0;
+	}
+
+	return true;
+}
+
+
+void ScanScheduler::SetPointResult(unsigned int point, double energy, double HOMOEnergy, int iterations, int polishingIterations)
+{
+	if (point >= nrPoints) return;
+
+	const double position = m_start + m_step * point;
+
+	std::lock_guard<std::mutex> lock(resultsMutex);
+
+	pointResults[point] = std::make_tuple(position, energy, HOMOEnergy);
+	pointIterations[point] = std::make_tuple(position, iterations, polishingIterations);
+	done[point] = true;
+
+	TaskDone();
+}
+
+
+void ScanScheduler::SetAtomResult(TaskType atom, double energy)
+{
+	std::lock_guard<std::mutex> lock(resultsMutex);
+
+	if (TaskType::FirstAtom == atom) firstAtomEnergy = energy;
+	else if (TaskType::SecondAtom == atom) secondAtomEnergy = energy;
+	else return;
+
+	++atomsDone;
+
+	// the atoms are in the first round, it cannot end without them
+	TaskDone();
+}
+
+
+void ScanScheduler::TaskDone()
+{
+	if (m_tolerance <= 0 || !remaining || --remaining || finished) return;
+
+	// the last task of the round, the next one starts if the curve needs more points
+	if (Refine())
+	{
+		++round;
+		DealRound(false);
+	}
+	else finished = true;
+
+	roundCondition.notify_all();
+}
+
+
+void ScanScheduler::Cancel()
+{
+	{
+		std::lock_guard<std::mutex> lock(resultsMutex);
+		finished = true;
+	}
+
+	roundCondition.notify_all();
+}
+
+
+bool ScanScheduler::Refine()
+{
+	std::vector<unsigned int> computed;
+	for (unsigned int point = 0; point < nrPoints; ++point)
+		if (done[point]) computed.push_back(point);
+
+	roundPoints.clear();
+	roundSpacings.clear();
+
+	for (size_t i = 0; i + 1 < computed.size(); ++i)
+	{
+		const unsigned int length = computed[i + 1] - computed[i];
+		if (length < 2) continue;
+
+		if (EstimateError(computed, i) > m_tolerance)
+		{
+			roundPoints.push_back(computed[i] + length / 2);
+
+			// the middles of neighbouring intervals of the same length are equally spaced
+			roundSpacings.push_back(length);
+		}
+	}
+
+	TRACE("Adaptive scan round %u: %u points computed, %u new\n", round + 1, static_cast<unsigned int>(computed.size()), static_cast<unsigned int>(roundPoints.size()));
+
+	return !roundPoints.empty();
+}
+
+
+double ScanScheduler::EstimateError(const std::vector<unsigned int>& computed, size_t i) const
+{
+	// with only the two ends there is nothing to compare with
+	if (computed.size() < 3) return std::numeric_limits<double>::infinity();
+
+	const auto getX = [this](unsigned int point) -> double { return m_start + m_step * point; };
+
+	const double x0 = getX(computed[i]);
+	const double y0 = GetValue(computed[i]);
+	const double x1 = getX(computed[i + 1]);
+	const double y1 = GetValue(computed[i + 1]);
+
+	// the chart curve in the middle of the interval
+	double x = (x0 + x1) / 2.;
+	double y = (y0 + y1) / 2.;
+
+	if (m_spline)
+	{
+		// at the ends the missing neighbour is the end point itself
+		const double xPrev = i > 0 ? getX(computed[i - 1]) : x0;
+		const double yPrev = i > 0 ? GetValue(computed[i - 1]) : y0;
+		const double xNext = i + 2 < computed.size() ? getX(computed[i + 2]) : x1;
+		const double yNext = i + 2 < computed.size() ? GetValue(computed[i + 2]) : y1;
+
+		GetSplinePoint(xPrev, yPrev, x0, y0, x1, y1, xNext, yNext, 0.5, x, y);
+	}
+
+	// the cubic through the two points on each side of the middle, at the ends the quadratic through three points, as the better approximation of the curve
+	const size_t first = (i > 0) ? i - 1 : 0;
+	const size_t last = min(i + 2, computed.size() - 1);
+
+	double value = 0;
+	for (size_t k = first; k <= last; ++k)
+	{
+		const double xk = getX(computed[k]);
+
+		double term = GetValue(computed[k]);
+		for (size_t l = first; l <= last; ++l)
+			if (l != k)
+			{
+				const double xl = getX(computed[l]);
+				term *= (x - xl) / (xk - xl);
+			}
+
+		value += term;
+	}
+
+	return std::abs(y - value);
+}
+
+
+void ScanScheduler::GetSplinePoint(double xPrev, double yPrev, double x0, double y0, double x1, double y1, double xNext, double yNext, double t, double& x, double& y)
+{
+	// the cardinal spline with the tension 0.5, the segment is a Bezier curve with the control points offset by (next - previous) / 6
+	const double cx1 = x0 + (x1 - xPrev) / 6.;
+	const double cy1 = y0 + (y1 - yPrev) / 6.;
+	const double cx2 = x1 - (xNext - x0) / 6.;
+	const double cy2 = y1 - (yNext - y0) / 6.;
+
+	const double s = 1. - t;
+	const double b0 = s * s * s;
+	const double b1 = 3. * s * s * t;
+	const double b2 = 3. * s * t * t;
+	const double b3 = t * t * t;
+
+	x = b0 * x0 + b1 * cx1 + b2 * cx2 + b3 * x1;
+	y = b0 * y0 + b1 * cy1 + b2 * cy2 + b3 * y1;
+}
+
+
+size_t ScanScheduler::GetResults(std::vector<std::tuple<double, double, double>>& results, std::vector<std::tuple<double, int, int>>& iterations)
+{
+	results.clear();
+	iterations.clear();
+
+	std::lock_guard<std::mutex> lock(resultsMutex);
+
+	for (unsigned int point = 0; point < nrPoints; ++point)
+	{
+		if (!done[point])
+		{
+			// the adaptive scan never computes some of the points
+			if (m_tolerance > 0) continue;
+
+			break;
+		}
+
+		results.push_back(pointResults[point]);
+		iterations.push_back(pointIterations[point]);
+	}
+
+	return results.size();
+}
+
+
+double ScanScheduler::GetFirstAtomEnergy()
+{
+	std::lock_guard<std::mutex> lock(resultsMutex);
+
+	return firstAtomEnergy;
+}
+
+
+double ScanScheduler::GetSecondAtomEnergy()
+{
+	std::lock_guard<std::mutex> lock(resultsMutex);
+
+	return secondAtomEnergy;
+}
+
+
+bool ScanScheduler::AtomsDone()
+{
+	std::lock_guard<std::mutex> lock(resultsMutex);
+
+	return 2 == atomsDone;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "WorkStealingPool.h"
+
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+// the tasks of a bond length scan, shared by the computing threads
+// each point is a task and so are the two atoms for the reference energy, the threads pull them until none is left
+// the points are dealt to the threads in contiguous blocks, so a thread goes through neighbouring bond lengths and can start each from the previous one
+// a thread that finishes its block steals from the ends of the others, so the slow points (short distances for the integrals, long ones for the SCF convergence) do not leave threads idle
+// the results are stored by point, so they can be retrieved in the bond length order while the scan is still running
+//
+// in the adaptive mode the points form the finest grid, only some of them are computed
+// it starts with a coarse grid, then in rounds the intervals between the computed points are halved where the curve drawn through them is not good enough
+// the error of an interval is estimated by comparing the chart curve (the cardinal spline or the line segments) in its middle with the cubic through the neighbouring points
+// it stops when all the estimates are below the tolerance or the intervals cannot be split anymore
+class ScanScheduler
+{
+public:
+	enum class TaskType
+	{
+		Point,
+		FirstAtom,
+		SecondAtom
+	};
+
+	struct Task
+	{
+		TaskType type;
+		unsigned int point;
+		double position;
+		unsigned int spacing; // the distance in points to the previous task of an equally spaced run, 0 if none
+
+		// true if this point comes right after the previous one on an equally spaced run, so a warm start can extrapolate from the points before
+		bool Follows(const Task& previous) const
+		{
+			return TaskType::Point == type && TaskType::Point == previous.type && spacing > 0 && spacing == previous.spacing && abs(static_cast<int>(point) - static_cast<int>(previous.point)) == static_cast<int>(spacing);
+		}
+	};
+
+	ScanScheduler();
+
+	// nrPoints points starting at start, step apart, plus the two atoms
+	// with a tolerance the scan is adaptive, the tolerance is in the units of the results, for the energies or for the HOMO energies
+	// spline tells if the chart draws the curve through the points with a spline or with line segments
+	void Init(double start, double step, unsigned int nrPoints, unsigned int nrThreads, double tolerance = 0, bool spline = true, bool HOMOEnergy = false);
+
+	// false if there is nothing left to do
+	// in the adaptive mode it waits for the current round to finish, if there is nothing left in it
+	bool GetTask(unsigned int thread, Task& task);
+
+	void SetPointResult(unsigned int point, double energy, double HOMOEnergy, int iterations, int polishingIterations);
+	void SetAtomResult(TaskType atom, double energy);
+
+	// releases the threads waiting for a new round, for cancelling the scan
+	void Cancel();
+
+	// the results of the points done so far, from the first one up to the first that is not done yet
+	// in the adaptive mode all the points done so far
+	// returns the number of points retrieved, it's the number of all points when the scan is complete
+	size_t GetResults(std::vector<std::tuple<double, double, double>>& results, std::vector<std::tuple<double, int, int>>& iterations);
+
+	unsigned int GetNrPoints() const { return nrPoints; }
+
+	// the point at t in [0, 1] on the segment from (x0, y0) to (x1, y1) of the spline the chart draws, it needs the previous and the next points as well
+	// at the ends of the curve the missing neighbour is the end point itself
+	static void GetSplinePoint(double xPrev, double yPrev, double x0, double y0, double x1, double y1, double xNext, double yNext, double t, double& x, double& y);
+
+	double GetFirstAtomEnergy();
+	double GetSecondAtomEnergy();
+	bool AtomsDone();
+
+protected:
+	// deals the round points, and the atoms if it's the first round
+	void DealRound(bool withAtoms);
+
+	// called with the results locked, for a task of the current round that's done
+	void TaskDone();
+
+	// called when a round is done, returns false if there is nothing to refine
+	bool Refine();
+
+	// the error of the chart curve in the middle of the interval between computed[i] and computed[i + 1]
+	double EstimateError(const std::vector<unsigned int>& computed, size_t i) const;
+
+	double GetValue(unsigned int point) const
+	{
+		return m_HOMOEnergy ? std::get<2>(pointResults[point]) : std::get<1>(pointResults[point]);
+	}
+
+	double m_start;
+	double m_step;
+	unsigned int nrPoints;
+
+	double m_tolerance;
+	bool m_spline;
+	bool m_HOMOEnergy;
+
+	std::unique_ptr<WorkStealingPool> pool;
+
+	std::mutex resultsMutex;
+
+	std::vector<bool> done;
+	std::vector<std::tuple<double, double, double>> pointResults;
+	std::vector<std::tuple<double, int, int>> pointIterations;
+
+	double firstAtomEnergy;
+	double secondAtomEnergy;
+	int atomsDone;
+
+	// the points of the current round, indexed by the task, with the spacing of each
+	std::vector<unsigned int> roundPoints;
+	std::vector<unsigned int> roundSpacings;
+	unsigned int roundTasks;
+
+	// the tasks of the current round not done yet
+	unsigned int remaining;
+	unsigned int round;
+	bool finished;
+	std::condition_variable roundCondition;
+};
@@ -0,0 +1,118 @@
+#include "stdafx.h"
+#include "ShellPairs.h"
+
+#include "MathUtils.h"
+#include "Molecule.h"
+
+namespace GaussianIntegrals {
+
+
+	ShellPairs::ShellPairs()
+		: nrPrimitivePairsTotal(0), nrPrimitivePairsSkipped(0), nrShells(0)
+	{
+	}
+
+
+	void ShellPairs::Clear()
+	{
+		nrShells = 0;
+		nrPrimitivePairsTotal = 0;
+		nrPrimitivePairsSkipped = 0;
+
+		pairs.clear();
+		primitivePairs.clear();
+	}
+
+
+	void ShellPairs::Build(const Systems::Molecule& molecule, double threshold)
+	{
+		Clear();
+
+		// the shells indexed by ID, the IDs are consecutive, in the order of atoms and shells in them
+		std::vector<const Orbitals::ContractedGaussianShell*> shells;
+
+		for (const auto& atom : molecule.atoms)
+			for (const auto& shell : atom.shells)
+			{
+				assert(shell.ID == shells.size());
+
+				shells.push_back(&shell);
+			}
+
+		nrShells = static_cast<unsigned int>(shells.size());
+		pairs.resize(static_cast<size_t>(nrShells) * nrShells);
+
+		size_t nrPrimitivePairs = 0;
+		for (const auto shell1 : shells)
+			for (const auto shell2 : shells)
+				nrPrimitivePairs += shell1->basisFunctions.front().gaussianOrbitals.size() * shell2->basisFunctions.front().gaussianOrbitals.size();
+
+		primitivePairs.reserve(nrPrimitivePairs);
+
+		for (const auto shell1 : shells)
+		{
+			// all the contracted gaussians in the shell have the same exponents, so the first one is enough
+			const Orbitals::ContractedGaussianOrbital& orbital1 = shell1->basisFunctions.front();
+
+			unsigned int maxL1 = 0;
+			for (const auto& orbital : shell1->basisFunctions)
+				maxL1 = max(maxL1, static_cast<unsigned int>(orbital.angularMomentum));
+
+			for (const auto shell2 : shells)
+			{
+				const Orbitals::ContractedGaussianOrbital& orbital2 = shell2->basisFunctions.front();
+
+				unsigned int maxL2 = 0;
+				for (const auto& orbital : shell2->basisFunctions)
+					maxL2 = max(maxL2, static_cast<unsigned int>(orbital.angularMomentum));
+
+				ShellPair& pair = pairs[static_cast<size_t>(shell1->ID) * nrShells + shell2->ID];
+
+				pair.center1 = orbital1.center;
+				pair.center2 = orbital2.center;
+				pair.AB = orbital1.center - orbital2.center;
+				pair.maxL1 = maxL1;
+				pair.maxL2 = maxL2;
+				pair.firstPrimitivePair = static_cast<unsigned int>(primitivePairs.size());
+
+				const double dist2 = pair.AB * pair.AB;
+
+				for (unsigned int primitive1 = 0; primitive1 < orbital1.gaussianOrbitals.size(); ++primitive1)
+					for (unsigned int primitive2 = 0; primitive2 < orbital2.gaussianOrbitals.size(); ++primitive2)
+					{
+						const double alpha1 = orbital1.gaussianOrbitals[primitive1].alpha;
+						const double alpha2 = orbital2.gaussianOrbitals[primitive2].alpha;
+						const double alpha = alpha1 + alpha2;
+						const double K = exp(-alpha1 * alpha2 / alpha * dist2);
+
+						++nrPrimitivePairsTotal;
+
+						// the overlap of the two normalized s gaussians, it's 1 for the same gaussian and goes down with the distance and the difference in exponents
+						// it's only an estimate for the other integrals, the higher angular momenta bring polynomial factors, but the exponential dominates
+						if (threshold > 0 && pow(2. * sqrt(alpha1 * alpha2) / alpha, 3. / 2.) * K < threshold)
+						{
+							++nrPrimitivePairsSkipped;
+							continue;
+						}
+
+						PrimitivePair primitivePair;
+
+						primitivePair.primitive1 = primitive1;
+						primitivePair.primitive2 = primitive2;
+						primitivePair.alpha1 = alpha1;
+						primitivePair.alpha2 = alpha2;
+						primitivePair.alpha = alpha;
+						primitivePair.P = (alpha1 * orbital1.center + alpha2 * orbital2.center) / alpha;
+						primitivePair.K = K;
+						primitivePair.overlapFactor = K * pow(M_PI / alpha, 3. / 2.);
+						primitivePair.nuclearFactor = K * 2. * M_PI / alpha;
+
+						primitivePairs.push_back(primitivePair);
+					}
+
+				pair.nrPrimitivePairs = static_cast<unsigned int>(primitivePairs.size()) - pair.firstPrimitivePair;
+			}
+		}
+	}
+
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vector>
+
+#include "Vector3D.h"
+
+namespace Systems {
+	class Molecule;
+}
+
+namespace GaussianIntegrals {
+
+	// the quantities that depend only on the two primitive gaussians from a pair, not on the angular momenta of the components
+	// computed once per geometry instead of once for each primitive integral
+	struct PrimitivePair
+	{
+		// the indices of the primitives in the contracted gaussians of the shells
+		unsigned int primitive1;
+		unsigned int primitive2;
+
+		double alpha1;
+		double alpha2;
+		double alpha; // alpha1 + alpha2
+
+		Vector3D<double> P; // the product center
+
+		double K; // exp(-alpha1 * alpha2 / alpha * |A - B|^2)
+		double overlapFactor; // K * (pi / alpha)^(3/2)
+		double nuclearFactor; // K * 2 * pi / alpha
+	};
+
+	struct ShellPair
+	{
+		Vector3D<double> center1;
+		Vector3D<double> center2;
+		Vector3D<double> AB; // center1 - center2
+
+		// the max angular momenta of the two shells, all the components of a shell share the primitives
+		unsigned int maxL1;
+		unsigned int maxL2;
+
+		// the primitive pairs that survived the screening, they are in the order of the primitives in the contracted gaussians
+		unsigned int firstPrimitivePair;
+		unsigned int nrPrimitivePairs;
+	};
+
+	// the list of all the (ordered) shell pairs of a molecule, with the primitive pairs data in a single contiguous array
+	// it's shared by the one and two electron integrals
+	class ShellPairs
+	{
+	public:
+		ShellPairs();
+
+		// the molecule must have the IDs set, the shells are indexed by ID
+		// the primitive pairs with the overlap of the normalized s gaussians below the threshold are dropped, 0 keeps all of them
+		void Build(const Systems::Molecule& molecule, double threshold = 0);
+		void Clear();
+
+		bool empty() const { return pairs.empty(); }
+
+		const ShellPair& operator()(unsigned int shellID1, unsigned int shellID2) const
+		{
+			return pairs[static_cast<size_t>(shellID1) * nrShells + shellID2];
+		}
+
+		const PrimitivePair* begin(const ShellPair& pair) const
+		{
+			return primitivePairs.data() + pair.firstPrimitivePair;
+		}
+
+		const PrimitivePair* end(const ShellPair& pair) const
+		{
+			return primitivePairs.data() + pair.firstPrimitivePair + pair.nrPrimitivePairs;
+		}
+
+		// statistics from the last Build
+		unsigned long long int nrPrimitivePairsTotal;
+		unsigned long long int nrPrimitivePairsSkipped;
+
+	protected:
+		unsigned int nrShells;
+
+		std::vector<ShellPair> pairs;
+		std::vector<PrimitivePair> primitivePairs;
+	};
+
+}
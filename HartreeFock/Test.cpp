@@ -8,12 +8,18 @@
 #include "QuantumMatrix.h"
 
 #include "BoysFunction.h"
+#include "BoysFunctions.h"
 
 #include "Test.h"
 
 #include "RestrictedHartreeFock.h"
 #include "UnrestrictedHartreeFock.h"
 #include "RestrictedCCSD.h"
+#include "AtomicDensities.h"
+#include "BasisProjection.h"
+#include "WarmStart.h"
+#include "ScanScheduler.h"
+#include "IntegralsPipeline.h"
 
 #include "Basis.h"
 #include "ChemUtils.h"
@@ -25,6 +31,144 @@
 #include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <chrono>
+#include <atomic>
+#include <thread>
+
+
+#ifdef _DEBUG
+namespace {
+	std::atomic<unsigned long long int> allocationsCounter(0);
+
+	int CountAllocationsHook(int allocType, void* /*userData*/, size_t /*size*/, int /*blockType*/, long /*requestNumber*/, const unsigned char* /*filename*/, int /*lineNumber*/)
+	{
+		if (_HOOK_ALLOC == allocType || _HOOK_REALLOC == allocType) ++allocationsCounter;
+
+		return TRUE;
+	}
+}
+#endif
+
+
+namespace {
+	// the settings of the guess and scan tests: DIIS with EDIIS for the first iterations, the second order solver finishing a stagnated DIIS
+	// with the polishing and the stability check, otherwise the points end up on saddle points depending on where they start from and the energies cannot be compared
+	void SetScanOptions(HartreeFock::HartreeFockAlgorithm& algorithm)
+	{
+		algorithm.UseDIIS = true;
+		algorithm.diis.useEDIIS = true;
+		algorithm.alpha = 0.5;
+		algorithm.initGuess = 0;
+		algorithm.secondOrderSCF = 2;
+		algorithm.stabilityCheck = true;
+	}
+
+	// a thread of a nitrogen molecule dissociation scan, the point is started from the previous ones if it follows the last one computed, otherwise from the atomic densities
+	class NitrogenScan
+	{
+	public:
+		NitrogenScan(const Systems::Molecule& nitrogen, bool restricted, HartreeFock::AtomicDensities& atomicDensities, int extrapolation = 2)
+			: nitrogen(nitrogen), algorithm(restricted ? static_cast<HartreeFock::HartreeFockAlgorithm&>(restrictedHartreeFock) : unrestrictedHartreeFock), atomicDensities(atomicDensities),
+			nrIterations(0), nrFockBuilds(0), allConverged(true)
+		{
+			SetScanOptions(algorithm);
+			warmStart.extrapolation = extrapolation;
+		}
+
+		static void SetDistance(Systems::Molecule& molecule, double distance)
+		{
+			molecule.atoms[0].position.X = -distance / 2.;
+			molecule.atoms[1].position.X = distance / 2.;
+			molecule.SetCenterForShells();
+		}
+
+		// for the molecule already at the point geometry, with the integrals precomputed for it, if passed
+		double ComputePoint(Systems::Molecule& molecule, bool follows, GaussianIntegrals::IntegralsRepository* integrals = nullptr)
+		{
+			if (!follows) warmStart.Clear();
+
+			if (!warmStart.SetGuess(algorithm, molecule))
+			{
+				algorithm.initialDensities.resize(1);
+				atomicDensities.GetGuess(molecule, algorithm.initialDensities[0]);
+			}
+
+			algorithm.precomputedIntegrals = integrals;
+			algorithm.Init(&molecule);
+			const double energy = algorithm.Calculate();
+
+			if (algorithm.converged) warmStart.Add(algorithm);
+			else
+			{
+				warmStart.Clear();
+				allConverged = false;
+			}
+
+			nrIterations += algorithm.nrIterations;
+			nrFockBuilds += algorithm.nrFockBuilds;
+
+			return energy;
+		}
+
+		double ComputePoint(double distance, bool follows)
+		{
+			SetDistance(nitrogen, distance);
+
+			return ComputePoint(nitrogen, follows);
+		}
+
+		// the isolated atom, for the dissociation limit
+		double ComputeAtom()
+		{
+			Systems::Molecule atom;
+			atom.atoms.push_back(nitrogen.atoms[0]);
+			atom.Init();
+
+			HartreeFock::UnrestrictedHartreeFock atomAlgorithm;
+			SetScanOptions(atomAlgorithm);
+			atomAlgorithm.initialDensities.resize(1);
+			atomicDensities.GetGuess(atom, atomAlgorithm.initialDensities[0]);
+
+			atomAlgorithm.Init(&atom);
+
+			return atomAlgorithm.Calculate();
+		}
+
+		Systems::Molecule nitrogen;
+
+		HartreeFock::RestrictedHartreeFock restrictedHartreeFock;
+		HartreeFock::UnrestrictedHartreeFock unrestrictedHartreeFock;
+		HartreeFock::HartreeFockAlgorithm& algorithm;
+
+		HartreeFock::WarmStart warmStart;
+		HartreeFock::AtomicDensities& atomicDensities;
+
+		int nrIterations;
+		int nrFockBuilds;
+		bool allConverged;
+	};
+
+	// all the points in order on the current thread, the reference for the scans split between threads
+	std::vector<double> SerialScan(const Systems::Molecule& nitrogen, bool restricted, double start, double step, unsigned int nrPoints, HartreeFock::AtomicDensities& atomicDensities)
+	{
+		NitrogenScan scan(nitrogen, restricted, atomicDensities);
+
+		std::vector<double> energies;
+		for (unsigned int point = 0; point < nrPoints; ++point)
+			energies.push_back(scan.ComputePoint(start + step * point, true));
+
+		return energies;
+	}
+
+	double MaxDifference(const std::vector<double>& values, const std::vector<double>& expected)
+	{
+		double maxDifference = 0;
+		for (size_t i = 0; i < values.size(); ++i)
+			maxDifference = max(maxDifference, abs(values[i] - expected[i]));
+
+		return maxDifference;
+	}
+}
 
 
 // will test values against examples from here:
@@ -32,6 +176,7 @@
 // uses STO3G, so that's what is loaded
 
 Test::Test(const std::string& basisFile)
+	: basisFile(basisFile)
 {
 	basis.Load(basisFile);
 }
@@ -85,7 +230,7 @@ void Test::OutputMatrix(const Eigen::MatrixXd& matrix, std::ofstream& file)
 
 
 
-void Test::OutputMatrices(Systems::Molecule& molecule, std::ofstream& file, const std::string& sfileName, const std::string& tfileName, const std::string& vfileName, const std::string& erifileName, bool useDIIS, const double expectedNucEnergy)
+void Test::OutputMatrices(Systems::Molecule& molecule, std::ofstream& file, const std::string& sfileName, const std::string& tfileName, const std::string& vfileName, const std::string& erifileName, bool useDIIS, const double expectedNucEnergy, double primitivePairThreshold)
 {
 	HartreeFock::HartreeFockAlgorithm* hartreeFock;
 	const bool restricted = molecule.alphaElectrons == molecule.betaElectrons;
@@ -98,6 +243,7 @@ void Test::OutputMatrices(Systems::Molecule& molecule, std::ofstream& file, cons
 	hartreeFock->UseDIIS = useDIIS;
 	hartreeFock->alpha = 0.5;
 	hartreeFock->initGuess = 0;
+	hartreeFock->integralsRepository.primitivePairThreshold = primitivePairThreshold;
 
 	hartreeFock->Init(&molecule);
 
@@ -112,6 +258,9 @@ void Test::OutputMatrices(Systems::Molecule& molecule, std::ofstream& file, cons
 
 	file << std::endl << std::endl;
 
+	const GaussianIntegrals::ShellPairs& shellPairs = hartreeFock->integralsRepository.getShellPairs();
+	file << "Primitive pairs screening threshold: " << primitivePairThreshold << " Primitive pairs: " << shellPairs.nrPrimitivePairsTotal << " Skipped: " << shellPairs.nrPrimitivePairsSkipped << std::endl << std::endl;
+
 	// now we have the molecule
 
 	//hartreeFock->integralsRepository.useLotsOfMemory = false;
@@ -430,11 +579,99 @@ void Test::CheckDifferences(const GaussianIntegrals::IntegralsRepository& repo,
 }
 
 
+bool Test::CheckValue(const std::string& name, double value, double expected, double tolerance, std::ofstream& file)
+{
+	if (abs(value - expected) <= tolerance) return true;
+
+	file.precision(12);
+	file << "Differences, " << name << "=" << value << " Expected: " << expected << std::endl;
+
+	return false;
+}
+
+
+bool Test::CheckLimit(const std::string& name, double value, double limit, std::ofstream& file)
+{
+	if (value <= limit) return true;
+
+	file.precision(12);
+	file << "Differences, " << name << "=" << value << " Limit: " << limit << std::endl;
+
+	return false;
+}
+
+
+
+Test::CalculationResult Test::RunCalculation(Systems::Molecule& molecule, bool restricted, const std::function<void(HartreeFock::HartreeFockAlgorithm&)>& setup)
+{
+	HartreeFock::RestrictedHartreeFock restrictedHartreeFock;
+	HartreeFock::UnrestrictedHartreeFock unrestrictedHartreeFock;
+
+	HartreeFock::HartreeFockAlgorithm& algorithm = restricted ? static_cast<HartreeFock::HartreeFockAlgorithm&>(restrictedHartreeFock) : unrestrictedHartreeFock;
+
+	algorithm.UseDIIS = true;
+	algorithm.alpha = 0.5;
+	algorithm.initGuess = 0;
+
+	if (setup) setup(algorithm);
+
+	const auto start = std::chrono::high_resolution_clock::now();
+	algorithm.Init(&molecule);
+
+	CalculationResult result;
+	result.energy = algorithm.Calculate();
+	result.time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	result.converged = algorithm.converged;
+	result.iterations = algorithm.nrIterations;
+	result.polishingIterations = algorithm.nrPolishingIterations;
+	result.fockBuilds = algorithm.nrFockBuilds;
+	result.diisStagnated = algorithm.diisStagnated;
+
+	return result;
+}
+
+
+void Test::OutputResult(const std::string& name, const CalculationResult& result, std::ofstream& file)
+{
+	file.precision(12);
+	file << name << ": Energy: " << result.energy << " Converged: " << result.converged << " Iterations: " << result.iterations << " Fock builds: " << result.fockBuilds;
+	if (result.polishingIterations) file << " After DIIS: " << result.polishingIterations;
+	if (result.diisStagnated) file << " DIIS stagnated";
+	file.precision(4);
+	file << " Time: " << result.time << " s" << std::endl;
+}
+
+
+bool Test::CheckResults(const std::vector<CheckedResult>& results, std::ofstream& file)
+{
+	bool same = true;
+
+	for (const auto& checked : results)
+	{
+		// the ones known not to converge are checked only for that
+		const bool converges = !checked.checkReference || checked.reference.maxIterations > 0;
+
+		if (checked.result.converged != converges)
+		{
+			file << "Differences, " << checked.name << (converges ? " did not converge" : " converged") << std::endl;
+			same = false;
+		}
+		else if (checked.checkReference && converges)
+		{
+			same = CheckValue(checked.name + ", energy", checked.result.energy, checked.reference.energy, 1E-6, file) && same;
+			same = CheckLimit(checked.name + ", iterations", checked.result.iterations, checked.reference.maxIterations, file) && same;
+		}
+	}
+
+	return same;
+}
+
+
 
 // TODO: try to load the provided file at https://github.com/CrawfordGroup/ProgrammingProjects/tree/master/Project%2303 and do comparisons in the code
 // even the geometry of the molecule could be loaded from the file
 
-void Test::TestWater(const std::string& fileName, const std::string& sfileName, const std::string& tfileName, const std::string& vfileName, const std::string& erifileName, bool useDIIS)
+void Test::BuildWater(Systems::Molecule& molecule) const
 {
 	Systems::AtomWithShells H1,H2,O;
 
@@ -448,8 +685,6 @@ void Test::TestWater(const std::string& fileName, const std::string& sfileName,
 			O = atom;
 	}
 
-	Systems::Molecule molecule;
-
 	O.position.X = 0;
 	O.position.Y = -0.143225816552;
 	O.position.Z = 0;
@@ -472,14 +707,20 @@ void Test::TestWater(const std::string& fileName, const std::string& sfileName,
 	molecule.atoms.push_back(H1);
 	molecule.atoms.push_back(H2);
 	molecule.Init();
+}
+
+void Test::TestWater(const std::string& fileName, const std::string& sfileName, const std::string& tfileName, const std::string& vfileName, const std::string& erifileName, bool useDIIS, double primitivePairThreshold)
+{
+	Systems::Molecule molecule;
+	BuildWater(molecule);
 
 	std::ofstream file(fileName);
 
-	OutputMatrices(molecule, file, sfileName, tfileName, vfileName, erifileName, useDIIS, 8.002367061810450);
+	OutputMatrices(molecule, file, sfileName, tfileName, vfileName, erifileName, useDIIS, 8.002367061810450, primitivePairThreshold);
 }
 
 
-void Test::TestMethane(const std::string& fileName, const std::string& sfileName, const std::string& tfileName, const std::string& vfileName, const std::string& erifileName, bool useDIIS)
+void Test::BuildMethane(Systems::Molecule& molecule) const
 {
 	Systems::AtomWithShells H1, H2, H3, H4, C;
 
@@ -493,8 +734,6 @@ void Test::TestMethane(const std::string& fileName, const std::string& sfileName
 			C = atom;
 	}
 
-	Systems::Molecule molecule;
-
 	C.position.X = 0;
 	C.position.Y = 0;
 	C.position.Z = 0;
@@ -521,8 +760,1240 @@ void Test::TestMethane(const std::string& fileName, const std::string& sfileName
 	molecule.atoms.push_back(H3);
 	molecule.atoms.push_back(H4);
 	molecule.Init();
+}
+
+void Test::BuildOxygen(Systems::Molecule& molecule) const
+{
+	Systems::AtomWithShells O1, O2;
+
+	for (auto& atom : basis.atoms)
+		if (8 == atom.Z)
+			O1 = O2 = atom;
+
+	O1.position.X = -1.14;
+	O2.position.X = 1.14;
+
+	molecule.atoms.push_back(O1);
+	molecule.atoms.push_back(O2);
+
+	// the triplet ground state
+	molecule.alphaElectrons = 9;
+	molecule.betaElectrons = 7;
+
+	molecule.Init();
+}
+
+void Test::BuildNitrogen(Systems::Molecule& molecule, double distance) const
+{
+	BuildNitrogen(basis, molecule, distance);
+}
+
+void Test::BuildNitrogen(const Chemistry::Basis& basis, Systems::Molecule& molecule, double distance)
+{
+	Systems::AtomWithShells N1, N2;
+
+	for (auto& atom : basis.atoms)
+		if (7 == atom.Z)
+			N1 = N2 = atom;
+
+	N1.position.X = -distance / 2.;
+	N2.position.X = distance / 2.;
+
+	molecule.atoms.push_back(N1);
+	molecule.atoms.push_back(N2);
+	molecule.Init();
+}
+
+void Test::TestMethane(const std::string& fileName, const std::string& sfileName, const std::string& tfileName, const std::string& vfileName, const std::string& erifileName, bool useDIIS, double primitivePairThreshold)
+{
+	Systems::Molecule molecule;
+	BuildMethane(molecule);
 
 	std::ofstream file(fileName);
 
-	OutputMatrices(molecule, file, sfileName, tfileName, vfileName, erifileName, useDIIS, 13.497304462036480);
+	OutputMatrices(molecule, file, sfileName, tfileName, vfileName, erifileName, useDIIS, 13.497304462036480, primitivePairThreshold);
+}
+
+
+// checks the tabulated Boys functions against the reference implementation, then times them
+
+void Test::TestBoysFunctions(const std::string& fileName)
+{
+	std::ofstream file(fileName);
+
+	GaussianIntegrals::BoysFunctions tabulated;
+	GaussianIntegrals::BoysFunctions reference;
+
+	const int maxM = GaussianIntegrals::BoysFunctions::maxTableOrder;
+
+	file << "Accuracy, maximum relative differences for each order:" << std::endl;
+
+	std::vector<double> maxDifs(maxM + 1ULL, 0.);
+	std::vector<double> maxDifsT(maxM + 1ULL, 0.);
+
+	// exactly 0 the reference would divide by an underflowed power of T for high orders, but the values are known there
+	tabulated.GenerateBoysFunctions(maxM, 0);
+	for (int m = 0; m <= maxM; ++m)
+		maxDifs[m] = abs(tabulated.functions[m] * (2. * m + 1.) - 1.);
+
+	// not on the grid points, and going past the asymptotic limit
+	for (double T = 0.001; T < 60; T += 0.0137)
+	{
+		tabulated.GenerateBoysFunctions(maxM, T);
+		reference.GenerateBoysFunctionsReference(maxM, T);
+
+		for (int m = 0; m <= maxM; ++m)
+		{
+			const double dif = abs(tabulated.functions[m] - reference.functions[m]) / reference.functions[m];
+			if (dif > maxDifs[m])
+			{
+				maxDifs[m] = dif;
+				maxDifsT[m] = T;
+			}
+		}
+	}
+
+	file.precision(3);
+	for (int m = 0; m <= maxM; ++m)
+		file << "m=" << m << "\t" << maxDifs[m] << "\tat T=" << maxDifsT[m] << std::endl;
+
+	// the benchmark, for the orders used for d orbitals in two electron integrals
+
+	const int benchM = 8;
+	const int nrCalls = 1000000;
+
+	double sum = 0; // to have the results used, so the calls are not optimized away
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < nrCalls; ++i)
+	{
+		tabulated.GenerateBoysFunctions(benchM, 50. * i / nrCalls);
+		sum += tabulated.functions[0];
+	}
+	const double tabulatedTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < nrCalls; ++i)
+	{
+		reference.GenerateBoysFunctionsReference(benchM, 50. * i / nrCalls);
+		sum -= reference.functions[0];
+	}
+	const double referenceTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	file << std::endl << "Timing for " << nrCalls << " calls, orders 0 to " << benchM << ":" << std::endl;
+	file << "Tabulated: " << tabulatedTime << " s" << std::endl;
+	file << "Reference: " << referenceTime << " s" << std::endl;
+	file << "Speedup: " << referenceTime / tabulatedTime << std::endl;
+	file << "Check sum (should be close to zero): " << sum << std::endl;
+}
+
+
+void Test::TestIntegralDirect(const std::string& fileName, double schwarzThreshold)
+{
+	Systems::Molecule molecule;
+	BuildWater(molecule);
+
+	std::ofstream file(fileName);
+	file.precision(15);
+
+	// stored integrals, integral direct with full Fock matrix builds, integral direct with incremental builds
+	double energies[3];
+	int iterations[3];
+	for (int direct = 0; direct < 3; ++direct)
+	{
+		HartreeFock::RestrictedHartreeFock hartreeFock;
+
+		hartreeFock.UseDIIS = true;
+		hartreeFock.alpha = 0.5;
+		hartreeFock.initGuess = 0;
+		hartreeFock.integralsRepository.schwarzThreshold = schwarzThreshold;
+		hartreeFock.integralsRepository.integralDirect = (direct > 0);
+		hartreeFock.fullFockBuildInterval = (2 == direct ? 10 : 1);
+
+		const auto start = std::chrono::high_resolution_clock::now();
+		hartreeFock.Init(&molecule);
+		energies[direct] = hartreeFock.Calculate();
+		const double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		iterations[direct] = hartreeFock.nrIterations;
+
+		file << (0 == direct ? "Stored integrals:" : (1 == direct ? "Integral direct, full builds:" : "Integral direct, incremental builds:")) << std::endl;
+		file << "Energy: " << energies[direct] << " Converged: " << hartreeFock.converged << " Iterations: " << iterations[direct] << " Time: " << time << " s" << std::endl;
+		// for the direct mode these are from the last Fock matrix build, with the density weighted screening
+		file << "Shell quartets: " << hartreeFock.integralsRepository.electronElectronShellQuartets << " Skipped: " << hartreeFock.integralsRepository.electronElectronShellQuartetsSkipped << std::endl << std::endl;
+	}
+
+	file << "Difference for full builds: " << abs(energies[1] - energies[0]) << std::endl;
+	file << "Difference for incremental builds: " << abs(energies[2] - energies[0]) << std::endl;
+
+	// the screening changes the energy a little, the incremental builds switch to full ones close to the convergence, that costs a few steps
+	file << "\nDifferences, if there are any:\n";
+
+	bool ok = CheckValue("energy, full builds", energies[1], energies[0], 1E-8, file);
+	ok = CheckValue("energy, incremental builds", energies[2], energies[0], 1E-8, file) && ok;
+	ok = CheckLimit("iterations, full builds", iterations[1], iterations[0] + 5., file) && ok;
+	ok = CheckLimit("iterations, incremental builds", iterations[2], iterations[0] + 5., file) && ok;
+
+	if (ok) file << "No differences!" << std::endl;
+}
+
+
+void Test::TestFockBuild(const std::string& fileName, int nrBuilds)
+{
+	Systems::Molecule molecule;
+	BuildWater(molecule);
+
+	std::ofstream file(fileName);
+
+	HartreeFock::RestrictedHartreeFock hartreeFock;
+
+	hartreeFock.UseDIIS = true;
+	hartreeFock.alpha = 0.5;
+	hartreeFock.initGuess = 0;
+
+	// the unpacked integrals are tested at the end
+	hartreeFock.integralsRepository.useLotsOfMemory = false;
+
+	hartreeFock.Init(&molecule);
+	hartreeFock.Calculate();
+
+	const Eigen::MatrixXd& D = hartreeFock.DensityMatrix;
+	const int numberOfOrbitals = static_cast<int>(D.rows());
+
+	// the old way, all i, j, k, l and two lookups for each
+	Eigen::MatrixXd Gloop;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int build = 0; build < nrBuilds; ++build)
+	{
+		Gloop = Eigen::MatrixXd::Zero(numberOfOrbitals, numberOfOrbitals);
+
+		for (int i = 0; i < numberOfOrbitals; ++i)
+			for (int j = 0; j < numberOfOrbitals; ++j)
+				for (int k = 0; k < numberOfOrbitals; ++k)
+					for (int l = 0; l < numberOfOrbitals; ++l)
+					{
+						const double coulomb = hartreeFock.integralsRepository.getElectronElectron(i, j, k, l);
+						const double exchange = hartreeFock.integralsRepository.getElectronElectron(i, l, k, j);
+
+						Gloop(i, j) += D(k, l) * (coulomb - 0.5 * exchange);
+					}
+	}
+	const double loopTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	// the unique integrals, each used once
+	Eigen::MatrixXd Gunique;
+	std::vector<Eigen::MatrixXd> coulomb;
+	std::vector<Eigen::MatrixXd> exchange;
+
+	start = std::chrono::high_resolution_clock::now();
+	for (int build = 0; build < nrBuilds; ++build)
+	{
+		hartreeFock.integralsRepository.CalculateCoulombAndExchange({ &D }, coulomb, exchange);
+		Gunique = coulomb[0] - 0.5 * exchange[0];
+	}
+	const double uniqueTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	// matrix products on the unpacked integrals
+	hartreeFock.integralsRepository.useLotsOfMemory = true;
+	hartreeFock.integralsRepository.supermatrixMemoryLimit = 4096;
+	hartreeFock.integralsRepository.CalculateElectronElectronIntegrals();
+
+	Eigen::MatrixXd Gsupermatrix;
+
+	start = std::chrono::high_resolution_clock::now();
+	for (int build = 0; build < nrBuilds; ++build)
+	{
+		hartreeFock.integralsRepository.CalculateCoulombAndExchange({ &D }, coulomb, exchange);
+		Gsupermatrix = coulomb[0] - 0.5 * exchange[0];
+	}
+	const double supermatrixTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	file.precision(15);
+	file << "Basis functions: " << numberOfOrbitals << " Fock matrix builds: " << nrBuilds << std::endl;
+	file << "Max difference, unique integrals: " << (Gloop - Gunique).cwiseAbs().maxCoeff() << std::endl;
+	if (hartreeFock.integralsRepository.HasSupermatrix())
+		file << "Max difference, unpacked integrals: " << (Gloop - Gsupermatrix).cwiseAbs().maxCoeff() << std::endl << std::endl;
+	else
+		file << "The unpacked integrals do not fit in memory" << std::endl << std::endl;
+
+	file.precision(4);
+	file << "All i, j, k, l loop: " << loopTime << " s" << std::endl;
+	file << "Unique integrals: " << uniqueTime << " s" << std::endl;
+	file << "Speedup: " << loopTime / uniqueTime << std::endl;
+	if (hartreeFock.integralsRepository.HasSupermatrix())
+	{
+		file << "Unpacked integrals: " << supermatrixTime << " s" << std::endl;
+		file << "Speedup: " << loopTime / supermatrixTime << ", against the unique integrals: " << uniqueTime / supermatrixTime << std::endl;
+	}
+}
+
+
+bool Test::CountStepAllocations(HartreeFock::HartreeFockAlgorithm& algorithm, int nrSteps, unsigned long long int& allocations, double& time)
+{
+	// the steps are counted from 1, as the DIIS ones of a calculation, the Fock matrix build is on the supermatrix or on the stored unique integrals, as set before Init
+	allocations = 0;
+
+	// one step to have everything sized
+	int iter = 1;
+	algorithm.Step(iter++);
+
+#ifdef _DEBUG
+	allocationsCounter = 0;
+	const _CRT_ALLOC_HOOK oldHook = _CrtSetAllocHook(CountAllocationsHook);
+#endif
+
+	const auto start = std::chrono::high_resolution_clock::now();
+	for (int step = 0; step < nrSteps; ++step)
+		algorithm.Step(iter++);
+	time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+#ifdef _DEBUG
+	_CrtSetAllocHook(oldHook);
+
+	allocations = allocationsCounter;
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+void Test::TestStepAllocations(const std::string& fileName, int nrSteps)
+{
+	Systems::Molecule molecule;
+	BuildWater(molecule);
+
+	std::ofstream file(fileName);
+
+#ifndef _DEBUG
+	file << "The allocations are counted only in debug builds" << std::endl << std::endl;
+#endif
+
+	// with the default options the unpacked integrals are used, then with the stored unique ones
+	for (int supermatrix = 1; supermatrix >= 0; --supermatrix)
+	{
+		HartreeFock::RestrictedHartreeFock restricted;
+		HartreeFock::UnrestrictedHartreeFock unrestricted;
+
+		HartreeFock::HartreeFockAlgorithm* algorithms[2] = { &restricted, &unrestricted };
+		const char* names[2] = { "Restricted", "Unrestricted" };
+
+		for (int i = 0; i < 2; ++i)
+		{
+			HartreeFock::HartreeFockAlgorithm& algorithm = *algorithms[i];
+
+			algorithm.UseDIIS = true;
+			algorithm.alpha = 0.5;
+			algorithm.initGuess = 0;
+
+			algorithm.integralsRepository.useLotsOfMemory = (1 == supermatrix);
+
+			algorithm.Init(&molecule);
+			algorithm.Calculate();
+
+			unsigned long long int allocations = 0;
+			double time = 0;
+			const bool counted = CountStepAllocations(algorithm, nrSteps, allocations, time);
+
+			file << names[i] << (algorithm.integralsRepository.HasSupermatrix() ? ", unpacked integrals: " : ", unique integrals: ");
+			if (counted) file << allocations << " allocations";
+			else file << "allocations not measured";
+			file << " in " << nrSteps << " steps, " << time / nrSteps << " s per step on " << algorithm.integralsRepository.nrThreads << " threads" << std::endl;
+		}
+	}
+}
+
+
+void Test::TestDIIS(const std::string& fileName)
+{
+	std::vector<Systems::Molecule> molecules(3);
+	BuildWater(molecules[0]);
+	BuildMethane(molecules[1]);
+	BuildOxygen(molecules[2]);
+
+	const char* names[3] = { "Water", "Methane", "Oxygen" };
+	const char* methods[3] = { "restricted", "unrestricted, joint DIIS", "unrestricted, separate DIIS" };
+
+	// the references, in the order of the calculations below
+	const Reference references[] = {
+		{ -75.992438, 37 }, { -75.992438, 44 }, { -75.992438, 698 },
+		{ -40.202166, 31 }, { -40.202166, 33 }, { -40.202166, 389 },
+		{ -149.619365, 315 }, { -149.619365, 629 }
+	};
+
+	std::ofstream file(fileName);
+	std::vector<CheckedResult> results;
+	int run = 0;
+
+	// the restricted method for the closed shell molecules, the unrestricted one for all, with joint and separate extrapolation of the alpha and beta Fock matrices
+	for (int i = 0; i < 3; ++i)
+		for (int method = 0; method < 3; ++method)
+		{
+			if (0 == method && molecules[i].alphaElectrons != molecules[i].betaElectrons) continue;
+
+			const CalculationResult result = RunCalculation(molecules[i], 0 == method, [method](HartreeFock::HartreeFockAlgorithm& algorithm)
+			{
+				if (method) static_cast<HartreeFock::UnrestrictedHartreeFock&>(algorithm).jointDIIS = (1 == method);
+			});
+
+			const std::string name = std::string(names[i]) + ", " + methods[method];
+			OutputResult(name, result, file);
+			results.push_back({ name, result, references[run++], ReferenceBasis() });
+		}
+
+	// regression checks: from the core Hamiltonian guess, DIIS converges to a saddle point for the nitrogen molecule
+	// in STO-3G at 2.1 bohr and in 6-31G at 4.0 bohr, the polishing must not stop there, the error grows while it leaves it
+	// in 6-31G the polishing passes by another saddle point and does not settle in its steps, the damped iterations after it reach the minimum
+	// the stability check has nothing left to do then, it only costs the Hessian products
+	Chemistry::Basis sto3g;
+	sto3g.Load("sto3g.txt");
+
+	Chemistry::Basis basis6_31G;
+	basis6_31G.Load("6-31g.1.nw");
+
+	const Chemistry::Basis* bases[2] = { &sto3g, &basis6_31G };
+	const char* basisNames[2] = { "STO-3G", "6-31G" };
+	const double distances[2] = { 2.1, 4.0 };
+	const Reference nitrogenReferences[2][2] = { { { -107.498850, 174 }, { -107.498850, 174 } }, { { -108.424064, 2515 }, { -108.424064, 2515 } } };
+
+	for (int i = 0; i < 2; ++i)
+	{
+		Systems::Molecule nitrogen;
+		BuildNitrogen(*bases[i], nitrogen, distances[i]);
+
+		for (int check = 0; check < 2; ++check)
+		{
+			const CalculationResult result = RunCalculation(nitrogen, true, [check](HartreeFock::HartreeFockAlgorithm& algorithm)
+			{
+				algorithm.stabilityCheck = (1 == check);
+			});
+
+			std::stringstream name;
+			name << "Nitrogen at " << distances[i] << " bohr, " << basisNames[i] << ", " << (check ? "with" : "without") << " the stability check";
+			OutputResult(name.str(), result, file);
+			results.push_back({ name.str(), result, nitrogenReferences[i][check], true });
+		}
+	}
+
+	file << "\nDifferences, if there are any:" << std::endl;
+
+	if (CheckResults(results, file)) file << "No differences!" << std::endl;
+}
+
+
+void Test::TestSecondOrder(const std::string& fileName)
+{
+	std::vector<Systems::Molecule> molecules(4);
+	BuildWater(molecules[0]);
+	BuildMethane(molecules[1]);
+	BuildOxygen(molecules[2]);
+	BuildNitrogen(molecules[3], 6.);
+
+	const char* names[4] = { "Water", "Methane", "Oxygen", "Nitrogen at 6 bohr" };
+	const char* solvers[3] = { "DIIS", "second order", "DIIS, second order finisher" };
+
+	// the references, in the order of the calculations below, the restricted DIIS does not settle for the nitrogen molecule
+	const Reference references[] = {
+		{ -75.992438, 34 }, { -75.992438, 18 }, { -75.992438, 34 },
+		{ -75.992438, 43 }, { -75.992438, 17 }, { -75.992438, 43 },
+		{ -40.202166, 30 }, { -40.202166, 17 }, { -40.202166, 30 },
+		{ -40.202166, 39 }, { -40.202166, 17 }, { -40.202166, 39 },
+		{ -149.619365, 359 }, { -149.619365, 30 }, { -149.619365, 359 },
+		{ 0, 0 }, { -108.295864, 86 }, { 0, 0 },
+		{ -108.772929, 49 }, { -108.772929, 19 }, { -108.772929, 49 }
+	};
+
+	std::ofstream file(fileName);
+	std::vector<CheckedResult> results;
+	int run = 0;
+
+	int fockBuilds[4][2][3] = {};
+
+	for (int i = 0; i < 4; ++i)
+		for (int method = 0; method < 2; ++method)
+		{
+			if (0 == method && molecules[i].alphaElectrons != molecules[i].betaElectrons) continue;
+
+			for (int solver = 0; solver < 3; ++solver)
+			{
+				const CalculationResult result = RunCalculation(molecules[i], 0 == method, [solver](HartreeFock::HartreeFockAlgorithm& algorithm)
+				{
+					algorithm.diis.useEDIIS = true;
+					algorithm.secondOrderSCF = solver;
+				});
+
+				fockBuilds[i][method][solver] = result.fockBuilds;
+
+				const std::string name = std::string(names[i]) + (0 == method ? ", restricted, " : ", unrestricted, ") + solvers[solver];
+				OutputResult(name, result, file);
+				results.push_back({ name, result, references[run++], ReferenceBasis() });
+			}
+		}
+
+	// the second order solver is not the default, it has to show it's worth it where DIIS needs many steps
+	// for the oxygen molecule it needs fewer Fock builds, to the same energy
+	file << "\nDifferences, if there are any:" << std::endl;
+
+	bool same = CheckResults(results, file);
+	same = CheckLimit("Oxygen, second order Fock builds", fockBuilds[2][1][1], 0.75 * fockBuilds[2][1][0], file) && same;
+
+	if (same) file << "No differences!" << std::endl;
+}
+
+
+void Test::TestSAD(const std::string& fileName)
+{
+	std::vector<Systems::Molecule> molecules(6);
+	BuildWater(molecules[0]);
+	BuildMethane(molecules[1]);
+	BuildOxygen(molecules[2]);
+
+	const double distances[3] = { 2.07, 3., 6. };
+	for (int i = 0; i < 3; ++i)
+		BuildNitrogen(molecules[3 + i], distances[i]);
+
+	const char* names[6] = { "Water", "Methane", "Oxygen", "Nitrogen at 2.07 bohr", "Nitrogen at 3 bohr", "Nitrogen at 6 bohr" };
+
+	// the references, in the order of the calculations below, without polishing DIIS stops on saddle points for some, the guess decides which one
+	const Reference references[] = {
+		{ -75.992438, 26 }, { -75.992438, 26 },
+		{ -75.992438, 29 }, { -75.992438, 31 },
+		{ -40.202166, 21 }, { -40.202166, 21 },
+		{ -40.202166, 23 }, { -40.202166, 28 },
+		{ -149.352657, 45 }, { -149.619365, 48 },
+		{ -108.208079, 28 }, { -108.946007, 21 },
+		{ -108.946007, 84 }, { -108.946007, 40 },
+		{ -108.347818, 23 }, { -108.601315, 28 },
+		{ -108.398808, 231 }, { -108.601315, 539 },
+		{ -107.857458, 40 }, { -108.257168, 49 },
+		{ -108.772929, 39 }, { -108.499904, 234 }
+	};
+
+	std::ofstream file(fileName);
+	std::vector<CheckedResult> results;
+	int run = 0;
+
+	HartreeFock::AtomicDensities atomicDensities;
+
+	for (int i = 0; i < 6; ++i)
+	{
+		Systems::Molecule& molecule = molecules[i];
+
+		// the first time the atoms are computed, the time for it is reported, then they are taken from the cache
+		const auto guessStart = std::chrono::high_resolution_clock::now();
+		Eigen::MatrixXd guess;
+		atomicDensities.GetGuess(molecule, guess);
+		const double guessTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - guessStart).count();
+
+		file.precision(4);
+		file << names[i] << ", atomic densities time: " << guessTime << " s" << std::endl;
+
+		for (int method = 0; method < 2; ++method)
+		{
+			if (0 == method && molecule.alphaElectrons != molecule.betaElectrons) continue;
+
+			for (int sad = 0; sad < 2; ++sad)
+			{
+				const CalculationResult result = RunCalculation(molecule, 0 == method, [sad, &guess](HartreeFock::HartreeFockAlgorithm& algorithm)
+				{
+					algorithm.diis.useEDIIS = true;
+					algorithm.normalIterAfterDIIS = 0;
+					if (sad) algorithm.initialDensities.assign(1, guess);
+				});
+
+				const std::string name = std::string(names[i]) + (0 == method ? ", restricted, " : ", unrestricted, ") + (sad ? "SAD" : "core Hamiltonian");
+				OutputResult(name, result, file);
+				results.push_back({ name, result, references[run++], ReferenceBasis() });
+			}
+		}
+
+		file << std::endl;
+	}
+
+	file << "\nDifferences, if there are any:" << std::endl;
+
+	if (CheckResults(results, file)) file << "No differences!" << std::endl;
+}
+
+
+void Test::TestEDIIS(const std::string& fileName, int nrPoints)
+{
+	// the references for the default points, in the order of the calculations below
+	// without polishing DIIS stops on saddle points for many of them, EDIIS changes which one, sometimes for the worse
+	const Reference references[] = {
+		{ -108.362002, 38 }, { -108.362002, 29 }, { -108.362002, 31 }, { -108.362002, 32 },
+		{ -108.199383, 29 }, { -108.199383, 28 }, { -108.199383, 679 }, { -108.946705, 87 },
+		{ -108.342411, 28 }, { -108.342411, 24 }, { -108.342411, 1046 }, { -108.842697, 976 },
+		{ -108.344073, 26 }, { -108.344073, 23 }, { -108.395483, 243 }, { -108.395483, 290 },
+		{ -108.323781, 27 }, { -108.323781, 24 }, { -108.375961, 143 }, { -108.472840, 153 },
+		{ -108.205763, 27 }, { -108.205763, 23 }, { -108.485860, 206 }, { -108.485860, 128 },
+		{ -108.222975, 27 }, { -108.222975, 23 }, { -108.506567, 46 }, { -108.506567, 58 },
+		{ -107.842634, 61 }, { -107.842634, 43 }, { -108.224894, 147 }, { -108.772286, 40 },
+		{ -107.856764, 50 }, { -107.856764, 68 }, { 0, 0 }, { -108.772896, 39 },
+		{ -107.859792, 42 }, { 0, 0 }, { -108.773110, 42 }, { -108.773110, 40 }
+	};
+
+	const bool reference = ReferenceBasis() && 10 == nrPoints;
+
+	std::ofstream file(fileName);
+	std::vector<CheckedResult> results;
+	int run = 0;
+
+	// the nitrogen molecule dissociation, the points far from the equilibrium are the difficult ones
+	for (int point = 0; point < nrPoints; ++point)
+	{
+		const double distance = 1.5 + 5. * point / max(nrPoints - 1, 1);
+
+		Systems::Molecule molecule;
+		BuildNitrogen(molecule, distance);
+
+		std::stringstream pointName;
+		pointName.precision(4);
+		pointName << "Distance: " << distance << " bohr";
+		file << pointName.str() << std::endl;
+
+		for (int method = 0; method < 4; ++method)
+		{
+			const bool useEDIIS = (1 == method % 2);
+
+			const CalculationResult result = RunCalculation(molecule, method < 2, [useEDIIS](HartreeFock::HartreeFockAlgorithm& algorithm)
+			{
+				algorithm.diis.useEDIIS = useEDIIS;
+				algorithm.normalIterAfterDIIS = 0;
+			});
+
+			const std::string name = pointName.str() + (method < 2 ? ", restricted, " : ", unrestricted, ") + (useEDIIS ? "EDIIS + DIIS" : "DIIS");
+			OutputResult(name, result, file);
+			results.push_back({ name, result, reference ? references[run++] : Reference{ 0, 0 }, reference });
+		}
+
+		file << std::endl;
+	}
+
+	file << "\nDifferences, if there are any:" << std::endl;
+
+	if (CheckResults(results, file)) file << "No differences!" << std::endl;
+}
+
+
+void Test::TestBasisProjection(const std::string& fileName, const std::string& smallBasisFile)
+{
+	Chemistry::Basis smallBasis;
+	smallBasis.Load(smallBasisFile);
+
+	std::vector<Systems::Molecule> molecules(5);
+	BuildWater(molecules[0]);
+	BuildMethane(molecules[1]);
+	BuildOxygen(molecules[2]);
+	BuildNitrogen(molecules[3], 2.07);
+	BuildNitrogen(molecules[4], 3.);
+
+	const char* names[5] = { "Water", "Methane", "Oxygen", "Nitrogen at 2.07 bohr", "Nitrogen at 3 bohr" };
+
+	std::ofstream file(fileName);
+
+	HartreeFock::AtomicDensities atomicDensities;
+
+	// the SAD and the projected start for each calculation
+	struct Comparison
+	{
+		std::string name;
+		CalculationResult results[2];
+	};
+	std::vector<Comparison> comparisons;
+
+	for (int i = 0; i < 5; ++i)
+	{
+		Systems::Molecule& molecule = molecules[i];
+
+		file << names[i] << std::endl;
+
+		for (int method = 0; method < 2; ++method)
+		{
+			if (0 == method && molecule.alphaElectrons != molecule.betaElectrons) continue;
+
+			comparisons.emplace_back();
+			comparisons.back().name = std::string(names[i]) + (0 == method ? ", restricted" : ", unrestricted");
+
+			for (int projection = 0; projection < 2; ++projection)
+			{
+				int smallBuilds = 0;
+				double smallTime = 0;
+
+				const CalculationResult result = RunCalculation(molecule, 0 == method, [&](HartreeFock::HartreeFockAlgorithm& algorithm)
+				{
+					SetScanOptions(algorithm);
+
+					if (projection)
+					{
+						const auto start = std::chrono::high_resolution_clock::now();
+						smallBuilds = HartreeFock::BasisProjection::SetGuess(algorithm, molecule, smallBasis, &atomicDensities);
+						smallTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+					}
+					else
+					{
+						algorithm.initialDensities.resize(1);
+						atomicDensities.GetGuess(molecule, algorithm.initialDensities[0]);
+					}
+				});
+
+				comparisons.back().results[projection] = result;
+
+				OutputResult(std::string(0 == method ? "Restricted, " : "Unrestricted, ") + (projection ? "projected" : "SAD"), result, file);
+				if (projection)
+				{
+					file.precision(4);
+					file << "Small basis Fock builds: " << smallBuilds << " Time: " << smallTime << " s" << std::endl;
+				}
+			}
+		}
+
+		file << std::endl;
+	}
+
+	// the projected start must get to the same state as the SAD one, without more Fock builds in the test basis
+	file << "\nDifferences, if there are any:" << std::endl;
+
+	bool same = true;
+	for (const auto& comparison : comparisons)
+	{
+		const CalculationResult& sad = comparison.results[0];
+		const CalculationResult& projected = comparison.results[1];
+
+		if (!sad.converged || !projected.converged)
+		{
+			file << "Differences, " << comparison.name << " did not converge" << std::endl;
+			same = false;
+			continue;
+		}
+
+		same = CheckValue(comparison.name + ", projected energy", projected.energy, sad.energy, 1E-6, file) && same;
+		same = CheckLimit(comparison.name + ", projected Fock builds", projected.fockBuilds, sad.fockBuilds, file) && same;
+	}
+
+	if (same) file << "No differences!" << std::endl;
+}
+
+
+void Test::TestWarmStart(const std::string& fileName, double start, double end, double step)
+{
+	Systems::Molecule nitrogen;
+	BuildNitrogen(nitrogen, start);
+
+	const unsigned int nrPoints = static_cast<unsigned int>(floor((end - start) / step + 0.5)) + 1;
+
+	const char* modes[4] = { "from scratch", "previous point", "linear extrapolation", "Grassmann extrapolation" };
+
+	std::ofstream file(fileName);
+
+	HartreeFock::AtomicDensities atomicDensities;
+
+	// for each method and mode
+	int iterations[2][4] = {};
+	bool converged[2][4] = {};
+	double maxEnergyRises[2][4] = {};
+
+	for (int method = 0; method < 2; ++method)
+	{
+		std::vector<double> coldEnergies;
+
+		for (int mode = 0; mode < 4; ++mode)
+		{
+			NitrogenScan scan(nitrogen, 0 == method, atomicDensities, max(mode - 1, 0));
+
+			std::vector<double> energies;
+
+			const auto startTime = std::chrono::high_resolution_clock::now();
+
+			for (unsigned int point = 0; point < nrPoints; ++point)
+				energies.push_back(scan.ComputePoint(start + step * point, 0 != mode));
+
+			const double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+			iterations[method][mode] = scan.nrIterations;
+			converged[method][mode] = scan.allConverged;
+
+			double maxEnergyDifference = 0;
+			if (0 == mode) coldEnergies = energies;
+			else
+			{
+				maxEnergyDifference = MaxDifference(energies, coldEnergies);
+				for (unsigned int point = 0; point < nrPoints; ++point)
+					maxEnergyRises[method][mode] = max(maxEnergyRises[method][mode], energies[point] - coldEnergies[point]);
+			}
+
+			file << (0 == method ? "Restricted, " : "Unrestricted, ") << modes[mode] << ": Iterations: " << scan.nrIterations << " Fock builds: " << scan.nrFockBuilds << " Converged: " << scan.allConverged;
+			file.precision(4);
+			file << " Time: " << time << " s";
+			if (mode)
+			{
+				file.precision(6);
+				file << " Max energy difference to the start from scratch: " << maxEnergyDifference;
+			}
+			file << std::endl;
+		}
+
+		file << std::endl;
+	}
+
+	// the warm started scans must converge, in fewer iterations than the ones from scratch and not to higher energies
+	// the unrestricted ones from scratch do not always converge and end up on higher states for some stretched bonds, following the curve from the previous points avoids that
+	file << "\nDifferences, if there are any:" << std::endl;
+
+	bool same = true;
+	for (int method = 0; method < 2; ++method)
+		for (int mode = 1; mode < 4; ++mode)
+		{
+			const std::string name = std::string(0 == method ? "Restricted, " : "Unrestricted, ") + modes[mode];
+
+			if (!converged[method][mode])
+			{
+				file << "Differences, " << name << " did not converge" << std::endl;
+				same = false;
+			}
+
+			same = CheckLimit(name + ", max energy above the start from scratch", maxEnergyRises[method][mode], 1E-6, file) && same;
+			same = CheckLimit(name + ", iterations", iterations[method][mode], iterations[method][0] - 1, file) && same;
+		}
+
+	if (same) file << "No differences!" << std::endl;
+}
+
+
+void Test::TestScanScheduler(const std::string& fileName, unsigned int nrThreads, double start, double end, double step)
+{
+	Systems::Molecule nitrogen;
+	BuildNitrogen(nitrogen, start);
+
+	const unsigned int nrPoints = static_cast<unsigned int>(floor((end - start) / step + 0.5)) + 1;
+
+	std::ofstream file(fileName);
+
+	HartreeFock::AtomicDensities atomicDensities;
+
+	const auto serialStart = std::chrono::high_resolution_clock::now();
+	const std::vector<double> serialEnergies = SerialScan(nitrogen, true, start, step, nrPoints, atomicDensities);
+	const double serialTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - serialStart).count();
+
+	file.precision(4);
+	file << "Serial: Wall time: " << serialTime << " s" << std::endl << std::endl;
+
+	double maxEnergyDifferences[2] = {};
+
+	for (int mode = 0; mode < 2; ++mode)
+	{
+		ScanScheduler scheduler;
+		scheduler.Init(start, step, nrPoints, nrThreads);
+
+		std::vector<double> energies(nrPoints);
+		std::vector<double> busyTimes(nrThreads);
+		std::vector<int> pointsDone(nrThreads);
+
+		const auto startTime = std::chrono::high_resolution_clock::now();
+
+		std::vector<std::thread> threads;
+		for (unsigned int thread = 0; thread < nrThreads; ++thread)
+			threads.emplace_back([&, thread]() {
+				NitrogenScan scan(nitrogen, true, atomicDensities);
+
+				int lastPoint = -1;
+
+				const auto computePoint = [&](unsigned int point) {
+					energies[point] = scan.ComputePoint(start + step * point, lastPoint >= 0 && abs(static_cast<int>(point) - lastPoint) == 1);
+					lastPoint = static_cast<int>(point);
+					++pointsDone[thread];
+				};
+
+				const auto threadStart = std::chrono::high_resolution_clock::now();
+
+				if (0 == mode)
+				{
+					// the old way, equal intervals
+					const unsigned int first = thread * nrPoints / nrThreads;
+					const unsigned int last = (thread + 1) * nrPoints / nrThreads;
+					for (unsigned int point = first; point < last; ++point)
+						computePoint(point);
+
+					if (0 == thread) scan.ComputeAtom();
+					if (nrThreads - 1 == thread) scan.ComputeAtom();
+				}
+				else
+				{
+					ScanScheduler::Task task;
+					while (scheduler.GetTask(thread, task))
+					{
+						if (ScanScheduler::TaskType::Point == task.type) computePoint(task.point);
+						else scheduler.SetAtomResult(task.type, scan.ComputeAtom());
+					}
+				}
+
+				busyTimes[thread] = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - threadStart).count();
+			});
+
+		for (auto& thread : threads)
+			thread.join();
+
+		const double wallTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+		double totalBusy = 0;
+		for (const double busy : busyTimes) totalBusy += busy;
+
+		maxEnergyDifferences[mode] = MaxDifference(energies, serialEnergies);
+
+		file.precision(4);
+		file << (0 == mode ? "Equal intervals: " : "Scan scheduler: ") << "Wall time: " << wallTime << " s, total work / threads: " << totalBusy / nrThreads << " s";
+		file.precision(6);
+		file << " Max energy difference to the serial scan: " << maxEnergyDifferences[mode] << std::endl;
+		file.precision(4);
+		for (unsigned int thread = 0; thread < nrThreads; ++thread)
+			file << "Thread " << thread << " points: " << pointsDone[thread] << " time: " << busyTimes[thread] << " s" << std::endl;
+
+		file.precision(12);
+		for (unsigned int point = 0; point < nrPoints; ++point)
+			file << start + step * point << " " << energies[point] << std::endl;
+
+		file << std::endl;
+	}
+
+	// splitting the scan between threads must not change the energies
+	file << "\nDifferences, if there are any:" << std::endl;
+
+	bool same = CheckValue("Equal intervals, max energy difference", maxEnergyDifferences[0], 0, 1E-6, file);
+	same = CheckValue("Scan scheduler, max energy difference", maxEnergyDifferences[1], 0, 1E-6, file) && same;
+
+	if (same) file << "No differences!" << std::endl;
+}
+
+
+void Test::TestIntegralsReuse(const std::string& fileName, int nrPoints, double schwarzThreshold)
+{
+	Systems::AtomWithShells H, N, O;
+
+	for (auto& atom : basis.atoms)
+	{
+		if (1 == atom.Z) H = atom;
+		else if (7 == atom.Z) N = atom;
+		else if (8 == atom.Z) O = atom;
+	}
+
+	std::ofstream file(fileName);
+
+	for (int system = 0; system < 2; ++system)
+	{
+		// the atom in the middle does not move, as for the scans
+		Systems::Molecule molecule;
+		if (0 == system)
+		{
+			molecule.atoms.push_back(N);
+			molecule.atoms.push_back(N);
+		}
+		else
+		{
+			molecule.atoms.push_back(H);
+			molecule.atoms.push_back(O);
+			molecule.atoms.push_back(H);
+		}
+		molecule.Init();
+
+		GaussianIntegrals::IntegralsRepository reusing;
+		reusing.reuseElectronElectronIntegrals = true;
+
+		double timeScratch = 0;
+		double timeReuse = 0;
+		unsigned long long int quartets = 0;
+		unsigned long long int quartetsReused = 0;
+		double maxDifference = 0;
+
+		const double angle = 104.5 * M_PI / 180.;
+
+		for (int point = 0; point < nrPoints; ++point)
+		{
+			const double dist = 1.6 + 0.1 * point;
+
+			if (0 == system)
+			{
+				molecule.atoms[0].position.X = -dist / 2.;
+				molecule.atoms[1].position.X = dist / 2.;
+			}
+			else
+			{
+				molecule.atoms[0].position.X = molecule.atoms[2].position.X = dist * cos(angle / 2.);
+				molecule.atoms[0].position.Y = dist * sin(angle / 2.);
+				molecule.atoms[2].position.Y = -molecule.atoms[0].position.Y;
+			}
+			molecule.SetCenterForShells();
+
+			GaussianIntegrals::IntegralsRepository scratch;
+			for (auto* repository : { &scratch, &reusing })
+			{
+				repository->useLotsOfMemory = false;
+				repository->schwarzThreshold = schwarzThreshold;
+				repository->Reset(&molecule);
+
+				const auto startTime = std::chrono::high_resolution_clock::now();
+				repository->CalculateElectronElectronIntegrals();
+				const double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+				if (&scratch == repository) timeScratch += time;
+				else timeReuse += time;
+			}
+
+			quartets += reusing.electronElectronShellQuartets;
+			quartetsReused += reusing.electronElectronShellQuartetsReused;
+
+			const int nrOrbitals = molecule.CountNumberOfContractedGaussians();
+			for (int i = 0; i < nrOrbitals; ++i)
+				for (int j = 0; j <= i; ++j)
+					for (int k = 0; k <= i; ++k)
+						for (int l = 0; l <= (k == i ? j : k); ++l)
+							maxDifference = max(maxDifference, abs(scratch.getElectronElectron(i, j, k, l) - reusing.getElectronElectron(i, j, k, l)));
+		}
+
+		file << (0 == system ? "Nitrogen molecule" : "Water") << ": Shell quartets: " << quartets << " Reused: " << quartetsReused;
+		file.precision(4);
+		file << " Time from scratch: " << timeScratch << " s Time with reuse: " << timeReuse << " s";
+		file.precision(6);
+		file << " Max difference: " << maxDifference << std::endl;
+	}
+}
+
+
+void Test::TestIntegralsPipeline(const std::string& fileName, unsigned int nrThreads, unsigned int depth, double start, double end, double step)
+{
+	Systems::Molecule nitrogen;
+	BuildNitrogen(nitrogen, start);
+
+	const unsigned int nrPoints = static_cast<unsigned int>(floor((end - start) / step + 0.5)) + 1;
+
+	std::ofstream file(fileName);
+
+	HartreeFock::AtomicDensities atomicDensities;
+
+	const std::vector<double> serialEnergies = SerialScan(nitrogen, true, start, step, nrPoints, atomicDensities);
+
+	double maxEnergyDifferences[2] = {};
+
+	for (int mode = 0; mode < 2; ++mode)
+	{
+		ScanScheduler scheduler;
+		scheduler.Init(start, step, nrPoints, nrThreads);
+
+		std::vector<double> energies(nrPoints);
+		std::vector<double> waitTimes(nrThreads);
+
+		const auto startTime = std::chrono::high_resolution_clock::now();
+
+		std::vector<std::thread> threads;
+		for (unsigned int thread = 0; thread < nrThreads; ++thread)
+			threads.emplace_back([&, thread]() {
+				NitrogenScan scan(nitrogen, true, atomicDensities);
+				scan.algorithm.integralsRepository.reuseElectronElectronIntegrals = true;
+
+				int lastPoint = -1;
+
+				const auto computePoint = [&](unsigned int point, Systems::Molecule& molecule, GaussianIntegrals::IntegralsRepository* integrals) {
+					energies[point] = scan.ComputePoint(molecule, lastPoint >= 0 && abs(static_cast<int>(point) - lastPoint) == 1, integrals);
+					lastPoint = static_cast<int>(point);
+				};
+
+				// the atoms are not needed here, their tasks are skipped
+				if (0 == mode)
+				{
+					ScanScheduler::Task task;
+					while (scheduler.GetTask(thread, task))
+						if (ScanScheduler::TaskType::Point == task.type)
+						{
+							NitrogenScan::SetDistance(scan.nitrogen, task.position);
+							computePoint(task.point, scan.nitrogen, nullptr);
+						}
+				}
+				else
+				{
+					IntegralsPipeline pipeline;
+					pipeline.Start(scan.nitrogen, scan.algorithm.integralsRepository, scan.algorithm.integralsRepository.nrThreads, depth, [&scheduler, thread](ScanScheduler::Task& task) -> bool { return scheduler.GetTask(thread, task); }, NitrogenScan::SetDistance);
+
+					std::unique_ptr<IntegralsPipeline::Item> current;
+					for (;;)
+					{
+						const auto waitStart = std::chrono::high_resolution_clock::now();
+						auto item = pipeline.Pop();
+						waitTimes[thread] += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - waitStart).count();
+
+						if (!item) break;
+
+						if (ScanScheduler::TaskType::Point == item->task.type)
+						{
+							computePoint(item->task.point, item->molecule, &item->integrals);
+							current = std::move(item);
+						}
+					}
+				}
+			});
+
+		for (auto& thread : threads) thread.join();
+
+		const double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+		maxEnergyDifferences[mode] = MaxDifference(energies, serialEnergies);
+
+		file << (0 == mode ? "In sequence" : "Pipelined") << ": Points: " << nrPoints;
+		file.precision(4);
+		file << " Time: " << time << " s";
+
+		if (mode)
+		{
+			double maxWait = 0;
+			for (double wait : waitTimes) maxWait = max(maxWait, wait);
+
+			file << " Max SCF thread wait for integrals: " << maxWait << " s";
+		}
+
+		file.precision(6);
+		file << " Max energy difference to the serial scan: " << maxEnergyDifferences[mode] << std::endl;
+	}
+
+	// the integrals computed ahead must not change the energies
+	file << "\nDifferences, if there are any:" << std::endl;
+
+	bool same = CheckValue("In sequence, max energy difference", maxEnergyDifferences[0], 0, 1E-6, file);
+	same = CheckValue("Pipelined, max energy difference", maxEnergyDifferences[1], 0, 1E-6, file) && same;
+
+	if (same) file << "No differences!" << std::endl;
+}
+
+
+void Test::TestAdaptiveScan(const std::string& fileName, unsigned int nrThreads, double tolerance, double start, double end, unsigned int nrPoints)
+{
+	Systems::Molecule nitrogen;
+	BuildNitrogen(nitrogen, start);
+
+	const double step = (end - start) / nrPoints;
+
+	std::ofstream file(fileName);
+
+	HartreeFock::AtomicDensities atomicDensities;
+
+	std::vector<double> allEnergies;
+
+	// the max difference between the chart spline through the passed points and the energies computed for all of them
+	const auto curveError = [&](const std::vector<unsigned int>& points, const std::vector<double>& energies) -> double {
+		double maxError = 0;
+
+		for (size_t i = 0; i + 1 < points.size(); ++i)
+		{
+			const size_t prev = i > 0 ? i - 1 : i;
+			const size_t next = i + 2 < points.size() ? i + 2 : i + 1;
+
+			for (unsigned int point = points[i] + 1; point < points[i + 1]; ++point)
+			{
+				// the spline is parametric, the parameter for the bond length is found by bisection
+				const double position = start + step * point;
+
+				double tMin = 0;
+				double tMax = 1;
+				double x = 0;
+				double y = 0;
+				for (int j = 0; j < 60; ++j)
+				{
+					const double t = (tMin + tMax) / 2.;
+					ScanScheduler::GetSplinePoint(start + step * points[prev], energies[points[prev]], start + step * points[i], energies[points[i]], start + step * points[i + 1], energies[points[i + 1]], start + step * points[next], energies[points[next]], t, x, y);
+
+					if (x < position) tMin = t;
+					else tMax = t;
+				}
+
+				maxError = max(maxError, std::abs(y - allEnergies[point]));
+			}
+		}
+
+		return maxError;
+	};
+
+	int runs[2] = {};
+	double adaptiveError = 0;
+
+	for (int mode = 0; mode < 2; ++mode)
+	{
+		ScanScheduler scheduler;
+		scheduler.Init(start, step, nrPoints + 1, nrThreads, mode ? tolerance : 0);
+
+		std::vector<double> energies(nrPoints + 1);
+		std::atomic_int nrRuns(0);
+
+		const auto startTime = std::chrono::high_resolution_clock::now();
+
+		std::vector<std::thread> threads;
+		for (unsigned int thread = 0; thread < nrThreads; ++thread)
+			threads.emplace_back([&, thread]() {
+				NitrogenScan scan(nitrogen, true, atomicDensities);
+				scan.algorithm.integralsRepository.reuseElectronElectronIntegrals = true;
+
+				ScanScheduler::Task lastPoint = { ScanScheduler::TaskType::Point, 0, 0, 0 };
+
+				// the atoms are not needed here, they are done without computing them
+				ScanScheduler::Task task;
+				while (scheduler.GetTask(thread, task))
+				{
+					if (ScanScheduler::TaskType::Point != task.type)
+					{
+						scheduler.SetAtomResult(task.type, 0);
+						continue;
+					}
+
+					energies[task.point] = scan.ComputePoint(task.position, task.Follows(lastPoint));
+					lastPoint = task;
+					++nrRuns;
+
+					scheduler.SetPointResult(task.point, energies[task.point], scan.algorithm.HOMOEnergy, scan.algorithm.nrIterations, scan.algorithm.nrPolishingIterations);
+				}
+			});
+
+		for (auto& thread : threads) thread.join();
+
+		const double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+		std::vector<std::tuple<double, double, double>> results;
+		std::vector<std::tuple<double, int, int>> iterations;
+		scheduler.GetResults(results, iterations);
+
+		std::vector<unsigned int> points;
+		for (const auto& result : results)
+			points.push_back(static_cast<unsigned int>(floor((std::get<0>(result) - start) / step + 0.5)));
+
+		if (0 == mode) allEnergies = energies;
+
+		runs[mode] = nrRuns;
+
+		file << (0 == mode ? "All points" : "Adaptive") << ": SCF runs: " << nrRuns;
+		file.precision(4);
+		file << " Time: " << time << " s";
+
+		if (mode)
+		{
+			adaptiveError = curveError(points, energies);
+
+			file.precision(6);
+			file << " Max spline error: " << adaptiveError;
+
+			// the uniform grid with about as many points, through the computed energies
+			const unsigned int stride = max(1U, static_cast<unsigned int>(floor(static_cast<double>(nrPoints) / (points.size() - 1) + 0.5)));
+
+			std::vector<unsigned int> uniformPoints;
+			for (unsigned int point = 0; point <= nrPoints; point += stride) uniformPoints.push_back(point);
+			if (uniformPoints.back() != nrPoints) uniformPoints.push_back(nrPoints);
+
+			file << " Uniform grid with " << uniformPoints.size() << " points, max spline error: " << curveError(uniformPoints, allEnergies);
+		}
+
+		file << std::endl;
+	}
+
+	// the adaptive scan must follow the curve within the tolerance, with fewer SCF runs
+	file << "\nDifferences, if there are any:" << std::endl;
+
+	bool same = CheckLimit("Adaptive, max spline error", adaptiveError, tolerance, file);
+	same = CheckLimit("Adaptive, SCF runs", runs[1], runs[0] - 1, file) && same;
+
+	if (same) file << "No differences!" << std::endl;
 }
@@ -3,6 +3,14 @@
 #include "ChemUtils.h"
 #include "Basis.h"
 
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace HartreeFock {
+	class HartreeFockAlgorithm;
+}
+
 
 class Test
 {
@@ -10,17 +18,135 @@ public:
 	Test(const std::string& basisFile = "sto3g.txt");
 
 	static void OutputMatricesForAtom(const std::string& atomName, const std::string& basisSetName, const std::string& fileName);
-	static void OutputMatrices(Systems::Molecule& molecule, std::ofstream& file, const std::string& sfileName = "", const std::string& tfileName = "", const std::string& vfileName = "", const std::string& erifileName = "", bool useDIIS = false, const double expectedNucEnergy = 0);
+	static void OutputMatrices(Systems::Molecule& molecule, std::ofstream& file, const std::string& sfileName = "", const std::string& tfileName = "", const std::string& vfileName = "", const std::string& erifileName = "", bool useDIIS = false, const double expectedNucEnergy = 0, double primitivePairThreshold = 0);
 
 	static void CheckDifferences(const Eigen::MatrixXd& matrix, const std::string& matrixFileName, std::ofstream& file);
 	static void CheckDifferences(const GaussianIntegrals::IntegralsRepository& repo, const std::string& eriFileName, std::ofstream& file);
 
-	void TestWater(const std::string& fileName, const std::string& sfileName = "", const std::string& tfileName = "", const std::string& vfileName = "", const std::string& erifileName = "", bool useDIIS = false);
-	void TestMethane(const std::string& fileName, const std::string& sfileName = "", const std::string& tfileName = "", const std::string& vfileName = "", const std::string& erifileName = "", bool useDIIS = false);
+	// writes the difference if the value is not within the tolerance of the expected one, or if it is over the limit, returns true if it's fine
+	static bool CheckValue(const std::string& name, double value, double expected, double tolerance, std::ofstream& file);
+	static bool CheckLimit(const std::string& name, double value, double limit, std::ofstream& file);
+
+	// with a primitive pairs screening threshold the results should still match the reference data, within the checking tolerance
+	void TestWater(const std::string& fileName, const std::string& sfileName = "", const std::string& tfileName = "", const std::string& vfileName = "", const std::string& erifileName = "", bool useDIIS = false, double primitivePairThreshold = 0);
+	static void TestBoysFunctions(const std::string& fileName);
+
+	void TestMethane(const std::string& fileName, const std::string& sfileName = "", const std::string& tfileName = "", const std::string& vfileName = "", const std::string& erifileName = "", bool useDIIS = false, double primitivePairThreshold = 0);
+
+	// compares the integral direct SCF, with full and incremental Fock matrix builds, with the one on the stored integrals, for water in the basis set the test was constructed with
+	// the energies must match and the integral direct modes must not need more than a few iterations more
+	void TestIntegralDirect(const std::string& fileName, double schwarzThreshold = 1E-12);
+
+	// benchmarks the Fock matrix build on the unique stored integrals and the one with matrix products on the unpacked integrals
+	// against the loop over all i, j, k, l, for converged water
+	void TestFockBuild(const std::string& fileName, int nrBuilds = 10);
+
+	// counts the heap allocations of the steady state iterations, for converged water, restricted and unrestricted, with the unpacked integrals (the default) and the unique ones
+	// the iterations are done as in a calculation, with DIIS and the Fock matrix build on the configured number of threads
+	// the counting uses the debug heap hook, so it works only in debug builds, otherwise the allocations are reported as not measured
+	void TestStepAllocations(const std::string& fileName, int nrSteps = 10);
+
+	// iterations to convergence with the DIIS extrapolation for water, methane and the oxygen molecule
+	// and the nitrogen molecule in STO-3G and 6-31G where DIIS converges to a saddle point, the polishing has to leave it, without and with the stability check
+	// each result is checked against the reference energy and iterations bound
+	void TestDIIS(const std::string& fileName);
+
+	// iterations to convergence at the points of the nitrogen molecule dissociation curve, with DIIS and with EDIIS for the first iterations
+	// checked against the reference energies and iterations bounds for the default points, for other points only the convergence is checked
+	void TestEDIIS(const std::string& fileName, int nrPoints = 10);
+
+	// iterations and Fock matrix builds to convergence with DIIS, with the second order solver instead and with it finishing a stagnated DIIS
+	// for water, methane, the oxygen molecule and the stretched nitrogen molecule, the oxygen molecule must need fewer Fock builds with the second order solver
+	// each result is checked against the reference energy and iterations bound, the stretched nitrogen molecule with restricted DIIS must not converge
+	void TestSecondOrder(const std::string& fileName);
+
+	// iterations to convergence starting from the initGuess Fock matrix and from the superposition of atomic densities
+	// for water, methane, the oxygen molecule and the nitrogen molecule at a few bond lengths
+	// each result is checked against the reference energy and iterations bound
+	void TestSAD(const std::string& fileName);
+
+	// Fock matrix builds to convergence in the test basis starting from the superposition of atomic densities
+	// and from the densities projected from a calculation in the small basis, with the builds done there
+	// the projected start must get to the same energy without more Fock builds in the test basis
+	void TestBasisProjection(const std::string& fileName, const std::string& smallBasisFile = "sto3g.txt");
+
+	// SCF iterations and Fock matrix builds along the nitrogen molecule dissociation curve
+	// for each point started from scratch and started from the previous points, without extrapolation, with the linear and with the Grassmann one
+	// the warm started scans must converge in fewer iterations than the ones from scratch, to energies that are not higher
+	void TestWarmStart(const std::string& fileName, double start = 1.6, double end = 4., double step = 0.1);
+
+	// wall time of the restricted nitrogen molecule dissociation scan on nrThreads threads, warm started
+	// with the range split in equal intervals, the atoms on the first and the last thread, and with the points and atoms pulled from the scan scheduler
+	// the energies must match the ones of the serial scan, restricted because the unrestricted scan can end up on other states when started elsewhere
+	void TestScanScheduler(const std::string& fileName, unsigned int nrThreads = 4, double start = 1.6, double end = 6., double step = 0.1);
+
+	// time of the electron-electron integrals along the nitrogen molecule dissociation and along the symmetric stretch of water, with the oxygen fixed
+	// computed from scratch for each point and with the unchanged quartets kept from the previous point, the integrals must match
+	void TestIntegralsReuse(const std::string& fileName, int nrPoints = 10, double schwarzThreshold = 1E-11);
+
+	// wall time of the restricted nitrogen molecule dissociation scan on nrThreads threads, warm started
+	// with the integrals and the SCF of each point done in sequence and with the integrals of the next points computed on a second thread, depth of them ahead
+	// the energies must match the ones of the serial scan
+	void TestIntegralsPipeline(const std::string& fileName, unsigned int nrThreads = 2, unsigned int depth = 1, double start = 1.6, double end = 4., double step = 0.1);
+
+	// the restricted nitrogen molecule dissociation scan on nrPoints + 1 points, all of them computed and with the adaptive sampling
+	// compares the number of SCF runs and the max error of the chart spline against the fully computed curve, also for the uniform grid with about as many points as the adaptive scan
+	// the adaptive scan must have fewer SCF runs and the error within the tolerance, the default range ends before the restricted solutions cross at about 2.77 bohr, a kink the error estimate cannot see
+	void TestAdaptiveScan(const std::string& fileName, unsigned int nrThreads = 2, double tolerance = 1E-4, double start = 1.6, double end = 2.6, unsigned int nrPoints = 128);
 
 protected:
 	static void OutputMatrix(const Eigen::MatrixXd& matrix, std::ofstream& file);
 
+	// the allocations and the time of nrSteps DIIS steps for an already converged algorithm, returns false if the allocations cannot be counted
+	static bool CountStepAllocations(HartreeFock::HartreeFockAlgorithm& algorithm, int nrSteps, unsigned long long int& allocations, double& time);
+
+	// what the SCF tests write and check for a calculation
+	struct CalculationResult
+	{
+		double energy;
+		bool converged;
+		int iterations;
+		int polishingIterations;
+		int fockBuilds;
+		bool diisStagnated;
+		double time;
+	};
+
+	// the restricted or the unrestricted calculation with DIIS from the core Hamiltonian guess, setup can change the settings before Init
+	static CalculationResult RunCalculation(Systems::Molecule& molecule, bool restricted, const std::function<void(HartreeFock::HartreeFockAlgorithm&)>& setup = nullptr);
+	static void OutputResult(const std::string& name, const CalculationResult& result, std::ofstream& file);
+
+	// the expected energy and the iterations bound, 0 for a calculation that does not converge in the iterations of the algorithm
+	struct Reference
+	{
+		double energy;
+		int maxIterations;
+	};
+
+	struct CheckedResult
+	{
+		std::string name;
+		CalculationResult result;
+		Reference reference;
+		bool checkReference;
+	};
+
+	// the results must be converged, the ones checked against the reference to the expected energy within 1E-6 Hartree in at most maxIterations
+	// writes the differences, returns true if there are none
+	static bool CheckResults(const std::vector<CheckedResult>& results, std::ofstream& file);
+
+	void BuildWater(Systems::Molecule& molecule) const;
+	void BuildMethane(Systems::Molecule& molecule) const;
+	void BuildOxygen(Systems::Molecule& molecule) const;
+
+	// along the x axis, centered in the origin, in the basis of the test or in the passed one
+	void BuildNitrogen(Systems::Molecule& molecule, double distance) const;
+	static void BuildNitrogen(const Chemistry::Basis& basis, Systems::Molecule& molecule, double distance);
+
+	// the reference energies and iterations of the SCF tests are for 6-31++G**, the basis they are run with, for another one only the convergence is checked
+	bool ReferenceBasis() const { return "6-31++g_st__st_.1.nw" == basisFile; }
+
+	std::string basisFile;
 	Chemistry::Basis basis;
 };
 
@@ -6,7 +6,7 @@ namespace HartreeFock {
 
 
 	UnrestrictedHartreeFock::UnrestrictedHartreeFock(int iterations)
-		: HartreeFockAlgorithm(iterations), nrOccupiedLevelsPlus(0), nrOccupiedLevelsMinus(0), addAsymmetry(true), asymmetry(0.1)
+		: HartreeFockAlgorithm(iterations), nrOccupiedLevelsPlus(0), nrOccupiedLevelsMinus(0), asymmetry(0.1), addAsymmetry(true), jointDIIS(true)
 	{
 	}
 
@@ -20,8 +20,19 @@ namespace HartreeFock {
 		HartreeFockAlgorithm::Init(molecule);
 
 
-		DensityMatrixPlus = Eigen::MatrixXd::Zero(h.rows(), h.cols());
-		DensityMatrixMinus = Eigen::MatrixXd::Zero(h.rows(), h.cols());
+		if (densityGuess && initialDensities.size() > 1)
+		{
+			DensityMatrixPlus = initialDensities[0];
+			DensityMatrixMinus = initialDensities[1];
+		}
+		else if (densityGuess)
+			DensityMatrixPlus = DensityMatrixMinus = 0.5 * initialDensities[0];
+		else
+		{
+			DensityMatrixPlus = Eigen::MatrixXd::Zero(h.rows(), h.cols());
+			DensityMatrixMinus = Eigen::MatrixXd::Zero(h.rows(), h.cols());
+		}
+		Gplus.resize(0, 0);
 
 		occupiedPlus.resize(0);
 		occupiedMinus.resize(0);
@@ -56,106 +67,62 @@ namespace HartreeFock {
 
 		occupiedPlus.resize(nrOccupiedLevelsPlus, true);
 		occupiedMinus.resize(nrOccupiedLevelsMinus, true);
+
+		if (jointDIIS) diis.Clear(2);
+		else
+		{
+			// the energy does not split between the spins, so EDIIS is only for the joint extrapolation
+			diisMinus.maxSize = diis.maxSize;
+			diisMinus.minSize = diis.minSize;
+			diisMinus.maxConditionNumber = diis.maxConditionNumber;
+			diisMinus.Clear();
+		}
 	}
 
 
 	bool UnrestrictedHartreeFock::DIISStep(int iter, Eigen::MatrixXd& FockMatrixPlus, Eigen::MatrixXd& FockMatrixMinus)
 	{
-		bool UsedDIIS = false;
-
 		if (UseDIIS && iter && iter < maxDIISiterations)
 		{
-			const Eigen::MatrixXd errorMatrixPlus = overlapMatrix.matrix * DensityMatrixPlus * FockMatrixPlus - FockMatrixPlus * DensityMatrixPlus * overlapMatrix.matrix;
+			CalculateDIISErrorMatrix(workspacePlus, FockMatrixPlus, DensityMatrixPlus);
+			CalculateDIISErrorMatrix(workspaceMinus, FockMatrixMinus, DensityMatrixMinus);
 
-			errorMatricesPlus.emplace_back(errorMatrixPlus);
-			fockMatricesPlus.push_back(FockMatrixPlus);
+			Eigen::MatrixXd* const fock[] = { &FockMatrixPlus, &FockMatrixMinus };
+			const Eigen::MatrixXd* const error[] = { &workspacePlus.errorMatrix, &workspaceMinus.errorMatrix };
+			const Eigen::MatrixXd* const density[] = { &DensityMatrixPlus, &DensityMatrixMinus };
 
-			const Eigen::MatrixXd errorMatrixMinus = overlapMatrix.matrix * DensityMatrixMinus * FockMatrixMinus - FockMatrixMinus * DensityMatrixMinus * overlapMatrix.matrix;
+			bool UsedDIIS;
+			if (jointDIIS)
+			{
+				// EDIIS needs the energy for the densities the Fock matrices were built from
+				const double energy = diis.useEDIIS ? 0.5 * (DensityMatrixPlus.cwiseProduct(h).sum() + DensityMatrixPlus.cwiseProduct(FockMatrixPlus).sum() +
+					DensityMatrixMinus.cwiseProduct(h).sum() + DensityMatrixMinus.cwiseProduct(FockMatrixMinus).sum()) : 0;
 
-			errorMatricesMinus.emplace_back(errorMatrixMinus);
-			fockMatricesMinus.push_back(FockMatrixMinus);
+				// a single set of coefficients for both spins, minimizing the sum of the errors
+				UsedDIIS = diis.Step(fock, error, density, energy);
 
-			if (errorMatricesPlus.size() > 6)
-			{
-				errorMatricesPlus.pop_front();
-				fockMatricesPlus.pop_front();
-				errorMatricesMinus.pop_front();
-				fockMatricesMinus.pop_front();
+				lastErrorEst = diis.GetErrorEstimate();
 			}
-
-			if (errorMatricesPlus.size() > 4)
+			else
 			{
-				// use DIIS
-				const size_t nrMatrices = errorMatricesPlus.size();
-				Eigen::MatrixXd Bplus = Eigen::MatrixXd::Zero(nrMatrices + 1, nrMatrices + 1);
-				Eigen::MatrixXd Bminus = Eigen::MatrixXd::Zero(nrMatrices + 1, nrMatrices + 1);
-
-				auto errorPlusIter1 = errorMatricesPlus.begin();
-				auto errorMinusIter1 = errorMatricesMinus.begin();
-
-				lastErrorEst = 0;
-
-				for (size_t i = 0; i < nrMatrices; ++i)
-				{
-					auto errorPlusIter2 = errorMatricesPlus.begin();
-					auto errorMinusIter2 = errorMatricesMinus.begin();
-
-					for (size_t j = 0; j < i; ++j)
-					{
-						Bplus(i, j) = Bplus(j, i) = (*errorPlusIter1).cwiseProduct(*errorPlusIter2).sum();
-						Bminus(i, j) = Bminus(j, i) = (*errorMinusIter1).cwiseProduct(*errorMinusIter2).sum();
-
-						++errorPlusIter2;
-						++errorMinusIter2;
-					}
-
-					Bplus(i, i) = (*errorPlusIter1).cwiseProduct(*errorPlusIter1).sum();
-					Bminus(i, i) = (*errorMinusIter1).cwiseProduct(*errorMinusIter1).sum();
-
-					if (i == nrMatrices - 1 || i == nrMatrices - 2) lastErrorEst += Bplus(i, i) + Bminus(i, i);
-
-					Bplus(nrMatrices, i) = Bplus(i, nrMatrices) = 1;
-					Bminus(nrMatrices, i) = Bminus(i, nrMatrices) = 1;
-
-					++errorPlusIter1;
-					++errorMinusIter1;
-				}
-
-				lastErrorEst = sqrt(lastErrorEst);
-
-
-				// Solve the systems of linear equations
+				const bool UsedDIISPlus = diis.Step(fock, error);
+				const bool UsedDIISMinus = diisMinus.Step(fock + 1, error + 1);
+				UsedDIIS = UsedDIISPlus || UsedDIISMinus;
 
-				Eigen::VectorXd CPlusDIIS = Eigen::VectorXd::Zero(nrMatrices + 1);
-				CPlusDIIS(nrMatrices) = 1;
-				Eigen::VectorXd CMinusDIIS = Eigen::VectorXd::Zero(nrMatrices + 1);
-				CMinusDIIS(nrMatrices) = 1;
-
-				CPlusDIIS = Bplus.colPivHouseholderQr().solve(CPlusDIIS);
-				CMinusDIIS = Bminus.colPivHouseholderQr().solve(CMinusDIIS);
-
-				// compute the new Fock matrices
-
-				FockMatrixPlus = Eigen::MatrixXd::Zero(FockMatrixPlus.rows(), FockMatrixPlus.cols());
-				FockMatrixMinus = Eigen::MatrixXd::Zero(FockMatrixMinus.rows(), FockMatrixMinus.cols());
-
-				auto fockIterPlus = fockMatricesPlus.begin();
-				auto fockIterMinus = fockMatricesMinus.begin();
-				for (size_t i = 0; i < nrMatrices; ++i)
-				{
-					FockMatrixPlus += CPlusDIIS(i) * (*fockIterPlus);
-					FockMatrixMinus += CMinusDIIS(i) * (*fockIterMinus);
-
-					++fockIterPlus;
-					++fockIterMinus;
-				}
-
-				UsedDIIS = true;
+				lastErrorEst = sqrt(diis.GetErrorEstimate() * diis.GetErrorEstimate() + diisMinus.GetErrorEstimate() * diisMinus.GetErrorEstimate());
 			}
+
+			return UsedDIIS;
+		}
+		else if (polishing && iter)
+		{
+			CalculateDIISErrorMatrix(workspacePlus, FockMatrixPlus, DensityMatrixPlus);
+			CalculateDIISErrorMatrix(workspaceMinus, FockMatrixMinus, DensityMatrixMinus);
+			lastErrorEst = sqrt(workspacePlus.errorMatrix.squaredNorm() + workspaceMinus.errorMatrix.squaredNorm());
 		}
 		else lastErrorEst = 0;
 
-		return UsedDIIS;
+		return false;
 	}
 
 
@@ -163,9 +130,9 @@ namespace HartreeFock {
 	{
 		// *****************************************************************************************************************
 
-		// the Fock matrices
-		Eigen::MatrixXd FockMatrixPlus;
-		Eigen::MatrixXd FockMatrixMinus;
+		// the Fock matrices, the matrices used by the step are in the workspaces, reused between the iterations
+		Eigen::MatrixXd& FockMatrixPlus = workspacePlus.FockMatrix;
+		Eigen::MatrixXd& FockMatrixMinus = workspaceMinus.FockMatrix;
 
 		InitFockMatrices(iter, FockMatrixPlus, FockMatrixMinus);
 
@@ -177,37 +144,9 @@ namespace HartreeFock {
 
 		// solve the Pople-NesbetBerthier equations
 
-		 // orthogonalize
-		const Eigen::MatrixXd FockMatrixPlusTransformed = Vt * FockMatrixPlus * V;
-		const Eigen::MatrixXd FockMatrixMinusTransformed = Vt * FockMatrixMinus * V;
-
-		if (FockMatrixPlusTransformed.rows() > 1)
-		{
-			Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> esplus(FockMatrixPlusTransformed);
-			eigenvalsplus = esplus.eigenvalues();
-			const Eigen::MatrixXd& Cplusprime = esplus.eigenvectors();
-
-			Cplus = V * Cplusprime; // transform back the eigenvectors into the original non-orthogonalized AO basis
-		}
-		else
-		{
-			eigenvalsplus = FockMatrixPlusTransformed(0, 0) * Eigen::VectorXd::Ones(1);
-			Cplus = V * Eigen::MatrixXd::Ones(1, 1);
-		}
-
-		if (FockMatrixMinusTransformed.rows() > 1)
-		{
-			Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> esminus(FockMatrixMinusTransformed);
-			eigenvalsminus = esminus.eigenvalues();
-			const Eigen::MatrixXd& Cminusprime = esminus.eigenvectors();
-
-			Cminus = V * Cminusprime; // transform back the eigenvectors into the original non-orthogonalized AO basis
-		}
-		else
-		{
-			eigenvalsminus = FockMatrixMinusTransformed(0, 0) * Eigen::VectorXd::Ones(1);
-			Cminus = V * Eigen::MatrixXd::Ones(1, 1);
-		}
+		// orthogonalize, diagonalize and transform back the eigenvectors into the original non-orthogonalized AO basis
+		SolveFockEquation(workspacePlus, eigenvalsplus, Cplus);
+		SolveFockEquation(workspaceMinus, eigenvalsminus, Cminus);
 
 		// normalize them - in some rare cases it seems to help
 		//NormalizeC(Cplus, occupiedPlus);
@@ -215,64 +154,76 @@ namespace HartreeFock {
 
 		//***************************************************************************************************************
 
-		// calculate the density matrices
-
-		Eigen::MatrixXd newDensityMatrixPlus = Eigen::MatrixXd::Zero(h.rows(), h.cols());
-		Eigen::MatrixXd newDensityMatrixMinus = Eigen::MatrixXd::Zero(h.rows(), h.cols());
-
-		for (int i = 0; i < h.rows(); ++i)
-			for (int j = 0; j < h.cols(); ++j)
-			{
-				for (unsigned int vec = 0; vec < occupiedPlus.size(); ++vec) // only eigenstates that are occupied 
-					if (occupiedPlus[vec]) newDensityMatrixPlus(i, j) += Cplus(i, vec) * Cplus(j, vec);
+		// calculate the density matrices, only eigenstates that are occupied
 
-				for (unsigned int vec = 0; vec < occupiedMinus.size(); ++vec) // only eigenstates that are occupied 
-					if (occupiedMinus[vec]) newDensityMatrixMinus(i, j) += Cminus(i, vec) * Cminus(j, vec);
-			}
+		CalculateDensityMatrix(workspacePlus, Cplus, occupiedPlus, 1.);
+		CalculateDensityMatrix(workspaceMinus, Cminus, occupiedMinus, 1.);
 
 		//**************************************************************************************************************
 
-		CalculateEnergy(eigenvalsplus, eigenvalsminus, newDensityMatrixPlus, newDensityMatrixMinus/*, Fplus, Fminus*/);
+		// the energy, the rms for differences between new and old density matrices (it can be used to check for convergence, too)
+		// and going to the next density matrices, using mixing if alpha is set less then one
+		// not mixed with an initial guess density, that one is not the result of a step
+		const double rmsD = UpdateDensityMatrices(!UsedDIIS && !(densityGuess && 0 == iter));
 
 		TRACE("Step: %d Energy: %f\n", iter, totalEnergy);
 
-		// calculate rms for differences between new and old density matrices, it can be used to check for convergence, too
-		Eigen::MatrixXd rmsDensityMatricesDif = newDensityMatrixPlus - DensityMatrixPlus;
-		rmsDensityMatricesDif = rmsDensityMatricesDif.cwiseProduct(rmsDensityMatricesDif);
-		double rmsD = rmsDensityMatricesDif.sum();
+		return rmsD;
+	}
 
-		rmsDensityMatricesDif = newDensityMatrixMinus - DensityMatrixMinus;
-		rmsDensityMatricesDif = rmsDensityMatricesDif.cwiseProduct(rmsDensityMatricesDif);
-		rmsD += rmsDensityMatricesDif.sum();
 
-		rmsD = sqrt(rmsD);
+	double UnrestrictedHartreeFock::UpdateDensityMatrices(bool mix)
+	{
+		const Eigen::MatrixXd& newDensityMatrixPlus = workspacePlus.newDensityMatrix;
+		const Eigen::MatrixXd& newDensityMatrixMinus = workspaceMinus.newDensityMatrix;
 
-		// ***************************************************************************************************
-		// go to the next density matrices
-		// use mixing if alpha is set less then one
-		
-		if (UsedDIIS)
-		{
-			DensityMatrixPlus = newDensityMatrixPlus;
-			DensityMatrixMinus = newDensityMatrixMinus;
-		}
-		else
-		{
-			DensityMatrixPlus = alpha * newDensityMatrixPlus + (1. - alpha) * DensityMatrixPlus;
-			DensityMatrixMinus = alpha * newDensityMatrixMinus + (1. - alpha) * DensityMatrixMinus;
-		}
+		// see CalculateEnergy, it's the same thing
+		double energy = 0;
+		double rms = 0;
 
-		return rmsD;
+		for (int j = 0; j < h.cols(); ++j)
+			for (int i = 0; i < h.rows(); ++i)
+			{
+				const double newValuePlus = newDensityMatrixPlus(i, j);
+				const double newValueMinus = newDensityMatrixMinus(i, j);
+				const double oldValuePlus = DensityMatrixPlus(i, j);
+				const double oldValueMinus = DensityMatrixMinus(i, j);
+
+				energy += (newValuePlus + newValueMinus) * h(i, j);
+
+				const double difPlus = newValuePlus - oldValuePlus;
+				const double difMinus = newValueMinus - oldValueMinus;
+				rms += difPlus * difPlus + difMinus * difMinus;
+
+				if (mix)
+				{
+					DensityMatrixPlus(i, j) = alpha * newValuePlus + (1. - alpha) * oldValuePlus;
+					DensityMatrixMinus(i, j) = alpha * newValueMinus + (1. - alpha) * oldValueMinus;
+				}
+				else
+				{
+					DensityMatrixPlus(i, j) = newValuePlus;
+					DensityMatrixMinus(i, j) = newValueMinus;
+				}
+			}
+
+		for (unsigned int level = 0; level < occupiedPlus.size(); ++level)
+			if (occupiedPlus[level]) energy += eigenvalsplus(level);
+		for (unsigned int level = 0; level < occupiedMinus.size(); ++level)
+			if (occupiedMinus[level]) energy += eigenvalsminus(level);
+
+		HOMOEnergy = max(nrOccupiedLevelsPlus ? eigenvalsplus(nrOccupiedLevelsPlus - 1) : 0, nrOccupiedLevelsMinus ? eigenvalsminus(nrOccupiedLevelsMinus - 1) : 0);
+
+		totalEnergy = 0.5 * energy + nuclearRepulsionEnergy;
+
+		return sqrt(rms);
 	}
 
-	void UnrestrictedHartreeFock::InitFockMatrices(int iter, Eigen::MatrixXd& FockMatrixPlus, Eigen::MatrixXd& FockMatrixMinus) const
+	void UnrestrictedHartreeFock::InitFockMatrices(int iter, Eigen::MatrixXd& FockMatrixPlus, Eigen::MatrixXd& FockMatrixMinus)
 	{
-		// this could be made faster knowing that the matrix should be symmetric
-		// but it would be less expressive so I'll let it as it is
-		// maybe I'll improve it later
-		// anyway, the slower part is dealing with electron-electron integrals
+		// see the comment in RestrictedHartreeFock::InitFockMatrix about how G is computed
 
-		if (0 == iter)
+		if (0 == iter && !densityGuess)
 		{
 			if (initGuess > 0)
 			{
@@ -297,27 +248,113 @@ namespace HartreeFock {
 		}
 		else
 		{
-			Eigen::MatrixXd Gplus = Eigen::MatrixXd::Zero(h.rows(), h.cols());
-			Eigen::MatrixXd Gminus = Eigen::MatrixXd::Zero(h.rows(), h.cols());
+			// each unique electron-electron integral is used once, either from the stored ones or computed again on the fly in the integral direct mode
+			// in the direct mode the build can be incremental: G is linear in the densities, so only the density changes are contracted and the results are added to the previous ones
+			// the stored integrals do not get cheaper for a small density change, so for them it's always a full build
+			const bool fullBuild = !integralsRepository.integralDirect || FullFockBuild() || Gplus.rows() != h.rows();
+			if (fullBuild)
+				deltaDensity = DensityMatrixPlus + DensityMatrixMinus;
+			else
+			{
+				deltaDensityPlus = DensityMatrixPlus - GDensityMatrixPlus;
+				deltaDensityMinus = DensityMatrixMinus - GDensityMatrixMinus;
+				deltaDensity = deltaDensityPlus + deltaDensityMinus;
+			}
+
+			// the alpha electrons interact with the beta ones with coulomb interaction, too, and the other way around
+			// so the Coulomb matrix is needed only for the total density, it's computed in the same pass with the exchange ones for each spin
+			coulombDensities.assign(1, &deltaDensity);
+			exchangeDensities.resize(2);
+			exchangeDensities[0] = fullBuild ? &DensityMatrixPlus : &deltaDensityPlus;
+			exchangeDensities[1] = fullBuild ? &DensityMatrixMinus : &deltaDensityMinus;
 
-			for (int i = 0; i < numberOfOrbitals; ++i)
-				for (int j = 0; j < numberOfOrbitals; ++j)
-					for (int k = 0; k < numberOfOrbitals; ++k)
-						for (int l = 0; l < numberOfOrbitals; ++l)
-						{
-							double coulomb = integralsRepository.getElectronElectron(i, j, k, l);
-							double exchange = integralsRepository.getElectronElectron(i, l, k, j);
+			// the screening errors of the incremental builds add up until the next full one, the threshold is lowered to compensate
+			integralsRepository.CalculateCoulombAndExchange(coulombDensities, exchangeDensities, coulomb, exchange, fullBuild ? 1. : 1. / fullFockBuildInterval);
 
-							Gplus(i, j) += DensityMatrixPlus(k, l) * (coulomb - exchange) + DensityMatrixMinus(k, l) * coulomb; // the beta electrons interact with the alpha ones with coulomb interaction, too
-							Gminus(i, j) += DensityMatrixMinus(k, l) * (coulomb - exchange) + DensityMatrixPlus(k, l) * coulomb; // the alpha electrons interact with the beta ones with coulomb interaction, too
-						}
+			const Eigen::MatrixXd& J = coulomb[0];
+
+			if (fullBuild)
+			{
+				Gplus = J - exchange[0];
+				Gminus = J - exchange[1];
+			}
+			else
+			{
+				Gplus += J - exchange[0];
+				Gminus += J - exchange[1];
+			}
+
+			++nrFockBuilds;
+
+			GDensityMatrixPlus = DensityMatrixPlus;
+			GDensityMatrixMinus = DensityMatrixMinus;
 
 			FockMatrixPlus = h + Gplus;
 			FockMatrixMinus = h + Gminus;
+
+			// the same alpha and beta densities would stay the same, as for the initGuess Fock matrices
+			if (0 == iter && addAsymmetry && 1 == initialDensities.size() && FockMatrixPlus.cols() > 1)
+			{
+				FockMatrixPlus(0, 1) += asymmetry;
+				FockMatrixPlus(1, 0) = FockMatrixPlus(0, 1);
+			}
 		}
 	}
 
 
+	void UnrestrictedHartreeFock::GetSpinChannels(std::vector<SpinChannel>& channels)
+	{
+		channels.resize(2);
+
+		channels[0].C = &Cplus;
+		channels[0].eigenvals = &eigenvalsplus;
+		channels[0].DensityMatrix = &DensityMatrixPlus;
+		channels[0].occupied = &occupiedPlus;
+		channels[0].occupation = 1.;
+
+		channels[1].C = &Cminus;
+		channels[1].eigenvals = &eigenvalsminus;
+		channels[1].DensityMatrix = &DensityMatrixMinus;
+		channels[1].occupied = &occupiedMinus;
+		channels[1].occupation = 1.;
+	}
+
+	void UnrestrictedHartreeFock::CalculateFockMatrices(std::vector<Eigen::MatrixXd>& fockMatrices)
+	{
+		// as in InitFockMatrices, the Coulomb matrix only for the total density
+		deltaDensity = DensityMatrixPlus + DensityMatrixMinus;
+
+		coulombDensities.assign(1, &deltaDensity);
+		exchangeDensities.resize(2);
+		exchangeDensities[0] = &DensityMatrixPlus;
+		exchangeDensities[1] = &DensityMatrixMinus;
+
+		integralsRepository.CalculateCoulombAndExchange(coulombDensities, exchangeDensities, coulomb, exchange);
+
+		fockMatrices.resize(2);
+		fockMatrices[0] = h + coulomb[0] - exchange[0];
+		fockMatrices[1] = h + coulomb[0] - exchange[1];
+
+		totalEnergy = 0.5 * (DensityMatrixPlus.cwiseProduct(h).sum() + DensityMatrixPlus.cwiseProduct(fockMatrices[0]).sum() +
+			DensityMatrixMinus.cwiseProduct(h).sum() + DensityMatrixMinus.cwiseProduct(fockMatrices[1]).sum()) + nuclearRepulsionEnergy;
+	}
+
+	void UnrestrictedHartreeFock::CalculateResponseFockMatrices(const std::vector<Eigen::MatrixXd>& deltaDensities, std::vector<Eigen::MatrixXd>& response)
+	{
+		deltaDensity = deltaDensities[0] + deltaDensities[1];
+
+		coulombDensities.assign(1, &deltaDensity);
+		exchangeDensities.resize(2);
+		exchangeDensities[0] = &deltaDensities[0];
+		exchangeDensities[1] = &deltaDensities[1];
+
+		integralsRepository.CalculateCoulombAndExchange(coulombDensities, exchangeDensities, coulomb, exchange);
+
+		response.resize(2);
+		response[0] = coulomb[0] - exchange[0];
+		response[1] = coulomb[0] - exchange[1];
+	}
+
 	void UnrestrictedHartreeFock::CalculateEnergy(const Eigen::VectorXd& eigenvalsPlus, const Eigen::VectorXd& eigenvalsMinus, const Eigen::MatrixXd& calcDensityMatrixPlus, const Eigen::MatrixXd& calcDensityMatrixMinus/*, const Eigen::MatrixXd& Fplus, const Eigen::MatrixXd& Fminus*/)
 	{
 		totalEnergy = 0;
@@ -373,6 +410,9 @@ namespace HartreeFock {
 
 		// TODO: calculate it
 
+		// the integral direct mode does not have them stored, but they are needed here
+		if (!integralsRepository.HasElectronElectronIntegrals()) integralsRepository.CalculateElectronElectronIntegrals(true);
+
 		GaussianIntegrals::MP2MolecularOrbitalsIntegralsRepository MP2repo(integralsRepository);
 
 		for (int i = 0; i < numberOfOrbitals; ++i)
@@ -8,14 +8,32 @@ namespace HartreeFock {
 	{
 		friend class Test;
 	protected:
-		std::list<Eigen::MatrixXd> errorMatricesPlus;
-		std::list<Eigen::MatrixXd> errorMatricesMinus;
+		// for the beta Fock matrix, if it's extrapolated separately
+		DIIS diisMinus;
 
-		std::list<Eigen::MatrixXd> fockMatricesPlus;
-		std::list<Eigen::MatrixXd> fockMatricesMinus;
+		// the electron-electron parts of the Fock matrices and the densities they were built with, for the incremental integral direct Fock matrix builds
+		Eigen::MatrixXd Gplus;
+		Eigen::MatrixXd Gminus;
+		Eigen::MatrixXd GDensityMatrixPlus;
+		Eigen::MatrixXd GDensityMatrixMinus;
+		Eigen::MatrixXd deltaDensityPlus;
+		Eigen::MatrixXd deltaDensityMinus;
+		Eigen::MatrixXd deltaDensity;
+
+		StepWorkspace workspacePlus;
+		StepWorkspace workspaceMinus;
 
 		void CalculateEnergy(const Eigen::VectorXd& eigenvalsplus, const Eigen::VectorXd& eigenvalsminus, const Eigen::MatrixXd& calcDensityMatrixPlus, const Eigen::MatrixXd& calcDensityMatrixMinus/*, const Eigen::MatrixXd& Fplus, const Eigen::MatrixXd& Fminus*/);
-		void InitFockMatrices(int iter, Eigen::MatrixXd& FockMatrixPlus, Eigen::MatrixXd& FockMatrixMinus) const;
+
+		// computes the energy for the new density matrices from the workspaces and the rms of their differences from the current ones
+		// then replaces the current ones with them or mixes them, all in a single pass over the matrices, returns the rms
+		double UpdateDensityMatrices(bool mix);
+		void InitFockMatrices(int iter, Eigen::MatrixXd& FockMatrixPlus, Eigen::MatrixXd& FockMatrixMinus);
+
+		// for the second order solver
+		virtual void GetSpinChannels(std::vector<SpinChannel>& channels) override;
+		virtual void CalculateFockMatrices(std::vector<Eigen::MatrixXd>& fockMatrices) override;
+		virtual void CalculateResponseFockMatrices(const std::vector<Eigen::MatrixXd>& deltaDensities, std::vector<Eigen::MatrixXd>& response) override;
 	public:
 		Eigen::MatrixXd DensityMatrixPlus;
 		Eigen::MatrixXd DensityMatrixMinus;
@@ -32,6 +50,9 @@ namespace HartreeFock {
 		double asymmetry;
 		bool addAsymmetry;
 
+		// extrapolate the alpha and beta Fock matrices together, with the same coefficients, instead of each one on its own
+		bool jointDIIS;
+
 		// results that might be needed in the end, after the last step
 		Eigen::VectorXd eigenvalsplus;
 		Eigen::VectorXd eigenvalsminus;
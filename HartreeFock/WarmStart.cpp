@@ -0,0 +1,178 @@
+#include "stdafx.h"
+#include "WarmStart.h"
+
+#include "HartreeFockAlgorithm.h"
+
+#include <cmath>
+
+
+namespace HartreeFock {
+
+	WarmStart::WarmStart()
+		: extrapolation(0)
+	{
+	}
+
+
+	void WarmStart::Clear()
+	{
+		points.clear();
+	}
+
+
+	void WarmStart::Add(HartreeFockAlgorithm& algorithm)
+	{
+		Point point;
+		algorithm.GetOccupiedOrbitals(point.orbitals, point.occupations);
+		point.softRotations = algorithm.softRotations;
+		point.softestCurvature = algorithm.softestCurvature;
+
+		const Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(algorithm.GetOverlapMatrix());
+		const Eigen::MatrixXd sqrtOverlap = solver.operatorSqrt();
+
+		point.orthonormalOrbitals.reserve(point.orbitals.size());
+		for (const auto& C : point.orbitals)
+			point.orthonormalOrbitals.emplace_back(sqrtOverlap * C);
+
+		// only the last two are needed for the extrapolation
+		if (points.size() > 1) points.erase(points.begin());
+		points.emplace_back(std::move(point));
+	}
+
+
+	bool WarmStart::SetGuess(HartreeFockAlgorithm& algorithm, Systems::Molecule& molecule) const
+	{
+		if (points.empty()) return false;
+
+		// only the overlap is needed for the new geometry, the one electron integrals are cheap
+		GaussianIntegrals::IntegralsRepository repository(&molecule);
+		const Matrices::OverlapMatrix overlapMatrix(&repository);
+		const Eigen::MatrixXd& overlap = overlapMatrix.matrix;
+
+		const Point& last = points.back();
+		if (last.orbitals.empty() || last.orbitals[0].rows() != overlap.rows()) return false;
+
+		const bool extrapolate = extrapolation && points.size() > 1 && points[0].orbitals.size() == last.orbitals.size();
+
+		Eigen::MatrixXd invSqrtOverlap;
+		if (extrapolate)
+		{
+			const Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(overlap);
+			invSqrtOverlap = solver.operatorInverseSqrt();
+		}
+
+		std::vector<Eigen::MatrixXd> densities(last.orbitals.size());
+
+		for (size_t i = 0; i < last.orbitals.size(); ++i)
+		{
+			Eigen::MatrixXd C;
+
+			if (extrapolate)
+			{
+				Eigen::MatrixXd Y;
+				const bool extrapolated = (1 == extrapolation) ? ExtrapolateLinear(points[0].orthonormalOrbitals[i], last.orthonormalOrbitals[i], Y) : ExtrapolateGrassmann(points[0].orthonormalOrbitals[i], last.orthonormalOrbitals[i], Y);
+
+				// back from the Lowdin basis of the new geometry
+				if (extrapolated) C = invSqrtOverlap * Y;
+			}
+
+			if (0 == C.size()) C = last.orbitals[i];
+
+			Orthonormalize(C, overlap);
+
+			densities[i] = last.occupations[i] * C * C.transpose();
+		}
+
+		// if the unrestricted solution was a restricted one, the total density only, so that the asymmetry is added again as for a start from scratch
+		// otherwise a scan would follow the restricted solution past the point where the unrestricted one gets lower
+		bool restrictedSolution = false;
+		if (2 == densities.size() && (densities[0] - densities[1]).cwiseAbs().maxCoeff() < 1E-5)
+		{
+			densities[0] += densities[1];
+			densities.pop_back();
+			restrictedSolution = true;
+		}
+
+		algorithm.initialDensities.swap(densities);
+
+		// the softest rotations change little from one point to the next, if they were found at the last point the check can start from them
+		// not for a restricted solution, it can get unstable within a step along a rotation that breaks the spin symmetry, which is not among them, so the check is done in full
+		if (restrictedSolution)
+		{
+			algorithm.stabilityGuess.clear();
+			algorithm.stabilityGuessCurvature = 0;
+		}
+		else
+		{
+			algorithm.stabilityGuess = last.softRotations;
+			algorithm.stabilityGuessCurvature = last.softestCurvature;
+		}
+
+		return true;
+	}
+
+
+	void WarmStart::Orthonormalize(Eigen::MatrixXd& C, const Eigen::MatrixXd& overlap)
+	{
+		if (0 == C.cols()) return;
+
+		const Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(C.transpose() * overlap * C);
+		C = C * solver.operatorInverseSqrt();
+	}
+
+
+	bool WarmStart::ExtrapolateLinear(const Eigen::MatrixXd& Y0, const Eigen::MatrixXd& Y1, Eigen::MatrixXd& Y)
+	{
+		if (Y0.rows() != Y1.rows() || Y0.cols() != Y1.cols()) return false;
+
+		// the occupied orbitals are determined only up to a rotation among them, so the older ones are rotated to match the newer ones first
+		// the best rotation is the orthogonal factor of the polar decomposition of Y0^T * Y1
+		const Eigen::JacobiSVD<Eigen::MatrixXd> svd(Y0.transpose() * Y1, Eigen::ComputeThinU | Eigen::ComputeThinV);
+
+		// the singular values are the cosines of the angles between the two occupied spaces, a big one means an orbital swap, not a small change
+		if (Y0.cols() && svd.singularValues().minCoeff() < 0.5) return false;
+
+		Y = 2. * Y1 - Y0 * (svd.matrixU() * svd.matrixV().transpose());
+
+		return true;
+	}
+
+
+	bool WarmStart::ExtrapolateGrassmann(const Eigen::MatrixXd& Y0, const Eigen::MatrixXd& Y1, Eigen::MatrixXd& Y)
+	{
+		if (Y0.rows() != Y1.rows() || Y0.cols() != Y1.cols()) return false;
+
+		if (0 == Y0.cols())
+		{
+			Y = Y1;
+			return true;
+		}
+
+		const Eigen::MatrixXd overlap = Y1.transpose() * Y0;
+
+		const Eigen::JacobiSVD<Eigen::MatrixXd> overlapSVD(overlap);
+		if (overlapSVD.singularValues().minCoeff() < 0.5) return false;
+
+		// the logarithm map at Y1: the tangent that takes the Y1 space into the Y0 space is U * atan(sigma) * V^T
+		// with the thin SVD of (I - Y1 * Y1^T) * Y0 * (Y1^T * Y0)^-1 = U * sigma * V^T
+		const Eigen::MatrixXd tangent = (Y0 - Y1 * overlap) * overlap.inverse();
+		const Eigen::JacobiSVD<Eigen::MatrixXd> svd(tangent, Eigen::ComputeThinU | Eigen::ComputeThinV);
+
+		Eigen::VectorXd cosines(svd.singularValues().size());
+		Eigen::VectorXd sines(svd.singularValues().size());
+		for (Eigen::Index i = 0; i < svd.singularValues().size(); ++i)
+		{
+			const double angle = atan(svd.singularValues()(i));
+			cosines(i) = cos(angle);
+			sines(i) = sin(angle);
+		}
+
+		// the geodesic Y1 * V * cos(t * theta) * V^T + U * sin(t * theta) * V^T goes through Y1 at t = 0 and through the Y0 space at t = 1
+		// the extrapolation is the point at t = -1
+		const Eigen::MatrixXd& V = svd.matrixV();
+		Y = Y1 * V * cosines.asDiagonal() * V.transpose() - svd.matrixU() * sines.asDiagonal() * V.transpose();
+
+		return true;
+	}
+
+}
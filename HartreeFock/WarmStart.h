@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Eigen\eigen>
+
+#include "Molecule.h"
+
+#include <vector>
+
+namespace HartreeFock {
+
+	class HartreeFockAlgorithm;
+
+	// the initial guess for a point of a scan from the converged orbitals of the previous points
+	// the neighbouring geometries differ by a small step, so the previous orbitals are already close to the solution
+	// the basis functions move with the atoms, so the old coefficients are not orthonormal anymore with the new overlap
+	// they are orthonormalized against it and the densities computed from them are set as the initial ones
+	// with two points available, the orbitals can be extrapolated first, linearly or along the Grassmann manifold geodesic
+	// the extrapolation is done in the Lowdin orthonormalized basis of each geometry, S^1/2 * C, and assumes equally spaced points
+	class WarmStart
+	{
+	public:
+		WarmStart();
+
+		// 0 - the orbitals of the last point, 1 - linear extrapolation from the last two points, 2 - Grassmann extrapolation from the last two points
+		int extrapolation;
+
+		// for a new scan, or after a point that did not converge
+		void Clear();
+
+		// keeps the orbitals of the converged algorithm, with the last ones, the older ones are dropped
+		void Add(HartreeFockAlgorithm& algorithm);
+
+		// sets the initial densities of the algorithm for the molecule at the new geometry, before its Init
+		// and the start of its stability check, if the last point passed it
+		// returns false if there is nothing to start from
+		bool SetGuess(HartreeFockAlgorithm& algorithm, Systems::Molecule& molecule) const;
+
+	protected:
+		struct Point
+		{
+			// the occupied orbitals for each spin channel, in the AO basis and in the Lowdin orthonormalized basis
+			std::vector<Eigen::MatrixXd> orbitals;
+			std::vector<Eigen::MatrixXd> orthonormalOrbitals;
+			std::vector<double> occupations;
+
+			// the softest orbital rotations from the stability check of the point, to start the check of the next one from them
+			std::vector<std::vector<Eigen::MatrixXd>> softRotations;
+			double softestCurvature;
+		};
+
+		// the last one is the most recent
+		std::vector<Point> points;
+
+		// columns orthonormal with the overlap, C * (C^T * S * C)^-1/2
+		static void Orthonormalize(Eigen::MatrixXd& C, const Eigen::MatrixXd& overlap);
+
+		// the orthonormal orbitals extrapolated one step further from Y0 through Y1, returns false if they changed too much for it
+		static bool ExtrapolateLinear(const Eigen::MatrixXd& Y0, const Eigen::MatrixXd& Y1, Eigen::MatrixXd& Y);
+		static bool ExtrapolateGrassmann(const Eigen::MatrixXd& Y0, const Eigen::MatrixXd& Y1, Eigen::MatrixXd& Y);
+	};
+
+}
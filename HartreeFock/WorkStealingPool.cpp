@@ -0,0 +1,160 @@
+#include "stdafx.h"
+#include "WorkStealingPool.h"
+
+
+WorkStealingPool::WorkStealingPool(unsigned int nrThreads)
+	: m_nrThreads(nrThreads ? nrThreads : 1), runFunction(nullptr), runGeneration(0), runningWorkers(0), stopping(false)
+{
+	for (unsigned int i = 0; i < m_nrThreads; ++i)
+		queues.emplace_back(std::make_unique<TasksQueue>());
+}
+
+
+WorkStealingPool::~WorkStealingPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(runMutex);
+		stopping = true;
+	}
+	runCondition.notify_all();
+
+	for (auto& worker : workers)
+		worker.join();
+}
+
+
+void WorkStealingPool::Run(unsigned int nrTasks, const std::function<void(unsigned int task, unsigned int thread)>& func)
+{
+	Deal(nrTasks);
+
+	unsigned int task;
+
+	if (1 == m_nrThreads)
+	{
+		while (GetTask(0, task)) func(task, 0);
+
+		return;
+	}
+
+	// started once, creating and joining the threads for each batch costs more than a small batch, like a Fock matrix build for a small molecule
+	if (workers.empty())
+	{
+		workers.reserve(m_nrThreads - 1);
+
+		for (unsigned int thread = 1; thread < m_nrThreads; ++thread)
+			workers.emplace_back(&WorkStealingPool::WorkerLoop, this, thread);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(runMutex);
+		runFunction = &func;
+		runningWorkers = m_nrThreads - 1;
+		++runGeneration;
+	}
+	runCondition.notify_all();
+
+	while (GetTask(0, task)) func(task, 0);
+
+	// the function must stay alive until the workers are done with it
+	std::unique_lock<std::mutex> lock(runMutex);
+	doneCondition.wait(lock, [this]() { return 0 == runningWorkers; });
+	runFunction = nullptr;
+}
+
+
+void WorkStealingPool::WorkerLoop(unsigned int thread)
+{
+	unsigned long long int generation = 0;
+
+	for (;;)
+	{
+		const std::function<void(unsigned int task, unsigned int thread)>* func;
+
+		{
+			std::unique_lock<std::mutex> lock(runMutex);
+			runCondition.wait(lock, [this, generation]() { return stopping || runGeneration != generation; });
+			if (stopping) return;
+
+			generation = runGeneration;
+			func = runFunction;
+		}
+
+		unsigned int task;
+		while (GetTask(thread, task)) (*func)(task, thread);
+
+		{
+			std::lock_guard<std::mutex> lock(runMutex);
+			--runningWorkers;
+		}
+		doneCondition.notify_one();
+	}
+}
+
+
+void WorkStealingPool::Deal(unsigned int nrTasks, bool contiguous)
+{
+	// the first nrTasks % m_nrThreads blocks get one more task
+	const unsigned int blockSize = nrTasks / m_nrThreads;
+	const unsigned int remainder = nrTasks % m_nrThreads;
+
+	unsigned int blockStart = 0;
+
+	// locked, the threads might be already asking for tasks, waiting for a new deal
+	for (unsigned int thread = 0; thread < m_nrThreads; ++thread)
+	{
+		TasksQueue& queue = *queues[thread];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		queue.tasks.clear();
+		queue.front = 0;
+
+		if (contiguous)
+		{
+			const unsigned int size = blockSize + (thread < remainder ? 1 : 0);
+			for (unsigned int task = blockStart; task < blockStart + size; ++task)
+				queue.tasks.push_back(task);
+
+			blockStart += size;
+		}
+		else
+		{
+			for (unsigned int task = thread; task < nrTasks; task += m_nrThreads)
+				queue.tasks.push_back(task);
+		}
+	}
+}
+
+
+bool WorkStealingPool::GetTask(unsigned int thread, unsigned int& task)
+{
+	// first from the own queue, from the front, those are the more expensive ones
+	{
+		TasksQueue& queue = *queues[thread];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		if (queue.front < queue.tasks.size())
+		{
+			task = queue.tasks[queue.front++];
+
+			return true;
+		}
+	}
+
+	// nothing left, steal from the back of the other ones
+	// no tasks are added during a run, so if all are empty, the work is done
+	for (unsigned int i = 1; i < m_nrThreads; ++i)
+	{
+		TasksQueue& queue = *queues[(thread + i) % m_nrThreads];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		if (queue.front < queue.tasks.size())
+		{
+			task = queue.tasks.back();
+			queue.tasks.pop_back();
+
+			return true;
+		}
+	}
+
+	return false;
+}
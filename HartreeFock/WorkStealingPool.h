@@ -0,0 +1,61 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// runs a batch of independent tasks on several threads
+// each thread has its own queue of tasks, when it runs out of them it steals from the back of the other queues
+// the tasks are dealt round robin, so if they are passed in decreasing order of cost the load starts balanced
+// and stealing takes care of the bad estimates
+// the worker threads for Run are started on its first call and kept until the pool is destroyed, they wait for the next batch in between
+class WorkStealingPool
+{
+public:
+	WorkStealingPool(unsigned int nrThreads = 1);
+	~WorkStealingPool();
+
+	WorkStealingPool(const WorkStealingPool&) = delete;
+	WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+	// the function gets the task index and the index of the thread that executes it, the later can be used for per thread data
+	// the calling thread works as the thread 0, the workers are the other ones, it returns when all the tasks are done
+	void Run(unsigned int nrTasks, const std::function<void(unsigned int task, unsigned int thread)>& func);
+
+	// for threads managed by the caller: deal the tasks, then each thread calls GetTask until it returns false
+	// contiguous deals each thread a block of consecutive tasks instead of round robin, for tasks that benefit from being done in order
+	// a thread then goes through its block from the front and the stealing takes consecutive tasks from the other blocks ends
+	// the previous tasks are dropped, a new deal can be done while the threads get tasks, for work done in rounds
+	void Deal(unsigned int nrTasks, bool contiguous = false);
+	bool GetTask(unsigned int thread, unsigned int& task);
+
+	unsigned int GetNrThreads() const { return m_nrThreads; }
+
+protected:
+	// a vector instead of a deque, the tasks are taken from the front by advancing an index, so a new deal reuses the memory of the previous one
+	struct TasksQueue
+	{
+		std::mutex mutex;
+		std::vector<unsigned int> tasks;
+		size_t front = 0;
+	};
+
+	unsigned int m_nrThreads;
+	std::vector<std::unique_ptr<TasksQueue>> queues;
+
+	// the persistent workers for Run, a new batch is signaled by incrementing the generation
+	std::vector<std::thread> workers;
+	std::mutex runMutex;
+	std::condition_variable runCondition;
+	std::condition_variable doneCondition;
+	const std::function<void(unsigned int task, unsigned int thread)>* runFunction;
+	unsigned long long int runGeneration;
+	unsigned int runningWorkers;
+	bool stopping;
+
+	void WorkerLoop(unsigned int thread);
+};
+